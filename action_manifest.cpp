@@ -0,0 +1,355 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Actions and interaction profile bindings loaded from a text file
+ */
+
+#include "action_manifest.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define MAX_TOKENS 8
+
+static const char* hand_prefixes[] = {"/user/hand/left/", "/user/hand/right/"};
+
+static const struct
+{
+	const char* name;
+	XrActionType type;
+} action_types[] = {
+	{"boolean", XR_ACTION_TYPE_BOOLEAN_INPUT}, {"float", XR_ACTION_TYPE_FLOAT_INPUT},
+	{"vector2f", XR_ACTION_TYPE_VECTOR2F_INPUT}, {"pose", XR_ACTION_TYPE_POSE_INPUT},
+	{"vibration", XR_ACTION_TYPE_VIBRATION_OUTPUT},
+};
+
+// FNV-1a
+static uint32_t
+hash_string(const char* str)
+{
+	uint32_t hash = 2166136261u;
+	for (; *str != '\0'; str++)
+		hash = (hash ^ (uint8_t)*str) * 16777619u;
+	return hash;
+}
+
+manifest_path
+action_manifest_intern(action_manifest* manifest, const char* path)
+{
+	uint32_t mask = ACTION_MANIFEST_HASH_SLOTS - 1;
+	uint32_t slot = hash_string(path) & mask;
+	while (manifest->path_slots[slot] != 0) {
+		manifest_path index = manifest->path_slots[slot] - 1;
+		if (strcmp(action_manifest_path_string(manifest, index), path) == 0)
+			return index;
+		slot = (slot + 1) & mask;
+	}
+
+	size_t length = strlen(path) + 1;
+	if (manifest->path_count == ACTION_MANIFEST_MAX_PATHS ||
+		manifest->path_chars_used + length > ACTION_MANIFEST_PATH_CHARS)
+		return MANIFEST_PATH_INVALID;
+
+	manifest_path index = (manifest_path)manifest->path_count++;
+	manifest->path_offsets[index] = manifest->path_chars_used;
+	manifest->path_values[index] = XR_NULL_PATH;
+	memcpy(manifest->path_chars + manifest->path_chars_used, path, length);
+	manifest->path_chars_used += (uint32_t)length;
+	manifest->path_slots[slot] = index + 1;
+	return index;
+}
+
+const char*
+action_manifest_path_string(const action_manifest* manifest, manifest_path path)
+{
+	return manifest->path_chars + manifest->path_offsets[path];
+}
+
+uint32_t
+action_manifest_resolve(action_manifest* manifest, XrInstance instance)
+{
+	TRACE_SCOPE("action_manifest_resolve");
+
+	uint32_t failed = 0;
+	for (uint32_t i = 0; i < manifest->path_count; i++) {
+		if (manifest->path_values[i] != XR_NULL_PATH)
+			continue;
+		const char* str = action_manifest_path_string(manifest, (manifest_path)i);
+		XrResult result = xrStringToPath(instance, str, &manifest->path_values[i]);
+		if (XR_FAILED(result)) {
+			printf("Failed to get path %s: %d\n", str, result);
+			manifest->path_values[i] = XR_NULL_PATH;
+			failed++;
+		}
+	}
+	return failed;
+}
+
+int
+action_manifest_find_action(const action_manifest* manifest, const char* name)
+{
+	for (uint32_t i = 0; i < manifest->action_count; i++)
+		if (strcmp(manifest->actions[i].name, name) == 0)
+			return (int)i;
+	return -1;
+}
+
+// splits line in place into whitespace separated tokens, "quoted strings" are one
+// token. Returns -1 on an unterminated quote.
+static int
+tokenize(char* line, char** tokens)
+{
+	int count = 0;
+	char* c = line;
+	while (true) {
+		while (*c == ' ' || *c == '\t' || *c == '\r')
+			c++;
+		if (*c == '\0' || *c == '#')
+			return count;
+		if (count == MAX_TOKENS)
+			return count;
+
+		if (*c == '"') {
+			tokens[count++] = ++c;
+			c = strchr(c, '"');
+			if (c == NULL)
+				return -1;
+		} else {
+			tokens[count++] = c;
+			while (*c != '\0' && *c != ' ' && *c != '\t' && *c != '\r' && *c != '#')
+				c++;
+			if (*c == '#') {
+				*c = '\0';
+				return count;
+			}
+		}
+		if (*c == '\0')
+			return count;
+		*c++ = '\0';
+	}
+}
+
+static bool
+copy_name(char* dst, size_t size, const char* src)
+{
+	if (strlen(src) >= size)
+		return false;
+	strcpy(dst, src);
+	return true;
+}
+
+static bool
+add_binding(action_manifest* manifest, int action, const char* path)
+{
+	if (manifest->binding_count == ACTION_MANIFEST_MAX_BINDINGS)
+		return false;
+	manifest_path index = action_manifest_intern(manifest, path);
+	if (index == MANIFEST_PATH_INVALID)
+		return false;
+
+	manifest->bindings[manifest->binding_count++] = {.action = (uint16_t)action, .path = index};
+	manifest->profiles[manifest->profile_count - 1].binding_count++;
+	return true;
+}
+
+static bool
+parse_line(action_manifest* manifest, char** tokens, int count, const char** error)
+{
+	const char* keyword = tokens[0];
+
+	if (strcmp(keyword, "action_set") == 0) {
+		if (count != 3) {
+			*error = "expected action_set <name> \"<localized name>\"";
+			return false;
+		}
+		if (!copy_name(manifest->action_set_name, sizeof(manifest->action_set_name), tokens[1]) ||
+			!copy_name(manifest->localized_action_set_name, sizeof(manifest->localized_action_set_name),
+					   tokens[2])) {
+			*error = "action set name too long";
+			return false;
+		}
+		return true;
+	}
+
+	if (strcmp(keyword, "action") == 0) {
+		if (count != 4) {
+			*error = "expected action <name> <type> \"<localized name>\"";
+			return false;
+		}
+		if (action_manifest_find_action(manifest, tokens[1]) >= 0) {
+			*error = "action defined twice";
+			return false;
+		}
+		if (manifest->action_count == ACTION_MANIFEST_MAX_ACTIONS) {
+			*error = "too many actions";
+			return false;
+		}
+
+		manifest_action* action = &manifest->actions[manifest->action_count];
+		action->type = XR_ACTION_TYPE_MAX_ENUM;
+		for (const auto& type : action_types)
+			if (strcmp(type.name, tokens[2]) == 0)
+				action->type = type.type;
+		if (action->type == XR_ACTION_TYPE_MAX_ENUM) {
+			*error = "unknown action type";
+			return false;
+		}
+		if (!copy_name(action->name, sizeof(action->name), tokens[1]) ||
+			!copy_name(action->localized_name, sizeof(action->localized_name), tokens[3])) {
+			*error = "action name too long";
+			return false;
+		}
+		manifest->action_count++;
+		return true;
+	}
+
+	if (strcmp(keyword, "profile") == 0) {
+		bool requires_extension = count == 4 && strcmp(tokens[2], "requires") == 0;
+		if (count != 2 && !requires_extension) {
+			*error = "expected profile <path> [requires <extension>]";
+			return false;
+		}
+		if (manifest->profile_count == ACTION_MANIFEST_MAX_PROFILES) {
+			*error = "too many profiles";
+			return false;
+		}
+
+		manifest_profile* profile = &manifest->profiles[manifest->profile_count];
+		profile->path = action_manifest_intern(manifest, tokens[1]);
+		profile->required_extension[0] = '\0';
+		profile->first_binding = manifest->binding_count;
+		profile->binding_count = 0;
+		if (profile->path == MANIFEST_PATH_INVALID) {
+			*error = "too many paths";
+			return false;
+		}
+		if (requires_extension &&
+			!copy_name(profile->required_extension, sizeof(profile->required_extension), tokens[3])) {
+			*error = "extension name too long";
+			return false;
+		}
+		manifest->profile_count++;
+		return true;
+	}
+
+	if (strcmp(keyword, "bind") == 0) {
+		if (count != 3) {
+			*error = "expected bind <action> <path>";
+			return false;
+		}
+		if (manifest->profile_count == 0) {
+			*error = "bind before the first profile";
+			return false;
+		}
+		int action = action_manifest_find_action(manifest, tokens[1]);
+		if (action < 0) {
+			*error = "unknown action";
+			return false;
+		}
+
+		const char* path = tokens[2];
+		if (path[0] == '/') {
+			if (!add_binding(manifest, action, path)) {
+				*error = "too many bindings";
+				return false;
+			}
+			return true;
+		}
+		for (const char* prefix : hand_prefixes) {
+			char full_path[XR_MAX_PATH_LENGTH];
+			if (snprintf(full_path, sizeof(full_path), "%s%s", prefix, path) >= (int)sizeof(full_path)) {
+				*error = "path too long";
+				return false;
+			}
+			if (!add_binding(manifest, action, full_path)) {
+				*error = "too many bindings";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	*error = "unknown keyword";
+	return false;
+}
+
+bool
+action_manifest_parse(const char* text, const char* source, action_manifest* manifest)
+{
+	memset(manifest, 0, sizeof(*manifest));
+
+	int line_number = 0;
+	const char* line_start = text;
+	while (*line_start != '\0') {
+		line_number++;
+		const char* line_end = strchr(line_start, '\n');
+		size_t length = line_end != NULL ? (size_t)(line_end - line_start) : strlen(line_start);
+
+		char line[512];
+		if (length >= sizeof(line)) {
+			printf("%s:%d: line too long\n", source, line_number);
+			return false;
+		}
+		memcpy(line, line_start, length);
+		line[length] = '\0';
+
+		char* tokens[MAX_TOKENS];
+		int count = tokenize(line, tokens);
+		const char* error = NULL;
+		if (count < 0)
+			error = "unterminated quote";
+		else if (count > 0)
+			parse_line(manifest, tokens, count, &error);
+		if (error != NULL) {
+			printf("%s:%d: %s\n", source, line_number, error);
+			return false;
+		}
+
+		if (line_end == NULL)
+			break;
+		line_start = line_end + 1;
+	}
+
+	if (manifest->action_set_name[0] == '\0') {
+		printf("%s: no action_set\n", source);
+		return false;
+	}
+	return true;
+}
+
+bool
+action_manifest_load(const char* file_name, action_manifest* manifest)
+{
+	FILE* file = fopen(file_name, "rb");
+	if (file == NULL) {
+		printf("Failed to open action manifest %s\n", file_name);
+		return false;
+	}
+
+	long size = -1;
+	if (fseek(file, 0, SEEK_END) == 0)
+		size = ftell(file);
+	if (size < 0 || fseek(file, 0, SEEK_SET) != 0) {
+		printf("Failed to get the size of action manifest %s\n", file_name);
+		fclose(file);
+		return false;
+	}
+
+	char* text = (char*)malloc(size + 1);
+	if (text == NULL) {
+		printf("Failed to allocate %ld bytes for action manifest %s\n", size + 1, file_name);
+		fclose(file);
+		return false;
+	}
+	size_t read = fread(text, 1, size, file);
+	text[read] = '\0';
+	fclose(file);
+
+	bool ok = action_manifest_parse(text, file_name, manifest);
+	free(text);
+	return ok;
+}
@@ -0,0 +1,118 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Actions and interaction profile bindings loaded from a text file
+ *
+ * The manifest is line based, # starts a comment:
+ *
+ *     action_set mainactions "Main Actions"
+ *     action grabobjectfloat float "Grab Object"
+ *     profile /interaction_profiles/valve/index_controller
+ *     bind grabobjectfloat input/trigger/value
+ *     profile /interaction_profiles/ext/hand_interaction_ext requires XR_EXT_hand_interaction
+ *
+ * Action types are boolean, float, vector2f, pose and vibration. A binding path
+ * that does not start with / is relative to each hand, /user/hand/left/ and
+ * /user/hand/right/. A profile that requires an extension is skipped when the
+ * extension is not enabled.
+ *
+ * Parsing compiles the manifest into flat tables: every path string is interned
+ * once in a hash map and bindings refer to actions and paths by index, so all
+ * paths are resolved with one batch of xrStringToPath calls.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "openxr/openxr.h"
+
+#define ACTION_MANIFEST_MAX_ACTIONS 32
+#define ACTION_MANIFEST_MAX_PROFILES 16
+#define ACTION_MANIFEST_MAX_BINDINGS 512
+#define ACTION_MANIFEST_MAX_PATHS 256
+// power of two, at least twice the number of paths
+#define ACTION_MANIFEST_HASH_SLOTS 512
+#define ACTION_MANIFEST_PATH_CHARS 16384
+
+typedef uint16_t manifest_path;
+#define MANIFEST_PATH_INVALID UINT16_MAX
+
+struct manifest_action
+{
+	char name[XR_MAX_ACTION_NAME_SIZE];
+	char localized_name[XR_MAX_LOCALIZED_ACTION_NAME_SIZE];
+	XrActionType type;
+};
+
+struct manifest_binding
+{
+	uint16_t action;
+	manifest_path path;
+};
+
+struct manifest_profile
+{
+	manifest_path path;
+	// empty if the profile is core OpenXR
+	char required_extension[XR_MAX_EXTENSION_NAME_SIZE];
+	uint32_t first_binding;
+	uint32_t binding_count;
+};
+
+struct action_manifest
+{
+	char action_set_name[XR_MAX_ACTION_SET_NAME_SIZE];
+	char localized_action_set_name[XR_MAX_LOCALIZED_ACTION_SET_NAME_SIZE];
+
+	manifest_action actions[ACTION_MANIFEST_MAX_ACTIONS];
+	uint32_t action_count;
+
+	manifest_profile profiles[ACTION_MANIFEST_MAX_PROFILES];
+	uint32_t profile_count;
+
+	// the bindings of a profile are consecutive
+	manifest_binding bindings[ACTION_MANIFEST_MAX_BINDINGS];
+	uint32_t binding_count;
+
+	// interned path strings, slots hold path index + 1, 0 is empty
+	uint32_t path_offsets[ACTION_MANIFEST_MAX_PATHS];
+	XrPath path_values[ACTION_MANIFEST_MAX_PATHS];
+	uint32_t path_count;
+	uint16_t path_slots[ACTION_MANIFEST_HASH_SLOTS];
+	char path_chars[ACTION_MANIFEST_PATH_CHARS];
+	uint32_t path_chars_used;
+};
+
+// reads and compiles the manifest file, prints the line of the first error
+bool
+action_manifest_load(const char* file_name, action_manifest* manifest);
+
+// compiles manifest text, source is only used in error messages
+bool
+action_manifest_parse(const char* text, const char* source, action_manifest* manifest);
+
+// returns the index of the path string, adding it if it is new.
+// MANIFEST_PATH_INVALID when the table is full.
+manifest_path
+action_manifest_intern(action_manifest* manifest, const char* path);
+
+const char*
+action_manifest_path_string(const action_manifest* manifest, manifest_path path);
+
+// resolves every interned path that has no XrPath yet, returns the number of
+// paths that failed to resolve
+uint32_t
+action_manifest_resolve(action_manifest* manifest, XrInstance instance);
+
+// XR_NULL_PATH until resolved
+static inline XrPath
+action_manifest_path(const action_manifest* manifest, manifest_path path)
+{
+	return manifest->path_values[path];
+}
+
+// index of the action, -1 if the manifest has none with that name
+int
+action_manifest_find_action(const action_manifest* manifest, const char* name);
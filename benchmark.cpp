@@ -0,0 +1,312 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Micro benchmarks that run without an XR session, selected with OXR_BENCHMARK
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include "benchmark.h"
+#include "bvh.h"
+#include "gesture.h"
+#include "raster.h"
+#include "trace.h"
+
+// xorshift, so every run uses the same objects
+static uint32_t random_state = 2463534242u;
+
+static float
+random_float(float min, float max)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return min + (max - min) * (random_state / 4294967296.f);
+}
+
+// objects in a 20 m cube, queried from two hands with 26 joints and a controller ray each
+static void
+benchmark_bvh_objects(uint32_t count)
+{
+	const int iterations = 1000;
+	const int joint_count = 26;
+
+	std::vector<float> x(count), y(count), z(count), radius(count);
+	for (uint32_t i = 0; i < count; i++) {
+		x[i] = random_float(-10.f, 10.f);
+		y[i] = random_float(-10.f, 10.f);
+		z[i] = random_float(-10.f, 10.f);
+		radius[i] = random_float(.05f, .3f);
+	}
+
+	bvh tree;
+	double start = trace_now_us();
+	bvh_build(&tree, count, x.data(), y.data(), z.data(), radius.data());
+	double build_us = trace_now_us() - start;
+
+	for (uint32_t i = 0; i < count; i++) {
+		x[i] += random_float(-.05f, .05f);
+		y[i] += random_float(-.05f, .05f);
+		z[i] += random_float(-.05f, .05f);
+	}
+	start = trace_now_us();
+	bvh_refit(&tree, x.data(), y.data(), z.data(), radius.data());
+	double refit_us = trace_now_us() - start;
+
+	// a hand of joints within 10 cm of the palm
+	XrVector3f joints[2][joint_count];
+	for (int hand = 0; hand < 2; hand++) {
+		for (int i = 0; i < joint_count; i++) {
+			joints[hand][i] = {.x = (hand ? .2f : -.2f) + random_float(-.1f, .1f),
+			                   .y = random_float(-.1f, .1f),
+			                   .z = random_float(-.1f, .1f)};
+		}
+	}
+
+	// one traversal per joint, as a baseline for the grouped query
+	uint32_t single_overlaps = 0;
+	start = trace_now_us();
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		XrVector3f offset = {.x = iteration * .001f, .y = 0.f, .z = 0.f};
+		for (int hand = 0; hand < 2; hand++) {
+			uint32_t found[16];
+			for (int i = 0; i < joint_count; i++) {
+				XrVector3f center = {.x = joints[hand][i].x + offset.x,
+				                     .y = joints[hand][i].y + offset.y,
+				                     .z = joints[hand][i].z + offset.z};
+				single_overlaps += bvh_overlap_sphere(&tree, center, .01f, found, 16);
+			}
+		}
+	}
+	double single_us = (trace_now_us() - start) / iterations;
+
+	uint32_t overlaps = 0;
+	uint32_t hits = 0;
+	start = trace_now_us();
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		// the hands move a little every frame
+		XrVector3f offset = {.x = iteration * .001f, .y = 0.f, .z = 0.f};
+		for (int hand = 0; hand < 2; hand++) {
+			XrVector3f centers[joint_count];
+			float radii[joint_count];
+			for (int i = 0; i < joint_count; i++) {
+				centers[i] = {.x = joints[hand][i].x + offset.x,
+				              .y = joints[hand][i].y + offset.y,
+				              .z = joints[hand][i].z + offset.z};
+				radii[i] = .01f;
+			}
+			uint32_t found[16];
+			overlaps += bvh_overlap_spheres(&tree, centers, radii, joint_count, found, 16);
+
+			XrVector3f origin = {.x = (hand ? .2f : -.2f) + offset.x, .y = 0.f, .z = 0.f};
+			XrVector3f direction = {.x = 0.f, .y = 0.f, .z = -1.f};
+			uint32_t item;
+			float distance;
+			hits += bvh_raycast(&tree, origin, direction, 10.f, &item, &distance) ? 1 : 0;
+		}
+	}
+	double query_us = (trace_now_us() - start) / iterations;
+
+	printf("%7u objects: build %8.3f ms, refit %7.3f ms\n", count, build_us / 1000., refit_us / 1000.);
+	printf("    %d joint spheres one by one %8.2f us per frame (%u overlaps)\n", 2 * joint_count,
+	       single_us, single_overlaps);
+	printf("    2 hands of %d joints + 2 rays %8.2f us per frame (%u overlaps, %u hits)\n", joint_count,
+	       query_us, overlaps, hits);
+}
+
+static void
+benchmark_bvh()
+{
+	benchmark_bvh_objects(10000);
+	benchmark_bvh_objects(100000);
+}
+
+// single threaded row kernels against the banded image functions
+static void
+benchmark_raster_size(int w, int h)
+{
+	const int iterations = 100;
+	std::vector<uint32_t> dst((size_t)w * h);
+	std::vector<uint32_t> src((size_t)w * h);
+	for (size_t i = 0; i < src.size(); i++)
+		src[i] = (uint32_t)(random_float(0.f, 1.f) * 4294967295.f);
+
+	double start = trace_now_us();
+	for (int iteration = 0; iteration < iterations; iteration++)
+		raster_quad_pattern_rows(dst.data(), w, h, 0, h);
+	double pattern_rows_us = (trace_now_us() - start) / iterations;
+
+	start = trace_now_us();
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		for (int row = 0; row < h; row++)
+			raster_compose_over_row(&dst[(size_t)row * w], &src[(size_t)row * w], w);
+	}
+	double compose_rows_us = (trace_now_us() - start) / iterations;
+
+	raster_throughput();
+	for (int iteration = 0; iteration < iterations; iteration++)
+		raster_quad_pattern((uint8_t*)dst.data(), w, h);
+	float pattern_mps = raster_throughput();
+
+	for (int iteration = 0; iteration < iterations; iteration++)
+		raster_compose_over((uint8_t*)dst.data(), (const uint8_t*)src.data(), w, h);
+	float compose_mps = raster_throughput();
+
+	double megapixels = (double)w * h / 1000000.;
+	printf("%5d x %-5d pattern %8.1f MP/s one thread, %8.1f MP/s banded\n", w, h,
+	       megapixels / pattern_rows_us * 1000000., pattern_mps);
+	printf("              compose %8.1f MP/s one thread, %8.1f MP/s banded\n",
+	       megapixels / compose_rows_us * 1000000., compose_mps);
+}
+
+static void
+benchmark_raster()
+{
+	benchmark_raster_size(800, 600);
+	benchmark_raster_size(3840, 2160);
+}
+
+// a hand reaching along -z with the palm facing down, the fingers bend towards the
+// palm by curl (0 straight, 1 folded), the index finger by index_curl, the thumb tip
+// moves to the index tip by pinch and the hand rolls by roll radians
+static void
+synthesize_hand(XrHandJointLocationEXT* joints, float x, float reach, float curl, float index_curl, float pinch, float roll)
+{
+	for (uint32_t i = 0; i < XR_HAND_JOINT_COUNT_EXT; i++) {
+		joints[i] = {.locationFlags = XR_SPACE_LOCATION_POSITION_VALID_BIT | XR_SPACE_LOCATION_ORIENTATION_VALID_BIT,
+		             .pose = {.orientation = {.x = 0.f, .y = 0.f, .z = sinf(roll / 2.f), .w = cosf(roll / 2.f)}},
+		             .radius = 0.01f};
+	}
+	joints[XR_HAND_JOINT_PALM_EXT].pose.position = {.x = x, .y = 0.f, .z = -reach - 0.05f};
+	joints[XR_HAND_JOINT_WRIST_EXT].pose.position = {.x = x, .y = 0.f, .z = -reach};
+
+	const float bone_lengths[4] = {0.045f, 0.025f, 0.02f, 0.015f};
+	for (uint32_t finger = 0; finger < 4; finger++) {
+		uint32_t m = XR_HAND_JOINT_INDEX_METACARPAL_EXT + finger * 5;
+		float fx = x + 0.02f * (finger - 1.5f);
+		float finger_curl = finger == 0 ? index_curl : curl;
+		XrVector3f p = {.x = fx, .y = 0.f, .z = -reach - 0.03f};
+		joints[m].pose.position = p;
+		p.z -= 0.06f;
+		joints[m + 1].pose.position = p;
+		// each of the three finger joints bends by a third of the curl
+		float angle = 0.f;
+		for (uint32_t bone = 1; bone < 4; bone++) {
+			angle += finger_curl * 3.14159265f / 3.f;
+			p.y -= bone_lengths[bone] * sinf(angle);
+			p.z -= bone_lengths[bone] * cosf(angle);
+			joints[m + 1 + bone].pose.position = p;
+		}
+	}
+
+	XrVector3f thumb = {.x = x - 0.03f, .y = -0.01f, .z = -reach - 0.02f};
+	for (uint32_t i = 0; i < 4; i++) {
+		joints[XR_HAND_JOINT_THUMB_METACARPAL_EXT + i].pose.position = thumb;
+		thumb.x -= 0.01f;
+		thumb.z -= 0.025f;
+	}
+	XrVector3f index_tip = joints[XR_HAND_JOINT_INDEX_TIP_EXT].pose.position;
+	XrVector3f* thumb_tip = &joints[XR_HAND_JOINT_THUMB_TIP_EXT].pose.position;
+	thumb_tip->x += (index_tip.x - thumb_tip->x) * pinch;
+	thumb_tip->y += (index_tip.y - thumb_tip->y) * pinch;
+	thumb_tip->z += (index_tip.z - thumb_tip->z) * pinch;
+}
+
+// a minute at 90 Hz of hands opening, closing, pinching, pointing, poking and rolling
+// over
+static void
+synthesize_hand_trace(std::vector<gesture_trace_frame>* frames)
+{
+	const uint32_t count = 90 * 60;
+	frames->resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		gesture_trace_frame* frame = &(*frames)[i];
+		float t = i / 90.f;
+		frame->time = 1000000000ll + (XrTime)i * 11111111ll;
+		for (uint32_t hand = 0; hand < GESTURE_MAX_HANDS; hand++) {
+			float phase = t + hand * 1.3f;
+			float curl = 0.5f + 0.5f * sinf(phase * 1.1f);
+			// now and then the index finger stays straight and pokes forward
+			float point = sinf(phase * 0.5f) > 0.5f ? 1.f : 0.f;
+			float reach = point * 0.1f * fmaxf(sinf(phase * 6.f), 0.f);
+			float pinch = 0.5f + 0.5f * sinf(phase * 2.3f);
+			float roll = 3.14159265f * (0.5f + 0.5f * sinf(phase * 0.4f));
+			frame->active[hand] = XR_TRUE;
+			synthesize_hand(frame->joints[hand], hand ? 0.2f : -0.2f, reach, curl, curl * (1.f - point), pinch,
+			                roll);
+		}
+	}
+}
+
+// replays OXR_GESTURE_TRACE, recorded with OXR_HAND_RECORD, or a synthesized trace
+static int
+benchmark_gesture()
+{
+	std::vector<gesture_trace_frame> frames;
+	const char* trace_env = getenv("OXR_GESTURE_TRACE");
+	if (trace_env != NULL) {
+		if (!gesture_trace_load(trace_env, &frames))
+			return 1;
+		printf("Replaying %zu frames from %s\n", frames.size(), trace_env);
+	} else {
+		synthesize_hand_trace(&frames);
+		printf("Replaying %zu synthesized frames\n", frames.size());
+	}
+	if (frames.empty())
+		return 1;
+
+	if (gesture_count() == 0)
+		gesture_add_defaults();
+
+	const int iterations = 20;
+	uint32_t began[GESTURE_MAX] = {};
+	XrHandJointLocationsEXT hands[GESTURE_MAX_HANDS];
+	double start = trace_now_us();
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		gesture_reset();
+		for (gesture_trace_frame& frame : frames) {
+			for (uint32_t hand = 0; hand < GESTURE_MAX_HANDS; hand++) {
+				hands[hand] = {.type = XR_TYPE_HAND_JOINT_LOCATIONS_EXT,
+				               .isActive = frame.active[hand],
+				               .jointCount = XR_HAND_JOINT_COUNT_EXT,
+				               .jointLocations = frame.joints[hand]};
+			}
+			const gesture_frame* result = gesture_update(frame.time, hands, GESTURE_MAX_HANDS);
+			if (iteration > 0)
+				continue;
+			for (uint32_t i = 0; i < result->event_count; i++)
+				if (result->events[i].kind == GESTURE_EVENT_BEGAN)
+					began[result->events[i].gesture]++;
+		}
+	}
+	double frame_us = (trace_now_us() - start) / iterations / frames.size();
+
+	printf("%d hands: %8.3f us per frame for the features and %u gestures\n", GESTURE_MAX_HANDS, frame_us,
+	       gesture_count());
+	for (uint32_t g = 0; g < gesture_count(); g++)
+		printf("    %-10s began %u times\n", gesture_get((int)g)->name, began[g]);
+	return 0;
+}
+
+int
+run_benchmark(const char* name)
+{
+	if (strcmp(name, "bvh") == 0) {
+		benchmark_bvh();
+		return 0;
+	}
+	if (strcmp(name, "raster") == 0) {
+		benchmark_raster();
+		return 0;
+	}
+	if (strcmp(name, "gesture") == 0)
+		return benchmark_gesture();
+
+	printf("Unknown benchmark %s, available: bvh, raster, gesture\n", name);
+	return 1;
+}
@@ -0,0 +1,13 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Micro benchmarks that run without an XR session, selected with OXR_BENCHMARK
+ */
+
+#pragma once
+
+// runs the benchmark called name and prints the results, returns non-zero if there is
+// no such benchmark
+int
+run_benchmark(const char* name);
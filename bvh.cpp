@@ -0,0 +1,337 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Bounding volume hierarchy over spheres for overlap and ray queries
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+#include "bvh.h"
+
+// items per leaf, larger leaves make refitting cheaper and queries slower
+#define BVH_LEAF_SIZE 4
+// median splits keep the tree balanced, 64 levels are plenty
+#define BVH_STACK_SIZE 64
+
+static void
+build_node(bvh* self, uint32_t node_index, uint32_t first, uint32_t count, const float* centers[3])
+{
+	if (count <= BVH_LEAF_SIZE) {
+		self->nodes[node_index].first = first;
+		self->nodes[node_index].count = count;
+		return;
+	}
+
+	// split at the median of the axis with the largest centroid extent
+	float min[3] = {INFINITY, INFINITY, INFINITY};
+	float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+	for (uint32_t i = first; i < first + count; i++) {
+		for (int axis = 0; axis < 3; axis++) {
+			min[axis] = fminf(min[axis], centers[axis][self->items[i]]);
+			max[axis] = fmaxf(max[axis], centers[axis][self->items[i]]);
+		}
+	}
+	int axis = 0;
+	for (int a = 1; a < 3; a++) {
+		if (max[a] - min[a] > max[axis] - min[axis])
+			axis = a;
+	}
+
+	uint32_t half = count / 2;
+	const float* center = centers[axis];
+	uint32_t* items = self->items.data();
+	std::nth_element(items + first, items + first + half, items + first + count,
+	                 [center](uint32_t a, uint32_t b) { return center[a] < center[b]; });
+
+	uint32_t left = self->nodes.size();
+	self->nodes.push_back(bvh_node{});
+	self->nodes.push_back(bvh_node{});
+	self->nodes[node_index].first = left;
+	self->nodes[node_index].count = 0;
+
+	build_node(self, left, first, half, centers);
+	build_node(self, left + 1, first + half, count - half, centers);
+}
+
+// children always come after their parent, so walking backwards visits them first
+static void
+refit_boxes(bvh* self)
+{
+	if (self->items.empty())
+		return;
+
+	for (size_t n = self->nodes.size(); n-- > 0;) {
+		bvh_node* node = &self->nodes[n];
+		if (node->count == 0) {
+			const bvh_node* a = &self->nodes[node->first];
+			const bvh_node* b = &self->nodes[node->first + 1];
+			for (int axis = 0; axis < 3; axis++) {
+				node->min[axis] = fminf(a->min[axis], b->min[axis]);
+				node->max[axis] = fmaxf(a->max[axis], b->max[axis]);
+			}
+			continue;
+		}
+
+		float min[3] = {INFINITY, INFINITY, INFINITY};
+		float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+		for (uint32_t i = node->first; i < node->first + node->count; i++) {
+			float r = self->radius[i];
+			min[0] = fminf(min[0], self->x[i] - r);
+			min[1] = fminf(min[1], self->y[i] - r);
+			min[2] = fminf(min[2], self->z[i] - r);
+			max[0] = fmaxf(max[0], self->x[i] + r);
+			max[1] = fmaxf(max[1], self->y[i] + r);
+			max[2] = fmaxf(max[2], self->z[i] + r);
+		}
+		for (int axis = 0; axis < 3; axis++) {
+			node->min[axis] = min[axis];
+			node->max[axis] = max[axis];
+		}
+	}
+}
+
+void
+bvh_build(bvh* self, uint32_t count, const float* x, const float* y, const float* z, const float* radius)
+{
+	self->nodes.clear();
+	self->items.resize(count);
+	for (uint32_t i = 0; i < count; i++)
+		self->items[i] = i;
+
+	// an empty tree still has a root, it is never looked at
+	self->nodes.push_back(bvh_node{});
+	const float* centers[3] = {x, y, z};
+	build_node(self, 0, 0, count, centers);
+
+	bvh_refit(self, x, y, z, radius);
+}
+
+void
+bvh_refit(bvh* self, const float* x, const float* y, const float* z, const float* radius)
+{
+	uint32_t count = self->items.size();
+	self->x.resize(count);
+	self->y.resize(count);
+	self->z.resize(count);
+	self->radius.resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t item = self->items[i];
+		self->x[i] = x[item];
+		self->y[i] = y[item];
+		self->z[i] = z[item];
+		self->radius[i] = radius[item];
+	}
+	refit_boxes(self);
+}
+
+static bool
+box_overlaps_sphere(const bvh_node* node, XrVector3f center, float radius)
+{
+	float c[3] = {center.x, center.y, center.z};
+	float distance_squared = 0.f;
+	for (int axis = 0; axis < 3; axis++) {
+		float d = fmaxf(node->min[axis] - c[axis], 0.f) + fmaxf(c[axis] - node->max[axis], 0.f);
+		distance_squared += d * d;
+	}
+	return distance_squared <= radius * radius;
+}
+
+uint32_t
+bvh_overlap_sphere(const bvh* self, XrVector3f center, float radius, uint32_t* items, uint32_t max_items)
+{
+	uint32_t found = 0;
+	if (self->items.empty())
+		return 0;
+
+	uint32_t stack[BVH_STACK_SIZE];
+	uint32_t stack_size = 0;
+	stack[stack_size++] = 0;
+
+	while (stack_size > 0) {
+		const bvh_node* node = &self->nodes[stack[--stack_size]];
+		if (!box_overlaps_sphere(node, center, radius))
+			continue;
+
+		if (node->count == 0) {
+			stack[stack_size++] = node->first;
+			stack[stack_size++] = node->first + 1;
+			continue;
+		}
+
+		for (uint32_t i = node->first; i < node->first + node->count; i++) {
+			float dx = self->x[i] - center.x;
+			float dy = self->y[i] - center.y;
+			float dz = self->z[i] - center.z;
+			float r = self->radius[i] + radius;
+			if (dx * dx + dy * dy + dz * dz > r * r)
+				continue;
+			if (found < max_items)
+				items[found] = self->items[i];
+			found++;
+		}
+	}
+	return found;
+}
+
+uint32_t
+bvh_overlap_spheres(const bvh* self,
+                    const XrVector3f* centers,
+                    const float* radii,
+                    uint32_t count,
+                    uint32_t* items,
+                    uint32_t max_items)
+{
+	uint32_t found = 0;
+	if (self->items.empty() || count == 0)
+		return 0;
+
+	// centered on the box around the spheres, not minimal but close enough
+	float min[3] = {INFINITY, INFINITY, INFINITY};
+	float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+	for (uint32_t s = 0; s < count; s++) {
+		float c[3] = {centers[s].x, centers[s].y, centers[s].z};
+		for (int axis = 0; axis < 3; axis++) {
+			min[axis] = fminf(min[axis], c[axis] - radii[s]);
+			max[axis] = fmaxf(max[axis], c[axis] + radii[s]);
+		}
+	}
+	XrVector3f group_center = {.x = (min[0] + max[0]) / 2.f, .y = (min[1] + max[1]) / 2.f, .z = (min[2] + max[2]) / 2.f};
+	float group_radius = 0.f;
+	for (uint32_t s = 0; s < count; s++) {
+		float dx = centers[s].x - group_center.x;
+		float dy = centers[s].y - group_center.y;
+		float dz = centers[s].z - group_center.z;
+		group_radius = fmaxf(group_radius, sqrtf(dx * dx + dy * dy + dz * dz) + radii[s]);
+	}
+
+	uint32_t stack[BVH_STACK_SIZE];
+	uint32_t stack_size = 0;
+	stack[stack_size++] = 0;
+
+	while (stack_size > 0) {
+		const bvh_node* node = &self->nodes[stack[--stack_size]];
+		if (!box_overlaps_sphere(node, group_center, group_radius))
+			continue;
+
+		if (node->count == 0) {
+			stack[stack_size++] = node->first;
+			stack[stack_size++] = node->first + 1;
+			continue;
+		}
+
+		for (uint32_t i = node->first; i < node->first + node->count; i++) {
+			for (uint32_t s = 0; s < count; s++) {
+				float dx = self->x[i] - centers[s].x;
+				float dy = self->y[i] - centers[s].y;
+				float dz = self->z[i] - centers[s].z;
+				float r = self->radius[i] + radii[s];
+				if (dx * dx + dy * dy + dz * dz > r * r)
+					continue;
+				if (found < max_items)
+					items[found] = self->items[i];
+				found++;
+				break;
+			}
+		}
+	}
+	return found;
+}
+
+// distance at which the ray enters the box, INFINITY if it misses it before max_distance
+static float
+ray_box_distance(const bvh_node* node, const float origin[3], const float inverse_direction[3], float max_distance)
+{
+	float t_min = 0.f;
+	float t_max = max_distance;
+	for (int axis = 0; axis < 3; axis++) {
+		float t0 = (node->min[axis] - origin[axis]) * inverse_direction[axis];
+		float t1 = (node->max[axis] - origin[axis]) * inverse_direction[axis];
+		t_min = fmaxf(t_min, fminf(t0, t1));
+		t_max = fminf(t_max, fmaxf(t0, t1));
+	}
+	return t_min <= t_max ? t_min : INFINITY;
+}
+
+bool
+bvh_raycast(const bvh* self,
+            XrVector3f origin,
+            XrVector3f direction,
+            float max_distance,
+            uint32_t* item,
+            float* distance)
+{
+	if (self->items.empty())
+		return false;
+
+	float o[3] = {origin.x, origin.y, origin.z};
+	float inverse_direction[3] = {1.f / direction.x, 1.f / direction.y, 1.f / direction.z};
+
+	float best = max_distance;
+	bool hit = false;
+
+	// nodes with the distance the ray enters them
+	uint32_t stack[BVH_STACK_SIZE];
+	float stack_distance[BVH_STACK_SIZE];
+	uint32_t stack_size = 0;
+	float root_distance = ray_box_distance(&self->nodes[0], o, inverse_direction, best);
+	if (root_distance != INFINITY) {
+		stack[stack_size] = 0;
+		stack_distance[stack_size++] = root_distance;
+	}
+
+	while (stack_size > 0) {
+		stack_size--;
+		// a closer hit was found since the node was pushed
+		if (stack_distance[stack_size] > best)
+			continue;
+		const bvh_node* node = &self->nodes[stack[stack_size]];
+
+		if (node->count == 0) {
+			// visit the nearer child first, it is pushed last
+			uint32_t a = node->first;
+			uint32_t b = node->first + 1;
+			float ta = ray_box_distance(&self->nodes[a], o, inverse_direction, best);
+			float tb = ray_box_distance(&self->nodes[b], o, inverse_direction, best);
+			if (ta > tb) {
+				std::swap(a, b);
+				std::swap(ta, tb);
+			}
+			if (tb != INFINITY) {
+				stack[stack_size] = b;
+				stack_distance[stack_size++] = tb;
+			}
+			if (ta != INFINITY) {
+				stack[stack_size] = a;
+				stack_distance[stack_size++] = ta;
+			}
+			continue;
+		}
+
+		for (uint32_t i = node->first; i < node->first + node->count; i++) {
+			float ox = origin.x - self->x[i];
+			float oy = origin.y - self->y[i];
+			float oz = origin.z - self->z[i];
+			float b = ox * direction.x + oy * direction.y + oz * direction.z;
+			float c = ox * ox + oy * oy + oz * oz - self->radius[i] * self->radius[i];
+			float discriminant = b * b - c;
+			// pointing away from the sphere or missing it
+			if ((c > 0.f && b > 0.f) || discriminant < 0.f)
+				continue;
+
+			// starting inside counts as a hit at 0
+			float t = fmaxf(-b - sqrtf(discriminant), 0.f);
+			if (t < best) {
+				best = t;
+				*item = self->items[i];
+				hit = true;
+			}
+		}
+	}
+
+	if (hit)
+		*distance = best;
+	return hit;
+}
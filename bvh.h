@@ -0,0 +1,69 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Bounding volume hierarchy over spheres for overlap and ray queries
+ *
+ * Items are bounding spheres identified by their index in the arrays passed to
+ * bvh_build(). Moving items only needs bvh_refit(), which keeps the tree topology
+ * and recomputes the boxes bottom up. Adding or removing items needs a rebuild.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "xrmath.h"
+
+// inner nodes have count 0 and their children at first and first + 1,
+// leaves hold items[first .. first + count)
+struct bvh_node
+{
+	float min[3];
+	float max[3];
+	uint32_t first;
+	uint32_t count;
+};
+
+struct bvh
+{
+	std::vector<bvh_node> nodes;
+	// item index per leaf slot
+	std::vector<uint32_t> items;
+	// item spheres in leaf slot order
+	std::vector<float> x, y, z, radius;
+};
+
+void
+bvh_build(bvh* self, uint32_t count, const float* x, const float* y, const float* z, const float* radius);
+
+// updates the item spheres, indexed like in bvh_build(), and refits all boxes
+void
+bvh_refit(bvh* self, const float* x, const float* y, const float* z, const float* radius);
+
+// writes up to max_items indices of items overlapping the sphere, returns how many
+// overlap in total
+uint32_t
+bvh_overlap_sphere(const bvh* self, XrVector3f center, float radius, uint32_t* items, uint32_t max_items);
+
+// like bvh_overlap_sphere() for a group of nearby spheres, e.g. the joints of a hand.
+// The tree is traversed once with a sphere enclosing the group, every item is
+// reported once.
+uint32_t
+bvh_overlap_spheres(const bvh* self,
+                    const XrVector3f* centers,
+                    const float* radii,
+                    uint32_t count,
+                    uint32_t* items,
+                    uint32_t max_items);
+
+// nearest item hit by the ray within max_distance, direction has to be normalized.
+// Returns false if nothing is hit.
+bool
+bvh_raycast(const bvh* self,
+            XrVector3f origin,
+            XrVector3f direction,
+            float max_distance,
+            uint32_t* item,
+            float* distance);
@@ -0,0 +1,324 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief View frustum culling of the scene draw list
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULL_SSE
+#endif
+
+#include "cull.h"
+#include "job.h"
+#include "trace.h"
+
+// below this many candidates the views are culled one after the other, a job
+// costs more than testing them
+#define CULL_PARALLEL_MIN 2048
+
+enum cull_plane
+{
+	CULL_PLANE_LEFT,
+	CULL_PLANE_RIGHT,
+	CULL_PLANE_DOWN,
+	CULL_PLANE_UP,
+	CULL_PLANE_NEAR,
+	CULL_PLANE_FAR,
+	CULL_PLANE_COUNT,
+};
+
+static struct
+{
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> visible[CULL_MAX_VIEWS];
+	cull_result result;
+} cull;
+
+static XrVector3f
+rotate(const XrQuaternionf* q, XrVector3f v)
+{
+	// v + 2w (q x v) + 2 q x (q x v)
+	XrVector3f t = {.x = 2.f * (q->y * v.z - q->z * v.y),
+	                .y = 2.f * (q->z * v.x - q->x * v.z),
+	                .z = 2.f * (q->x * v.y - q->y * v.x)};
+	return {.x = v.x + q->w * t.x + (q->y * t.z - q->z * t.y),
+	        .y = v.y + q->w * t.y + (q->z * t.x - q->x * t.z),
+	        .z = v.z + q->w * t.z + (q->x * t.y - q->y * t.x)};
+}
+
+static float
+dot(XrVector3f a, XrVector3f b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// planes are given in a space with the orientation and origin of pose, inside is
+// n . p + w >= 0
+static void
+set_plane(cull_frustum* frustum, int plane, const XrPosef* pose, XrVector3f n, float w)
+{
+	float length = sqrtf(dot(n, n));
+	n = {.x = n.x / length, .y = n.y / length, .z = n.z / length};
+	w /= length;
+
+	XrVector3f world_n = rotate(&pose->orientation, n);
+	frustum->planes[plane][0] = world_n.x;
+	frustum->planes[plane][1] = world_n.y;
+	frustum->planes[plane][2] = world_n.z;
+	frustum->planes[plane][3] = w - dot(world_n, pose->position);
+}
+
+// tan_* are the field of view tangents, apex_z the offset of the apex along +z
+static void
+set_planes(cull_frustum* frustum,
+           const XrPosef* pose,
+           float tan_left,
+           float tan_right,
+           float tan_down,
+           float tan_up,
+           float apex_z,
+           float near_distance,
+           float far_distance)
+{
+	// -z is forward, the side planes go through (0, 0, apex_z)
+	XrVector3f left = {.x = 1.f, .y = 0.f, .z = tan_left};
+	XrVector3f right = {.x = -1.f, .y = 0.f, .z = -tan_right};
+	XrVector3f down = {.x = 0.f, .y = 1.f, .z = tan_down};
+	XrVector3f up = {.x = 0.f, .y = -1.f, .z = -tan_up};
+	set_plane(frustum, CULL_PLANE_LEFT, pose, left, -left.z * apex_z);
+	set_plane(frustum, CULL_PLANE_RIGHT, pose, right, -right.z * apex_z);
+	set_plane(frustum, CULL_PLANE_DOWN, pose, down, -down.z * apex_z);
+	set_plane(frustum, CULL_PLANE_UP, pose, up, -up.z * apex_z);
+	set_plane(frustum, CULL_PLANE_NEAR, pose, {.x = 0.f, .y = 0.f, .z = -1.f}, -near_distance);
+	set_plane(frustum, CULL_PLANE_FAR, pose, {.x = 0.f, .y = 0.f, .z = 1.f}, far_distance);
+}
+
+void
+cull_frustum_from_view(cull_frustum* frustum, const XrView* view, float near_z, float far_z)
+{
+	set_planes(frustum, &view->pose, tanf(view->fov.angleLeft), tanf(view->fov.angleRight),
+	           tanf(view->fov.angleDown), tanf(view->fov.angleUp), 0.f, near_z, far_z);
+}
+
+bool
+cull_frustum_enclosing(cull_frustum* frustum,
+                       const XrView* views,
+                       uint32_t view_count,
+                       float near_z,
+                       float far_z)
+{
+	// common space: averaged orientation, centered between the views
+	XrQuaternionf q = {};
+	XrVector3f center = {};
+	for (uint32_t i = 0; i < view_count; i++) {
+		XrQuaternionf v = views[i].pose.orientation;
+		float sign = q.x * v.x + q.y * v.y + q.z * v.z + q.w * v.w < 0.f ? -1.f : 1.f;
+		q.x += sign * v.x;
+		q.y += sign * v.y;
+		q.z += sign * v.z;
+		q.w += sign * v.w;
+		center.x += views[i].pose.position.x / view_count;
+		center.y += views[i].pose.position.y / view_count;
+		center.z += views[i].pose.position.z / view_count;
+	}
+	float length = sqrtf(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+	if (length == 0.f)
+		return false;
+	q = {.x = q.x / length, .y = q.y / length, .z = q.z / length, .w = q.w / length};
+	XrQuaternionf inverse_q = {.x = -q.x, .y = -q.y, .z = -q.z, .w = q.w};
+
+	// union of the corner rays of all views, as tangents in common space. With canted
+	// views the near and far planes of a view are not parallel to the common ones, so
+	// the common near and far planes enclose the corners of every view's frustum.
+	float tan_left = INFINITY, tan_right = -INFINITY, tan_down = INFINITY, tan_up = -INFINITY;
+	float near_distance = INFINITY;
+	float far_distance = -INFINITY;
+	XrVector3f eyes[CULL_MAX_VIEWS];
+	for (uint32_t i = 0; i < view_count; i++) {
+		XrVector3f offset = {.x = views[i].pose.position.x - center.x,
+		                     .y = views[i].pose.position.y - center.y,
+		                     .z = views[i].pose.position.z - center.z};
+		eyes[i] = rotate(&inverse_q, offset);
+
+		const XrFovf* fov = &views[i].fov;
+		float x[2] = {tanf(fov->angleLeft), tanf(fov->angleRight)};
+		float y[2] = {tanf(fov->angleDown), tanf(fov->angleUp)};
+		for (int corner = 0; corner < 4; corner++) {
+			XrVector3f ray = {.x = x[corner & 1], .y = y[corner >> 1], .z = -1.f};
+			ray = rotate(&inverse_q, rotate(&views[i].pose.orientation, ray));
+			if (ray.z > -1e-3f)
+				return false;
+			tan_left = fminf(tan_left, ray.x / -ray.z);
+			tan_right = fmaxf(tan_right, ray.x / -ray.z);
+			tan_down = fminf(tan_down, ray.y / -ray.z);
+			tan_up = fmaxf(tan_up, ray.y / -ray.z);
+
+			// the ray has depth 1 in view space, so it reaches the view's near and far
+			// planes at near_z and far_z times its length
+			near_distance = fminf(near_distance, -(eyes[i].z + ray.z * near_z));
+			far_distance = fmaxf(far_distance, -(eyes[i].z + ray.z * far_z));
+		}
+	}
+
+	// move the apex back until all eyes are inside the side planes
+	XrVector3f sides[4] = {{.x = 1.f, .y = 0.f, .z = tan_left},
+	                       {.x = -1.f, .y = 0.f, .z = -tan_right},
+	                       {.x = 0.f, .y = 1.f, .z = tan_down},
+	                       {.x = 0.f, .y = -1.f, .z = -tan_up}};
+	float apex_z = 0.f;
+	for (uint32_t i = 0; i < view_count; i++) {
+		for (const XrVector3f& n : sides) {
+			if (n.z < 0.f)
+				apex_z = fmaxf(apex_z, dot(n, eyes[i]) / n.z);
+		}
+	}
+
+	XrPosef common = {.orientation = q, .position = center};
+	set_planes(frustum, &common, tan_left, tan_right, tan_down, tan_up, apex_z, near_distance,
+	           far_distance);
+	return true;
+}
+
+uint32_t
+cull_spheres(const cull_frustum* frustum,
+             const scene_draw_list* draw_list,
+             const uint32_t* indices,
+             uint32_t count,
+             uint32_t* visible)
+{
+	const float* bx = draw_list->bound_x;
+	const float* by = draw_list->bound_y;
+	const float* bz = draw_list->bound_z;
+	const float* br = draw_list->bound_radius;
+
+	uint32_t visible_count = 0;
+	uint32_t i = 0;
+
+#ifdef CULL_SSE
+	__m128 planes[CULL_PLANE_COUNT][4];
+	for (int p = 0; p < CULL_PLANE_COUNT; p++) {
+		for (int c = 0; c < 4; c++)
+			planes[p][c] = _mm_set1_ps(frustum->planes[p][c]);
+	}
+
+	for (; i + 4 <= count; i += 4) {
+		__m128 x, y, z, r;
+		uint32_t draw[4];
+		if (indices != NULL) {
+			for (int k = 0; k < 4; k++)
+				draw[k] = indices[i + k];
+			x = _mm_setr_ps(bx[draw[0]], bx[draw[1]], bx[draw[2]], bx[draw[3]]);
+			y = _mm_setr_ps(by[draw[0]], by[draw[1]], by[draw[2]], by[draw[3]]);
+			z = _mm_setr_ps(bz[draw[0]], bz[draw[1]], bz[draw[2]], bz[draw[3]]);
+			r = _mm_setr_ps(br[draw[0]], br[draw[1]], br[draw[2]], br[draw[3]]);
+		} else {
+			for (int k = 0; k < 4; k++)
+				draw[k] = i + k;
+			x = _mm_loadu_ps(bx + i);
+			y = _mm_loadu_ps(by + i);
+			z = _mm_loadu_ps(bz + i);
+			r = _mm_loadu_ps(br + i);
+		}
+
+		// inside or intersecting while the center is at most r behind every plane
+		__m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), r);
+		__m128 inside;
+		for (int p = 0; p < CULL_PLANE_COUNT; p++) {
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[p][0], x), _mm_mul_ps(planes[p][1], y)),
+			                      _mm_add_ps(_mm_mul_ps(planes[p][2], z), planes[p][3]));
+			__m128 in_front = _mm_cmpge_ps(d, neg_r);
+			inside = p == 0 ? in_front : _mm_and_ps(inside, in_front);
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (int k = 0; k < 4; k++) {
+			if (mask & (1 << k))
+				visible[visible_count++] = draw[k];
+		}
+	}
+#endif
+
+	for (; i < count; i++) {
+		uint32_t draw = indices != NULL ? indices[i] : i;
+		bool inside = true;
+		for (int p = 0; p < CULL_PLANE_COUNT; p++) {
+			const float* plane = frustum->planes[p];
+			float d = plane[0] * bx[draw] + plane[1] * by[draw] + plane[2] * bz[draw] + plane[3];
+			inside = inside && d >= -br[draw];
+		}
+		if (inside)
+			visible[visible_count++] = draw;
+	}
+	return visible_count;
+}
+
+struct cull_view_job
+{
+	const scene_draw_list* draw_list;
+	const XrView* views;
+	float near_z;
+	float far_z;
+	const uint32_t* candidates;
+	uint32_t candidate_count;
+};
+
+// every view writes only its own list
+static void
+cull_view(void* data, uint32_t view)
+{
+	cull_view_job* job = (cull_view_job*)data;
+
+	cull_frustum frustum;
+	cull_frustum_from_view(&frustum, &job->views[view], job->near_z, job->far_z);
+	cull.visible[view].resize(job->candidate_count);
+	cull.result.visible_count[view] = cull_spheres(&frustum, job->draw_list, job->candidates,
+	                                               job->candidate_count, cull.visible[view].data());
+	cull.result.visible[view] = cull.visible[view].data();
+}
+
+const cull_result*
+cull_views(const scene_draw_list* draw_list,
+           const XrView* views,
+           uint32_t view_count,
+           float near_z,
+           float far_z)
+{
+	TRACE_SCOPE("cull_views");
+
+	if (view_count > CULL_MAX_VIEWS)
+		view_count = CULL_MAX_VIEWS;
+
+	cull.candidates.resize(draw_list->count);
+	cull_frustum combined;
+	uint32_t candidate_count;
+	const uint32_t* candidates;
+	if (cull_frustum_enclosing(&combined, views, view_count, near_z, far_z)) {
+		candidate_count = cull_spheres(&combined, draw_list, NULL, draw_list->count, cull.candidates.data());
+		candidates = cull.candidates.data();
+	} else {
+		// every view tests every draw
+		candidate_count = draw_list->count;
+		candidates = NULL;
+	}
+	cull.result.candidate_count = candidate_count;
+
+	cull_view_job job = {.draw_list = draw_list,
+	                     .views = views,
+	                     .near_z = near_z,
+	                     .far_z = far_z,
+	                     .candidates = candidates,
+	                     .candidate_count = candidate_count};
+	if (candidate_count >= CULL_PARALLEL_MIN) {
+		job_run("cull view", view_count, cull_view, &job);
+	} else {
+		for (uint32_t i = 0; i < view_count; i++)
+			cull_view(&job, i);
+	}
+	return &cull.result;
+}
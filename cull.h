@@ -0,0 +1,65 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief View frustum culling of the scene draw list
+ *
+ * The bounding spheres of all draws are first tested against one conservative
+ * frustum that encloses the frusta of all views, the survivors are then tested
+ * against each view. Both passes test four spheres at a time with SSE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "xrmath.h"
+#include "scene.h"
+
+// OpenXR view configurations have at most four views
+#define CULL_MAX_VIEWS 4
+
+// planes as (normal, distance) with the normal pointing inside, world space
+struct cull_frustum
+{
+	float planes[6][4];
+};
+
+struct cull_result
+{
+	// draws inside the combined frustum
+	uint32_t candidate_count;
+	// indices into the draw list per view, ascending so the material order is kept
+	const uint32_t* visible[CULL_MAX_VIEWS];
+	uint32_t visible_count[CULL_MAX_VIEWS];
+};
+
+void
+cull_frustum_from_view(cull_frustum* frustum, const XrView* view, float near_z, float far_z);
+
+// returns false if the views diverge too much for a common frustum, e.g. more than
+// 180 degrees combined field of view
+bool
+cull_frustum_enclosing(cull_frustum* frustum,
+                       const XrView* views,
+                       uint32_t view_count,
+                       float near_z,
+                       float far_z);
+
+// writes the draw list indices of spheres that intersect the frustum to visible and
+// returns their count. Tests indices[0..count) or, without indices, all draws [0..count).
+uint32_t
+cull_spheres(const cull_frustum* frustum,
+             const scene_draw_list* draw_list,
+             const uint32_t* indices,
+             uint32_t count,
+             uint32_t* visible);
+
+// culls the draw list for up to CULL_MAX_VIEWS views. The result stays valid until
+// the next call.
+const cull_result*
+cull_views(const scene_draw_list* draw_list,
+           const XrView* views,
+           uint32_t view_count,
+           float near_z,
+           float far_z);
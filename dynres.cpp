@@ -0,0 +1,76 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Dynamic resolution scaling driven by GPU frame time
+ */
+
+#include "dynres.h"
+
+#include <math.h>
+
+void
+dynres_default_settings(dynres_settings* settings)
+{
+	settings->min_scale = 0.5f;
+	settings->max_scale = 1.0f;
+	settings->target_utilization = 0.85f;
+	settings->smoothing = 0.1f;
+	settings->hysteresis = 0.1f;
+	settings->max_increase = 1.05f;
+	settings->cooldown_frames = 8;
+}
+
+void
+dynres_init(dynres* self, const dynres_settings* settings)
+{
+	self->settings = *settings;
+	self->scale = settings->max_scale;
+	self->smoothed_gpu_ms = -1.f;
+	self->frames_since_change = 0;
+}
+
+float
+dynres_update(dynres* self, float gpu_frame_ms, float display_period_ms)
+{
+	const dynres_settings* s = &self->settings;
+
+	self->frames_since_change++;
+	if (gpu_frame_ms <= 0.f || display_period_ms <= 0.f)
+		return self->scale;
+
+	if (self->smoothed_gpu_ms < 0.f)
+		self->smoothed_gpu_ms = gpu_frame_ms;
+	else
+		self->smoothed_gpu_ms += s->smoothing * (gpu_frame_ms - self->smoothed_gpu_ms);
+
+	if (self->frames_since_change < s->cooldown_frames)
+		return self->scale;
+
+	float budget_ms = display_period_ms * s->target_utilization;
+	float load = self->smoothed_gpu_ms / budget_ms;
+	if (fabsf(load - 1.f) < s->hysteresis)
+		return self->scale;
+
+	// GPU time is roughly proportional to the pixel count, so the per axis
+	// scale goes with the square root of the load
+	float factor = sqrtf(1.f / load);
+	if (factor > s->max_increase)
+		factor = s->max_increase;
+
+	float scale = self->scale * factor;
+	if (scale < s->min_scale)
+		scale = s->min_scale;
+	if (scale > s->max_scale)
+		scale = s->max_scale;
+
+	if (scale != self->scale) {
+		// the smoothed time was measured at the old scale, rescale it by the
+		// clamped change
+		float applied = scale / self->scale;
+		self->smoothed_gpu_ms *= applied * applied;
+		self->scale = scale;
+		self->frames_since_change = 0;
+	}
+	return self->scale;
+}
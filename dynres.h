@@ -0,0 +1,51 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Dynamic resolution scaling driven by GPU frame time
+ *
+ * Swapchains are allocated at max_scale times the recommended size, every frame
+ * only scale times the recommended size is rendered and submitted via the
+ * imageRect of the projection views. The runtime scales the image up.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct dynres_settings
+{
+	// per axis scale relative to recommendedImageRectWidth/Height
+	float min_scale;
+	float max_scale;
+	// fraction of the display period the GPU may use
+	float target_utilization;
+	// weight of the newest GPU time sample in the moving average
+	float smoothing;
+	// no change while the smoothed GPU time is within this fraction of the budget
+	float hysteresis;
+	// largest per axis increase per step, decreases are not limited
+	float max_increase;
+	// frames to wait after a change, GPU timings arrive a few frames late
+	uint32_t cooldown_frames;
+};
+
+struct dynres
+{
+	dynres_settings settings;
+	float scale;
+	float smoothed_gpu_ms;
+	uint32_t frames_since_change;
+};
+
+// reasonable defaults that only scale down, override fields before dynres_init()
+void
+dynres_default_settings(dynres_settings* settings);
+
+void
+dynres_init(dynres* self, const dynres_settings* settings);
+
+// feeds in the latest GPU frame time (negative if not available yet) and
+// returns the scale to render the next frame with
+float
+dynres_update(dynres* self, float gpu_frame_ms, float display_period_ms);
@@ -0,0 +1,135 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Distant static scene content submitted as a cube or equirect layer
+ */
+
+#include "environment.h"
+
+#include <stdio.h>
+
+#include "glimpl.h"
+#include "layer_manager.h"
+#include "scene.h"
+#include "trace.h"
+
+static struct
+{
+	environment_mode mode;
+	uint32_t face_size;
+	layer_content_id content;
+	layer_handle layer;
+	// scene_environment_version() the layer was last marked changed for
+	uint32_t version;
+} environment = {.mode = ENVIRONMENT_OFF, .content = LAYER_CONTENT_INVALID, .layer = LAYER_HANDLE_INVALID};
+
+bool
+environment_init(environment_mode mode, XrSpace space, int64_t format, uint32_t face_size, int32_t depth)
+{
+	environment.mode = mode;
+	if (mode == ENVIRONMENT_OFF)
+		return true;
+
+	// a full equirect image has two texels per cube face texel around the equator
+	bool equirect = mode == ENVIRONMENT_EQUIRECT;
+	layer_content_desc desc = {
+		.kind = LAYER_CONTENT_ENVIRONMENT,
+		.format = format,
+		.width = equirect ? face_size * 4 : face_size,
+		.height = equirect ? face_size * 2 : face_size,
+		.face_count = equirect ? 1u : 6u,
+		.create_flags = 0,
+	};
+	environment.face_size = face_size;
+	environment.content = layer_content_acquire(&desc);
+	if (environment.content == LAYER_CONTENT_INVALID) {
+		environment.mode = ENVIRONMENT_OFF;
+		return false;
+	}
+
+	environment.layer =
+		layer_manager_add(equirect ? LAYER_KIND_EQUIRECT : LAYER_KIND_CUBE, depth, environment.content);
+	if (environment.layer == LAYER_HANDLE_INVALID) {
+		layer_content_release(environment.content);
+		environment.content = LAYER_CONTENT_INVALID;
+		environment.mode = ENVIRONMENT_OFF;
+		return false;
+	}
+	layer_manager_set_update(environment.layer, LAYER_UPDATE_ON_CHANGE, 0);
+
+	layer_data* layer = layer_manager_get(environment.layer);
+	XrQuaternionf identity = {.x = 0.f, .y = 0.f, .z = 0.f, .w = 1.f};
+	if (equirect) {
+		XrCompositionLayerEquirectKHR* equirect_layer = &layer->equirect;
+		equirect_layer->layerFlags = 0;
+		equirect_layer->space = space;
+		equirect_layer->eyeVisibility = XR_EYE_VISIBILITY_BOTH;
+		equirect_layer->subImage = layer_content_sub_image(environment.content);
+		equirect_layer->pose = {.orientation = identity, .position = {}};
+		// an infinite sphere, the whole image
+		equirect_layer->radius = 0.f;
+		equirect_layer->scale = {.x = 1.f, .y = 1.f};
+		equirect_layer->bias = {.x = 0.f, .y = 0.f};
+	} else {
+		XrCompositionLayerCubeKHR* cube_layer = &layer->cube;
+		cube_layer->layerFlags = 0;
+		cube_layer->space = space;
+		cube_layer->eyeVisibility = XR_EYE_VISIBILITY_BOTH;
+		cube_layer->swapchain = layer_content_swapchain(environment.content);
+		cube_layer->imageArrayIndex = 0;
+		cube_layer->orientation = identity;
+	}
+
+	environment.version = scene_environment_version();
+	printf("Environment rendered into a %s layer, %u pixels per face\n", equirect ? "equirect" : "cube",
+		   face_size);
+	return true;
+}
+
+environment_mode
+environment_get_mode()
+{
+	return environment.mode;
+}
+
+void
+environment_update()
+{
+	if (environment.mode == ENVIRONMENT_OFF)
+		return;
+
+	uint32_t version = scene_environment_version();
+	if (version == environment.version)
+		return;
+	environment.version = version;
+	layer_manager_mark_changed(environment.layer);
+}
+
+void
+environment_render(XrSwapchainImageOpenGLKHR image)
+{
+	TRACE_SCOPE("environment_render");
+	const layer_content_desc* desc = layer_content_get_desc(environment.content);
+	const scene_draw_list* draw_list = scene_build_environment_draw_list();
+	render_environment((int)environment.face_size, draw_list, image, environment.mode == ENVIRONMENT_EQUIRECT,
+					   (int)desc->width, (int)desc->height);
+}
+
+bool
+environment_is_content(layer_content_id content)
+{
+	return environment.mode != ENVIRONMENT_OFF && content == environment.content;
+}
+
+void
+environment_cleanup()
+{
+	if (environment.layer != LAYER_HANDLE_INVALID)
+		layer_manager_remove(environment.layer);
+	if (environment.content != LAYER_CONTENT_INVALID)
+		layer_content_release(environment.content);
+	environment.layer = LAYER_HANDLE_INVALID;
+	environment.content = LAYER_CONTENT_INVALID;
+	environment.mode = ENVIRONMENT_OFF;
+}
@@ -0,0 +1,51 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Distant static scene content submitted as a cube or equirect layer
+ *
+ * The environment objects of the scene are rendered from the origin into a cube map
+ * once, and again only when they change. The compositor reprojects the layer for
+ * every frame, so only the near and moving objects are rendered into the eyes.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "platform.h"
+#include "layer_content.h"
+
+enum environment_mode
+{
+	// environment objects are rendered into the eyes
+	ENVIRONMENT_OFF,
+	// XR_KHR_composition_layer_cube
+	ENVIRONMENT_CUBE,
+	// XR_KHR_composition_layer_equirect, converted from a cube map
+	ENVIRONMENT_EQUIRECT,
+};
+
+// Acquires the layer content and adds the layer behind the projection layer at depth,
+// the projection layer has to blend over it. OpenGL only. Does nothing for
+// ENVIRONMENT_OFF.
+bool
+environment_init(environment_mode mode, XrSpace space, int64_t format, uint32_t face_size, int32_t depth);
+
+environment_mode
+environment_get_mode();
+
+// marks the layer changed when the environment objects of the scene changed,
+// before layer_manager_begin_frame()
+void
+environment_update();
+
+// renders the environment into an acquired image of its content
+void
+environment_render(XrSwapchainImageOpenGLKHR image);
+
+bool
+environment_is_content(layer_content_id content);
+
+void
+environment_cleanup();
@@ -0,0 +1,437 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Gestures recognized from the tracked hand joints
+ */
+
+#include "gesture.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define GESTURE_SSE
+#endif
+
+#include "trace.h"
+
+// index, middle, ring and little finger of every hand
+#define FINGER_LANES (GESTURE_MAX_HANDS * 4)
+
+// longer gaps don't give a meaningful poke speed
+#define GESTURE_MAX_DT 0.1f
+
+static const char trace_magic[8] = {'O', 'X', 'R', 'H', 'A', 'N', 'D', '1'};
+
+// the metacarpal of the index, middle, ring and little finger, the other joints of
+// a finger follow it: proximal, intermediate, distal, tip
+static const uint32_t finger_metacarpals[4] = {
+	XR_HAND_JOINT_INDEX_METACARPAL_EXT,
+	XR_HAND_JOINT_MIDDLE_METACARPAL_EXT,
+	XR_HAND_JOINT_RING_METACARPAL_EXT,
+	XR_HAND_JOINT_LITTLE_METACARPAL_EXT,
+};
+
+struct gesture_state
+{
+	bool active;
+	uint32_t frames;
+};
+
+// the finger joints the features need, gathered into lanes
+struct finger_lanes
+{
+	alignas(16) float tip[3][FINGER_LANES];
+	alignas(16) float thumb_tip[3][FINGER_LANES];
+	// metacarpal to proximal and intermediate to tip
+	alignas(16) float base_dir[3][FINGER_LANES];
+	alignas(16) float tip_dir[3][FINGER_LANES];
+	alignas(16) float pinch[FINGER_LANES];
+	alignas(16) float curl[FINGER_LANES];
+};
+
+static struct
+{
+	gesture_def defs[GESTURE_MAX];
+	uint32_t def_count;
+	gesture_state states[GESTURE_MAX_HANDS][GESTURE_MAX];
+
+	// index tip of the previous frame for the poke speed
+	XrTime last_time;
+	bool last_valid[GESTURE_MAX_HANDS];
+	XrVector3f last_index_tip[GESTURE_MAX_HANDS];
+
+	gesture_frame frame;
+	FILE* record_file;
+} gestures;
+
+int
+gesture_add(const gesture_def* def)
+{
+	if (gestures.def_count == GESTURE_MAX) {
+		printf("Too many gestures, not adding %s\n", def->name);
+		return -1;
+	}
+	gestures.defs[gestures.def_count] = *def;
+	for (int hand = 0; hand < GESTURE_MAX_HANDS; hand++)
+		gestures.states[hand][gestures.def_count] = {};
+	return (int)gestures.def_count++;
+}
+
+void
+gesture_add_defaults()
+{
+	gesture_def pinch = {.name = "pinch",
+	                     .feature = GESTURE_FEATURE_PINCH_INDEX,
+	                     .engage = 0.015f,
+	                     .release = 0.03f,
+	                     .engage_frames = 2,
+	                     .required = -1,
+	                     .action = INPUT_ACTION_GRAB};
+	gesture_add(&pinch);
+
+	gesture_def grab = {.name = "grab",
+	                    .feature = GESTURE_FEATURE_GRAB,
+	                    .engage = 0.6f,
+	                    .release = 0.45f,
+	                    .engage_frames = 3,
+	                    .required = -1,
+	                    .action = INPUT_ACTION_GRAB};
+	gesture_add(&grab);
+
+	gesture_def point = {.name = "point",
+	                     .feature = GESTURE_FEATURE_POINT,
+	                     .engage = 0.35f,
+	                     .release = 0.2f,
+	                     .engage_frames = 3,
+	                     .required = -1,
+	                     .action = INPUT_ACTION_COUNT};
+	int point_index = gesture_add(&point);
+
+	gesture_def poke = {.name = "poke",
+	                    .feature = GESTURE_FEATURE_POKE_SPEED,
+	                    .engage = 0.3f,
+	                    .release = 0.1f,
+	                    .engage_frames = 1,
+	                    .required = point_index,
+	                    .action = INPUT_ACTION_COUNT};
+	gesture_add(&poke);
+
+	gesture_def palm_up = {.name = "palm up",
+	                       .feature = GESTURE_FEATURE_PALM_UP,
+	                       .engage = 0.7f,
+	                       .release = 0.5f,
+	                       .engage_frames = 5,
+	                       .required = -1,
+	                       .action = INPUT_ACTION_COUNT};
+	gesture_add(&palm_up);
+}
+
+uint32_t
+gesture_count()
+{
+	return gestures.def_count;
+}
+
+const gesture_def*
+gesture_get(int gesture)
+{
+	return &gestures.defs[gesture];
+}
+
+void
+gesture_reset()
+{
+	memset(gestures.states, 0, sizeof(gestures.states));
+	memset(gestures.frame.active, 0, sizeof(gestures.frame.active));
+	memset(gestures.last_valid, 0, sizeof(gestures.last_valid));
+	gestures.last_time = 0;
+}
+
+static bool
+joint_valid(const XrHandJointLocationsEXT* hand, uint32_t joint)
+{
+	return joint < hand->jointCount &&
+	       (hand->jointLocations[joint].locationFlags & XR_SPACE_LOCATION_POSITION_VALID_BIT) != 0;
+}
+
+static bool
+hand_valid(const XrHandJointLocationsEXT* hand)
+{
+	if (!hand->isActive || !joint_valid(hand, XR_HAND_JOINT_PALM_EXT))
+		return false;
+	for (uint32_t joint = XR_HAND_JOINT_THUMB_METACARPAL_EXT; joint <= XR_HAND_JOINT_LITTLE_TIP_EXT; joint++)
+		if (!joint_valid(hand, joint))
+			return false;
+	return true;
+}
+
+static XrVector3f
+sub(XrVector3f a, XrVector3f b)
+{
+	return {.x = a.x - b.x, .y = a.y - b.y, .z = a.z - b.z};
+}
+
+static float
+dot(XrVector3f a, XrVector3f b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// 0 when b points along a, 1 when it points back
+static float
+curl(XrVector3f a, XrVector3f b)
+{
+	float length2 = dot(a, a) * dot(b, b);
+	if (length2 <= 0.f)
+		return 0.f;
+	return 0.5f - 0.5f * dot(a, b) / sqrtf(length2);
+}
+
+static void
+set_lane(float lanes[3][FINGER_LANES], uint32_t lane, XrVector3f v)
+{
+	lanes[0][lane] = v.x;
+	lanes[1][lane] = v.y;
+	lanes[2][lane] = v.z;
+}
+
+static void
+finger_features(finger_lanes* l, uint32_t i)
+{
+	float dx = l->tip[0][i] - l->thumb_tip[0][i];
+	float dy = l->tip[1][i] - l->thumb_tip[1][i];
+	float dz = l->tip[2][i] - l->thumb_tip[2][i];
+	l->pinch[i] = sqrtf(dx * dx + dy * dy + dz * dz);
+
+	XrVector3f base = {.x = l->base_dir[0][i], .y = l->base_dir[1][i], .z = l->base_dir[2][i]};
+	XrVector3f tip = {.x = l->tip_dir[0][i], .y = l->tip_dir[1][i], .z = l->tip_dir[2][i]};
+	l->curl[i] = curl(base, tip);
+}
+
+#ifdef GESTURE_SSE
+static inline __m128
+dot4(const float a[3][FINGER_LANES], const float b[3][FINGER_LANES], uint32_t i)
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(a[0] + i), _mm_load_ps(b[0] + i)),
+	                             _mm_mul_ps(_mm_load_ps(a[1] + i), _mm_load_ps(b[1] + i))),
+	                  _mm_mul_ps(_mm_load_ps(a[2] + i), _mm_load_ps(b[2] + i)));
+}
+
+// the same as finger_features() for lanes i to i + 3
+static void
+finger_features4(finger_lanes* l, uint32_t i)
+{
+	__m128 dx = _mm_sub_ps(_mm_load_ps(l->tip[0] + i), _mm_load_ps(l->thumb_tip[0] + i));
+	__m128 dy = _mm_sub_ps(_mm_load_ps(l->tip[1] + i), _mm_load_ps(l->thumb_tip[1] + i));
+	__m128 dz = _mm_sub_ps(_mm_load_ps(l->tip[2] + i), _mm_load_ps(l->thumb_tip[2] + i));
+	_mm_store_ps(l->pinch + i,
+	             _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz))));
+
+	__m128 length2 = _mm_mul_ps(dot4(l->base_dir, l->base_dir, i), dot4(l->tip_dir, l->tip_dir, i));
+	__m128 cosine = _mm_div_ps(dot4(l->base_dir, l->tip_dir, i), _mm_sqrt_ps(length2));
+	// degenerate bones count as straight
+	__m128 nondegenerate = _mm_cmpgt_ps(length2, _mm_setzero_ps());
+	cosine = _mm_or_ps(_mm_and_ps(nondegenerate, cosine), _mm_andnot_ps(nondegenerate, _mm_set1_ps(1.f)));
+	__m128 half = _mm_set1_ps(0.5f);
+	_mm_store_ps(l->curl + i, _mm_sub_ps(half, _mm_mul_ps(half, cosine)));
+}
+#endif
+
+static void
+compute_features(gesture_frame* frame, const XrHandJointLocationsEXT* hands, uint32_t hand_count, float dt)
+{
+	finger_lanes l;
+	memset(&l, 0, sizeof(l));
+
+	for (uint32_t hand = 0; hand < GESTURE_MAX_HANDS; hand++) {
+		frame->valid[hand] = hand < hand_count && hand_valid(&hands[hand]);
+		if (!frame->valid[hand])
+			continue;
+
+		const XrHandJointLocationEXT* j = hands[hand].jointLocations;
+		XrVector3f thumb_tip = j[XR_HAND_JOINT_THUMB_TIP_EXT].pose.position;
+		for (uint32_t finger = 0; finger < 4; finger++) {
+			uint32_t lane = hand * 4 + finger;
+			uint32_t m = finger_metacarpals[finger];
+			set_lane(l.tip, lane, j[m + 4].pose.position);
+			set_lane(l.thumb_tip, lane, thumb_tip);
+			set_lane(l.base_dir, lane, sub(j[m + 1].pose.position, j[m].pose.position));
+			set_lane(l.tip_dir, lane, sub(j[m + 4].pose.position, j[m + 2].pose.position));
+		}
+	}
+
+	uint32_t i = 0;
+#ifdef GESTURE_SSE
+	for (; i + 4 <= FINGER_LANES; i += 4)
+		finger_features4(&l, i);
+#endif
+	for (; i < FINGER_LANES; i++)
+		finger_features(&l, i);
+
+	for (uint32_t hand = 0; hand < GESTURE_MAX_HANDS; hand++) {
+		float* f = frame->features[hand];
+		if (!frame->valid[hand]) {
+			memset(f, 0, sizeof(frame->features[hand]));
+			gestures.last_valid[hand] = false;
+			continue;
+		}
+
+		for (uint32_t finger = 0; finger < 4; finger++) {
+			f[GESTURE_FEATURE_PINCH_INDEX + finger] = l.pinch[hand * 4 + finger];
+			f[GESTURE_FEATURE_CURL_INDEX + finger] = l.curl[hand * 4 + finger];
+		}
+
+		const XrHandJointLocationEXT* j = hands[hand].jointLocations;
+		f[GESTURE_FEATURE_CURL_THUMB] =
+		    curl(sub(j[XR_HAND_JOINT_THUMB_PROXIMAL_EXT].pose.position, j[XR_HAND_JOINT_THUMB_METACARPAL_EXT].pose.position),
+		         sub(j[XR_HAND_JOINT_THUMB_TIP_EXT].pose.position, j[XR_HAND_JOINT_THUMB_DISTAL_EXT].pose.position));
+		f[GESTURE_FEATURE_GRAB] = 0.25f * (f[GESTURE_FEATURE_CURL_INDEX] + f[GESTURE_FEATURE_CURL_MIDDLE] +
+		                                   f[GESTURE_FEATURE_CURL_RING] + f[GESTURE_FEATURE_CURL_LITTLE]);
+		f[GESTURE_FEATURE_POINT] =
+		    fminf(f[GESTURE_FEATURE_CURL_MIDDLE], fminf(f[GESTURE_FEATURE_CURL_RING], f[GESTURE_FEATURE_CURL_LITTLE])) -
+		    f[GESTURE_FEATURE_CURL_INDEX];
+
+		// the +y axis of the palm joint points out of the back of the hand, this is
+		// the y component of its -y axis
+		const XrQuaternionf* q = &j[XR_HAND_JOINT_PALM_EXT].pose.orientation;
+		f[GESTURE_FEATURE_PALM_UP] = 2.f * (q->x * q->x + q->z * q->z) - 1.f;
+
+		XrVector3f index_tip = j[XR_HAND_JOINT_INDEX_TIP_EXT].pose.position;
+		XrVector3f index_dir = sub(index_tip, j[XR_HAND_JOINT_INDEX_INTERMEDIATE_EXT].pose.position);
+		float index_length = sqrtf(dot(index_dir, index_dir));
+		f[GESTURE_FEATURE_POKE_SPEED] = 0.f;
+		if (gestures.last_valid[hand] && dt > 0.f && index_length > 0.f)
+			f[GESTURE_FEATURE_POKE_SPEED] =
+			    dot(sub(index_tip, gestures.last_index_tip[hand]), index_dir) / (index_length * dt);
+		gestures.last_index_tip[hand] = index_tip;
+		gestures.last_valid[hand] = true;
+	}
+}
+
+static void
+push_event(gesture_frame* frame, uint32_t gesture, uint32_t hand, gesture_event_kind kind)
+{
+	frame->events[frame->event_count++] = {.gesture = (uint16_t)gesture, .hand = (uint16_t)hand, .kind = kind};
+}
+
+static void
+update_states(gesture_frame* frame)
+{
+	for (uint32_t hand = 0; hand < GESTURE_MAX_HANDS; hand++) {
+		uint32_t previous = frame->active[hand];
+		uint32_t active = 0;
+
+		// a required gesture has a lower index, it is already updated
+		for (uint32_t g = 0; g < gestures.def_count; g++) {
+			const gesture_def* def = &gestures.defs[g];
+			gesture_state* state = &gestures.states[hand][g];
+			bool allowed = frame->valid[hand] && (def->required < 0 || (active >> def->required) & 1);
+
+			float value = frame->features[hand][def->feature];
+			bool below = def->engage < def->release;
+			if (!allowed) {
+				state->active = false;
+				state->frames = 0;
+			} else if (state->active) {
+				state->active = below ? value <= def->release : value >= def->release;
+			} else {
+				bool engaging = below ? value < def->engage : value > def->engage;
+				state->frames = engaging ? state->frames + 1 : 0;
+				state->active = state->frames >= def->engage_frames;
+			}
+			if (state->active)
+				active |= 1u << g;
+		}
+
+		for (uint32_t g = 0; g < gestures.def_count; g++) {
+			uint32_t bit = 1u << g;
+			if ((active & bit) && !(previous & bit))
+				push_event(frame, g, hand, GESTURE_EVENT_BEGAN);
+			else if (!(active & bit) && (previous & bit))
+				push_event(frame, g, hand, GESTURE_EVENT_ENDED);
+		}
+		frame->active[hand] = active;
+	}
+}
+
+const gesture_frame*
+gesture_update(XrTime time, const XrHandJointLocationsEXT* hands, uint32_t hand_count)
+{
+	TRACE_SCOPE("gesture_update");
+
+	gesture_frame* frame = &gestures.frame;
+	float dt = (time - gestures.last_time) / 1e9f;
+	if (gestures.last_time == 0 || dt > GESTURE_MAX_DT)
+		dt = 0.f;
+	gestures.last_time = time;
+
+	frame->time = time;
+	frame->event_count = 0;
+	compute_features(frame, hands, hand_count, dt);
+	update_states(frame);
+	return frame;
+}
+
+bool
+gesture_record_open(const char* file_name)
+{
+	gestures.record_file = fopen(file_name, "wb");
+	if (gestures.record_file == NULL) {
+		printf("Failed to open hand trace %s\n", file_name);
+		return false;
+	}
+	fwrite(trace_magic, sizeof(trace_magic), 1, gestures.record_file);
+	return true;
+}
+
+void
+gesture_record_frame(XrTime time, const XrHandJointLocationsEXT* hands, uint32_t hand_count)
+{
+	if (gestures.record_file == NULL)
+		return;
+
+	gesture_trace_frame frame = {.time = time};
+	for (uint32_t hand = 0; hand < GESTURE_MAX_HANDS && hand < hand_count; hand++) {
+		frame.active[hand] = hands[hand].isActive;
+		uint32_t count = hands[hand].jointCount < XR_HAND_JOINT_COUNT_EXT ? hands[hand].jointCount
+		                                                                   : XR_HAND_JOINT_COUNT_EXT;
+		memcpy(frame.joints[hand], hands[hand].jointLocations, count * sizeof(XrHandJointLocationEXT));
+	}
+	fwrite(&frame, sizeof(frame), 1, gestures.record_file);
+}
+
+void
+gesture_record_close()
+{
+	if (gestures.record_file != NULL)
+		fclose(gestures.record_file);
+	gestures.record_file = NULL;
+}
+
+bool
+gesture_trace_load(const char* file_name, std::vector<gesture_trace_frame>* frames)
+{
+	FILE* file = fopen(file_name, "rb");
+	if (file == NULL) {
+		printf("Failed to open hand trace %s\n", file_name);
+		return false;
+	}
+
+	char magic[sizeof(trace_magic)];
+	if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, trace_magic, sizeof(magic)) != 0) {
+		printf("%s is not a hand trace\n", file_name);
+		fclose(file);
+		return false;
+	}
+
+	gesture_trace_frame frame;
+	frames->clear();
+	while (fread(&frame, sizeof(frame), 1, file) == 1)
+		frames->push_back(frame);
+	fclose(file);
+	return true;
+}
@@ -0,0 +1,135 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Gestures recognized from the tracked hand joints
+ *
+ * Each frame the features of both hands are computed from the joint arrays in one
+ * pass, the fingers of both hands four at a time with SSE: the distance of each
+ * fingertip to the thumb tip, how far each finger is curled and which way the palm
+ * faces. Every gesture is a state machine on one feature with hysteresis: it
+ * engages once the feature passes the engage threshold for a number of frames and
+ * releases once it passes back over the release threshold. A gesture can drive an
+ * action, input_apply_gestures() merges it into the input snapshot, so code reading
+ * the grab action also reacts to a pinch of a tracked hand.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "input.h"
+
+#define GESTURE_MAX 16
+#define GESTURE_MAX_HANDS 2
+
+enum gesture_feature
+{
+	// thumb tip to fingertip distance in m
+	GESTURE_FEATURE_PINCH_INDEX,
+	GESTURE_FEATURE_PINCH_MIDDLE,
+	GESTURE_FEATURE_PINCH_RING,
+	GESTURE_FEATURE_PINCH_LITTLE,
+	// 0 for a straight finger, 0.5 when the tip points 90 degrees away from the
+	// metacarpal, 1 when it points back
+	GESTURE_FEATURE_CURL_INDEX,
+	GESTURE_FEATURE_CURL_MIDDLE,
+	GESTURE_FEATURE_CURL_RING,
+	GESTURE_FEATURE_CURL_LITTLE,
+	GESTURE_FEATURE_CURL_THUMB,
+	// mean curl of the four fingers
+	GESTURE_FEATURE_GRAB,
+	// least curl of middle, ring and little finger minus the curl of the index finger
+	GESTURE_FEATURE_POINT,
+	// cosine between the palm normal and up, 1 when the palm faces up
+	GESTURE_FEATURE_PALM_UP,
+	// speed of the index tip along the index finger in m/s
+	GESTURE_FEATURE_POKE_SPEED,
+	GESTURE_FEATURE_COUNT,
+};
+
+struct gesture_def
+{
+	const char* name;
+	gesture_feature feature;
+	// with engage < release the gesture engages below engage, otherwise above
+	float engage;
+	float release;
+	// frames the engage condition has to hold
+	uint32_t engage_frames;
+	// index of a gesture that has to be active, -1 for none
+	int required;
+	// the action the gesture drives while active, INPUT_ACTION_COUNT for none
+	input_action action;
+};
+
+enum gesture_event_kind
+{
+	GESTURE_EVENT_BEGAN,
+	GESTURE_EVENT_ENDED,
+};
+
+struct gesture_event
+{
+	uint16_t gesture;
+	uint16_t hand;
+	gesture_event_kind kind;
+};
+
+struct gesture_frame
+{
+	XrTime time;
+	float features[GESTURE_MAX_HANDS][GESTURE_FEATURE_COUNT];
+	// the tracked hand has all joints the features need
+	bool valid[GESTURE_MAX_HANDS];
+	// bit per gesture
+	uint32_t active[GESTURE_MAX_HANDS];
+	gesture_event events[GESTURE_MAX * GESTURE_MAX_HANDS];
+	uint32_t event_count;
+};
+
+// the joints of one frame of a recorded hand trace
+struct gesture_trace_frame
+{
+	XrTime time;
+	XrBool32 active[GESTURE_MAX_HANDS];
+	XrHandJointLocationEXT joints[GESTURE_MAX_HANDS][XR_HAND_JOINT_COUNT_EXT];
+};
+
+// returns the index of the gesture, -1 if there are GESTURE_MAX already
+int
+gesture_add(const gesture_def* def);
+
+// pinch, grab, point, poke and palm up
+void
+gesture_add_defaults();
+
+uint32_t
+gesture_count();
+
+const gesture_def*
+gesture_get(int gesture);
+
+// releases all gestures without events and forgets the previous frame
+void
+gesture_reset();
+
+// computes the features of the hands located for time and advances the state
+// machines. The frame is valid until the next call.
+const gesture_frame*
+gesture_update(XrTime time, const XrHandJointLocationsEXT* hands, uint32_t hand_count);
+
+// appends frames to a hand trace file that OXR_BENCHMARK=gesture can replay
+bool
+gesture_record_open(const char* file_name);
+
+void
+gesture_record_frame(XrTime time, const XrHandJointLocationsEXT* hands, uint32_t hand_count);
+
+void
+gesture_record_close();
+
+bool
+gesture_trace_load(const char* file_name, std::vector<gesture_trace_frame>* frames);
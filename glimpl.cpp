@@ -17,6 +17,15 @@
 #define MATH_3D_IMPLEMENTATION
 #include "math_3d.h"
 #include "glimpl.h"
+#include "trace.h"
+#include "gpu_timer.h"
+#include "raster.h"
+#include "cube_mesh.h"
+#include "scene.h"
+
+static const char* gpu_eye_names[] = {"GPU eye 0", "GPU eye 1", "GPU eye 2", "GPU eye 3"};
+static const char* trace_view_names[] = {"render_frame view 0", "render_frame view 1", "render_frame view 2",
+                                         "render_frame view 3"};
 
 GLuint shaderProgramID = 0;
 GLuint VAOs[1] = {0};
@@ -48,8 +57,99 @@ static const char* fragmentshader =
 	"1.0);\n"
 	"}\n";
 
-static SDL_Window* desktop_window;
-static SDL_GLContext gl_context;
+// The hidden area mesh is drawn at the near plane into the depth buffer only, so the
+// depth test rejects everything the lenses would hide anyway.
+static const char* mask_vertexshader =
+	"#version 330 core\n"
+	"#extension GL_ARB_explicit_uniform_location : require\n"
+	"layout(location = 0) in vec2 aPos;\n"
+	"layout(location = 4) uniform mat4 proj;\n"
+	"void main() {\n"
+	"	gl_Position = proj * vec4(aPos, -1.0, 1.0);\n"
+	"	gl_Position.z = -gl_Position.w;\n"
+	"}\n";
+
+static const char* mask_fragmentshader =
+	"#version 330 core\n"
+	"void main() {\n"
+	"}\n";
+
+// Fullscreen triangle for the GPU layer producer, the fragment shader draws the same
+// pattern as raster_quad_pattern(). The layer swapchains are written without sRGB
+// encoding, like the uploaded bytes.
+static const char* layer_vertexshader =
+	"#version 330 core\n"
+	"void main() {\n"
+	"	vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+	"	gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);\n"
+	"}\n";
+
+static const char* layer_fragmentshader =
+	"#version 330 core\n"
+	"#extension GL_ARB_explicit_uniform_location : require\n"
+	"layout(location = 0) out vec4 FragColor;\n"
+	"layout(location = 0) uniform ivec2 size;\n"
+	"void main() {\n"
+	"	int col = int(gl_FragCoord.x);\n"
+	"	int row = int(gl_FragCoord.y);\n"
+	"	vec3 color = vec3(floor(float(row) / float(size.y) * 255.0) / 255.0, 0.0, 0.0);\n"
+	"	if (abs(row - col) < 3)\n"
+	"		color = vec3(1.0);\n"
+	"	if (abs((size.x - col) - row) < 3)\n"
+	"		color = vec3(0.0);\n"
+	"	FragColor = vec4(color, 1.0);\n"
+	"}\n";
+
+// Converts the environment cube map into an equirect image. u = 0.5 looks down -z,
+// the rows of OpenGL images are stored bottom up, so v = 1 is the first row.
+static const char* equirect_fragmentshader =
+	"#version 330 core\n"
+	"#extension GL_ARB_explicit_uniform_location : require\n"
+	"layout(location = 0) out vec4 FragColor;\n"
+	"layout(location = 0) uniform ivec2 size;\n"
+	"uniform samplerCube environment;\n"
+	"const float PI = 3.14159265358979;\n"
+	"void main() {\n"
+	"	vec2 uv = gl_FragCoord.xy / vec2(size);\n"
+	"	float longitude = (uv.x - 0.5) * 2.0 * PI;\n"
+	"	float latitude = (uv.y - 0.5) * PI;\n"
+	"	vec3 direction = vec3(sin(longitude) * cos(latitude), sin(latitude),\n"
+	"	                      -cos(longitude) * cos(latitude));\n"
+	"	FragColor = texture(environment, direction);\n"
+	"}\n";
+
+#define MAX_MASK_VIEWS 4
+
+static GLuint mask_program_id = 0;
+// pixel unpack buffer the CPU layer producer rasterizes into
+static GLuint quad_upload_buffer = 0;
+// GPU layer producer, the swapchain texture is attached to the framebuffer per draw
+static GLuint layer_program_id = 0;
+static GLuint layer_vao = 0;
+static GLuint layer_framebuffer = 0;
+// environment faces share one depth buffer, the cube map is only used for equirect
+static GLuint environment_framebuffer = 0;
+static GLuint environment_depth = 0;
+static int environment_depth_size = 0;
+static GLuint environment_cube = 0;
+static int environment_cube_size = 0;
+static GLuint equirect_program_id = 0;
+static float clear_color[4] = {.0f, 0.0f, 0.2f, 1.0f};
+static struct
+{
+	GLuint vao;
+	GLuint vbo;
+	GLuint ibo;
+	GLsizei index_count;
+} visibility_masks[MAX_MASK_VIEWS];
+// depth of the eyes when the runtime provides no depth swapchain, the visibility
+// mask and the depth test need one
+static struct
+{
+	GLuint renderbuffer;
+	int width;
+	int height;
+} eye_depths[MAX_MASK_VIEWS];
 
 void GLAPIENTRY
 MessageCallback(GLenum source,
@@ -64,52 +164,42 @@ MessageCallback(GLenum source,
 			(type == GL_DEBUG_TYPE_ERROR ? "** GL ERROR **" : ""), type, severity, message);
 }
 
-bool
-init_sdl_window(HDC& xDisplay, HGLRC& glxContext,
-				int w,
-				int h)
+static GLuint
+compile_shader_program(const char* vertex_source, const char* fragment_source, const char* name)
 {
+	GLuint vertex_shader_id = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vertex_shader_id, 1, &vertex_source, NULL);
+	glCompileShader(vertex_shader_id);
 
-	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-		printf("Unable to initialize SDL");
-		return false;
-	}
-
-	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
-	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
-	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_COMPATIBILITY);
+	GLuint fragment_shader_id = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(fragment_shader_id, 1, &fragment_source, NULL);
+	glCompileShader(fragment_shader_id);
 
-	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 0);
+	GLuint program_id = glCreateProgram();
+	glAttachShader(program_id, vertex_shader_id);
+	glAttachShader(program_id, fragment_shader_id);
+	glLinkProgram(program_id);
+	glDeleteShader(vertex_shader_id);
+	glDeleteShader(fragment_shader_id);
 
-	/* Create our window centered at half the VR resolution */
-	desktop_window = SDL_CreateWindow("OpenXR Example", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 
-		w / 2, h / 2, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
-	if (!desktop_window) {
-		printf("Unable to create window");
-		return false;
+	GLint res;
+	glGetProgramiv(program_id, GL_LINK_STATUS, &res);
+	if (!res) {
+		char info_log[512];
+		glGetProgramInfoLog(program_id, 512, NULL, info_log);
+		printf("%s shader program failed to link: %s\n", name, info_log);
+		glDeleteProgram(program_id);
+		return 0;
 	}
-
-	gl_context = SDL_GL_CreateContext(desktop_window);
-	auto err = glewInit();
-
-	glEnable(GL_DEBUG_OUTPUT);
-	glDebugMessageCallback(MessageCallback, 0);
-
-	SDL_GL_SetSwapInterval(0);
-
-
-	// HACK? OpenXR wants us to report these values, so "work around" SDL a
-	// bit and get the underlying glx stuff. Does this still work when e.g.
-	// SDL switches to xcb?
-	xDisplay = wglGetCurrentDC();
-	glxContext = wglGetCurrentContext();
-
-	return true;
+	return program_id;
 }
 
 int
 init_gl()
 {
+	glEnable(GL_DEBUG_OUTPUT);
+	glDebugMessageCallback(MessageCallback, 0);
+
 	GLuint vertex_shader_id = glCreateShader(GL_VERTEX_SHADER);
 	const GLchar* vertex_shader_source[1];
 	vertex_shader_source[0] = vertexshader;
@@ -161,75 +251,161 @@ init_gl()
 	glDeleteShader(vertex_shader_id);
 	glDeleteShader(fragment_shader_id);
 
-	float vertices[] = {-0.5f, -0.5f, -0.5f, 0.0f, 0.0f, 0.5f,  -0.5f, -0.5f, 1.0f, 0.0f,
-						0.5f,  0.5f,  -0.5f, 1.0f, 1.0f, 0.5f,  0.5f,  -0.5f, 1.0f, 1.0f,
-						-0.5f, 0.5f,  -0.5f, 0.0f, 1.0f, -0.5f, -0.5f, -0.5f, 0.0f, 0.0f,
-
-						-0.5f, -0.5f, 0.5f,  0.0f, 0.0f, 0.5f,  -0.5f, 0.5f,  1.0f, 0.0f,
-						0.5f,  0.5f,  0.5f,  1.0f, 1.0f, 0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-						-0.5f, 0.5f,  0.5f,  0.0f, 1.0f, -0.5f, -0.5f, 0.5f,  0.0f, 0.0f,
-
-						-0.5f, 0.5f,  0.5f,  1.0f, 0.0f, -0.5f, 0.5f,  -0.5f, 1.0f, 1.0f,
-						-0.5f, -0.5f, -0.5f, 0.0f, 1.0f, -0.5f, -0.5f, -0.5f, 0.0f, 1.0f,
-						-0.5f, -0.5f, 0.5f,  0.0f, 0.0f, -0.5f, 0.5f,  0.5f,  1.0f, 0.0f,
-
-						0.5f,  0.5f,  0.5f,  1.0f, 0.0f, 0.5f,  0.5f,  -0.5f, 1.0f, 1.0f,
-						0.5f,  -0.5f, -0.5f, 0.0f, 1.0f, 0.5f,  -0.5f, -0.5f, 0.0f, 1.0f,
-						0.5f,  -0.5f, 0.5f,  0.0f, 0.0f, 0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-
-						-0.5f, -0.5f, -0.5f, 0.0f, 1.0f, 0.5f,  -0.5f, -0.5f, 1.0f, 1.0f,
-						0.5f,  -0.5f, 0.5f,  1.0f, 0.0f, 0.5f,  -0.5f, 0.5f,  1.0f, 0.0f,
-						-0.5f, -0.5f, 0.5f,  0.0f, 0.0f, -0.5f, -0.5f, -0.5f, 0.0f, 1.0f,
-
-						-0.5f, 0.5f,  -0.5f, 0.0f, 1.0f, 0.5f,  0.5f,  -0.5f, 1.0f, 1.0f,
-						0.5f,  0.5f,  0.5f,  1.0f, 0.0f, 0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-						-0.5f, 0.5f,  0.5f,  0.0f, 0.0f, -0.5f, 0.5f,  -0.5f, 0.0f, 1.0f};
-
 	GLuint VBOs[1];
 	glGenBuffers(1, VBOs);
 
 	glGenVertexArrays(1, &VAOs[0]);
 	glBindVertexArray(VAOs[0]);
 	glBindBuffer(GL_ARRAY_BUFFER, VBOs[0]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_DYNAMIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, CUBE_VERTEX_STRIDE, (void*)0);
 	glEnableVertexAttribArray(0);
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
-	glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+	glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_DYNAMIC_DRAW);
+	glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, CUBE_VERTEX_STRIDE, (void*)(3 * sizeof(float)));
 	glEnableVertexAttribArray(5);
 
 	glEnable(GL_DEPTH_TEST);
 
+	mask_program_id = compile_shader_program(mask_vertexshader, mask_fragmentshader, "Visibility mask");
+	if (mask_program_id == 0)
+		return 1;
+
+	layer_program_id = compile_shader_program(layer_vertexshader, layer_fragmentshader, "Layer pattern");
+	if (layer_program_id == 0)
+		return 1;
+	// core profiles need a bound vertex array even without attributes
+	glGenVertexArrays(1, &layer_vao);
+	glGenFramebuffers(1, &layer_framebuffer);
+
+	equirect_program_id =
+		compile_shader_program(layer_vertexshader, equirect_fragmentshader, "Environment equirect");
+	if (equirect_program_id == 0)
+		return 1;
+	glGenFramebuffers(1, &environment_framebuffer);
+	glGenRenderbuffers(1, &environment_depth);
+
 	return 0;
 }
 
 void
-render_cube(
-	vec3_t position, float scale, float rotation, float* view_matrix, float* projection_matrix)
+set_clear_color(float r, float g, float b, float a)
 {
+	clear_color[0] = r;
+	clear_color[1] = g;
+	clear_color[2] = b;
+	clear_color[3] = a;
+}
 
-	mat4_t modelmatrix = m4_mul(m4_translation(position), m4_scaling(vec3(scale, scale, scale)));
+void
+set_visibility_mask(int view_index,
+					const XrVector2f* vertices,
+					uint32_t vertex_count,
+					const uint32_t* indices,
+					uint32_t index_count)
+{
+	if (view_index >= MAX_MASK_VIEWS)
+		return;
+
+	auto& mask = visibility_masks[view_index];
+	if (mask.vao == 0) {
+		glGenVertexArrays(1, &mask.vao);
+		glGenBuffers(1, &mask.vbo);
+		glGenBuffers(1, &mask.ibo);
+
+		glBindVertexArray(mask.vao);
+		glBindBuffer(GL_ARRAY_BUFFER, mask.vbo);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(XrVector2f), (void*)0);
+		glEnableVertexAttribArray(0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mask.ibo);
+	}
 
-	mat4_t rotationmatrix = m4_rotation_y(degreesToRadians(rotation));
-	modelmatrix = m4_mul(modelmatrix, rotationmatrix);
+	// the array buffer binding is not part of the vertex array state
+	glBindVertexArray(mask.vao);
+	glBindBuffer(GL_ARRAY_BUFFER, mask.vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(XrVector2f), vertices, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(uint32_t), indices, GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	glUseProgram(shaderProgramID);
-	glBindVertexArray(VAOs[0]);
+	mask.index_count = (GLsizei)index_count;
+}
 
+// grows the depth renderbuffer of the view to at least w x h, it only shrinks the
+// framebuffer to the rendered area
+static GLuint
+eye_depth_renderbuffer(int view_index, int w, int h)
+{
+	auto& depth = eye_depths[view_index % MAX_MASK_VIEWS];
+	if (depth.renderbuffer == 0)
+		glGenRenderbuffers(1, &depth.renderbuffer);
+	if (depth.width < w || depth.height < h) {
+		glBindRenderbuffer(GL_RENDERBUFFER, depth.renderbuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		depth.width = w;
+		depth.height = h;
+	}
+	return depth.renderbuffer;
+}
 
-	int color = glGetUniformLocation(shaderProgramID, "uniformColor");
-	// the color (0, 0, 0) will get replaced by some UV color in the shader
-	glUniform3f(color, 0.0, 0.0, 0.0);
+static void
+render_visibility_mask(int view_index, XrMatrix4x4f* projectionmatrix)
+{
+	if (view_index >= MAX_MASK_VIEWS || visibility_masks[view_index].index_count == 0)
+		return;
 
-	int viewLoc = glGetUniformLocation(shaderProgramID, "view");
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, view_matrix);
-	int projLoc = glGetUniformLocation(shaderProgramID, "proj");
-	glUniformMatrix4fv(projLoc, 1, GL_FALSE, projection_matrix);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthFunc(GL_ALWAYS);
 
-	int modelLoc = glGetUniformLocation(shaderProgramID, "model");
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, (float*)modelmatrix.m);
-	glDrawArrays(GL_TRIANGLES, 0, 36);
+	glUseProgram(mask_program_id);
+	glUniformMatrix4fv(4, 1, GL_FALSE, projectionmatrix->m);
+	glBindVertexArray(visibility_masks[view_index].vao);
+	glDrawElements(GL_TRIANGLES, visibility_masks[view_index].index_count, GL_UNSIGNED_INT, 0);
+
+	glDepthFunc(GL_LESS);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+static void
+upload_layer_cpu(int w, int h, XrSwapchainImageOpenGLKHR image)
+{
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, image.image);
+
+	if (quad_upload_buffer == 0)
+		glGenBuffers(1, &quad_upload_buffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, quad_upload_buffer);
+
+	// orphaning gives fresh storage, so mapping never waits for the previous upload
+	GLsizeiptr size = (GLsizeiptr)w * h * 4;
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	uint8_t* rgba = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+											   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (rgba != NULL) {
+		raster_quad_pattern(rgba, w, h);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei)w, (GLsizei)h, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+static void
+render_layer_gpu(int w, int h, XrSwapchainImageOpenGLKHR image)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, layer_framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, image.image, 0);
+	glViewport(0, 0, w, h);
+	glScissor(0, 0, w, h);
+
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(layer_program_id);
+	glUniform2i(0, w, h);
+	glBindVertexArray(layer_vao);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glEnable(GL_DEPTH_TEST);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void
@@ -237,42 +413,48 @@ render_quad(int w,
 			int h,
 			int64_t swapchain_format,
 			XrSwapchainImageOpenGLKHR image,
+			layer_producer producer,
 			XrTime predictedDisplayTime)
 {
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, image.image);
+	TRACE_SCOPE("render_quad");
+	TRACE_GPU_SCOPE("render_quad");
 
-	glViewport(0, 0, w, h);
-	glScissor(0, 0, w, h);
+	if (producer == LAYER_PRODUCER_GPU)
+		render_layer_gpu(w, h, image);
+	else
+		upload_layer_cpu(w, h, image);
+}
+
+// visible is a list of draw indices, NULL draws all count objects of the list
+static void
+draw_objects(XrMatrix4x4f* projectionmatrix,
+			 XrMatrix4x4f* viewmatrix,
+			 const scene_draw_list* draw_list,
+			 const uint32_t* visible,
+			 uint32_t count)
+{
+	glUseProgram(shaderProgramID);
+	glBindVertexArray(VAOs[0]);
 
-	uint8_t* rgb = new uint8_t[w * h * 4];
-	for (int row = 0; row < h; row++) {
-		for (int col = 0; col < w; col++) {
-			uint8_t* base = &rgb[(row * w * 4 + col * 4)];
-			*(base + 0) = (((float)row / (float)h)) * 255.;
-			*(base + 1) = 0;
-			*(base + 2) = 0;
-			*(base + 3) = 255;
-
-			if (abs(row - col) < 3) {
-				*(base + 0) = 255.;
-				*(base + 1) = 255;
-				*(base + 2) = 255;
-				*(base + 3) = 255;
-			}
-
-			if (abs((w - col) - (row)) < 3) {
-				*(base + 0) = 0.;
-				*(base + 1) = 0;
-				*(base + 2) = 0;
-				*(base + 3) = 255;
-			}
+	int viewLoc = glGetUniformLocation(shaderProgramID, "view");
+	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, (float*)viewmatrix->m);
+	int projLoc = glGetUniformLocation(shaderProgramID, "proj");
+	glUniformMatrix4fv(projLoc, 1, GL_FALSE, (float*)projectionmatrix->m);
+
+	int color = glGetUniformLocation(shaderProgramID, "uniformColor");
+	int modelLoc = glGetUniformLocation(shaderProgramID, "model");
+
+	// the draw list is sorted by material, only set the color when it changes
+	uint32_t material = UINT32_MAX;
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t draw = visible != NULL ? visible[i] : i;
+		if (draw_list->materials[draw] != material) {
+			material = draw_list->materials[draw];
+			glUniform3fv(color, 1, scene_material_colors[material]);
 		}
+		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, (float*)draw_list->models[draw].m);
+		glDrawArrays(GL_TRIANGLES, 0, CUBE_VERTEX_COUNT);
 	}
-
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei)w, (GLsizei)h, GL_RGBA, GL_UNSIGNED_BYTE,
-					(GLvoid*)rgb);
-	delete [] rgb;
 }
 
 void
@@ -280,15 +462,18 @@ render_frame(int w,
 			 int h,
 			 XrMatrix4x4f projectionmatrix,
 			 XrMatrix4x4f viewmatrix,
-			 XrSpaceLocation* hand_locations,
-			 bool* hand_locations_valid,
-			 XrHandJointLocationsEXT* joint_locations,
+			 const scene_draw_list* draw_list,
+			 const uint32_t* visible,
+			 uint32_t visible_count,
 			 GLuint framebuffer,
 			 GLuint depthbuffer,
 			 XrSwapchainImageOpenGLKHR image,
-			 int view_index,
-			 XrTime predictedDisplayTime)
+			 int view_index)
 {
+	TRACE_SCOPE("render_frame");
+	trace_gpu_begin(trace_view_names[view_index % 4]);
+	gpu_timer_begin_eye(gpu_eye_names[view_index % 4]);
+
 	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
 
 	glViewport(0, 0, w, h);
@@ -298,99 +483,169 @@ render_frame(int w,
 	if (depthbuffer != UINT32_MAX) {
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthbuffer, 0);
 	} else {
-		// TODO: need a depth attachment for depth test when rendering to fbo
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER,
+								  eye_depth_renderbuffer(view_index, w, h));
 	}
 
-	glClearColor(.0f, 0.0f, 0.2f, 1.0f);
+	glClearColor(clear_color[0], clear_color[1], clear_color[2], clear_color[3]);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	double display_time_seconds = ((double)predictedDisplayTime) / (1000. * 1000. * 1000.);
-	const float rotations_per_sec = .25;
-	float rotation = ((long)(display_time_seconds * 360. * rotations_per_sec)) % 360;
+	render_visibility_mask(view_index, &projectionmatrix);
 
-	float dist = 1.5f;
-	float height = 0.5f;
-	render_cube(vec3(0, height, -dist), .33f, rotation, viewmatrix.m, projectionmatrix.m);
-	render_cube(vec3(0, height, dist), .33f, rotation, viewmatrix.m, projectionmatrix.m);
-	render_cube(vec3(dist, height, 0), .33f, rotation, viewmatrix.m, projectionmatrix.m);
-	render_cube(vec3(-dist, height, 0), .33f, rotation, viewmatrix.m, projectionmatrix.m);
+	draw_objects(&projectionmatrix, &viewmatrix, draw_list, visible, visible_count);
 
-	glUseProgram(shaderProgramID);
-	glBindVertexArray(VAOs[0]);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	gpu_timer_end();
+	trace_gpu_end();
+}
 
-	int color = glGetUniformLocation(shaderProgramID, "uniformColor");
-	// the color (0, 0, 0) will get replaced by some UV color in the shader
-	glUniform3f(color, 0.0, 0.0, 0.0);
+static XrVector3f
+cross(XrVector3f a, XrVector3f b)
+{
+	return {.x = a.y * b.z - a.z * b.y, .y = a.z * b.x - a.x * b.z, .z = a.x * b.y - a.y * b.x};
+}
 
-	int viewLoc = glGetUniformLocation(shaderProgramID, "view");
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, (float*)viewmatrix.m);
-	int projLoc = glGetUniformLocation(shaderProgramID, "proj");
-	glUniformMatrix4fv(projLoc, 1, GL_FALSE, (float*)projectionmatrix.m);
+// view matrix at the origin looking down forward, rows are right, up and -forward.
+// forward and up have to be orthonormal.
+static XrMatrix4x4f
+look_at(XrVector3f forward, XrVector3f up)
+{
+	XrVector3f right = cross(forward, up);
+
+	XrMatrix4x4f view = {};
+	view.m[0] = right.x;
+	view.m[4] = right.y;
+	view.m[8] = right.z;
+	view.m[1] = up.x;
+	view.m[5] = up.y;
+	view.m[9] = up.z;
+	view.m[2] = -forward.x;
+	view.m[6] = -forward.y;
+	view.m[10] = -forward.z;
+	view.m[15] = 1.f;
+	return view;
+}
 
-	int modelLoc = glGetUniformLocation(shaderProgramID, "model");
-	for (int hand = 0; hand < 2; hand++) {
-		if (hand == 0) {
-			glUniform3f(color, 1.0, 0.5, 0.5);
-		} else {
-			glUniform3f(color, 0.5, 1.0, 0.5);
-		}
+// the usual OpenGL cube map orientation of the faces, +x, -x, +y, -y, +z, -z
+static const XrVector3f face_forward[6] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+static const XrVector3f face_up[6] = {{0, -1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}, {0, -1, 0}, {0, -1, 0}};
 
-		// draw blocks for controller locations if hand tracking is not available
-		if (!joint_locations[hand].isActive) {
+static void
+render_environment_faces(int face_size, const scene_draw_list* draw_list, GLuint cube_texture)
+{
+	if (environment_depth_size != face_size) {
+		glBindRenderbuffer(GL_RENDERBUFFER, environment_depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, face_size, face_size);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		environment_depth_size = face_size;
+	}
 
-			if (!hand_locations_valid[hand])
-				continue;
+	glBindFramebuffer(GL_FRAMEBUFFER, environment_framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, environment_depth);
+	glViewport(0, 0, face_size, face_size);
+	glScissor(0, 0, face_size, face_size);
 
-			XrMatrix4x4f matrix;
-			XrVector3f scale = {.x = .05f, .y = .05f, .z = .2f};
-			XrMatrix4x4f_CreateModelMatrix(&matrix, &hand_locations[hand].pose.position,
-										   &hand_locations[hand].pose.orientation, &scale);
-			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, (float*)matrix.m);
+	float quarter_turn = (float)M_PI / 4.f;
+	XrFovf fov = {.angleLeft = -quarter_turn, .angleRight = quarter_turn, .angleUp = quarter_turn, .angleDown = -quarter_turn};
+	XrMatrix4x4f projection;
+	XrMatrix4x4f_CreateProjectionFov(&projection, GRAPHICS_OPENGL, fov, 1.f, 500.f);
 
-			glDrawArrays(GL_TRIANGLES, 0, 36);
-			continue;
-		}
+	for (int face = 0; face < 6; face++) {
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
+							   cube_texture, 0);
+		glClearColor(.0f, 0.0f, 0.2f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		for (uint32_t i = 0; i < joint_locations[hand].jointCount; i++) {
-			struct XrHandJointLocationEXT* joint_location = &joint_locations[hand].jointLocations[i];
+		XrMatrix4x4f view = look_at(face_forward[face], face_up[face]);
+		draw_objects(&projection, &view, draw_list, NULL, draw_list->count);
+	}
 
-			if (!(joint_location->locationFlags & XR_SPACE_LOCATION_POSITION_VALID_BIT)) {
-				continue;
-			}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-			float size = joint_location->radius;
+static void
+render_equirect(int w, int h, XrSwapchainImageOpenGLKHR image)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, layer_framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, image.image, 0);
+	glViewport(0, 0, w, h);
+	glScissor(0, 0, w, h);
 
-			XrVector3f scale = {.x = size, .y = size, .z = size};
-			XrMatrix4x4f joint_matrix;
-			XrMatrix4x4f_CreateModelMatrix(&joint_matrix, &joint_location->pose.position,
-										   &joint_location->pose.orientation, &scale);
-			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, (float*)joint_matrix.m);
-			glDrawArrays(GL_TRIANGLES, 0, 36);
-		}
-	}
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(equirect_program_id);
+	glUniform2i(0, w, h);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, environment_cube);
+	glBindVertexArray(layer_vao);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	glEnable(GL_DEPTH_TEST);
 
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-	if (view_index == 0) {
-		//glBlitNamedFramebuffer((GLuint)framebuffer,             // readFramebuffer
-		//						(GLuint)0,                       // backbuffer     // drawFramebuffer
-		//						(GLint)0,                        // srcX0
-		//						(GLint)0,                        // srcY0
-		//						(GLint)w,                        // srcX1
-		//						(GLint)h,                        // srcY1
-		//						(GLint)0,                        // dstX0
-		//						(GLint)0,                        // dstY0
-		//						(GLint)w / 2,                    // dstX1
-		//						(GLint)h / 2,                    // dstY1
-		//						(GLbitfield)GL_COLOR_BUFFER_BIT, // mask
-		//						(GLenum)GL_LINEAR);              // filter
-
-		SDL_GL_SwapWindow(desktop_window);
+void
+render_environment(int face_size,
+				   const scene_draw_list* draw_list,
+				   XrSwapchainImageOpenGLKHR image,
+				   bool equirect,
+				   int w,
+				   int h)
+{
+	TRACE_SCOPE("render_environment");
+	TRACE_GPU_SCOPE("render_environment");
+
+	if (!equirect) {
+		render_environment_faces(face_size, draw_list, image.image);
+		return;
 	}
+
+	if (environment_cube_size != face_size) {
+		if (environment_cube == 0)
+			glGenTextures(1, &environment_cube);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, environment_cube);
+		for (int face = 0; face < 6; face++)
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA8, face_size, face_size, 0, GL_RGBA,
+						 GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		environment_cube_size = face_size;
+	}
+	render_environment_faces(face_size, draw_list, environment_cube);
+	render_equirect(w, h, image);
 }
 
 void
 cleanup_gl()
 {
 	// TODO clean up gl stuff
+	for (auto& mask : visibility_masks) {
+		if (mask.vao == 0)
+			continue;
+		glDeleteBuffers(1, &mask.vbo);
+		glDeleteBuffers(1, &mask.ibo);
+		glDeleteVertexArrays(1, &mask.vao);
+		mask = {};
+	}
+	for (auto& depth : eye_depths) {
+		glDeleteRenderbuffers(1, &depth.renderbuffer);
+		depth = {};
+	}
+	glDeleteProgram(mask_program_id);
+	glDeleteBuffers(1, &quad_upload_buffer);
+	quad_upload_buffer = 0;
+	glDeleteProgram(layer_program_id);
+	glDeleteVertexArrays(1, &layer_vao);
+	glDeleteFramebuffers(1, &layer_framebuffer);
+	glDeleteProgram(equirect_program_id);
+	glDeleteFramebuffers(1, &environment_framebuffer);
+	glDeleteRenderbuffers(1, &environment_depth);
+	environment_depth_size = 0;
+	glDeleteTextures(1, &environment_cube);
+	environment_cube = 0;
+	environment_cube_size = 0;
 }
@@ -9,24 +9,17 @@
 #ifndef GLIMPL
 #define GLIMPL
 
-#include <Windows.h>
-
 #define NO_SDL_GLEXT
 #include <GL/glew.h>
 #include <SDL2/SDL_opengl.h>
 #include <GL/glu.h>
 
 #include "xrmath.h"
+#include "scene.h"
+#include "layer_producer.h"
 
-#define XR_USE_PLATFORM_WIN32
-#define XR_USE_GRAPHICS_API_OPENGL
-#include "openxr/openxr.h"
-#include "openxr/openxr_platform.h"
-
-bool
-init_sdl_window(HDC& xDisplay, HGLRC& glxContext,
-                int w,
-                int h);
+// window system headers and the matching OpenXR graphics binding
+#include "platform.h"
 
 int
 init_gl();
@@ -36,21 +29,47 @@ render_quad(int w,
             int h,
             int64_t swapchain_format,
             XrSwapchainImageOpenGLKHR image,
+            layer_producer producer,
             XrTime predictedDisplayTime);
 
+// depthbuffer is UINT32_MAX without a depth swapchain, the eye then renders into a
+// depth renderbuffer of its own
 void
 render_frame(int w,
              int h,
              XrMatrix4x4f projectionmatrix,
              XrMatrix4x4f viewmatrix,
-             XrSpaceLocation* hand_locations,
-             bool* hand_locations_valid,
-             XrHandJointLocationsEXT* joint_locations,
+             const scene_draw_list* draw_list,
+             const uint32_t* visible,
+             uint32_t visible_count,
              GLuint framebuffer,
              GLuint depthbuffer,
              XrSwapchainImageOpenGLKHR image,
-             int view_index,
-             XrTime predictedDisplayTime);
+             int view_index);
+
+// renders the draw list seen from the origin into the six faces of a cube map
+// swapchain image. With equirect the faces go into an internal cube map that is then
+// converted into the w * h equirect swapchain image.
+void
+render_environment(int face_size,
+                   const scene_draw_list* draw_list,
+                   XrSwapchainImageOpenGLKHR image,
+                   bool equirect,
+                   int w,
+                   int h);
+
+// the eyes are cleared to this color, transparent when an environment layer is behind them
+void
+set_clear_color(float r, float g, float b, float a);
+
+// uploads the hidden area mesh of a view from XR_KHR_visibility_mask, vertices are
+// in view space on the z = -1 plane. An empty mesh disables the mask for the view.
+void
+set_visibility_mask(int view_index,
+                    const XrVector2f* vertices,
+                    uint32_t vertex_count,
+                    const uint32_t* indices,
+                    uint32_t index_count);
 
 void
 cleanup_gl();
@@ -0,0 +1,187 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief GPU time per render pass with GL_TIME_ELAPSED queries
+ */
+
+#include "gpu_timer.h"
+
+#include <stdio.h>
+
+#include "glimpl.h"
+#include "stats.h"
+
+// must be a power of two. A frame uses ~5 queries, so this covers more than 10
+// frames of GPU latency before queries have to be dropped.
+#define GPU_TIMER_QUERY_COUNT 64
+// distinct section names
+#define GPU_TIMER_MAX_NAMES 16
+
+struct gpu_timer_query
+{
+	GLuint query;
+	rolling_stats* stats;
+	uint64_t frame;
+	bool eye;
+};
+
+// only touched from the GL thread
+static struct
+{
+	bool initialized;
+	gpu_timer_query queries[GPU_TIMER_QUERY_COUNT];
+	uint32_t head;
+	uint32_t tail;
+	bool active;
+	uint64_t frame;
+
+	// frame whose results are currently being summed up
+	uint64_t collect_frame;
+	float collect_frame_ms;
+	float collect_eyes_ms;
+	float last_frame_ms;
+	float last_eyes_ms;
+	rolling_stats* frame_stats;
+	uint32_t dropped;
+
+	// the names are string literals, so the statistics are looked up once per
+	// name and found again by comparing pointers
+	const char* names[GPU_TIMER_MAX_NAMES];
+	rolling_stats* name_stats[GPU_TIMER_MAX_NAMES];
+	uint32_t name_count;
+} timer;
+
+static rolling_stats*
+stats_for(const char* name)
+{
+	for (uint32_t i = 0; i < timer.name_count; i++)
+		if (timer.names[i] == name)
+			return timer.name_stats[i];
+
+	rolling_stats* stats = stats_get(name);
+	if (timer.name_count < GPU_TIMER_MAX_NAMES) {
+		timer.names[timer.name_count] = name;
+		timer.name_stats[timer.name_count] = stats;
+		timer.name_count++;
+	}
+	return stats;
+}
+
+static void
+begin(const char* name, bool eye)
+{
+	if (!timer.initialized) {
+		for (int i = 0; i < GPU_TIMER_QUERY_COUNT; i++)
+			glGenQueries(1, &timer.queries[i].query);
+		timer.frame_stats = stats_get("GPU frame");
+		timer.last_frame_ms = -1.f;
+		timer.last_eyes_ms = -1.f;
+		timer.initialized = true;
+	}
+
+	if (timer.head - timer.tail == GPU_TIMER_QUERY_COUNT) {
+		// the GPU is far behind, rather lose a sample than wait for it
+		timer.dropped++;
+		return;
+	}
+
+	gpu_timer_query* q = &timer.queries[timer.head & (GPU_TIMER_QUERY_COUNT - 1)];
+	q->stats = stats_for(name);
+	q->frame = timer.frame;
+	q->eye = eye;
+	glBeginQuery(GL_TIME_ELAPSED, q->query);
+	timer.active = true;
+}
+
+void
+gpu_timer_begin(const char* name)
+{
+	begin(name, false);
+}
+
+void
+gpu_timer_begin_eye(const char* name)
+{
+	begin(name, true);
+}
+
+void
+gpu_timer_end()
+{
+	if (!timer.active)
+		return;
+
+	glEndQuery(GL_TIME_ELAPSED);
+	timer.head++;
+	timer.active = false;
+}
+
+void
+gpu_timer_frame_end()
+{
+	timer.frame++;
+}
+
+void
+gpu_timer_collect()
+{
+	while (timer.tail != timer.head) {
+		gpu_timer_query* q = &timer.queries[timer.tail & (GPU_TIMER_QUERY_COUNT - 1)];
+
+		GLint available = 0;
+		glGetQueryObjectiv(q->query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			break;
+
+		GLuint64 elapsed_ns;
+		glGetQueryObjectui64v(q->query, GL_QUERY_RESULT, &elapsed_ns);
+		float elapsed_ms = elapsed_ns / 1000000.f;
+		stats_add(q->stats, elapsed_ms);
+
+		// results arrive in submission order, the first result of a new frame
+		// completes the previous one
+		if (q->frame != timer.collect_frame) {
+			if (timer.collect_frame_ms > 0.f) {
+				timer.last_frame_ms = timer.collect_frame_ms;
+				stats_add(timer.frame_stats, timer.collect_frame_ms);
+			}
+			// frames that only reproject have no eye sections
+			if (timer.collect_eyes_ms > 0.f)
+				timer.last_eyes_ms = timer.collect_eyes_ms;
+			timer.collect_frame = q->frame;
+			timer.collect_frame_ms = 0.f;
+			timer.collect_eyes_ms = 0.f;
+		}
+		timer.collect_frame_ms += elapsed_ms;
+		if (q->eye)
+			timer.collect_eyes_ms += elapsed_ms;
+
+		timer.tail++;
+	}
+}
+
+float
+gpu_timer_last_frame_ms()
+{
+	return timer.initialized ? timer.last_frame_ms : -1.f;
+}
+
+float
+gpu_timer_last_eyes_ms()
+{
+	return timer.initialized ? timer.last_eyes_ms : -1.f;
+}
+
+void
+gpu_timer_cleanup()
+{
+	if (!timer.initialized)
+		return;
+
+	for (int i = 0; i < GPU_TIMER_QUERY_COUNT; i++)
+		glDeleteQueries(1, &timer.queries[i].query);
+	if (timer.dropped > 0)
+		printf("GPU timer dropped %u samples\n", timer.dropped);
+	timer.initialized = false;
+}
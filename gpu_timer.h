@@ -0,0 +1,50 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief GPU time per render pass with GL_TIME_ELAPSED queries
+ *
+ * Queries come from a ring that is deep enough for several frames in flight, so
+ * results are read back frames later without ever waiting for the GPU. Results
+ * are fed into the rolling statistics from stats.h.
+ */
+
+#pragma once
+
+// measures the GL commands until gpu_timer_end(). name must be a string literal,
+// it is used as the statistics name. Sections must not nest.
+void
+gpu_timer_begin(const char* name);
+
+// a section that renders an eye, also summed up by gpu_timer_last_eyes_ms()
+void
+gpu_timer_begin_eye(const char* name);
+
+void
+gpu_timer_end();
+
+// call after all sections of a frame have been submitted
+void
+gpu_timer_frame_end();
+
+// reads back finished queries without stalling
+void
+gpu_timer_collect();
+
+// sum of all sections of the last frame whose results are available, in
+// milliseconds, or a negative value if none is available yet
+float
+gpu_timer_last_frame_ms();
+
+// like gpu_timer_last_frame_ms(), but only the eye sections of the frame
+float
+gpu_timer_last_eyes_ms();
+
+void
+gpu_timer_cleanup();
+
+struct gpu_timer_scope
+{
+	gpu_timer_scope(const char* name) { gpu_timer_begin(name); }
+	~gpu_timer_scope() { gpu_timer_end(); }
+};
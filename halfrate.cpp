@@ -0,0 +1,78 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Rendering the eyes every other display period
+ */
+
+#include "halfrate.h"
+
+#include <math.h>
+
+void
+halfrate_default_settings(halfrate_settings* settings)
+{
+	settings->mode = HALFRATE_OFF;
+	settings->engage_utilization = 0.95f;
+	settings->release_utilization = 0.6f;
+	settings->smoothing = 0.1f;
+	settings->cooldown_frames = 90;
+}
+
+void
+halfrate_init(halfrate* self, const halfrate_settings* settings)
+{
+	self->settings = *settings;
+	self->engaged = settings->mode == HALFRATE_ALWAYS;
+	self->smoothed_gpu_ms = -1.f;
+	self->last_gpu_ms = -1.f;
+	self->frames_since_change = 0;
+	self->phase = 0;
+}
+
+static void
+update_auto(halfrate* self, float gpu_frame_ms, float display_period_ms)
+{
+	const halfrate_settings* s = &self->settings;
+
+	self->frames_since_change++;
+	if (gpu_frame_ms <= 0.f || display_period_ms <= 0.f)
+		return;
+
+	// at half rate only every other frame renders the eyes, the larger of two
+	// consecutive samples is the one of a rendered frame
+	float sample = gpu_frame_ms;
+	if (self->engaged && self->last_gpu_ms > sample)
+		sample = self->last_gpu_ms;
+	self->last_gpu_ms = gpu_frame_ms;
+
+	if (self->smoothed_gpu_ms < 0.f)
+		self->smoothed_gpu_ms = sample;
+	else
+		self->smoothed_gpu_ms += s->smoothing * (sample - self->smoothed_gpu_ms);
+
+	if (self->frames_since_change < s->cooldown_frames)
+		return;
+
+	float load = self->smoothed_gpu_ms / display_period_ms;
+	bool engaged = self->engaged ? load > s->release_utilization : load > s->engage_utilization;
+	if (engaged != self->engaged) {
+		self->engaged = engaged;
+		self->frames_since_change = 0;
+		self->phase = 0;
+	}
+}
+
+bool
+halfrate_update(halfrate* self, float gpu_frame_ms, float display_period_ms)
+{
+	if (self->settings.mode == HALFRATE_OFF)
+		return true;
+	if (self->settings.mode == HALFRATE_AUTO)
+		update_auto(self, gpu_frame_ms, display_period_ms);
+	if (!self->engaged)
+		return true;
+
+	// the first engaged frame renders, so there always is an image to reproject
+	return self->phase++ % 2 == 0;
+}
@@ -0,0 +1,58 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Rendering the eyes every other display period
+ *
+ * While half rate is engaged new eye images are only rendered every other frame. In
+ * between the projection layer is submitted again with the images, poses and depth
+ * of the last rendered frame, and the runtime reprojects them to the new head pose.
+ * Layer content is not affected. In auto mode half rate engages while the GPU time
+ * does not fit into one display period and releases once it fits comfortably.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+enum halfrate_mode
+{
+	HALFRATE_OFF,
+	HALFRATE_ALWAYS,
+	HALFRATE_AUTO,
+};
+
+struct halfrate_settings
+{
+	halfrate_mode mode;
+	// engage when the smoothed GPU time exceeds this fraction of the display period
+	float engage_utilization;
+	// release when it falls below this fraction, lower than engage to avoid toggling
+	float release_utilization;
+	// weight of the newest GPU time sample in the moving average
+	float smoothing;
+	// frames to stay in a state after a change, GPU timings arrive a few frames late
+	uint32_t cooldown_frames;
+};
+
+struct halfrate
+{
+	halfrate_settings settings;
+	bool engaged;
+	float smoothed_gpu_ms;
+	float last_gpu_ms;
+	uint32_t frames_since_change;
+	// frames since half rate engaged, even frames are rendered
+	uint64_t phase;
+};
+
+void
+halfrate_default_settings(halfrate_settings* settings);
+
+void
+halfrate_init(halfrate* self, const halfrate_settings* settings);
+
+// feeds in the latest GPU frame time (negative if not available yet) and returns
+// whether the eyes are rendered this frame
+bool
+halfrate_update(halfrate* self, float gpu_frame_ms, float display_period_ms);
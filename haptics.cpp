@@ -0,0 +1,390 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Haptic effects scheduled on a thread
+ */
+
+#include "haptics.h"
+
+#include <math.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "log.h"
+#include "trace.h"
+
+// amplitude steps of the mixed output, ramps cost one call per step
+#define HAPTICS_LEVELS 16
+
+enum command_type
+{
+	COMMAND_PLAY,
+	COMMAND_RELEASE,
+};
+
+struct command
+{
+	command_type type;
+	int hand;
+	uint32_t handle;
+	haptic_effect effect;
+};
+
+struct active_effect
+{
+	uint32_t handle;
+	haptic_effect effect;
+	double start_s;
+	// when a held envelope was released, negative while it holds
+	double release_start_s;
+};
+
+struct hand_state
+{
+	active_effect effects[HAPTICS_MAX_EFFECTS];
+	uint32_t effect_count;
+
+	// the vibration the runtime plays
+	float level;
+	float frequency;
+	double end_s;
+};
+
+static struct
+{
+	haptics_settings settings;
+	XrSession session;
+	std::thread thread;
+	std::atomic<bool> stop;
+	bool running;
+
+	// only touched by the thread
+	hand_state hands[HAND_COUNT];
+
+	// only touched by the producer
+	uint32_t next_handle;
+
+	// single producer (the frame loop), single consumer (the haptics thread)
+	std::atomic<uint32_t> head;
+	std::atomic<uint32_t> tail;
+	command ring[HAPTICS_COMMAND_RING_SIZE];
+
+	std::atomic<uint32_t> effects;
+	std::atomic<uint32_t> apply_calls;
+	std::atomic<uint32_t> stop_calls;
+	std::atomic<uint32_t> failed_calls;
+	std::atomic<uint32_t> dropped_commands;
+} haptics;
+
+void
+haptics_default_settings(haptics_settings* settings)
+{
+	settings->tick_hz = 250;
+	settings->max_duration_s = 1.f;
+}
+
+static float
+quantize(float amplitude)
+{
+	return roundf(fminf(amplitude, 1.f) * HAPTICS_LEVELS) / HAPTICS_LEVELS;
+}
+
+// when a linear ramp from `from` at start to `to` at start + length leaves the
+// quantized level it has at now, the output only changes that often
+static double
+ramp_step_end(float from, float to, double start, double length, double now)
+{
+	float level = from + (to - from) * (float)((now - start) / length);
+	float boundary = quantize(level) + (to > from ? 0.5f : -0.5f) / HAPTICS_LEVELS;
+	double end = start + length * (boundary - from) / (to - from);
+	return end < start + length ? end : start + length;
+}
+
+// amplitude of the effect at now, segment_end is when the amplitude starts to follow
+// another piece of the effect. Returns a negative value once the effect is over.
+static float
+effect_amplitude(const active_effect* active, double now, double* segment_end)
+{
+	const haptic_effect* effect = &active->effect;
+	double t = now - active->start_s;
+
+	switch (effect->kind) {
+	case HAPTIC_ONE_SHOT:
+		*segment_end = active->start_s + effect->duration_s;
+		return t < effect->duration_s ? effect->amplitude : -1.f;
+
+	case HAPTIC_PATTERN: {
+		if (effect->interval_s <= effect->duration_s) {
+			// the pulses touch, one long pulse
+			*segment_end = active->start_s + effect->interval_s * (effect->repeat - 1) + effect->duration_s;
+			return now < *segment_end ? effect->amplitude : -1.f;
+		}
+		uint32_t pulse = (uint32_t)(t / effect->interval_s);
+		if (pulse >= effect->repeat)
+			return -1.f;
+		double pulse_start = active->start_s + pulse * effect->interval_s;
+		if (now < pulse_start + effect->duration_s) {
+			*segment_end = pulse_start + effect->duration_s;
+			return effect->amplitude;
+		}
+		if (pulse + 1 == effect->repeat)
+			return -1.f;
+		*segment_end = pulse_start + effect->interval_s;
+		return 0.f;
+	}
+
+	case HAPTIC_ENVELOPE: {
+		double release_start = active->release_start_s;
+		if (release_start < 0. && effect->duration_s >= 0.)
+			release_start = active->start_s + effect->attack_s + effect->duration_s;
+
+		if (release_start >= 0. && now >= release_start) {
+			// ramp down from wherever the attack got to
+			double held = release_start - active->start_s;
+			float from = held < effect->attack_s ? effect->amplitude * (float)(held / effect->attack_s)
+			                                     : effect->amplitude;
+			double r = now - release_start;
+			if (r >= effect->release_s)
+				return -1.f;
+			*segment_end = ramp_step_end(from, 0.f, release_start, effect->release_s, now);
+			return from * (float)(1. - r / effect->release_s);
+		}
+		// the last step of the attack already is the held level
+		float attack_level = effect->amplitude * (float)(t / effect->attack_s);
+		if (t < effect->attack_s && quantize(attack_level) < quantize(effect->amplitude)) {
+			*segment_end = ramp_step_end(0.f, effect->amplitude, active->start_s, effect->attack_s, now);
+			return attack_level;
+		}
+		*segment_end = release_start >= 0. ? release_start : INFINITY;
+		return effect->amplitude;
+	}
+	}
+	return -1.f;
+}
+
+static void
+apply(int hand, float level, float frequency, double duration_s)
+{
+	TRACE_SCOPE("xrApplyHapticFeedback");
+	XrHapticVibration vibration = {.type = XR_TYPE_HAPTIC_VIBRATION,
+	                               .next = NULL,
+	                               .duration = (XrDuration)(duration_s * 1000000000.),
+	                               .frequency = frequency,
+	                               .amplitude = level};
+	XrHapticActionInfo info = {.type = XR_TYPE_HAPTIC_ACTION_INFO,
+	                           .next = NULL,
+	                           .action = input_get_action(INPUT_ACTION_HAPTIC),
+	                           .subactionPath = input_hand_path(hand)};
+	XrResult result = xrApplyHapticFeedback(haptics.session, &info, (const XrHapticBaseHeader*)&vibration);
+	haptics.apply_calls.fetch_add(1, std::memory_order_relaxed);
+	if (XR_FAILED(result)) {
+		haptics.failed_calls.fetch_add(1, std::memory_order_relaxed);
+		LOG_ERROR("Failed to apply haptic feedback: %d\n", result);
+	}
+}
+
+static void
+stop_vibration(int hand)
+{
+	TRACE_SCOPE("xrStopHapticFeedback");
+	XrHapticActionInfo info = {.type = XR_TYPE_HAPTIC_ACTION_INFO,
+	                           .next = NULL,
+	                           .action = input_get_action(INPUT_ACTION_HAPTIC),
+	                           .subactionPath = input_hand_path(hand)};
+	XrResult result = xrStopHapticFeedback(haptics.session, &info);
+	haptics.stop_calls.fetch_add(1, std::memory_order_relaxed);
+	if (XR_FAILED(result)) {
+		haptics.failed_calls.fetch_add(1, std::memory_order_relaxed);
+		LOG_ERROR("Failed to stop haptic feedback: %d\n", result);
+	}
+}
+
+static void
+run_command(const command* cmd, double now)
+{
+	hand_state* hand = &haptics.hands[cmd->hand];
+
+	if (cmd->type == COMMAND_PLAY) {
+		if (hand->effect_count == HAPTICS_MAX_EFFECTS) {
+			haptics.dropped_commands.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		hand->effects[hand->effect_count++] = {
+		    .handle = cmd->handle, .effect = cmd->effect, .start_s = now, .release_start_s = -1.};
+		haptics.effects.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	for (uint32_t i = 0; i < hand->effect_count; i++) {
+		active_effect* active = &hand->effects[i];
+		if (active->handle != cmd->handle)
+			continue;
+		if (active->effect.kind == HAPTIC_ENVELOPE && active->release_start_s < 0.)
+			active->release_start_s = now;
+		else if (active->effect.kind != HAPTIC_ENVELOPE)
+			*active = hand->effects[--hand->effect_count];
+		return;
+	}
+}
+
+// mixes the effects of the hand and tells the runtime only what changed
+static void
+update_hand(int hand_index, double now, double tick_s)
+{
+	hand_state* hand = &haptics.hands[hand_index];
+
+	float level = 0.f;
+	float frequency = XR_FREQUENCY_UNSPECIFIED;
+	double segment_end = now + haptics.settings.max_duration_s;
+	for (uint32_t i = 0; i < hand->effect_count;) {
+		double effect_end = INFINITY;
+		float amplitude = effect_amplitude(&hand->effects[i], now, &effect_end);
+		if (amplitude < 0.f) {
+			hand->effects[i] = hand->effects[--hand->effect_count];
+			continue;
+		}
+		if (amplitude > level) {
+			level = amplitude;
+			frequency = hand->effects[i].effect.frequency;
+		}
+		if (effect_end < segment_end)
+			segment_end = effect_end;
+		i++;
+	}
+	level = quantize(level);
+
+	if (level <= 0.f) {
+		// a vibration that is about to end anyway is left alone
+		if (hand->level > 0.f && hand->end_s > now + tick_s / 2.)
+			stop_vibration(hand_index);
+		hand->level = 0.f;
+		hand->end_s = now;
+		return;
+	}
+
+	bool same = level == hand->level && frequency == hand->frequency && hand->end_s > now;
+	// renew a held output one tick before the runtime would end it
+	bool expiring = hand->end_s < segment_end && hand->end_s - now < tick_s * 1.5;
+	if (same && !expiring)
+		return;
+
+	apply(hand_index, level, frequency, segment_end - now);
+	hand->level = level;
+	hand->frequency = frequency;
+	hand->end_s = segment_end;
+}
+
+static void
+haptics_thread()
+{
+	trace_thread_name("haptics");
+
+	const std::chrono::nanoseconds period(1000000000ll / haptics.settings.tick_hz);
+	const double tick_s = 1. / haptics.settings.tick_hz;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point next = start;
+
+	while (!haptics.stop.load(std::memory_order_relaxed)) {
+		next += period;
+		std::this_thread::sleep_until(next);
+		if (std::chrono::steady_clock::now() - next > period)
+			next = std::chrono::steady_clock::now();
+
+		double now = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		uint32_t tail = haptics.tail.load(std::memory_order_relaxed);
+		uint32_t head = haptics.head.load(std::memory_order_acquire);
+		for (; tail != head; tail++)
+			run_command(&haptics.ring[tail & (HAPTICS_COMMAND_RING_SIZE - 1)], now);
+		haptics.tail.store(tail, std::memory_order_release);
+
+		for (int hand = 0; hand < HAND_COUNT; hand++)
+			update_hand(hand, now, tick_s);
+	}
+
+	for (int hand = 0; hand < HAND_COUNT; hand++) {
+		if (haptics.hands[hand].level > 0.f)
+			stop_vibration(hand);
+	}
+}
+
+bool
+haptics_start(XrSession session, const haptics_settings* settings)
+{
+	if (haptics.running || settings->tick_hz == 0)
+		return false;
+
+	haptics.settings = *settings;
+	haptics.session = session;
+	haptics.stop = false;
+	haptics.head = 0;
+	haptics.tail = 0;
+	haptics.next_handle = 0;
+	for (int hand = 0; hand < HAND_COUNT; hand++)
+		haptics.hands[hand] = {};
+	haptics.thread = std::thread(haptics_thread);
+	haptics.running = true;
+	return true;
+}
+
+static bool
+push(const command* cmd)
+{
+	uint32_t head = haptics.head.load(std::memory_order_relaxed);
+	if (head - haptics.tail.load(std::memory_order_acquire) == HAPTICS_COMMAND_RING_SIZE) {
+		haptics.dropped_commands.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	haptics.ring[head & (HAPTICS_COMMAND_RING_SIZE - 1)] = *cmd;
+	haptics.head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+uint32_t
+haptics_play(int hand, const haptic_effect* effect)
+{
+	if (!haptics.running || hand < 0 || hand >= HAND_COUNT)
+		return 0;
+	if (effect->kind == HAPTIC_PATTERN && effect->repeat == 0)
+		return 0;
+
+	// 0 stays free for "no effect"
+	if (++haptics.next_handle == 0)
+		haptics.next_handle = 1;
+	command cmd = {.type = COMMAND_PLAY, .hand = hand, .handle = haptics.next_handle, .effect = *effect};
+	return push(&cmd) ? cmd.handle : 0;
+}
+
+bool
+haptics_release(int hand, uint32_t handle)
+{
+	// nothing plays that could be released
+	if (!haptics.running || hand < 0 || hand >= HAND_COUNT || handle == 0)
+		return true;
+
+	command cmd = {.type = COMMAND_RELEASE, .hand = hand, .handle = handle};
+	return push(&cmd);
+}
+
+void
+haptics_take_counts(haptics_counts* counts)
+{
+	counts->effects = haptics.effects.exchange(0, std::memory_order_relaxed);
+	counts->apply_calls = haptics.apply_calls.exchange(0, std::memory_order_relaxed);
+	counts->stop_calls = haptics.stop_calls.exchange(0, std::memory_order_relaxed);
+	counts->failed_calls = haptics.failed_calls.exchange(0, std::memory_order_relaxed);
+	counts->dropped_commands = haptics.dropped_commands.exchange(0, std::memory_order_relaxed);
+}
+
+void
+haptics_stop()
+{
+	if (!haptics.running)
+		return;
+	haptics.stop = true;
+	haptics.thread.join();
+	haptics.running = false;
+}
@@ -0,0 +1,91 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Haptic effects scheduled on a thread
+ *
+ * The frame loop queues effects per hand: one-shots, envelopes that ramp up, hold
+ * and ramp down, and patterns of repeated pulses. A thread ticking at a fixed rate
+ * mixes the effects of each hand into the strongest one and only calls
+ * xrApplyHapticFeedback when that output changes, with the duration the output
+ * stays the same, so a held vibration costs one call instead of one per frame.
+ * xrStopHapticFeedback is only called to cut a vibration short.
+ *
+ * Effects are queued through a lock-free ring with a single producer, call the
+ * queueing functions from one thread only.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "openxr/openxr.h"
+#include "input.h"
+
+#define HAPTICS_MAX_EFFECTS 16
+#define HAPTICS_COMMAND_RING_SIZE 64
+
+enum haptic_effect_kind
+{
+	// amplitude for duration_s
+	HAPTIC_ONE_SHOT,
+	// ramps up over attack_s, holds amplitude for duration_s, ramps down over release_s.
+	// A negative duration_s holds until haptics_release().
+	HAPTIC_ENVELOPE,
+	// repeat pulses of duration_s, interval_s from one pulse start to the next, repeat
+	// has to be at least 1
+	HAPTIC_PATTERN,
+};
+
+struct haptic_effect
+{
+	haptic_effect_kind kind;
+	float amplitude;
+	// in Hz, XR_FREQUENCY_UNSPECIFIED lets the runtime choose
+	float frequency;
+	float duration_s;
+	float attack_s;
+	float release_s;
+	float interval_s;
+	uint32_t repeat;
+};
+
+struct haptics_settings
+{
+	uint32_t tick_hz;
+	// the longest single vibration, held effects are renewed before it runs out
+	float max_duration_s;
+};
+
+// runtime calls since the last haptics_take_counts()
+struct haptics_counts
+{
+	uint32_t effects;
+	uint32_t apply_calls;
+	uint32_t stop_calls;
+	uint32_t failed_calls;
+	uint32_t dropped_commands;
+};
+
+void
+haptics_default_settings(haptics_settings* settings);
+
+// starts the thread that applies the vibrations of the haptic input action
+bool
+haptics_start(XrSession session, const haptics_settings* settings);
+
+// returns a handle for haptics_release(), 0 if the effect was invalid or dropped
+uint32_t
+haptics_play(int hand, const haptic_effect* effect);
+
+// ends a held envelope with its release ramp, stops other effects right away.
+// Returns false if the ring was full, call it again later, a held envelope would
+// vibrate forever otherwise.
+bool
+haptics_release(int hand, uint32_t handle);
+
+void
+haptics_take_counts(haptics_counts* counts);
+
+void
+haptics_stop();
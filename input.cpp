@@ -0,0 +1,356 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Actions of both hands, refreshed in one pass per frame
+ */
+
+#include "input.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "gesture.h"
+#include "log.h"
+#include "trace.h"
+
+// the actions the example reads, looked up in the manifest by name
+static const struct
+{
+	const char* name;
+	XrActionType type;
+} input_action_descs[INPUT_ACTION_COUNT] = {
+	{"grabobjectfloat", XR_ACTION_TYPE_FLOAT_INPUT},
+	{"throttle", XR_ACTION_TYPE_FLOAT_INPUT},
+	{"handpose", XR_ACTION_TYPE_POSE_INPUT},
+	{"haptic", XR_ACTION_TYPE_VIBRATION_OUTPUT},
+};
+
+static const char* hand_path_strings[HAND_COUNT] = {"/user/hand/left", "/user/hand/right"};
+
+// a float input of one hand, the get info is built once
+struct float_input
+{
+	XrActionStateGetInfo get_info;
+	input_action action;
+	int hand;
+	XrActionStateFloat* state;
+};
+
+static struct
+{
+	XrInstance instance;
+	XrSession session;
+	XrSpace play_space;
+
+	action_manifest manifest;
+	// the required extension of profile i was enabled
+	bool profile_enabled[ACTION_MANIFEST_MAX_PROFILES];
+	manifest_path hand_manifest_paths[HAND_COUNT];
+
+	XrActionSet action_set;
+	XrAction manifest_actions[ACTION_MANIFEST_MAX_ACTIONS];
+	XrAction actions[INPUT_ACTION_COUNT];
+	XrPath hand_paths[HAND_COUNT];
+	// poses can't be queried directly, there is a space for each hand
+	XrSpace pose_spaces[HAND_COUNT];
+
+	float_input float_inputs[(int)INPUT_ACTION_COUNT * HAND_COUNT];
+	uint32_t float_input_count;
+
+	input_snapshot snapshot;
+	// values of the actions that gestures drive
+	float gesture_values[HAND_COUNT][INPUT_ACTION_COUNT];
+} input;
+
+static bool
+check(XrResult result, const char* what)
+{
+	if (XR_SUCCEEDED(result))
+		return true;
+	LOG_ERROR("Failed to %s: %d\n", what, result);
+	return false;
+}
+
+// suggests the compiled bindings of every profile whose extension is enabled. A
+// runtime that does not know a profile rejects it, the others still apply.
+static void
+suggest_all_bindings()
+{
+	const action_manifest* manifest = &input.manifest;
+	static XrActionSuggestedBinding bindings[ACTION_MANIFEST_MAX_BINDINGS];
+
+	for (uint32_t i = 0; i < manifest->profile_count; i++) {
+		const manifest_profile* profile = &manifest->profiles[i];
+		const char* profile_str = action_manifest_path_string(manifest, profile->path);
+		XrPath profile_path = action_manifest_path(manifest, profile->path);
+		if (!input.profile_enabled[i]) {
+			printf("Skipping %s, %s is not enabled\n", profile_str, profile->required_extension);
+			continue;
+		}
+		if (profile_path == XR_NULL_PATH)
+			continue;
+
+		uint32_t count = 0;
+		for (uint32_t j = 0; j < profile->binding_count; j++) {
+			const manifest_binding* binding = &manifest->bindings[profile->first_binding + j];
+			XrPath path = action_manifest_path(manifest, binding->path);
+			if (path != XR_NULL_PATH)
+				bindings[count++] = {.action = input.manifest_actions[binding->action], .binding = path};
+		}
+
+		const XrInteractionProfileSuggestedBinding suggested_bindings = {
+			.type = XR_TYPE_INTERACTION_PROFILE_SUGGESTED_BINDING,
+			.next = NULL,
+			.interactionProfile = profile_path,
+			.countSuggestedBindings = count,
+			.suggestedBindings = bindings};
+		XrResult result = xrSuggestInteractionProfileBindings(input.instance, &suggested_bindings);
+		if (XR_FAILED(result))
+			printf("Failed to suggest bindings for %s: %d\n", profile_str, result);
+	}
+}
+
+bool
+input_load_manifest(const char* file_name)
+{
+	double start_us = trace_now_us();
+	action_manifest* manifest = &input.manifest;
+	if (!action_manifest_load(file_name, manifest))
+		return false;
+
+	for (int hand = 0; hand < HAND_COUNT; hand++)
+		input.hand_manifest_paths[hand] = action_manifest_intern(manifest, hand_path_strings[hand]);
+
+	for (int i = 0; i < INPUT_ACTION_COUNT; i++) {
+		int action = action_manifest_find_action(manifest, input_action_descs[i].name);
+		if (action < 0 || manifest->actions[action].type != input_action_descs[i].type) {
+			printf("%s: action %s is missing or has the wrong type\n", file_name, input_action_descs[i].name);
+			return false;
+		}
+	}
+
+	for (uint32_t i = 0; i < manifest->profile_count; i++)
+		input.profile_enabled[i] = manifest->profiles[i].required_extension[0] == '\0';
+
+	printf("Loaded %s: %u actions, %u profiles, %u bindings, %u paths in %.2f ms\n", file_name,
+	       manifest->action_count, manifest->profile_count, manifest->binding_count, manifest->path_count,
+	       (trace_now_us() - start_us) / 1000.);
+	return true;
+}
+
+const char*
+input_require_extension(const char* name)
+{
+	const char* required = NULL;
+	for (uint32_t i = 0; i < input.manifest.profile_count; i++) {
+		if (strcmp(input.manifest.profiles[i].required_extension, name) != 0)
+			continue;
+		input.profile_enabled[i] = true;
+		required = input.manifest.profiles[i].required_extension;
+	}
+	return required;
+}
+
+// the snapshot member a float action of a hand is refreshed into
+static XrActionStateFloat*
+float_state(input_action action, int hand)
+{
+	switch (action) {
+	case INPUT_ACTION_GRAB: return &input.snapshot.hands[hand].grab;
+	case INPUT_ACTION_THROTTLE: return &input.snapshot.hands[hand].throttle;
+	default: return NULL;
+	}
+}
+
+bool
+input_init(XrInstance instance, XrSession session, XrSpace play_space)
+{
+	input.instance = instance;
+	input.session = session;
+	input.play_space = play_space;
+
+	const action_manifest* manifest = &input.manifest;
+
+	// every path of the manifest in one batch
+	double resolve_start_us = trace_now_us();
+	uint32_t failed = action_manifest_resolve(&input.manifest, instance);
+	printf("Resolved %u paths in %.2f ms, %u failed\n", manifest->path_count,
+	       (trace_now_us() - resolve_start_us) / 1000., failed);
+
+	for (int hand = 0; hand < HAND_COUNT; hand++) {
+		input.hand_paths[hand] = action_manifest_path(manifest, input.hand_manifest_paths[hand]);
+		if (input.hand_paths[hand] == XR_NULL_PATH)
+			return false;
+	}
+
+	XrActionSetCreateInfo action_set_info = {.type = XR_TYPE_ACTION_SET_CREATE_INFO, .next = NULL, .priority = 0};
+	strcpy(action_set_info.actionSetName, manifest->action_set_name);
+	strcpy(action_set_info.localizedActionSetName, manifest->localized_action_set_name);
+	if (!check(xrCreateActionSet(instance, &action_set_info, &input.action_set), "create actionset"))
+		return false;
+
+	for (uint32_t i = 0; i < manifest->action_count; i++) {
+		XrActionCreateInfo action_info = {.type = XR_TYPE_ACTION_CREATE_INFO,
+		                                  .next = NULL,
+		                                  .actionType = manifest->actions[i].type,
+		                                  .countSubactionPaths = HAND_COUNT,
+		                                  .subactionPaths = input.hand_paths};
+		strcpy(action_info.actionName, manifest->actions[i].name);
+		strcpy(action_info.localizedActionName, manifest->actions[i].localized_name);
+		if (!check(xrCreateAction(input.action_set, &action_info, &input.manifest_actions[i]), "create action"))
+			return false;
+	}
+	for (int i = 0; i < INPUT_ACTION_COUNT; i++)
+		input.actions[i] = input.manifest_actions[action_manifest_find_action(manifest, input_action_descs[i].name)];
+
+	suggest_all_bindings();
+
+	for (int hand = 0; hand < HAND_COUNT; hand++) {
+		XrActionSpaceCreateInfo action_space_info = {.type = XR_TYPE_ACTION_SPACE_CREATE_INFO,
+		                                             .next = NULL,
+		                                             .action = input.actions[INPUT_ACTION_POSE],
+		                                             .subactionPath = input.hand_paths[hand],
+		                                             .poseInActionSpace = {.orientation = {.w = 1.f}}};
+		if (!check(xrCreateActionSpace(session, &action_space_info, &input.pose_spaces[hand]),
+		           "create hand pose space"))
+			return false;
+	}
+
+	XrSessionActionSetsAttachInfo attach_info = {.type = XR_TYPE_SESSION_ACTION_SETS_ATTACH_INFO,
+	                                             .next = NULL,
+	                                             .countActionSets = 1,
+	                                             .actionSets = &input.action_set};
+	if (!check(xrAttachSessionActionSets(session, &attach_info), "attach action set"))
+		return false;
+
+	// the table of float inputs the refresh pass walks
+	input.float_input_count = 0;
+	for (int action = 0; action < INPUT_ACTION_COUNT; action++) {
+		if (input_action_descs[action].type != XR_ACTION_TYPE_FLOAT_INPUT)
+			continue;
+		for (int hand = 0; hand < HAND_COUNT; hand++) {
+			float_input* f = &input.float_inputs[input.float_input_count++];
+			f->get_info = {.type = XR_TYPE_ACTION_STATE_GET_INFO,
+			               .next = NULL,
+			               .action = input.actions[action],
+			               .subactionPath = input.hand_paths[hand]};
+			f->action = (input_action)action;
+			f->hand = hand;
+			f->state = float_state((input_action)action, hand);
+			*f->state = {.type = XR_TYPE_ACTION_STATE_FLOAT, .next = NULL};
+		}
+	}
+	for (input_hand& hand : input.snapshot.hands)
+		hand.location = {.type = XR_TYPE_SPACE_LOCATION, .next = NULL};
+
+	return true;
+}
+
+XrPath
+input_hand_path(int hand)
+{
+	return input.hand_paths[hand];
+}
+
+XrSpace
+input_hand_space(int hand)
+{
+	return input.pose_spaces[hand];
+}
+
+XrAction
+input_get_action(input_action action)
+{
+	return input.actions[action];
+}
+
+const input_snapshot*
+input_sync(XrTime time)
+{
+	TRACE_SCOPE("input_sync");
+	double start_us = trace_now_us();
+
+	const XrActiveActionSet active_action_sets[] = {{.actionSet = input.action_set, .subactionPath = XR_NULL_PATH}};
+	XrActionsSyncInfo sync_info = {
+		.type = XR_TYPE_ACTIONS_SYNC_INFO,
+		.next = NULL,
+		.countActiveActionSets = sizeof(active_action_sets) / sizeof(active_action_sets[0]),
+		.activeActionSets = active_action_sets,
+	};
+	check(xrSyncActions(input.session, &sync_info), "sync actions");
+
+	input_snapshot* snapshot = &input.snapshot;
+	snapshot->time = time;
+	snapshot->changed = 0;
+
+	for (uint32_t i = 0; i < input.float_input_count; i++) {
+		float_input* f = &input.float_inputs[i];
+		if (!check(xrGetActionStateFloat(input.session, &f->get_info, f->state), "get float action state"))
+			f->state->isActive = XR_FALSE;
+		if (f->state->changedSinceLastSync)
+			snapshot->changed |= 1u << ((int)f->action * HAND_COUNT + f->hand);
+	}
+
+	// the location flags tell whether the pose action is active
+	for (int hand = 0; hand < HAND_COUNT; hand++) {
+		input_hand* h = &snapshot->hands[hand];
+		if (!check(xrLocateSpace(input.pose_spaces[hand], input.play_space, time, &h->location), "locate hand space"))
+			h->location.locationFlags = 0;
+		h->location_valid = (h->location.locationFlags & XR_SPACE_LOCATION_ORIENTATION_VALID_BIT) != 0;
+	}
+
+	snapshot->cost_ms = (trace_now_us() - start_us) / 1000.;
+	return snapshot;
+}
+
+void
+input_apply_gestures(const gesture_frame* frame)
+{
+	input_snapshot* snapshot = &input.snapshot;
+
+	for (int hand = 0; hand < HAND_COUNT; hand++) {
+		snapshot->hands[hand].gestures = frame->active[hand];
+
+		bool drives[INPUT_ACTION_COUNT] = {};
+		bool driven[INPUT_ACTION_COUNT] = {};
+		for (uint32_t g = 0; g < gesture_count(); g++) {
+			input_action action = gesture_get((int)g)->action;
+			if (action == INPUT_ACTION_COUNT)
+				continue;
+			drives[action] = true;
+			driven[action] |= ((frame->active[hand] >> g) & 1) != 0;
+		}
+
+		for (int action = 0; action < INPUT_ACTION_COUNT; action++) {
+			XrActionStateFloat* state = float_state((input_action)action, hand);
+			// a bound controller wins
+			if (!drives[action] || state == NULL || state->isActive)
+				continue;
+
+			float value = driven[action] ? 1.f : 0.f;
+			bool changed = value != input.gesture_values[hand][action];
+			input.gesture_values[hand][action] = value;
+			state->isActive = XR_TRUE;
+			state->currentState = value;
+			state->changedSinceLastSync = changed;
+			if (changed) {
+				state->lastChangeTime = frame->time;
+				snapshot->changed |= 1u << (action * HAND_COUNT + hand);
+			}
+		}
+	}
+}
+
+void
+input_cleanup()
+{
+	for (XrSpace& space : input.pose_spaces) {
+		if (space != XR_NULL_HANDLE)
+			xrDestroySpace(space);
+		space = XR_NULL_HANDLE;
+	}
+	if (input.action_set != XR_NULL_HANDLE)
+		xrDestroyActionSet(input.action_set);
+	input.action_set = XR_NULL_HANDLE;
+}
@@ -0,0 +1,106 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Actions of both hands, refreshed in one pass per frame
+ *
+ * All actions and their subaction paths are kept in one table. After xrSyncActions
+ * the table is walked once with get infos built at startup, the results land in a
+ * snapshot the rest of the frame reads. Pose actions are only located, their action
+ * state is implied by the location flags.
+ *
+ * The actions and their bindings come from an action manifest file, see
+ * action_manifest.h. It has to define the actions in input_action.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "openxr/openxr.h"
+#include "action_manifest.h"
+
+// small helper so we don't forget whether we treat 0 as left or right hand
+enum OPENXR_HANDS
+{
+	HAND_LEFT = 0,
+	HAND_RIGHT = 1,
+	HAND_COUNT
+};
+
+enum input_action
+{
+	INPUT_ACTION_GRAB,
+	INPUT_ACTION_THROTTLE,
+	INPUT_ACTION_POSE,
+	INPUT_ACTION_HAPTIC,
+	INPUT_ACTION_COUNT,
+};
+
+struct input_hand
+{
+	XrSpaceLocation location;
+	// the orientation is valid
+	bool location_valid;
+	XrActionStateFloat grab;
+	XrActionStateFloat throttle;
+	// bit per active gesture, see gesture.h
+	uint32_t gestures;
+};
+
+struct input_snapshot
+{
+	XrTime time;
+	input_hand hands[HAND_COUNT];
+	// bit action * HAND_COUNT + hand for every input whose state changed since the
+	// last sync, 0 when nothing but the poses changed
+	uint32_t changed;
+	// xrSyncActions and the refresh pass
+	double cost_ms;
+};
+
+static inline bool
+input_changed(const input_snapshot* snapshot, input_action action, int hand)
+{
+	return (snapshot->changed >> ((int)action * HAND_COUNT + hand)) & 1;
+}
+
+// loads the actions and bindings, before the instance is created
+bool
+input_load_manifest(const char* file_name);
+
+// when a profile of the manifest requires the extension, marks the extension as
+// enabled and returns a copy of its name that stays valid, otherwise NULL
+const char*
+input_require_extension(const char* name);
+
+// resolves the manifest paths, creates the action set, actions and action spaces, suggests the bindings and
+// attaches the action set to the session
+bool
+input_init(XrInstance instance, XrSession session, XrSpace play_space);
+
+XrPath
+input_hand_path(int hand);
+
+// the space of the pose action of the hand
+XrSpace
+input_hand_space(int hand);
+
+XrAction
+input_get_action(input_action action);
+
+// syncs the actions and refreshes the snapshot, poses are located at time. The
+// snapshot is valid until the next call.
+const input_snapshot*
+input_sync(XrTime time);
+
+struct gesture_frame;
+
+// Merges the gestures of the tracked hands into the snapshot. A float action that
+// no controller drives takes the value 1 while a gesture driving it is active,
+// changes set its bit in changed like those of the controllers do.
+void
+input_apply_gestures(const gesture_frame* frame);
+
+void
+input_cleanup();
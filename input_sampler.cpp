@@ -0,0 +1,173 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Hand poses sampled on a thread at a fixed rate
+ */
+
+#include "input_sampler.h"
+
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "trace.h"
+
+// no clock mapping yet
+#define CLOCK_OFFSET_UNSET INT64_MIN
+
+static struct
+{
+	input_sampler_settings settings;
+	std::thread thread;
+	std::atomic<bool> stop;
+	bool running;
+
+	// XrTime in ns minus the trace clock in ns
+	std::atomic<int64_t> clock_offset_ns;
+
+	// single producer (the sampler thread), single consumer (the frame loop)
+	std::atomic<uint32_t> head;
+	std::atomic<uint32_t> tail;
+	std::atomic<uint64_t> dropped;
+	input_sample ring[INPUT_SAMPLER_RING_SIZE];
+} sampler;
+
+static void
+locate(input_sample* sample)
+{
+	const input_sampler_settings* settings = &sampler.settings;
+
+	for (int hand = 0; hand < HAND_COUNT; hand++) {
+		XrSpaceLocation location = {.type = XR_TYPE_SPACE_LOCATION, .next = NULL};
+		XrResult result = xrLocateSpace(settings->hand_spaces[hand], settings->base_space, sample->time, &location);
+		sample->hand_poses[hand] = location.pose;
+		sample->hand_poses_valid[hand] =
+		    XR_SUCCEEDED(result) && (location.locationFlags & XR_SPACE_LOCATION_ORIENTATION_VALID_BIT) != 0;
+
+		sample->joints_active[hand] = false;
+		if (settings->hand_trackers[hand] == XR_NULL_HANDLE)
+			continue;
+
+		XrHandJointLocationsEXT joint_locations = {.type = XR_TYPE_HAND_JOINT_LOCATIONS_EXT,
+		                                           .next = NULL,
+		                                           .jointCount = XR_HAND_JOINT_COUNT_EXT,
+		                                           .jointLocations = sample->joints[hand]};
+		XrHandJointsLocateInfoEXT locate_info = {.type = XR_TYPE_HAND_JOINTS_LOCATE_INFO_EXT,
+		                                         .next = NULL,
+		                                         .baseSpace = settings->base_space,
+		                                         .time = sample->time};
+		result = settings->locate_hand_joints(settings->hand_trackers[hand], &locate_info, &joint_locations);
+		sample->joints_active[hand] = XR_SUCCEEDED(result) && joint_locations.isActive;
+	}
+}
+
+static void
+sampler_thread()
+{
+	trace_thread_name("input sampler");
+
+	const std::chrono::nanoseconds period(1000000000ll / sampler.settings.rate_hz);
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+	double last_us = -1.;
+
+	while (!sampler.stop.load(std::memory_order_relaxed)) {
+		// an absolute schedule, late wakeups don't shift the following samples
+		next += period;
+		std::this_thread::sleep_until(next);
+		if (std::chrono::steady_clock::now() - next > period)
+			next = std::chrono::steady_clock::now();
+
+		int64_t clock_offset_ns = sampler.clock_offset_ns.load(std::memory_order_relaxed);
+		if (clock_offset_ns == CLOCK_OFFSET_UNSET)
+			continue;
+
+		uint32_t head = sampler.head.load(std::memory_order_relaxed);
+		if (head - sampler.tail.load(std::memory_order_acquire) == INPUT_SAMPLER_RING_SIZE) {
+			// never wait for the frame loop
+			sampler.dropped.fetch_add(1, std::memory_order_relaxed);
+			last_us = -1.;
+			continue;
+		}
+
+		TRACE_SCOPE("input sample");
+		input_sample* sample = &sampler.ring[head & (INPUT_SAMPLER_RING_SIZE - 1)];
+		double now_us = trace_now_us();
+		sample->time = (XrTime)(now_us * 1000.) + clock_offset_ns + sampler.settings.offset_ns;
+		sample->sampled_us = now_us;
+		sample->interval_us = last_us >= 0. ? now_us - last_us : 0.;
+		last_us = now_us;
+		locate(sample);
+		sampler.head.store(head + 1, std::memory_order_release);
+	}
+}
+
+bool
+input_sampler_start(const input_sampler_settings* settings)
+{
+	if (sampler.running || settings->rate_hz == 0)
+		return false;
+
+	sampler.settings = *settings;
+	sampler.stop = false;
+	sampler.clock_offset_ns = CLOCK_OFFSET_UNSET;
+	sampler.head = 0;
+	sampler.tail = 0;
+	sampler.dropped = 0;
+	sampler.thread = std::thread(sampler_thread);
+	sampler.running = true;
+
+	printf("Sampling hand poses at %u Hz, %.1f ms offset\n", settings->rate_hz, settings->offset_ns / 1000000.);
+	return true;
+}
+
+void
+input_sampler_set_clock(XrTime predicted_display_time, double now_us)
+{
+	sampler.clock_offset_ns.store(predicted_display_time - (int64_t)(now_us * 1000.), std::memory_order_relaxed);
+}
+
+uint32_t
+input_sampler_drain(input_sample* samples, uint32_t max)
+{
+	if (!sampler.running)
+		return 0;
+
+	uint32_t tail = sampler.tail.load(std::memory_order_relaxed);
+	uint32_t head = sampler.head.load(std::memory_order_acquire);
+	uint32_t count = 0;
+	for (; tail != head && count < max; tail++)
+		samples[count++] = sampler.ring[tail & (INPUT_SAMPLER_RING_SIZE - 1)];
+	sampler.tail.store(tail, std::memory_order_release);
+	return count;
+}
+
+uint64_t
+input_sampler_take_dropped()
+{
+	return sampler.dropped.exchange(0, std::memory_order_relaxed);
+}
+
+bool
+input_sampler_running()
+{
+	return sampler.running;
+}
+
+uint32_t
+input_sampler_rate_hz()
+{
+	return sampler.settings.rate_hz;
+}
+
+void
+input_sampler_stop()
+{
+	if (!sampler.running)
+		return;
+	sampler.stop = true;
+	sampler.thread.join();
+	sampler.running = false;
+}
@@ -0,0 +1,77 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Hand poses sampled on a thread at a fixed rate
+ *
+ * The sampler thread locates the hand pose spaces and, with hand tracking, the hand
+ * joints at a fixed rate, independent of the frame rate. Samples are published
+ * through a single producer, single consumer ring that the frame loop drains
+ * without locking. When the frame loop falls behind, new samples are dropped.
+ *
+ * The XrTime of the current moment is extrapolated from the predicted display time
+ * of the last frame, so a sample with offset 0 is located for when a frame started
+ * at the moment of sampling would be displayed. Negative offsets locate the past.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "input.h"
+
+// must be a power of two, covers several frames at the highest rate
+#define INPUT_SAMPLER_RING_SIZE 256
+
+struct input_sample
+{
+	// the poses were located for this time
+	XrTime time;
+	// trace clock when the poses were located
+	double sampled_us;
+	// since the previous sample, the target is 1 / rate
+	double interval_us;
+	XrPosef hand_poses[HAND_COUNT];
+	bool hand_poses_valid[HAND_COUNT];
+	// only with hand tracking
+	bool joints_active[HAND_COUNT];
+	XrHandJointLocationEXT joints[HAND_COUNT][XR_HAND_JOINT_COUNT_EXT];
+};
+
+struct input_sampler_settings
+{
+	uint32_t rate_hz;
+	// added to the extrapolated time of each sample
+	int64_t offset_ns;
+	XrSpace base_space;
+	XrSpace hand_spaces[HAND_COUNT];
+	// XR_NULL_HANDLE and NULL without hand tracking
+	XrHandTrackerEXT hand_trackers[HAND_COUNT];
+	PFN_xrLocateHandJointsEXT locate_hand_joints;
+};
+
+bool
+input_sampler_start(const input_sampler_settings* settings);
+
+// maps the trace clock to XrTime, called once per frame after xrWaitFrame.
+// Nothing is sampled before the first call.
+void
+input_sampler_set_clock(XrTime predicted_display_time, double now_us);
+
+// moves up to max samples, oldest first, into samples and returns their number
+uint32_t
+input_sampler_drain(input_sample* samples, uint32_t max);
+
+// samples dropped because the ring was full since the last call
+uint64_t
+input_sampler_take_dropped();
+
+bool
+input_sampler_running();
+
+uint32_t
+input_sampler_rate_hz();
+
+// joins the thread, before the spaces and hand trackers are destroyed
+void
+input_sampler_stop();
@@ -0,0 +1,263 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Work stealing job system for the per frame CPU work
+ */
+
+#include "job.h"
+
+#include <stdio.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "trace.h"
+
+static const char* worker_names[JOB_MAX_THREADS] = {
+    "main",      "worker 1",  "worker 2",  "worker 3",  "worker 4",  "worker 5",
+    "worker 6",  "worker 7",  "worker 8",  "worker 9",  "worker 10", "worker 11",
+    "worker 12", "worker 13", "worker 14", "worker 15"};
+
+struct job
+{
+	job_fn fn;
+	void* data;
+	uint32_t index;
+	job_counter* counter;
+	const char* name;
+};
+
+// the owner pushes and pops at the back, thieves take from the front
+struct job_queue
+{
+	std::mutex mutex;
+	std::deque<job> jobs;
+};
+
+static struct
+{
+	std::vector<std::thread> threads;
+	job_queue queues[JOB_MAX_THREADS];
+	uint32_t thread_count = 1;
+
+	// jobs in all queues, workers sleep while it is 0
+	std::atomic<uint32_t> queued;
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+	bool stop;
+
+	std::atomic<uint64_t> busy_ns;
+	double last_utilization_us;
+} jobs;
+
+// queue of the calling thread. Threads that are not workers share queue 0 with the
+// thread that started the job system.
+static thread_local uint32_t queue_index = 0;
+
+static bool
+pop_job(job* out)
+{
+	job_queue* own = &jobs.queues[queue_index];
+	{
+		std::lock_guard<std::mutex> lock(own->mutex);
+		if (!own->jobs.empty()) {
+			*out = own->jobs.back();
+			own->jobs.pop_back();
+			return true;
+		}
+	}
+
+	for (uint32_t i = 1; i < jobs.thread_count; i++) {
+		job_queue* victim = &jobs.queues[(queue_index + i) % jobs.thread_count];
+		std::lock_guard<std::mutex> lock(victim->mutex);
+		if (!victim->jobs.empty()) {
+			*out = victim->jobs.front();
+			victim->jobs.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+static void
+execute(const job* j)
+{
+	double start = trace_now_us();
+	j->fn(j->data, j->index);
+	double end = trace_now_us();
+
+	if (trace_enabled.load(std::memory_order_relaxed))
+		trace_complete(j->name, start, end - start);
+	jobs.busy_ns.fetch_add((uint64_t)((end - start) * 1000.), std::memory_order_relaxed);
+
+	j->counter->pending.fetch_sub(1, std::memory_order_release);
+}
+
+static bool
+run_one_job()
+{
+	if (jobs.queued.load(std::memory_order_acquire) == 0)
+		return false;
+
+	job j;
+	if (!pop_job(&j))
+		return false;
+	jobs.queued.fetch_sub(1, std::memory_order_relaxed);
+	execute(&j);
+	return true;
+}
+
+static void
+worker_main(uint32_t index)
+{
+	queue_index = index;
+	trace_thread_name(worker_names[index]);
+
+	while (true) {
+		if (run_one_job())
+			continue;
+
+		std::unique_lock<std::mutex> lock(jobs.sleep_mutex);
+		jobs.wake.wait(lock, [] { return jobs.stop || jobs.queued.load() > 0; });
+		if (jobs.stop)
+			return;
+	}
+}
+
+void
+job_system_init(uint32_t worker_count)
+{
+	if (worker_count > JOB_MAX_THREADS - 1)
+		worker_count = JOB_MAX_THREADS - 1;
+
+	jobs.stop = false;
+	jobs.queued = 0;
+	jobs.busy_ns = 0;
+	jobs.last_utilization_us = trace_now_us();
+	jobs.thread_count = worker_count + 1;
+	queue_index = 0;
+	for (uint32_t i = 1; i <= worker_count; i++)
+		jobs.threads.emplace_back(worker_main, i);
+	printf("Job system with %u worker threads\n", worker_count);
+}
+
+void
+job_system_shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(jobs.sleep_mutex);
+		jobs.stop = true;
+	}
+	jobs.wake.notify_all();
+	for (std::thread& thread : jobs.threads)
+		thread.join();
+	jobs.threads.clear();
+	jobs.thread_count = 1;
+}
+
+uint32_t
+job_system_thread_count()
+{
+	return jobs.thread_count;
+}
+
+void
+job_spawn(job_counter* counter, const char* name, uint32_t count, job_fn fn, void* data)
+{
+	if (count == 0)
+		return;
+
+	counter->pending.fetch_add(count, std::memory_order_relaxed);
+	{
+		job_queue* own = &jobs.queues[queue_index];
+		std::lock_guard<std::mutex> lock(own->mutex);
+		for (uint32_t i = 0; i < count; i++)
+			own->jobs.push_back(job{.fn = fn, .data = data, .index = i, .counter = counter, .name = name});
+	}
+	jobs.queued.fetch_add(count, std::memory_order_release);
+
+	if (jobs.threads.empty())
+		return;
+
+	// taking the lock orders this with a worker that is about to sleep
+	{
+		std::lock_guard<std::mutex> lock(jobs.sleep_mutex);
+	}
+	if (count == 1)
+		jobs.wake.notify_one();
+	else
+		jobs.wake.notify_all();
+}
+
+void
+job_wait(job_counter* counter)
+{
+	// Once the queue is empty the last jobs are running on workers. The jobs are
+	// fractions of a frame, so the caller spins with yield instead of sleeping on the
+	// counter: a wakeup would cost more than the wait itself.
+	while (counter->pending.load(std::memory_order_acquire) > 0) {
+		if (!run_one_job())
+			std::this_thread::yield();
+	}
+}
+
+void
+job_run(const char* name, uint32_t count, job_fn fn, void* data)
+{
+	if (count == 1) {
+		TRACE_SCOPE(name);
+		fn(data, 0);
+		return;
+	}
+
+	job_counter counter = {};
+	job_spawn(&counter, name, count, fn, data);
+	job_wait(&counter);
+}
+
+struct range_job
+{
+	job_range_fn fn;
+	void* data;
+	uint32_t count;
+	uint32_t batch_size;
+};
+
+static void
+run_range(void* data, uint32_t index)
+{
+	range_job* range = (range_job*)data;
+	uint32_t begin = index * range->batch_size;
+	uint32_t end = begin + range->batch_size < range->count ? begin + range->batch_size : range->count;
+	range->fn(range->data, begin, end);
+}
+
+void
+job_parallel_for(const char* name, uint32_t count, uint32_t batch_size, job_range_fn fn, void* data)
+{
+	if (count == 0)
+		return;
+	if (batch_size == 0)
+		batch_size = 1;
+
+	uint32_t batches = (count + batch_size - 1) / batch_size;
+	range_job range = {.fn = fn, .data = data, .count = count, .batch_size = batch_size};
+	job_run(name, batches, run_range, &range);
+}
+
+float
+job_system_utilization()
+{
+	double now = trace_now_us();
+	double elapsed_us = now - jobs.last_utilization_us;
+	jobs.last_utilization_us = now;
+
+	uint64_t busy_ns = jobs.busy_ns.exchange(0, std::memory_order_relaxed);
+	if (elapsed_us <= 0.)
+		return 0.f;
+	return (float)(busy_ns / 1000. / (elapsed_us * jobs.thread_count));
+}
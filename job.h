@@ -0,0 +1,62 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Work stealing job system for the per frame CPU work
+ *
+ * Every thread has its own job queue. A thread takes its newest job first and
+ * steals the oldest job of another queue when its own is empty. Waiting for a
+ * counter runs queued jobs instead of blocking, so jobs may spawn and wait for
+ * jobs themselves. Each job is recorded as a span in the trace, so the trace shows
+ * how busy the workers are.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+// the thread that calls job_system_init() counts as one of these
+#define JOB_MAX_THREADS 16
+
+typedef void (*job_fn)(void* data, uint32_t index);
+typedef void (*job_range_fn)(void* data, uint32_t begin, uint32_t end);
+
+// number of unfinished jobs, zero initialize it before spawning
+struct job_counter
+{
+	std::atomic<uint32_t> pending;
+};
+
+// starts worker_count threads, 0 runs all jobs on the waiting thread
+void
+job_system_init(uint32_t worker_count);
+
+void
+job_system_shutdown();
+
+// workers plus the thread that called job_system_init()
+uint32_t
+job_system_thread_count();
+
+// queues count jobs that call fn(data, 0) to fn(data, count - 1). The name must be
+// a string literal, it is used for the trace.
+void
+job_spawn(job_counter* counter, const char* name, uint32_t count, job_fn fn, void* data);
+
+// runs queued jobs until all jobs of the counter have finished, then spins while
+// workers finish the last ones. Meant for short frame jobs, not for long waits.
+void
+job_wait(job_counter* counter);
+
+// fork-join of count jobs, runs a single job directly
+void
+job_run(const char* name, uint32_t count, job_fn fn, void* data);
+
+// splits [0, count) into batches of batch_size, at least 1, and runs them as jobs
+void
+job_parallel_for(const char* name, uint32_t count, uint32_t batch_size, job_range_fn fn, void* data);
+
+// fraction of the time of all threads spent in jobs since the last call
+float
+job_system_utilization();
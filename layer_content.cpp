@@ -0,0 +1,205 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Swapchains with layer content, shared by the layers that show the same content
+ */
+
+#include "layer_content.h"
+
+#include <stdio.h>
+#include <vector>
+
+#ifdef XR_EXAMPLE_VULKAN
+#include "vkimpl.h"
+static_assert(LAYER_CONTENT_MAX <= VK_TARGET_MAX_LAYERS, "every layer content needs a Vulkan target");
+#endif
+
+struct layer_content
+{
+	layer_content_desc desc;
+	uint32_t refcount;
+	XrSwapchain swapchain;
+	// OpenGL only, with Vulkan the images are owned by vkimpl.cpp
+	std::vector<XrSwapchainImageOpenGLKHR> gl_images;
+};
+
+static struct
+{
+	XrSession session;
+	bool vulkan;
+	layer_content contents[LAYER_CONTENT_MAX];
+} registry;
+
+static bool
+desc_equal(const layer_content_desc* a, const layer_content_desc* b)
+{
+	return a->kind == b->kind && a->format == b->format && a->width == b->width &&
+	       a->height == b->height && a->face_count == b->face_count && a->create_flags == b->create_flags;
+}
+
+void
+layer_content_init(XrSession session, bool vulkan)
+{
+	registry.session = session;
+	registry.vulkan = vulkan;
+}
+
+static bool
+create_swapchain(layer_content_id id)
+{
+	layer_content* content = &registry.contents[id];
+
+	// uploaded by the CPU layer producer, rendered by the GPU one
+	XrSwapchainCreateInfo swapchain_create_info = {
+		.type = XR_TYPE_SWAPCHAIN_CREATE_INFO,
+		.next = NULL,
+		.createFlags = content->desc.create_flags,
+		.usageFlags = XR_SWAPCHAIN_USAGE_SAMPLED_BIT | XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT |
+					  XR_SWAPCHAIN_USAGE_TRANSFER_DST_BIT,
+		.format = content->desc.format,
+		.sampleCount = 1,
+		.width = content->desc.width,
+		.height = content->desc.height,
+		.faceCount = content->desc.face_count,
+		.arraySize = 1,
+		.mipCount = 1,
+	};
+	XrResult result = xrCreateSwapchain(registry.session, &swapchain_create_info, &content->swapchain);
+	if (XR_FAILED(result)) {
+		printf("Failed to create layer content swapchain: %d\n", result);
+		return false;
+	}
+
+	if (registry.vulkan) {
+#ifdef XR_EXAMPLE_VULKAN
+		return vk_add_swapchain((vk_target)(VK_TARGET_LAYER + id), content->swapchain,
+								content->desc.format, content->desc.width, content->desc.height);
+#else
+		return false;
+#endif
+	}
+
+	uint32_t swapchain_length;
+	result = xrEnumerateSwapchainImages(content->swapchain, 0, &swapchain_length, NULL);
+	if (XR_FAILED(result)) {
+		printf("Failed to enumerate swapchains: %d\n", result);
+		return false;
+	}
+
+	// these are wrappers for the actual OpenGL texture id
+	content->gl_images.resize(swapchain_length, {XR_TYPE_SWAPCHAIN_IMAGE_OPENGL_KHR, nullptr});
+	result = xrEnumerateSwapchainImages(content->swapchain, swapchain_length, &swapchain_length,
+										(XrSwapchainImageBaseHeader*)content->gl_images.data());
+	if (XR_FAILED(result)) {
+		printf("Failed to enumerate swapchain images: %d\n", result);
+		return false;
+	}
+	return true;
+}
+
+static void
+destroy_content(layer_content_id id)
+{
+	layer_content* content = &registry.contents[id];
+#ifdef XR_EXAMPLE_VULKAN
+	if (registry.vulkan)
+		vk_remove_swapchain((vk_target)(VK_TARGET_LAYER + id));
+#endif
+	if (content->swapchain != XR_NULL_HANDLE)
+		xrDestroySwapchain(content->swapchain);
+	*content = layer_content();
+}
+
+layer_content_id
+layer_content_acquire(const layer_content_desc* desc)
+{
+	layer_content_id free_id = LAYER_CONTENT_INVALID;
+	for (layer_content_id id = 0; id < LAYER_CONTENT_MAX; id++) {
+		layer_content* content = &registry.contents[id];
+		if (content->refcount == 0) {
+			if (free_id == LAYER_CONTENT_INVALID)
+				free_id = id;
+			continue;
+		}
+		if (desc_equal(&content->desc, desc)) {
+			content->refcount++;
+			return id;
+		}
+	}
+
+	if (free_id == LAYER_CONTENT_INVALID) {
+		printf("No free layer content, at most %d different contents\n", LAYER_CONTENT_MAX);
+		return LAYER_CONTENT_INVALID;
+	}
+
+	layer_content* content = &registry.contents[free_id];
+	content->desc = *desc;
+	content->refcount = 1;
+	if (!create_swapchain(free_id)) {
+		destroy_content(free_id);
+		return LAYER_CONTENT_INVALID;
+	}
+	return free_id;
+}
+
+void
+layer_content_release(layer_content_id id)
+{
+	if (!layer_content_alive(id))
+		return;
+	if (--registry.contents[id].refcount == 0)
+		destroy_content(id);
+}
+
+bool
+layer_content_alive(layer_content_id id)
+{
+	return id < LAYER_CONTENT_MAX && registry.contents[id].refcount > 0;
+}
+
+const layer_content_desc*
+layer_content_get_desc(layer_content_id id)
+{
+	return &registry.contents[id].desc;
+}
+
+XrSwapchain
+layer_content_swapchain(layer_content_id id)
+{
+	return registry.contents[id].swapchain;
+}
+
+XrSwapchainSubImage
+layer_content_sub_image(layer_content_id id)
+{
+	const layer_content* content = &registry.contents[id];
+	return XrSwapchainSubImage{
+		.swapchain = content->swapchain,
+		.imageRect = {.offset = {.x = 0, .y = 0},
+					  .extent = {.width = (int32_t)content->desc.width,
+								 .height = (int32_t)content->desc.height}},
+		.imageArrayIndex = 0,
+	};
+}
+
+XrSwapchainImageOpenGLKHR
+layer_content_gl_image(layer_content_id id, uint32_t image_index)
+{
+	return registry.contents[id].gl_images[image_index];
+}
+
+uint32_t
+layer_content_refcount(layer_content_id id)
+{
+	return id < LAYER_CONTENT_MAX ? registry.contents[id].refcount : 0;
+}
+
+void
+layer_content_cleanup()
+{
+	for (layer_content_id id = 0; id < LAYER_CONTENT_MAX; id++) {
+		if (registry.contents[id].refcount > 0)
+			destroy_content(id);
+	}
+}
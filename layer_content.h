@@ -0,0 +1,84 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Swapchains with layer content, shared by the layers that show the same content
+ *
+ * Layers acquire their content by description. Layers with equal descriptions get the
+ * same swapchain and sub image, so the content is generated and uploaded once per frame
+ * no matter how many quad, cylinder or equirect layers show it. Entries are reference
+ * counted, the swapchain is destroyed with the last release.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// window system headers and the matching OpenXR graphics binding
+#include "platform.h"
+
+// one Vulkan layer target per content, see vkimpl.h
+#define LAYER_CONTENT_MAX 4
+
+typedef uint32_t layer_content_id;
+#define LAYER_CONTENT_INVALID UINT32_MAX
+
+// what the layer producers draw into the swapchain
+enum layer_content_kind
+{
+	// the gradient with diagonal lines of raster_quad_pattern()
+	LAYER_CONTENT_PATTERN,
+	// the environment objects of the scene seen from the origin, see environment.h
+	LAYER_CONTENT_ENVIRONMENT,
+};
+
+// Sharing is only legal when all fields are equal: the content is the same and the
+// swapchains would be created with the same parameters.
+struct layer_content_desc
+{
+	layer_content_kind kind;
+	int64_t format;
+	uint32_t width;
+	uint32_t height;
+	// 6 for cube maps
+	uint32_t face_count;
+	XrSwapchainCreateFlags create_flags;
+};
+
+// vulkan selects vk_add_swapchain() instead of enumerating OpenGL images
+void
+layer_content_init(XrSession session, bool vulkan);
+
+// finds a content with an equal description or creates a swapchain for it,
+// LAYER_CONTENT_INVALID if that fails
+layer_content_id
+layer_content_acquire(const layer_content_desc* desc);
+
+void
+layer_content_release(layer_content_id id);
+
+// contents with at least one reference, ids are below LAYER_CONTENT_MAX
+bool
+layer_content_alive(layer_content_id id);
+
+const layer_content_desc*
+layer_content_get_desc(layer_content_id id);
+
+XrSwapchain
+layer_content_swapchain(layer_content_id id);
+
+// the whole image, for the subImage of the layers
+XrSwapchainSubImage
+layer_content_sub_image(layer_content_id id);
+
+// OpenGL only
+XrSwapchainImageOpenGLKHR
+layer_content_gl_image(layer_content_id id, uint32_t image_index);
+
+// number of layers using the content
+uint32_t
+layer_content_refcount(layer_content_id id);
+
+// destroys all swapchains, before the session is destroyed
+void
+layer_content_cleanup();
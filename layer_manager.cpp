@@ -0,0 +1,233 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Composition layers submitted with xrEndFrame
+ */
+
+#include "layer_manager.h"
+
+#include <stdio.h>
+#include <string.h>
+
+struct managed_layer
+{
+	bool used;
+	bool visible;
+	layer_kind kind;
+	int32_t depth;
+	// insertion order, keeps the sort stable for layers with the same depth
+	uint32_t sequence;
+	layer_content_id content;
+
+	layer_update update;
+	uint32_t interval;
+	bool changed;
+
+	layer_data data;
+};
+
+static struct
+{
+	managed_layer layers[LAYER_MANAGER_MAX_LAYERS];
+	uint32_t next_sequence;
+
+	// handles of the used layers sorted by depth, only sorted again after changes
+	layer_handle sorted[LAYER_MANAGER_MAX_LAYERS];
+	uint32_t sorted_count;
+	bool sort_dirty;
+
+	const XrCompositionLayerBaseHeader* submitted[LAYER_MANAGER_MAX_LAYERS];
+
+	bool content_due[LAYER_CONTENT_MAX];
+	bool content_generated[LAYER_CONTENT_MAX];
+} manager;
+
+static const XrStructureType layer_types[] = {
+	XR_TYPE_COMPOSITION_LAYER_PROJECTION,
+	XR_TYPE_COMPOSITION_LAYER_QUAD,
+	XR_TYPE_COMPOSITION_LAYER_CYLINDER_KHR,
+	XR_TYPE_COMPOSITION_LAYER_EQUIRECT_KHR,
+	XR_TYPE_COMPOSITION_LAYER_CUBE_KHR,
+};
+
+static managed_layer*
+get_layer(layer_handle handle)
+{
+	if (handle >= LAYER_MANAGER_MAX_LAYERS || !manager.layers[handle].used)
+		return NULL;
+	return &manager.layers[handle];
+}
+
+layer_handle
+layer_manager_add(layer_kind kind, int32_t depth, layer_content_id content)
+{
+	for (layer_handle handle = 0; handle < LAYER_MANAGER_MAX_LAYERS; handle++) {
+		managed_layer* layer = &manager.layers[handle];
+		if (layer->used)
+			continue;
+
+		*layer = managed_layer();
+		layer->used = true;
+		layer->visible = true;
+		layer->kind = kind;
+		layer->depth = depth;
+		layer->sequence = manager.next_sequence++;
+		layer->content = content;
+		layer->update = LAYER_UPDATE_EVERY_FRAME;
+		layer->interval = 1;
+		memset(&layer->data, 0, sizeof(layer->data));
+		layer->data.base.type = layer_types[kind];
+		manager.sort_dirty = true;
+		return handle;
+	}
+
+	printf("No free composition layer, at most %d layers\n", LAYER_MANAGER_MAX_LAYERS);
+	return LAYER_HANDLE_INVALID;
+}
+
+void
+layer_manager_remove(layer_handle handle)
+{
+	managed_layer* layer = get_layer(handle);
+	if (layer == NULL)
+		return;
+	layer->used = false;
+	manager.sort_dirty = true;
+}
+
+layer_data*
+layer_manager_get(layer_handle handle)
+{
+	managed_layer* layer = get_layer(handle);
+	return layer != NULL ? &layer->data : NULL;
+}
+
+void
+layer_manager_set_depth(layer_handle handle, int32_t depth)
+{
+	managed_layer* layer = get_layer(handle);
+	if (layer == NULL || layer->depth == depth)
+		return;
+	layer->depth = depth;
+	manager.sort_dirty = true;
+}
+
+void
+layer_manager_set_visible(layer_handle handle, bool visible)
+{
+	managed_layer* layer = get_layer(handle);
+	if (layer != NULL)
+		layer->visible = visible;
+}
+
+void
+layer_manager_set_update(layer_handle handle, layer_update update, uint32_t interval)
+{
+	managed_layer* layer = get_layer(handle);
+	if (layer == NULL)
+		return;
+	layer->update = update;
+	layer->interval = interval > 0 ? interval : 1;
+}
+
+void
+layer_manager_mark_changed(layer_handle handle)
+{
+	managed_layer* layer = get_layer(handle);
+	if (layer != NULL)
+		layer->changed = true;
+}
+
+static bool
+layer_due(managed_layer* layer, uint64_t frame_index)
+{
+	switch (layer->update) {
+	case LAYER_UPDATE_EVERY_FRAME: return true;
+	case LAYER_UPDATE_EVERY_N_FRAMES: return frame_index % layer->interval == 0;
+	case LAYER_UPDATE_ON_CHANGE: return layer->changed;
+	}
+	return true;
+}
+
+void
+layer_manager_begin_frame(uint64_t frame_index)
+{
+	for (layer_content_id id = 0; id < LAYER_CONTENT_MAX; id++) {
+		// a content that was destroyed and acquired again has a new swapchain
+		if (!layer_content_alive(id))
+			manager.content_generated[id] = false;
+		manager.content_due[id] = false;
+	}
+
+	for (managed_layer& layer : manager.layers) {
+		if (!layer.used || !layer.visible || layer.content >= LAYER_CONTENT_MAX)
+			continue;
+		if (layer_due(&layer, frame_index) || !manager.content_generated[layer.content])
+			manager.content_due[layer.content] = true;
+		layer.changed = false;
+	}
+
+	for (layer_content_id id = 0; id < LAYER_CONTENT_MAX; id++) {
+		if (manager.content_due[id])
+			manager.content_generated[id] = true;
+	}
+}
+
+bool
+layer_manager_content_due(layer_content_id content)
+{
+	return content < LAYER_CONTENT_MAX && manager.content_due[content];
+}
+
+static bool
+sorts_before(const managed_layer* a, const managed_layer* b)
+{
+	if (a->depth != b->depth)
+		return a->depth < b->depth;
+	return a->sequence < b->sequence;
+}
+
+// insertion sort, there are only a few layers and they are usually sorted already
+static void
+sort_layers()
+{
+	manager.sorted_count = 0;
+	for (layer_handle handle = 0; handle < LAYER_MANAGER_MAX_LAYERS; handle++) {
+		if (!manager.layers[handle].used)
+			continue;
+
+		uint32_t i = manager.sorted_count++;
+		while (i > 0 && sorts_before(&manager.layers[handle], &manager.layers[manager.sorted[i - 1]])) {
+			manager.sorted[i] = manager.sorted[i - 1];
+			i--;
+		}
+		manager.sorted[i] = handle;
+	}
+	manager.sort_dirty = false;
+}
+
+const XrCompositionLayerBaseHeader* const*
+layer_manager_build(uint32_t* layer_count)
+{
+	if (manager.sort_dirty)
+		sort_layers();
+
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < manager.sorted_count; i++) {
+		managed_layer* layer = &manager.layers[manager.sorted[i]];
+		if (layer->visible)
+			manager.submitted[count++] = &layer->data.base;
+	}
+	*layer_count = count;
+	return manager.submitted;
+}
+
+uint32_t
+layer_manager_layer_count()
+{
+	uint32_t count = 0;
+	for (const managed_layer& layer : manager.layers)
+		count += layer.used ? 1 : 0;
+	return count;
+}
@@ -0,0 +1,98 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Composition layers submitted with xrEndFrame
+ *
+ * The manager owns any number of projection, quad, cylinder, equirect and cube
+ * layers in a preallocated pool. Each layer declares a depth, the layers are
+ * submitted from the lowest to the highest depth, so higher layers are composed
+ * over lower ones. Each layer also declares how often its content is updated:
+ * every frame, every N frames or only when it was marked as changed. The content
+ * of a frame is generated when any layer showing it is due.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "platform.h"
+#include "layer_content.h"
+
+#define LAYER_MANAGER_MAX_LAYERS 16
+
+typedef uint32_t layer_handle;
+#define LAYER_HANDLE_INVALID UINT32_MAX
+
+enum layer_kind
+{
+	LAYER_KIND_PROJECTION,
+	LAYER_KIND_QUAD,
+	LAYER_KIND_CYLINDER,
+	LAYER_KIND_EQUIRECT,
+	LAYER_KIND_CUBE,
+};
+
+enum layer_update
+{
+	LAYER_UPDATE_EVERY_FRAME,
+	// every interval frames
+	LAYER_UPDATE_EVERY_N_FRAMES,
+	// after layer_manager_mark_changed()
+	LAYER_UPDATE_ON_CHANGE,
+};
+
+// the OpenXR struct of a layer, the member matching its kind is valid
+union layer_data
+{
+	XrCompositionLayerBaseHeader base;
+	XrCompositionLayerProjection projection;
+	XrCompositionLayerQuad quad;
+	XrCompositionLayerCylinderKHR cylinder;
+	XrCompositionLayerEquirectKHR equirect;
+	XrCompositionLayerCubeKHR cube;
+};
+
+// Adds a layer whose struct is filled in later with layer_manager_get(). The type
+// of the struct is set from the kind. content is LAYER_CONTENT_INVALID for layers
+// that are not filled from a layer content, e.g. the projection layer. Returns
+// LAYER_HANDLE_INVALID when the pool is full.
+layer_handle
+layer_manager_add(layer_kind kind, int32_t depth, layer_content_id content);
+
+void
+layer_manager_remove(layer_handle handle);
+
+layer_data*
+layer_manager_get(layer_handle handle);
+
+void
+layer_manager_set_depth(layer_handle handle, int32_t depth);
+
+// hidden layers are not submitted and do not update their content
+void
+layer_manager_set_visible(layer_handle handle, bool visible);
+
+// interval is only used with LAYER_UPDATE_EVERY_N_FRAMES, the default is every frame
+void
+layer_manager_set_update(layer_handle handle, layer_update update, uint32_t interval);
+
+// the content of the layer is updated in the next frame
+void
+layer_manager_mark_changed(layer_handle handle);
+
+// decides which contents are due this frame. Contents that were never generated are
+// always due, a swapchain has to be released once before a layer can show it.
+void
+layer_manager_begin_frame(uint64_t frame_index);
+
+bool
+layer_manager_content_due(layer_content_id content);
+
+// the visible layers sorted by depth, for XrFrameEndInfo. The array is owned by the
+// manager and valid until the next call.
+const XrCompositionLayerBaseHeader* const*
+layer_manager_build(uint32_t* layer_count);
+
+uint32_t
+layer_manager_layer_count();
@@ -0,0 +1,22 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Producers of the quad and cylinder layer content
+ *
+ * Both backends implement every producer and both producers draw the same content,
+ * so they can be swapped without touching the layer setup. The layer swapchains are
+ * created with the color attachment and the transfer destination usage for that.
+ */
+
+#pragma once
+
+enum layer_producer
+{
+	// raster.h writes the pixels into a mapped upload buffer that is copied into the
+	// swapchain image
+	LAYER_PRODUCER_CPU,
+	// a fullscreen triangle renders the content straight into the swapchain image,
+	// nothing is filled or uploaded by the CPU
+	LAYER_PRODUCER_GPU,
+};
@@ -0,0 +1,268 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Log messages written to stdout by a thread
+ */
+
+#include "log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <thread>
+
+#include "trace.h"
+
+#define DEFAULT_SITE_RATE 10
+
+struct log_entry
+{
+	// the slot is ready to read when it equals the read position + 1
+	std::atomic<uint32_t> sequence;
+	uint32_t length;
+	char text[LOG_MESSAGE_SIZE];
+};
+
+static struct
+{
+	log_settings settings = {.site_rate = DEFAULT_SITE_RATE};
+	std::thread thread;
+	std::atomic<bool> stop;
+	std::atomic<bool> running;
+
+	// bounded multiple producer, single consumer ring, producers claim a slot by
+	// advancing head and publish it through its sequence number
+	std::atomic<uint32_t> head;
+	uint32_t tail;
+	log_entry ring[LOG_RING_SIZE];
+	std::atomic<uint64_t> dropped;
+	uint64_t dropped_reported;
+
+	// every site that logged, for the writer to sum up repeats
+	std::atomic<log_site*> sites;
+} logger;
+
+void
+log_default_settings(log_settings* settings)
+{
+	settings->site_rate = DEFAULT_SITE_RATE;
+}
+
+static uint64_t
+hash_message(const char* text, uint32_t length)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (uint32_t i = 0; i < length; i++)
+		hash = (hash ^ (uint8_t)text[i]) * 1099511628211ull;
+	return hash;
+}
+
+static void
+write_out(const char* text, uint32_t length)
+{
+	fwrite(text, 1, length, stdout);
+}
+
+static void
+enqueue(const char* text, uint32_t length)
+{
+	if (!logger.running.load(std::memory_order_acquire)) {
+		write_out(text, length);
+		return;
+	}
+
+	uint32_t pos = logger.head.load(std::memory_order_relaxed);
+	log_entry* entry;
+	while (true) {
+		entry = &logger.ring[pos & (LOG_RING_SIZE - 1)];
+		int32_t diff = (int32_t)(entry->sequence.load(std::memory_order_acquire) - pos);
+		if (diff == 0) {
+			if (logger.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			// full, never wait for stdout
+			logger.dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			pos = logger.head.load(std::memory_order_relaxed);
+		}
+	}
+	memcpy(entry->text, text, length);
+	entry->length = length;
+	entry->sequence.store(pos + 1, std::memory_order_release);
+}
+
+// repeats and suppressed messages of the site since it last printed
+static void
+summarize(log_site* site)
+{
+	uint32_t repeated = site->repeated.exchange(0, std::memory_order_relaxed);
+	uint32_t suppressed = site->suppressed.exchange(0, std::memory_order_relaxed);
+	if (repeated == 0 && suppressed == 0)
+		return;
+
+	char text[LOG_MESSAGE_SIZE];
+	int length;
+	if (suppressed == 0)
+		length = snprintf(text, sizeof(text), "%s:%d: last message repeated %u times\n", site->file, site->line,
+		                  repeated);
+	else if (repeated == 0)
+		length = snprintf(text, sizeof(text), "%s:%d: %u messages suppressed\n", site->file, site->line,
+		                  suppressed);
+	else
+		length = snprintf(text, sizeof(text), "%s:%d: last message repeated %u times, %u more suppressed\n",
+		                  site->file, site->line, repeated, suppressed);
+	if (length > 0)
+		enqueue(text, length < (int)sizeof(text) ? (uint32_t)length : (uint32_t)sizeof(text) - 1);
+}
+
+static void
+register_site(log_site* site)
+{
+	if (site->registered.exchange(true, std::memory_order_relaxed))
+		return;
+	log_site* head = logger.sites.load(std::memory_order_relaxed);
+	do {
+		site->next = head;
+	} while (!logger.sites.compare_exchange_weak(head, site, std::memory_order_release, std::memory_order_relaxed));
+}
+
+// decides whether the message of the site is printed, counts it otherwise
+static bool
+admit(log_site* site, uint64_t hash)
+{
+	uint32_t rate = site->rate == LOG_RATE_DEFAULT ? logger.settings.site_rate : site->rate;
+	if (rate == 0)
+		return true;
+
+	register_site(site);
+
+	if (site->last_hash.exchange(hash, std::memory_order_relaxed) == hash) {
+		site->repeated.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	int64_t now_ms = (int64_t)(trace_now_us() / 1000.);
+	int64_t window_start_ms = site->window_start_ms.load(std::memory_order_relaxed);
+	if (now_ms - window_start_ms >= 1000) {
+		site->window_start_ms.store(now_ms, std::memory_order_relaxed);
+		site->window_count.store(0, std::memory_order_relaxed);
+	}
+	if (site->window_count.fetch_add(1, std::memory_order_relaxed) >= rate) {
+		site->suppressed.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	summarize(site);
+	return true;
+}
+
+void
+log_write(log_site* site, int level, const char* format, ...)
+{
+	if (level < LOG_MIN_LEVEL)
+		return;
+
+	char text[LOG_MESSAGE_SIZE];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	if (length < 0)
+		return;
+	if (length >= (int)sizeof(text)) {
+		// keep the line break of a cut off message
+		length = sizeof(text) - 1;
+		text[length - 1] = '\n';
+	}
+
+	if (!admit(site, hash_message(text, (uint32_t)length)))
+		return;
+	enqueue(text, (uint32_t)length);
+}
+
+// prints what the producers published, returns the number of messages
+static uint32_t
+drain()
+{
+	uint32_t count = 0;
+	while (true) {
+		log_entry* entry = &logger.ring[logger.tail & (LOG_RING_SIZE - 1)];
+		if (entry->sequence.load(std::memory_order_acquire) != logger.tail + 1)
+			break;
+		write_out(entry->text, entry->length);
+		entry->sequence.store(logger.tail + LOG_RING_SIZE, std::memory_order_release);
+		logger.tail++;
+		count++;
+	}
+
+	uint64_t dropped = logger.dropped.load(std::memory_order_relaxed);
+	if (dropped != logger.dropped_reported) {
+		fprintf(stdout, "Dropped %llu log messages\n", (unsigned long long)(dropped - logger.dropped_reported));
+		logger.dropped_reported = dropped;
+	}
+	if (count > 0)
+		fflush(stdout);
+	return count;
+}
+
+static void
+writer_thread()
+{
+	trace_thread_name("log writer");
+
+	double last_summary_us = trace_now_us();
+	while (!logger.stop.load(std::memory_order_relaxed)) {
+		if (drain() == 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+		double now_us = trace_now_us();
+		if (now_us - last_summary_us >= 1000000.) {
+			for (log_site* site = logger.sites.load(std::memory_order_acquire); site != NULL; site = site->next)
+				summarize(site);
+			last_summary_us = now_us;
+		}
+	}
+}
+
+void
+log_start(const log_settings* settings)
+{
+	if (logger.running)
+		return;
+
+	logger.settings = *settings;
+	logger.head = 0;
+	logger.tail = 0;
+	for (uint32_t i = 0; i < LOG_RING_SIZE; i++)
+		logger.ring[i].sequence.store(i, std::memory_order_relaxed);
+	logger.dropped = 0;
+	logger.dropped_reported = 0;
+	logger.stop = false;
+	logger.running.store(true, std::memory_order_release);
+	logger.thread = std::thread(writer_thread);
+}
+
+void
+log_stop()
+{
+	if (!logger.running)
+		return;
+
+	for (log_site* site = logger.sites.load(std::memory_order_acquire); site != NULL; site = site->next)
+		summarize(site);
+	logger.stop = true;
+	logger.thread.join();
+	// later messages are printed right away, then print what got queued until now
+	logger.running.store(false, std::memory_order_release);
+	drain();
+}
+
+uint64_t
+log_dropped()
+{
+	return logger.dropped.load(std::memory_order_relaxed);
+}
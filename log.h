@@ -0,0 +1,113 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Log messages written to stdout by a thread
+ *
+ * Messages are formatted on the calling thread into a fixed size entry of a
+ * lock-free ring that any thread can write to, a writer thread prints them, so a
+ * blocking stdout never stalls the frame loop. When the ring is full messages are
+ * dropped and counted. Before log_start() and after log_stop() messages are printed
+ * right away.
+ *
+ * Every LOG_* call site keeps its own state: a message equal to the last one of the
+ * site is only counted, and a site prints at most its rate of messages per second.
+ * Repeats and suppressed messages are summed up once the site prints again, or by
+ * the writer after a second.
+ *
+ * Messages below LOG_MIN_LEVEL are compiled out, by default debug messages are only
+ * kept without NDEBUG.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+#ifndef LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+// longer messages are cut off
+#define LOG_MESSAGE_SIZE 256
+#define LOG_RING_SIZE 1024
+// the call site prints at the rate of the log settings
+#define LOG_RATE_DEFAULT UINT32_MAX
+
+struct log_site
+{
+	const char* file = NULL;
+	int line = 0;
+	// messages per second, 0 for no limit and no deduplication
+	uint32_t rate = LOG_RATE_DEFAULT;
+
+	std::atomic<bool> registered{false};
+	log_site* next = NULL;
+
+	std::atomic<uint64_t> last_hash{0};
+	std::atomic<uint32_t> repeated{0};
+	std::atomic<int64_t> window_start_ms{0};
+	std::atomic<uint32_t> window_count{0};
+	std::atomic<uint32_t> suppressed{0};
+};
+
+struct log_settings
+{
+	// messages per second of the call sites with LOG_RATE_DEFAULT, 0 for no limit
+	uint32_t site_rate;
+};
+
+void
+log_default_settings(log_settings* settings);
+
+// starts the writer thread
+void
+log_start(const log_settings* settings);
+
+// prints what is queued and stops the writer thread
+void
+log_stop();
+
+void
+log_write(log_site* site, int level, const char* format, ...);
+
+// messages dropped because the ring was full, since the start
+uint64_t
+log_dropped();
+
+#define LOG_AT_RATE(level, site_rate, ...)                                                              \
+	do {                                                                                               \
+		static log_site log_site_ = {.file = __FILE__, .line = __LINE__, .rate = site_rate};       \
+		log_write(&log_site_, level, __VA_ARGS__);                                                 \
+	} while (0)
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_AT_RATE(LOG_LEVEL_DEBUG, LOG_RATE_DEFAULT, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_AT_RATE(LOG_LEVEL_INFO, LOG_RATE_DEFAULT, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_AT_RATE(LOG_LEVEL_WARN, LOG_RATE_DEFAULT, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#define LOG_ERROR(...) LOG_AT_RATE(LOG_LEVEL_ERROR, LOG_RATE_DEFAULT, __VA_ARGS__)
@@ -7,16 +7,42 @@
  */
 
 // STD Header
+#include <stdarg.h>
+#include <math.h>
+#include <string.h>
 #include <iostream>
 #include <array>
 #include <vector>
 #include <string>
 
 #include "glimpl.h" // factored out rendering of a simple scene
-
-// OpenXR Header and defination
-#define XR_USE_GRAPHICS_API_OPENGL
-#define XR_USE_PLATFORM_WIN32
+#include "trace.h"
+#include "stats.h"
+#include "gpu_timer.h"
+#include "dynres.h"
+#include "halfrate.h"
+#include "mirror.h"
+#include "scene.h"
+#include "cull.h"
+#include "benchmark.h"
+#include "job.h"
+#include "raster.h"
+#include "layer_content.h"
+#include "layer_manager.h"
+#include "environment.h"
+#include "input.h"
+#include "input_sampler.h"
+#include "pose_filter.h"
+#include "gesture.h"
+#include "haptics.h"
+#include "log.h"
+#ifdef XR_EXAMPLE_VULKAN
+#include "vkimpl.h"
+#endif
+
+#include <thread>
+
+// OpenXR Header and defination, the platform defines come from platform.h
 #include "openxr/openxr.h"
 
 #include "xrmath.h" // math glue between OpenXR and OpenGL
@@ -28,14 +54,6 @@
 static XrPosef identity_pose = {.orientation = {.x = 0, .y = 0, .z = 0, .w = 1.0},
 								.position = {.x = 0, .y = 0, .z = 0}};
 
-// small helper so we don't forget whether we treat 0 as left or right hand
-enum OPENXR_HANDS
-{
-	HAND_LEFT = 0,
-	HAND_RIGHT = 1,
-	HAND_COUNT
-};
-
 std::string h_str(int hand)
 {
 	if (hand == HAND_LEFT)
@@ -73,14 +91,23 @@ public:
 	std::vector<XrCompositionLayerProjectionView>	projection_views;
 	std::vector<XrView> views;
 
+	// set with OXR_GRAPHICS=opengl|vulkan
+	GraphicsAPI graphics_api;
+
 	// The runtime interacts with the OpenGL images (textures) via a Swapchain.
-	XrGraphicsBindingOpenGLWin32KHR graphics_binding_gl;
+	platform_graphics_binding graphics_binding_gl;
+#ifdef XR_EXAMPLE_VULKAN
+	// with Vulkan the swapchain images are owned by vkimpl.cpp
+	XrGraphicsBindingVulkanKHR graphics_binding_vk;
+#endif
 
 	int64_t swapchain_format;
 	// one array of images per view.
 	std::vector<std::vector<XrSwapchainImageOpenGLKHR>> images;
 	// one swapchain per view. Using only one and rendering l/r to the same image is also possible.
 	std::vector<XrSwapchain> swapchains;
+	// swapchain size per view, larger than the recommended size with dynamic resolution
+	std::vector<XrExtent2Di> swapchain_extents;
 
 	int64_t depth_swapchain_format;
 	std::vector<std::vector<XrSwapchainImageOpenGLKHR>> depth_images;
@@ -89,9 +116,13 @@ public:
 	// quad layers are placed into world space, no need to render them per eye
 	int64_t quad_swapchain_format;
 	uint32_t quad_pixel_width, quad_pixel_height;
-	uint32_t quad_swapchain_length;
-	std::vector<XrSwapchainImageOpenGLKHR> quad_images;
-	XrSwapchain quad_swapchain;
+	// swapchain of the quad layer, shared with the cylinder layer when the content is equal
+	layer_content_id quad_content;
+	// composition layers, submitted by the layer manager
+	layer_handle projection_layer;
+	layer_handle quad_layer;
+	// fills the quad and the cylinder layer, set with OXR_LAYER_PRODUCER=cpu|gpu
+	layer_producer layer_content_producer;
 
 	float near_z;
 	float far_z;
@@ -109,15 +140,45 @@ public:
 		bool supported;
 		int64_t format;
 		uint32_t swapchain_width, swapchain_height;
-		uint32_t swapchain_length;
-		std::vector<XrSwapchainImageOpenGLKHR> images;
-		XrSwapchain swapchain;
+		layer_content_id content;
+		layer_handle layer;
 	} cylinder;
 
+	// cube and equirect layer extensions for the environment layer
+	struct
+	{
+		bool cube_supported = false;
+		bool equirect_supported = false;
+	} environment;
+
+	// dynamic resolution: only a part of the swapchain images is rendered and submitted
+	struct
+	{
+		bool enabled;
+		dynres controller;
+	} dynamic_resolution;
+
+	// the eyes are rendered every other frame and reprojected in between
+	halfrate half_rate;
+
+	// visibility mask extension data
+	struct
+	{
+		bool supported;
+		PFN_xrGetVisibilityMaskKHR pfnGetVisibilityMaskKHR;
+		// the mesh is only fetched again after a visibility mask changed event
+		std::vector<bool> dirty;
+	} visibility_mask;
+
 	// To render into a texture we need a framebuffer (one per texture to make it easy)
 	std::vector<std::vector<GLuint>> framebuffers;
 
-	std::array<XrPath, HAND_COUNT> hand_paths;
+	// hand poses sampled between frames, drained once per frame
+	std::vector<input_sample> input_samples;
+	uint32_t input_sample_count;
+
+	// the held grab vibration of each hand, 0 while none plays
+	uint32_t grab_haptics[HAND_COUNT] = {};
 
 	// hand tracking extension data
 	struct
@@ -127,31 +188,46 @@ public:
 		bool system_supported;
 		PFN_xrLocateHandJointsEXT pfnLocateHandJointsEXT;
 		std::array<XrHandTrackerEXT, HAND_COUNT> trackers;
+		// smooths the joints and predicts them with their velocities
+		pose_filter filter;
 	} hand_tracking;
+
+	// scene objects for the controller blocks and the tracked hand joints
+	struct
+	{
+		std::array<scene_handle, HAND_COUNT> controllers;
+		std::array<std::array<scene_handle, XR_HAND_JOINT_COUNT_EXT>, HAND_COUNT> joints;
+		// objects touched by a joint or pointed at by a controller, drawn highlighted
+		std::vector<scene_handle> highlighted;
+	} hand_objects;
 } xr_example;
 
-bool xr_result(XrInstance instance, XrResult result, const char* format, ...)
+// formats into stack buffers and queues the message, nothing is allocated
+bool xr_result_log(log_site* site, XrInstance instance, XrResult result, const char* format, ...)
 {
-	if (XR_SUCCEEDED(result))
-		return true;
-
 	char resultString[XR_MAX_RESULT_STRING_SIZE];
 	xrResultToString(instance, result, resultString);
 
-	size_t len1 = strlen(format);
-	size_t len2 = strlen(resultString) + 1;
-	char *formatRes = new  char[len1 + len2 + 4]; // + " []\n"
-	sprintf(formatRes, "%s [%s]\n", format, resultString);
-
+	char message[LOG_MESSAGE_SIZE];
 	va_list args;
 	va_start(args, format);
-	vprintf(formatRes, args);
+	vsnprintf(message, sizeof(message), format, args);
 	va_end(args);
 
-	delete [] formatRes;
+	log_write(site, LOG_LEVEL_ERROR, "%s [%s]\n", message, resultString);
 	return false;
 }
 
+// every call is its own log site, so a call failing every frame is rate limited
+// without hiding the failures of other calls
+#define xr_result(instance, result, ...)                                                           \
+	[&]() {                                                                                        \
+		if (XR_SUCCEEDED(result))                                                              \
+			return true;                                                                   \
+		static log_site xr_result_site = {.file = __FILE__, .line = __LINE__};                 \
+		return xr_result_log(&xr_result_site, instance, result, __VA_ARGS__);                  \
+	}()
+
 void sdl_handle_events(SDL_Event event, bool* running);
 
 // some optional OpenXR calls demonstrated in functions to clutter the main app less
@@ -281,11 +357,242 @@ void print_reference_spaces(XrExample* self)
 	}
 }
 
+// sets the part of the swapchain images that is rendered and submitted
+void apply_render_scale(XrExample* self, float scale)
+{
+	for (uint32_t i = 0; i < self->projection_views.size(); i++) {
+		int32_t width = (int32_t)(self->viewconfig_views[i].recommendedImageRectWidth * scale + 0.5f);
+		int32_t height = (int32_t)(self->viewconfig_views[i].recommendedImageRectHeight * scale + 0.5f);
+		if (width > self->swapchain_extents[i].width)
+			width = self->swapchain_extents[i].width;
+		if (height > self->swapchain_extents[i].height)
+			height = self->swapchain_extents[i].height;
+
+		self->projection_views[i].subImage.imageRect.extent = {width, height};
+		if (self->depth.supported) {
+			self->depth.infos[i].subImage.imageRect.extent = {width, height};
+		}
+	}
+}
+
+// fetches the hidden area mesh of a view and uploads it to the GPU
+void update_visibility_mask(XrExample* self, uint32_t view_index)
+{
+	XrResult result;
+
+	XrVisibilityMaskKHR mask = {.type = XR_TYPE_VISIBILITY_MASK_KHR, .next = NULL};
+	result = self->visibility_mask.pfnGetVisibilityMaskKHR(
+		self->session, XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO, view_index,
+		XR_VISIBILITY_MASK_TYPE_HIDDEN_TRIANGLE_MESH_KHR, &mask);
+	if (!xr_result(self->instance, result, "Failed to get visibility mask size for view %d", view_index))
+		return;
+
+	std::vector<XrVector2f> vertices(mask.vertexCountOutput);
+	std::vector<uint32_t> indices(mask.indexCountOutput);
+	mask.vertexCapacityInput = mask.vertexCountOutput;
+	mask.vertices = vertices.data();
+	mask.indexCapacityInput = mask.indexCountOutput;
+	mask.indices = indices.data();
+	result = self->visibility_mask.pfnGetVisibilityMaskKHR(
+		self->session, XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO, view_index,
+		XR_VISIBILITY_MASK_TYPE_HIDDEN_TRIANGLE_MESH_KHR, &mask);
+	if (!xr_result(self->instance, result, "Failed to get visibility mask for view %d", view_index))
+		return;
+
+	printf("Visibility mask for view %d: %d vertices, %d indices\n", view_index,
+		   mask.vertexCountOutput, mask.indexCountOutput);
+	set_visibility_mask(view_index, vertices.data(), mask.vertexCountOutput, indices.data(),
+						mask.indexCountOutput);
+}
+
+// checks the OpenGL requirements, creates the context and sets up rendering
+int init_opengl(XrExample* self)
+{
+	XrResult result;
+
+	// OpenXR requires checking graphics requirements before creating a session.
+	XrGraphicsRequirementsOpenGLKHR opengl_reqs = {.type = XR_TYPE_GRAPHICS_REQUIREMENTS_OPENGL_KHR, .next = NULL};
+
+	PFN_xrGetOpenGLGraphicsRequirementsKHR pfnGetOpenGLGraphicsRequirementsKHR = NULL;
+	{
+		result = xrGetInstanceProcAddr(self->instance, "xrGetOpenGLGraphicsRequirementsKHR", (PFN_xrVoidFunction*)&pfnGetOpenGLGraphicsRequirementsKHR);
+		if (!xr_result(self->instance, result, "Failed to get OpenGL graphics requirements function!"))
+			return 1;
+	}
+
+	result = pfnGetOpenGLGraphicsRequirementsKHR(self->instance, self->system_id, &opengl_reqs);
+	if (!xr_result(self->instance, result, "Failed to get OpenGL graphics requirements!"))
+		return 1;
+
+	// On OpenGL we never fail this check because the version requirement is not useful.
+	// Other APIs may have more useful requirements.
+	check_opengl_version(&opengl_reqs);
+
+
+	// set OXR_HEADLESS=surfaceless|pbuffer to run without a desktop window (EGL platform only)
+	platform_context_mode context_mode = PLATFORM_CONTEXT_WINDOW;
+	const char* headless_env = getenv("OXR_HEADLESS");
+	if (headless_env != NULL) {
+		context_mode = strcmp(headless_env, "pbuffer") == 0 ? PLATFORM_CONTEXT_PBUFFER
+															: PLATFORM_CONTEXT_SURFACELESS;
+	}
+
+	// create SDL window the size of the left eye & fill GL graphics binding info
+	if (!init_platform_gl(&self->graphics_binding_gl, context_mode,
+						  self->viewconfig_views[0].recommendedImageRectWidth,
+						  self->viewconfig_views[0].recommendedImageRectHeight)) {
+		printf("OpenGL context creation failed!\n");
+		return 1;
+	}
+
+	printf("Using OpenGL version: %s\n", glGetString(GL_VERSION));
+	printf("Using OpenGL Renderer: %s\n", glGetString(GL_RENDERER));
+
+	// Set up rendering (compile shaders, ...)
+	if (init_gl() != 0) {
+		printf("OpenGl setup failed!\n");
+		return 1;
+	}
+
+	// set OXR_MIRROR=none|left|both and OXR_MIRROR_RATE=<Hz> to configure the desktop window
+	mirror_settings mirror_settings = {.mode = MIRROR_LEFT, .rate_hz = 30.f};
+	const char* mirror_env = getenv("OXR_MIRROR");
+	if (mirror_env != NULL) {
+		if (strcmp(mirror_env, "none") == 0)
+			mirror_settings.mode = MIRROR_NONE;
+		else if (strcmp(mirror_env, "both") == 0)
+			mirror_settings.mode = MIRROR_BOTH;
+	}
+	const char* mirror_rate_env = getenv("OXR_MIRROR_RATE");
+	if (mirror_rate_env != NULL && atof(mirror_rate_env) > 0.)
+		mirror_settings.rate_hz = (float)atof(mirror_rate_env);
+	mirror_init(&mirror_settings);
+
+	return 0;
+}
+
+// the projection layer at the bottom, the quad and the cylinder layer over it
+bool init_layers(XrExample* self)
+{
+	// set OXR_LAYER_UPDATE=N to generate the layer content every N frames, 0 only once
+	layer_update update = LAYER_UPDATE_EVERY_FRAME;
+	uint32_t interval = 1;
+	const char* update_env = getenv("OXR_LAYER_UPDATE");
+	if (update_env != NULL) {
+		interval = (uint32_t)atoi(update_env);
+		update = interval == 0 ? LAYER_UPDATE_ON_CHANGE
+		                       : interval == 1 ? LAYER_UPDATE_EVERY_FRAME : LAYER_UPDATE_EVERY_N_FRAMES;
+	}
+
+	self->projection_layer = layer_manager_add(LAYER_KIND_PROJECTION, 0, LAYER_CONTENT_INVALID);
+	if (self->projection_layer == LAYER_HANDLE_INVALID)
+		return false;
+	XrCompositionLayerProjection* projection = &layer_manager_get(self->projection_layer)->projection;
+	projection->layerFlags = 0;
+	projection->space = self->play_space;
+	projection->viewCount = self->projection_views.size();
+	projection->views = self->projection_views.data();
+
+	self->quad_layer = layer_manager_add(LAYER_KIND_QUAD, 1, self->quad_content);
+	if (self->quad_layer == LAYER_HANDLE_INVALID)
+		return false;
+	layer_manager_set_update(self->quad_layer, update, interval);
+	float aspect = (float)self->quad_pixel_width / (float)self->quad_pixel_height;
+	float quad_width = 1.f;
+	XrCompositionLayerQuad* quad = &layer_manager_get(self->quad_layer)->quad;
+	quad->layerFlags = XR_COMPOSITION_LAYER_BLEND_TEXTURE_SOURCE_ALPHA_BIT;
+	quad->space = self->play_space;
+	quad->eyeVisibility = XR_EYE_VISIBILITY_BOTH;
+	quad->pose = {.orientation = {.x = 0.f, .y = 0.f, .z = 0.f, .w = 1.f},
+				  .position = {.x = 1.5f, .y = .7f, .z = -1.5f}};
+	quad->size = {.width = quad_width, .height = quad_width / aspect};
+	quad->subImage = layer_content_sub_image(self->quad_content);
+
+	self->cylinder.layer = LAYER_HANDLE_INVALID;
+	if (self->cylinder.supported) {
+		self->cylinder.layer = layer_manager_add(LAYER_KIND_CYLINDER, 1, self->cylinder.content);
+		if (self->cylinder.layer == LAYER_HANDLE_INVALID)
+			return false;
+		layer_manager_set_update(self->cylinder.layer, update, interval);
+		float cylinder_aspect =
+			(float)self->cylinder.swapchain_width / (float)self->cylinder.swapchain_height;
+		float threesixty = M_PI * 2 - 0.0001; /* TODO: spec issue range [0, 2π)*/
+		XrCompositionLayerCylinderKHR* cylinder = &layer_manager_get(self->cylinder.layer)->cylinder;
+		cylinder->layerFlags = XR_COMPOSITION_LAYER_BLEND_TEXTURE_SOURCE_ALPHA_BIT;
+		cylinder->space = self->play_space;
+		cylinder->eyeVisibility = XR_EYE_VISIBILITY_BOTH;
+		cylinder->subImage = layer_content_sub_image(self->cylinder.content);
+		cylinder->pose = {.orientation = {.x = 0.f, .y = 0.f, .z = 0.f, .w = 1.f},
+						  .position = {.x = 1.5f, .y = 0.f, .z = -1.5f}};
+		cylinder->radius = 0.5;
+		cylinder->centralAngle = threesixty / 3;
+		cylinder->aspectRatio = cylinder_aspect;
+	}
+
+	// set OXR_ENVIRONMENT=cube|equirect|off, the default is the first one supported
+	environment_mode mode = self->environment.cube_supported       ? ENVIRONMENT_CUBE
+	                        : self->environment.equirect_supported ? ENVIRONMENT_EQUIRECT
+	                                                               : ENVIRONMENT_OFF;
+	const char* environment_env = getenv("OXR_ENVIRONMENT");
+	if (environment_env != NULL) {
+		if (strcmp(environment_env, "cube") == 0 && self->environment.cube_supported)
+			mode = ENVIRONMENT_CUBE;
+		else if (strcmp(environment_env, "equirect") == 0 && self->environment.equirect_supported)
+			mode = ENVIRONMENT_EQUIRECT;
+		else if (strcmp(environment_env, "off") == 0)
+			mode = ENVIRONMENT_OFF;
+		else
+			printf("OXR_ENVIRONMENT=%s is not supported\n", environment_env);
+	}
+	if (!environment_init(mode, self->play_space, self->quad_swapchain_format, 1024, -1))
+		return false;
+	if (mode != ENVIRONMENT_OFF) {
+		// the environment layer shows through where the eyes are cleared
+		projection->layerFlags = XR_COMPOSITION_LAYER_BLEND_TEXTURE_SOURCE_ALPHA_BIT;
+		set_clear_color(0.f, 0.f, 0.f, 0.f);
+		scene_split_environment(true);
+	}
+
+	uint32_t content_count = 0;
+	for (layer_content_id id = 0; id < LAYER_CONTENT_MAX; id++)
+		content_count += layer_content_alive(id) ? 1 : 0;
+	printf("%u composition layers with %u layer content swapchains\n", layer_manager_layer_count(),
+	       content_count);
+	return true;
+}
+
 int init_openxr(XrExample* self)
 {
 	XrResult result;
 
-	// --- Make sure runtime supports the OpenGL extension
+	// set OXR_GRAPHICS=vulkan to render with Vulkan instead of OpenGL
+	self->graphics_api = GRAPHICS_OPENGL;
+	const char* graphics_extension = XR_KHR_OPENGL_ENABLE_EXTENSION_NAME;
+	const char* graphics_env = getenv("OXR_GRAPHICS");
+	if (graphics_env != NULL && strcmp(graphics_env, "vulkan") == 0) {
+#ifdef XR_EXAMPLE_VULKAN
+		self->graphics_api = GRAPHICS_VULKAN;
+		graphics_extension = XR_KHR_VULKAN_ENABLE_EXTENSION_NAME;
+#else
+		printf("This build has no Vulkan support, configure with XR_EXAMPLE_VULKAN!\n");
+		return 1;
+#endif
+	}
+
+	// the pattern is procedural, the GPU draws it without uploads
+	self->layer_content_producer = LAYER_PRODUCER_GPU;
+	const char* layer_producer_env = getenv("OXR_LAYER_PRODUCER");
+	if (layer_producer_env != NULL && strcmp(layer_producer_env, "cpu") == 0)
+		self->layer_content_producer = LAYER_PRODUCER_CPU;
+	printf("Layer content is produced by the %s\n",
+		   self->layer_content_producer == LAYER_PRODUCER_GPU ? "GPU" : "CPU");
+
+	// set OXR_ACTIONS=file to load other actions and bindings
+	const char* actions_env = getenv("OXR_ACTIONS");
+	if (!input_load_manifest(actions_env != NULL ? actions_env : "actions.manifest"))
+		return 1;
+
+	// --- Make sure runtime supports the graphics extension
 
 	// xrEnumerate*() functions are usually called once with CapacityInput = 0.
 	// The function will write the required amount into CountOutput. We then have
@@ -305,41 +612,83 @@ int init_openxr(XrExample* self)
 	if (!xr_result(NULL, result, "Failed to enumerate extension properties"))
 		return 1;
 
-	bool opengl_ext = false;
+	// the platform binding extension is only needed by the OpenGL context
+	bool use_platform_ext = platform_binding_extension != NULL && self->graphics_api == GRAPHICS_OPENGL;
+
+	bool graphics_ext = false;
+	bool platform_ext = !use_platform_ext;
+	// extensions that interaction profiles of the action manifest require
+	const char* input_exts[ACTION_MANIFEST_MAX_PROFILES];
+	uint32_t input_ext_count = 0;
 	for (uint32_t i = 0; i < ext_count; i++) {
 		printf("\t%s v%d\n", extensionProperties[i].extensionName, extensionProperties[i].extensionVersion);
-		if (strcmp(XR_KHR_OPENGL_ENABLE_EXTENSION_NAME, extensionProperties[i].extensionName) == 0) {
-			opengl_ext = true;
+		if (strcmp(graphics_extension, extensionProperties[i].extensionName) == 0) {
+			graphics_ext = true;
+		}
+
+		if (use_platform_ext &&
+			strcmp(platform_binding_extension, extensionProperties[i].extensionName) == 0) {
+			platform_ext = true;
 		}
 
 		if (strcmp(XR_EXT_HAND_TRACKING_EXTENSION_NAME, extensionProperties[i].extensionName) == 0) {
 			self->hand_tracking.supported = true;
 		}
 
+		const char* input_ext = input_require_extension(extensionProperties[i].extensionName);
+		if (input_ext != NULL && input_ext_count < ACTION_MANIFEST_MAX_PROFILES) {
+			input_exts[input_ext_count++] = input_ext;
+		}
+
 		if (strcmp(XR_KHR_COMPOSITION_LAYER_CYLINDER_EXTENSION_NAME, extensionProperties[i].extensionName) == 0) {
 			self->cylinder.supported = true;
 		}
 
+		// the environment is only rendered with OpenGL for now
+		if (strcmp(XR_KHR_COMPOSITION_LAYER_CUBE_EXTENSION_NAME, extensionProperties[i].extensionName) == 0) {
+			self->environment.cube_supported = self->graphics_api == GRAPHICS_OPENGL;
+		}
+		if (strcmp(XR_KHR_COMPOSITION_LAYER_EQUIRECT_EXTENSION_NAME, extensionProperties[i].extensionName) == 0) {
+			self->environment.equirect_supported = self->graphics_api == GRAPHICS_OPENGL;
+		}
+
+		// the Vulkan backend renders into its own depth images and does not draw the
+		// visibility mask yet
 		if (strcmp(XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME, extensionProperties[i].extensionName) == 0) {
-			self->depth.supported = true;
+			self->depth.supported = self->graphics_api == GRAPHICS_OPENGL;
+		}
+
+		if (strcmp(XR_KHR_VISIBILITY_MASK_EXTENSION_NAME, extensionProperties[i].extensionName) == 0) {
+			self->visibility_mask.supported = self->graphics_api == GRAPHICS_OPENGL;
 		}
 	}
 
 	// A graphics extension like OpenGL is required to draw anything in VR
-	if (!opengl_ext) {
-		printf("Runtime does not support OpenGL extension!\n");
+	if (!graphics_ext) {
+		printf("Runtime does not support %s extension!\n", graphics_extension);
+		return 1;
+	}
+	if (!platform_ext) {
+		printf("Runtime does not support %s extension!\n", platform_binding_extension);
 		return 1;
 	}
 
 	printf("Runtime supports extensions:\n");
-	printf("\t%s: %d\n", XR_KHR_OPENGL_ENABLE_EXTENSION_NAME, opengl_ext);
+	printf("\t%s: %d\n", graphics_extension, graphics_ext);
 	printf("\t%s: %d\n", XR_EXT_HAND_TRACKING_EXTENSION_NAME, self->hand_tracking.supported);
 	printf("\t%s: %d\n", XR_KHR_COMPOSITION_LAYER_CYLINDER_EXTENSION_NAME, self->cylinder.supported);
+	printf("\t%s: %d\n", XR_KHR_COMPOSITION_LAYER_CUBE_EXTENSION_NAME, self->environment.cube_supported);
+	printf("\t%s: %d\n", XR_KHR_COMPOSITION_LAYER_EQUIRECT_EXTENSION_NAME, self->environment.equirect_supported);
 	printf("\t%s: %d\n", XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME, self->depth.supported);
+	printf("\t%s: %d\n", XR_KHR_VISIBILITY_MASK_EXTENSION_NAME, self->visibility_mask.supported);
 
 	// --- Create XrInstance
 	int enabled_ext_count = 1;
-	const char* enabled_exts[3] = {XR_KHR_OPENGL_ENABLE_EXTENSION_NAME};
+	const char* enabled_exts[16 + ACTION_MANIFEST_MAX_PROFILES] = {graphics_extension};
+
+	if (use_platform_ext) {
+		enabled_exts[enabled_ext_count++] = platform_binding_extension;
+	}
 
 	if (self->hand_tracking.supported) {
 		enabled_exts[enabled_ext_count++] = XR_EXT_HAND_TRACKING_EXTENSION_NAME;
@@ -347,6 +696,22 @@ int init_openxr(XrExample* self)
 	if (self->cylinder.supported) {
 		enabled_exts[enabled_ext_count++] = XR_KHR_COMPOSITION_LAYER_CYLINDER_EXTENSION_NAME;
 	}
+	if (self->environment.cube_supported) {
+		enabled_exts[enabled_ext_count++] = XR_KHR_COMPOSITION_LAYER_CUBE_EXTENSION_NAME;
+	}
+	if (self->environment.equirect_supported) {
+		enabled_exts[enabled_ext_count++] = XR_KHR_COMPOSITION_LAYER_EQUIRECT_EXTENSION_NAME;
+	}
+	if (self->visibility_mask.supported) {
+		enabled_exts[enabled_ext_count++] = XR_KHR_VISIBILITY_MASK_EXTENSION_NAME;
+	}
+	if (self->depth.supported) {
+		enabled_exts[enabled_ext_count++] = XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME;
+	}
+	for (uint32_t i = 0; i < input_ext_count; i++) {
+		printf("\t%s: 1 (action manifest)\n", input_exts[i]);
+		enabled_exts[enabled_ext_count++] = input_exts[i];
+	}
 
 	// same can be done for API layers, but API layers can also be enabled by env var
 
@@ -428,56 +793,35 @@ int init_openxr(XrExample* self)
 	print_viewconfig_view_info(self);
 
 
-	// OpenXR requires checking graphics requirements before creating a session.
-	XrGraphicsRequirementsOpenGLKHR opengl_reqs = {.type = XR_TYPE_GRAPHICS_REQUIREMENTS_OPENGL_KHR, .next = NULL};
-
-	PFN_xrGetOpenGLGraphicsRequirementsKHR pfnGetOpenGLGraphicsRequirementsKHR = NULL;
-	{
-		result = xrGetInstanceProcAddr(self->instance, "xrGetOpenGLGraphicsRequirementsKHR", (PFN_xrVoidFunction*)&pfnGetOpenGLGraphicsRequirementsKHR);
-		if (!xr_result(self->instance, result, "Failed to get OpenGL graphics requirements function!"))
+	if (self->graphics_api == GRAPHICS_VULKAN) {
+#ifdef XR_EXAMPLE_VULKAN
+		// checks the graphics requirements and creates the device the runtime asks for
+		if (!vk_init(self->instance, self->system_id, &self->graphics_binding_vk)) {
+			printf("Vulkan setup failed!\n");
 			return 1;
-	}
-
-	result = pfnGetOpenGLGraphicsRequirementsKHR(self->instance, self->system_id, &opengl_reqs);
-	if (!xr_result(self->instance, result, "Failed to get OpenGL graphics requirements!"))
-		return 1;
-
-	// On OpenGL we never fail this check because the version requirement is not useful.
-	// Other APIs may have more useful requirements.
-	check_opengl_version(&opengl_reqs);
-
-
-	// --- Create session
-	self->graphics_binding_gl = XrGraphicsBindingOpenGLWin32KHR{ .type = XR_TYPE_GRAPHICS_BINDING_OPENGL_WIN32_KHR, };
-
-	// create SDL window the size of the left eye & fill GL graphics binding info
-	if (!init_sdl_window(self->graphics_binding_gl.hDC, self->graphics_binding_gl.hGLRC,
-						 self->viewconfig_views[0].recommendedImageRectWidth,
-						 self->viewconfig_views[0].recommendedImageRectHeight)) {
-		printf("GLX init failed!\n");
-		return 1;
-	}
-
-	printf("Using OpenGL version: %s\n", glGetString(GL_VERSION));
-	printf("Using OpenGL Renderer: %s\n", glGetString(GL_RENDERER));
-
-	// Set up rendering (compile shaders, ...)
-	if (init_gl() != 0) {
-		printf("OpenGl setup failed!\n");
+		}
+#endif
+	} else if (init_opengl(self) != 0) {
 		return 1;
 	}
 
 	self->state = XR_SESSION_STATE_UNKNOWN;
 
+	// --- Create session
 	XrSessionCreateInfo session_create_info = {.type = XR_TYPE_SESSION_CREATE_INFO,
 											   .next = &self->graphics_binding_gl,
 											   .systemId = self->system_id};
+#ifdef XR_EXAMPLE_VULKAN
+	if (self->graphics_api == GRAPHICS_VULKAN)
+		session_create_info.next = &self->graphics_binding_vk;
+#endif
 
 	result = xrCreateSession(self->instance, &session_create_info, &self->session);
 	if (!xr_result(self->instance, result, "Failed to create session"))
 		return 1;
 
-	printf("Successfully created a session with OpenGL!\n");
+	printf("Successfully created a session with %s!\n",
+		   self->graphics_api == GRAPHICS_VULKAN ? "Vulkan" : "OpenGL");
 
 	if (self->hand_tracking.system_supported) {
 		result = xrGetInstanceProcAddr(self->instance, "xrLocateHandJointsEXT", (PFN_xrVoidFunction*)&self->hand_tracking.pfnLocateHandJointsEXT);
@@ -517,6 +861,15 @@ int init_openxr(XrExample* self)
 		}
 	}
 
+	if (self->visibility_mask.supported) {
+		result = xrGetInstanceProcAddr(self->instance, "xrGetVisibilityMaskKHR",
+									   (PFN_xrVoidFunction*)&self->visibility_mask.pfnGetVisibilityMaskKHR);
+		if (!xr_result(self->instance, result, "Failed to get xrGetVisibilityMaskKHR function!"))
+			self->visibility_mask.supported = false;
+	}
+	// fetched before the first frame is rendered
+	self->visibility_mask.dirty.resize(view_count, self->visibility_mask.supported);
+
 	XrReferenceSpaceType play_space_type = XR_REFERENCE_SPACE_TYPE_LOCAL;
 	// We could check if our ref space type is supported, but next call will error anyway if not
 	print_reference_spaces(self);
@@ -555,6 +908,14 @@ int init_openxr(XrExample* self)
 	// GL_DEPTH_COMPONENT16, GL_DEPTH_COMPONENT32F
 	int64_t preferred_depth_swapchain_format = GL_DEPTH_COMPONENT32F;
 	int64_t preferred_quad_swapchain_format = GL_RGBA8_EXT;
+#ifdef XR_EXAMPLE_VULKAN
+	if (self->graphics_api == GRAPHICS_VULKAN) {
+		preferred_swapchain_format = VK_FORMAT_R8G8B8A8_SRGB;
+		// vkimpl.cpp renders into its own depth images
+		preferred_depth_swapchain_format = -1;
+		preferred_quad_swapchain_format = VK_FORMAT_R8G8B8A8_UNORM;
+	}
+#endif
 
 	self->swapchain_format = swapchain_formats[0];
 	self->quad_swapchain_format = swapchain_formats[0];
@@ -562,7 +923,7 @@ int init_openxr(XrExample* self)
 	self->depth_swapchain_format = -1;
 	for (auto& swapchain_format : swapchain_formats)
 	{
-		printf("Supported GL format: %#lx\n", swapchain_format);
+		printf("Supported format: %#lx\n", swapchain_format);
 		if (swapchain_format == preferred_swapchain_format) {
 			self->swapchain_format = swapchain_format;
 			printf("Using preferred swapchain format %#lx\n", self->swapchain_format);
@@ -581,6 +942,77 @@ int init_openxr(XrExample* self)
 	if (self->swapchain_format != preferred_swapchain_format) {
 		printf("Using non preferred swapchain format %#lx\n", self->swapchain_format);
 	}
+
+	if (self->graphics_api == GRAPHICS_VULKAN) {
+#ifdef XR_EXAMPLE_VULKAN
+		if (!vk_init_pipeline(self->swapchain_format)) {
+			printf("Vulkan pipeline setup failed!\n");
+			return 1;
+		}
+#endif
+	}
+
+	// set OXR_DYNRES=min:max to scale the rendered resolution between min and max times the
+	// recommended resolution, e.g. OXR_DYNRES=0.5:1.2
+	dynres_settings dynres_settings;
+	dynres_default_settings(&dynres_settings);
+	const char* dynres_env = getenv("OXR_DYNRES");
+	self->dynamic_resolution.enabled = dynres_env != NULL;
+	if (dynres_env != NULL) {
+		if (sscanf(dynres_env, "%f:%f", &dynres_settings.min_scale, &dynres_settings.max_scale) != 2 ||
+			dynres_settings.min_scale <= 0.f || dynres_settings.max_scale <= 0.f) {
+			printf("OXR_DYNRES must be min:max, e.g. 0.5:1.2, using the defaults\n");
+			dynres_default_settings(&dynres_settings);
+		}
+		if (dynres_settings.min_scale > dynres_settings.max_scale)
+			dynres_settings.min_scale = dynres_settings.max_scale;
+		printf("Dynamic resolution scale %.2f - %.2f\n", dynres_settings.min_scale,
+			   dynres_settings.max_scale);
+	} else {
+		dynres_settings.min_scale = dynres_settings.max_scale = 1.f;
+	}
+	dynres_init(&self->dynamic_resolution.controller, &dynres_settings);
+
+	// set OXR_HALF_RATE=always|auto to render the eyes every other frame, always or only
+	// while the GPU time does not fit into a display period
+	halfrate_settings halfrate_settings;
+	halfrate_default_settings(&halfrate_settings);
+	const char* halfrate_env = getenv("OXR_HALF_RATE");
+	if (halfrate_env != NULL) {
+		if (strcmp(halfrate_env, "always") == 0)
+			halfrate_settings.mode = HALFRATE_ALWAYS;
+		else if (strcmp(halfrate_env, "auto") == 0)
+			halfrate_settings.mode = HALFRATE_AUTO;
+		else
+			printf("Unknown OXR_HALF_RATE=%s, use always or auto\n", halfrate_env);
+	}
+	halfrate_init(&self->half_rate, &halfrate_settings);
+	if (halfrate_settings.mode != HALFRATE_OFF)
+		printf("Half rate eye rendering %s\n", halfrate_env);
+
+	// set OXR_HAND_FILTER=off to draw the raw hand joints, OXR_HAND_PREDICT_MS=ms to
+	// extrapolate them with their velocities
+	pose_filter_settings filter_settings;
+	pose_filter_default_settings(&filter_settings);
+	const char* hand_filter_env = getenv("OXR_HAND_FILTER");
+	if (hand_filter_env != NULL && strcmp(hand_filter_env, "off") == 0)
+		filter_settings.enabled = false;
+	const char* hand_predict_env = getenv("OXR_HAND_PREDICT_MS");
+	if (hand_predict_env != NULL)
+		filter_settings.prediction_s = (float)atof(hand_predict_env) / 1000.f;
+	pose_filter_init(&self->hand_tracking.filter, &filter_settings);
+
+	// swapchains have to fit the largest scale, the runtime may not allow more than max
+	self->swapchain_extents.resize(view_count);
+	for (uint32_t i = 0; i < view_count; i++) {
+		uint32_t width = (uint32_t)(self->viewconfig_views[i].recommendedImageRectWidth * dynres_settings.max_scale);
+		uint32_t height = (uint32_t)(self->viewconfig_views[i].recommendedImageRectHeight * dynres_settings.max_scale);
+		if (width > self->viewconfig_views[i].maxImageRectWidth)
+			width = self->viewconfig_views[i].maxImageRectWidth;
+		if (height > self->viewconfig_views[i].maxImageRectHeight)
+			height = self->viewconfig_views[i].maxImageRectHeight;
+		self->swapchain_extents[i] = {(int32_t)width, (int32_t)height};
+	}
 	/* All OpenGL textures that will be submitted in xrEndFrame are created by the runtime here.
 	 * The runtime will give us a number (not controlled by us) of OpenGL textures per swapchain
 	 * and tell us with xrAcquireSwapchainImage, which of those we can render to per frame.
@@ -596,8 +1028,8 @@ int init_openxr(XrExample* self)
 		swapchain_create_info.createFlags = 0;
 		swapchain_create_info.format = self->swapchain_format;
 		swapchain_create_info.sampleCount = self->viewconfig_views[i].recommendedSwapchainSampleCount;
-		swapchain_create_info.width = self->viewconfig_views[i].recommendedImageRectWidth;
-		swapchain_create_info.height = self->viewconfig_views[i].recommendedImageRectHeight;
+		swapchain_create_info.width = self->swapchain_extents[i].width;
+		swapchain_create_info.height = self->swapchain_extents[i].height;
 		swapchain_create_info.faceCount = 1;
 		swapchain_create_info.arraySize = 1;
 		swapchain_create_info.mipCount = 1;
@@ -607,6 +1039,20 @@ int init_openxr(XrExample* self)
 		if (!xr_result(self->instance, result, "Failed to create swapchain %d!", i))
 			return 1;
 
+		if (self->graphics_api == GRAPHICS_VULKAN) {
+#ifdef XR_EXAMPLE_VULKAN
+			if (i >= VK_TARGET_MAX_EYES) {
+				printf("Vulkan backend supports only %d views!\n", VK_TARGET_MAX_EYES);
+				return 1;
+			}
+			if (!vk_add_swapchain((vk_target)(VK_TARGET_EYE + i), self->swapchains[i],
+								  self->swapchain_format, swapchain_create_info.width,
+								  swapchain_create_info.height))
+				return 1;
+#endif
+			continue;
+		}
+
 		uint32_t swapchain_length;
 		result = xrEnumerateSwapchainImages(self->swapchains[i], 0, &swapchain_length, nullptr);
 		if (!xr_result(self->instance, result, "Failed to enumerate swapchains"))
@@ -625,15 +1071,20 @@ int init_openxr(XrExample* self)
 	 * This is not mandated by OpenXR, other ways to render to textures will work too.
 	 */
 	self->framebuffers.resize(view_count);
-	for (uint32_t i = 0; i < view_count; i++) {
+	for (uint32_t i = 0; i < view_count && self->graphics_api == GRAPHICS_OPENGL; i++) {
 		self->framebuffers[i].resize(self->images[i].size());
 		glGenFramebuffers(self->framebuffers[i].size(), self->framebuffers[i].data());
 	}
 
-	if (self->depth_swapchain_format == -1) {
+	if (self->depth_swapchain_format == -1 && preferred_depth_swapchain_format != -1) {
 		printf("Preferred depth swapchain format %#lx not supported!\n",
 			   preferred_depth_swapchain_format);
 	}
+	// without depth swapchains there is nothing to put into the depth infos
+	if (self->depth.supported && self->depth_swapchain_format == -1) {
+		printf("Not submitting depth, no depth swapchain format\n");
+		self->depth.supported = false;
+	}
 
 	if (self->depth_swapchain_format != -1) {
 		self->depth_swapchains.resize(view_count);
@@ -645,8 +1096,8 @@ int init_openxr(XrExample* self)
 			swapchain_create_info.createFlags = 0;
 			swapchain_create_info.format = self->depth_swapchain_format;
 			swapchain_create_info.sampleCount = self->viewconfig_views[i].recommendedSwapchainSampleCount;
-			swapchain_create_info.width = self->viewconfig_views[i].recommendedImageRectWidth;
-			swapchain_create_info.height = self->viewconfig_views[i].recommendedImageRectHeight;
+			swapchain_create_info.width = self->swapchain_extents[i].width;
+			swapchain_create_info.height = self->swapchain_extents[i].height;
 			swapchain_create_info.faceCount = 1;
 			swapchain_create_info.arraySize = 1;
 			swapchain_create_info.mipCount = 1;
@@ -669,70 +1120,39 @@ int init_openxr(XrExample* self)
 		}
 	}
 
+	layer_content_init(self->session, self->graphics_api == GRAPHICS_VULKAN);
 	{
 		self->quad_pixel_width = 800;
 		self->quad_pixel_height = 600;
-		XrSwapchainCreateInfo swapchain_create_info;
-		swapchain_create_info.type = XR_TYPE_SWAPCHAIN_CREATE_INFO;
-		swapchain_create_info.usageFlags = XR_SWAPCHAIN_USAGE_SAMPLED_BIT | XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT;
-		swapchain_create_info.createFlags = 0;
-		swapchain_create_info.format = self->quad_swapchain_format;
-		swapchain_create_info.sampleCount = 1;
-		swapchain_create_info.width = self->quad_pixel_width;
-		swapchain_create_info.height = self->quad_pixel_height;
-		swapchain_create_info.faceCount = 1;
-		swapchain_create_info.arraySize = 1;
-		swapchain_create_info.mipCount = 1;
-		swapchain_create_info.next = NULL;
-
-		result = xrCreateSwapchain(self->session, &swapchain_create_info, &self->quad_swapchain);
-		if (!xr_result(self->instance, result, "Failed to create swapchain!"))
-			return 1;
-
-		result = xrEnumerateSwapchainImages(self->quad_swapchain, 0, &self->quad_swapchain_length, NULL);
-		if (!xr_result(self->instance, result, "Failed to enumerate swapchains"))
-			return 1;
-
-		// these are wrappers for the actual OpenGL texture id
-		self->quad_images.resize(self->quad_swapchain_length, { XR_TYPE_SWAPCHAIN_IMAGE_OPENGL_KHR , nullptr});
-		result = xrEnumerateSwapchainImages(self->quad_swapchain, self->quad_swapchain_length,
-											&self->quad_swapchain_length,
-											(XrSwapchainImageBaseHeader*)self->quad_images.data());
-		if (!xr_result(self->instance, result, "Failed to enumerate swapchain images"))
+		layer_content_desc desc = {
+			.kind = LAYER_CONTENT_PATTERN,
+			.format = self->quad_swapchain_format,
+			.width = self->quad_pixel_width,
+			.height = self->quad_pixel_height,
+			.face_count = 1,
+			.create_flags = 0,
+		};
+		self->quad_content = layer_content_acquire(&desc);
+		if (self->quad_content == LAYER_CONTENT_INVALID)
 			return 1;
 	}
 
+	self->cylinder.content = LAYER_CONTENT_INVALID;
 	if (self->cylinder.supported) {
 		self->cylinder.swapchain_width = 800;
 		self->cylinder.swapchain_height = 600;
-		XrSwapchainCreateInfo swapchain_create_info;
-		swapchain_create_info.type = XR_TYPE_SWAPCHAIN_CREATE_INFO;
-		swapchain_create_info.usageFlags = XR_SWAPCHAIN_USAGE_SAMPLED_BIT | XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT;
-		swapchain_create_info.createFlags = 0;
-		swapchain_create_info.format = self->cylinder.format;
-		swapchain_create_info.sampleCount = 1;
-		swapchain_create_info.width = self->cylinder.swapchain_width;
-		swapchain_create_info.height = self->cylinder.swapchain_height;
-		swapchain_create_info.faceCount = 1;
-		swapchain_create_info.arraySize = 1;
-		swapchain_create_info.mipCount = 1;
-		swapchain_create_info.next = NULL;
-
-		result = xrCreateSwapchain(self->session, &swapchain_create_info, &self->cylinder.swapchain);
-		if (!xr_result(self->instance, result, "Failed to create swapchain!"))
-			return 1;
-
-		result = xrEnumerateSwapchainImages(self->cylinder.swapchain, 0,
-											&self->cylinder.swapchain_length, NULL);
-		if (!xr_result(self->instance, result, "Failed to enumerate swapchains"))
-			return 1;
-
-		// these are wrappers for the actual OpenGL texture id
-		self->cylinder.images.resize(self->cylinder.swapchain_length, { XR_TYPE_SWAPCHAIN_IMAGE_OPENGL_KHR , nullptr});
-		result = xrEnumerateSwapchainImages(self->cylinder.swapchain, self->cylinder.swapchain_length,
-											&self->cylinder.swapchain_length,
-											(XrSwapchainImageBaseHeader*)self->cylinder.images.data());
-		if (!xr_result(self->instance, result, "Failed to enumerate swapchain images"))
+		// the cylinder shows the quad pattern too, so it only gets its own swapchain
+		// when its size or format differ
+		layer_content_desc desc = {
+			.kind = LAYER_CONTENT_PATTERN,
+			.format = self->cylinder.format,
+			.width = self->cylinder.swapchain_width,
+			.height = self->cylinder.swapchain_height,
+			.face_count = 1,
+			.create_flags = 0,
+		};
+		self->cylinder.content = layer_content_acquire(&desc);
+		if (self->cylinder.content == LAYER_CONTENT_INVALID)
 			return 1;
 	}
 
@@ -781,210 +1201,389 @@ int init_openxr(XrExample* self)
 		};
 	}
 
+	if (!init_layers(self))
+		return 1;
+
+	apply_render_scale(self, self->dynamic_resolution.controller.scale);
+
 	return 0;
 }
 
-void main_loop(XrExample* self)
+// GPU time of the last frame that has finished rendering, negative if none has yet
+float last_gpu_frame_ms(XrExample* self)
 {
-	XrResult result;
+#ifdef XR_EXAMPLE_VULKAN
+	if (self->graphics_api == GRAPHICS_VULKAN)
+		return vk_last_frame_ms();
+#endif
+	return gpu_timer_last_frame_ms();
+}
 
-	XrActionSetCreateInfo main_actionset_info = { .type = XR_TYPE_ACTION_SET_CREATE_INFO, .next = NULL, .priority = 0};
-	strcpy(main_actionset_info.actionSetName, "mainactions");
-	strcpy(main_actionset_info.localizedActionSetName, "Main Actions");
+// GPU time of the eye passes of the last finished frame, the part that the render
+// scale changes, negative if none has finished yet
+float last_gpu_eyes_ms(XrExample* self)
+{
+#ifdef XR_EXAMPLE_VULKAN
+	if (self->graphics_api == GRAPHICS_VULKAN)
+		return vk_last_eyes_ms();
+#endif
+	return gpu_timer_last_eyes_ms();
+}
+
+#ifdef XR_EXAMPLE_VULKAN
+// Renders all eyes and layers into one command buffer. All swapchain images are acquired
+// first and released after the single submit, instead of waiting for the GPU per image.
+// everything the workers need to record one target each
+struct vulkan_record_job
+{
+	XrExample* self;
+	XrView* views;
+	// eyes at the start of the target list, 0 while half rate skips them
+	uint32_t view_count;
+	uint32_t* acquired_indices;
+	// content of the targets after the eyes
+	layer_content_id* contents;
+	const scene_draw_list* draw_list;
+	const cull_result* culled;
+	XrTime predictedDisplayTime;
+};
+
+// index is the position in the swapchains[] list of render_frame_vulkan: eyes, then layer contents
+static void record_vulkan_target(void* data, uint32_t index)
+{
+	vulkan_record_job* job = (vulkan_record_job*)data;
+	XrExample* self = job->self;
 
-	XrActionSet main_actionset;
-	result = xrCreateActionSet(self->instance, &main_actionset_info, &main_actionset);
-	if (!xr_result(self->instance, result, "failed to create actionset"))
+	if (index >= job->view_count) {
+		layer_content_id content = job->contents[index - job->view_count];
+		vk_render_quad((vk_target)(VK_TARGET_LAYER + content), job->acquired_indices[index],
+					   self->layer_content_producer, job->predictedDisplayTime);
 		return;
+	}
 
-	xrStringToPath(self->instance, "/user/hand/left", &self->hand_paths[HAND_LEFT]);
-	xrStringToPath(self->instance, "/user/hand/right", &self->hand_paths[HAND_RIGHT]);
+	XrView* view = &job->views[index];
 
-	XrAction grab_action_float;
-	{
-		XrActionCreateInfo action_info = {.type = XR_TYPE_ACTION_CREATE_INFO,
-										  .next = NULL,
-										  .actionType = XR_ACTION_TYPE_FLOAT_INPUT,
-										  .countSubactionPaths = HAND_COUNT,
-										  .subactionPaths = self->hand_paths.data()};
-		strcpy(action_info.actionName, "grabobjectfloat");
-		strcpy(action_info.localizedActionName, "Grab Object");
-
-		result = xrCreateAction(main_actionset, &action_info, &grab_action_float);
-		if (!xr_result(self->instance, result, "failed to create grab action"))
-			return;
+	// Vulkan clip space has y down and a depth range of [0, 1]
+	XrMatrix4x4f projection_matrix;
+	XrMatrix4x4f_CreateProjectionFov(&projection_matrix, GRAPHICS_VULKAN, view->fov, self->near_z,
+									 self->far_z);
+
+	XrMatrix4x4f view_matrix;
+	XrMatrix4x4f_CreateViewMatrix(&view_matrix, &view->pose.position, &view->pose.orientation);
+
+	self->projection_views[index].pose = view->pose;
+	self->projection_views[index].fov = view->fov;
+
+	vk_render_frame((vk_target)(VK_TARGET_EYE + index), job->acquired_indices[index],
+					self->projection_views[index].subImage.imageRect.extent.width,
+					self->projection_views[index].subImage.imageRect.extent.height, projection_matrix,
+					view_matrix, job->draw_list, job->culled->visible[index],
+					job->culled->visible_count[index]);
+}
+
+bool render_frame_vulkan(XrExample* self,
+						 XrView* views,
+						 bool render_eyes,
+						 const scene_draw_list* draw_list,
+						 const cull_result* culled,
+						 XrTime predictedDisplayTime)
+{
+	XrResult result;
+	uint32_t view_count = self->viewconfig_views.size();
+
+	// eyes first, then each layer content that is due, once no matter how many layers show it
+	XrSwapchain swapchains[VK_TARGET_COUNT];
+	uint32_t acquired_indices[VK_TARGET_COUNT];
+	layer_content_id contents[LAYER_CONTENT_MAX];
+	uint32_t swapchain_count = 0;
+	uint32_t content_count = 0;
+	uint32_t eye_count = render_eyes ? view_count : 0;
+	for (uint32_t i = 0; i < eye_count; i++) {
+		swapchains[swapchain_count++] = self->swapchains[i];
+	}
+	for (layer_content_id id = 0; id < LAYER_CONTENT_MAX; id++) {
+		if (!layer_manager_content_due(id))
+			continue;
+		contents[content_count++] = id;
+		swapchains[swapchain_count++] = layer_content_swapchain(id);
 	}
 
-	// just an example that could sensibly use one axis of e.g. a thumbstick
-	XrAction throttle_action_float;
-	{
-		XrActionCreateInfo action_info = {.type = XR_TYPE_ACTION_CREATE_INFO,
-										  .next = NULL,
-										  .actionType = XR_ACTION_TYPE_FLOAT_INPUT,
-										  .countSubactionPaths = HAND_COUNT,
-										  .subactionPaths = self->hand_paths.data() };
-		strcpy(action_info.actionName, "throttle");
-		strcpy(action_info.localizedActionName, "Use Throttle forward/backward");
-
-		result = xrCreateAction(main_actionset, &action_info, &throttle_action_float);
-		if (!xr_result(self->instance, result, "failed to create throttle action"))
-			return;
+	if (!vk_begin_frame())
+		return false;
+
+	for (uint32_t i = 0; i < swapchain_count; i++) {
+		XrSwapchainImageAcquireInfo acquire_info = {.type = XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO,
+													.next = NULL};
+		result = xrAcquireSwapchainImage(swapchains[i], &acquire_info, &acquired_indices[i]);
+		if (!xr_result(self->instance, result, "failed to acquire swapchain image!"))
+			return false;
+
+		XrSwapchainImageWaitInfo wait_info = {
+			.type = XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO, .next = NULL, .timeout = 1000};
+		result = xrWaitSwapchainImage(swapchains[i], &wait_info);
+		if (!xr_result(self->instance, result, "failed to wait for swapchain image!"))
+			return false;
 	}
 
-	XrAction pose_action;
-	{
-		XrActionCreateInfo action_info = {.type = XR_TYPE_ACTION_CREATE_INFO,
-										  .next = NULL,
-										  .actionType = XR_ACTION_TYPE_POSE_INPUT,
-										  .countSubactionPaths = HAND_COUNT,
-										  .subactionPaths = self->hand_paths.data() };
-		strcpy(action_info.actionName, "handpose");
-		strcpy(action_info.localizedActionName, "Hand Pose");
-
-		result = xrCreateAction(main_actionset, &action_info, &pose_action);
-		if (!xr_result(self->instance, result, "failed to create pose action"))
-			return;
+	// fork-join: every eye and layer records its own secondary command buffer, the
+	// primary one that executes them is submitted once by vk_end_frame()
+	vulkan_record_job job = {.self = self,
+							 .views = views,
+							 .view_count = eye_count,
+							 .acquired_indices = acquired_indices,
+							 .contents = contents,
+							 .draw_list = draw_list,
+							 .culled = culled,
+							 .predictedDisplayTime = predictedDisplayTime};
+	job_run("record target", swapchain_count, record_vulkan_target, &job);
+
+	if (!vk_end_frame())
+		return false;
+
+	// the runtime waits for the submitted work itself
+	for (uint32_t i = 0; i < swapchain_count; i++) {
+		XrSwapchainImageReleaseInfo release_info = {.type = XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO,
+													.next = NULL};
+		result = xrReleaseSwapchainImage(swapchains[i], &release_info);
+		if (!xr_result(self->instance, result, "failed to release swapchain image!"))
+			return false;
 	}
+	return true;
+}
+#endif
 
-	XrAction haptic_action;
-	{
-		XrActionCreateInfo action_info = {.type = XR_TYPE_ACTION_CREATE_INFO,
-										  .next = NULL,
-										  .actionType = XR_ACTION_TYPE_VIBRATION_OUTPUT,
-										  .countSubactionPaths = HAND_COUNT,
-										  .subactionPaths = self->hand_paths.data() };
-		strcpy(action_info.actionName, "haptic");
-		strcpy(action_info.localizedActionName, "Haptic Vibration");
-		result = xrCreateAction(main_actionset, &action_info, &haptic_action);
-		if (!xr_result(self->instance, result, "failed to create haptic action"))
-			return;
+void init_scene(XrExample* self)
+{
+	scene_add_default_objects();
+	scene_add_environment_objects();
+
+	// set OXR_STRESS_CUBES=count to add a grid of small cubes
+	const char* stress_env = getenv("OXR_STRESS_CUBES");
+	if (stress_env != NULL)
+		scene_add_stress_cubes((uint32_t)atoi(stress_env));
+
+	XrPosef identity = {.orientation = {.x = 0.f, .y = 0.f, .z = 0.f, .w = 1.f}, .position = {}};
+	for (int hand = 0; hand < HAND_COUNT; hand++) {
+		scene_material material = hand == HAND_LEFT ? SCENE_MATERIAL_LEFT_HAND : SCENE_MATERIAL_RIGHT_HAND;
+
+		XrVector3f controller_scale = {.x = .05f, .y = .05f, .z = .2f};
+		self->hand_objects.controllers[hand] = scene_add(SCENE_MESH_CUBE, material, identity, controller_scale);
+		scene_set_visible(self->hand_objects.controllers[hand], false);
+		scene_set_pickable(self->hand_objects.controllers[hand], false);
+
+		for (uint32_t i = 0; i < XR_HAND_JOINT_COUNT_EXT; i++) {
+			self->hand_objects.joints[hand][i] = scene_add(SCENE_MESH_CUBE, material, identity, {});
+			scene_set_visible(self->hand_objects.joints[hand][i], false);
+			scene_set_pickable(self->hand_objects.joints[hand][i], false);
+		}
 	}
+	printf("Scene has %u objects\n", scene_object_count());
+}
 
-	XrPath select_click_path[HAND_COUNT];
-	xrStringToPath(self->instance, "/user/hand/left/input/select/click",
-				   &select_click_path[HAND_LEFT]);
-	xrStringToPath(self->instance, "/user/hand/right/input/select/click",
-				   &select_click_path[HAND_RIGHT]);
+// controller blocks are only shown while the hand is not tracked
+static void update_hand_objects(XrExample* self,
+								const input_snapshot* input,
+								XrHandJointLocationsEXT* joint_locations)
+{
+	for (int hand = 0; hand < HAND_COUNT; hand++) {
+		bool tracked = joint_locations[hand].isActive;
+		const input_hand* controller_input = &input->hands[hand];
+
+		scene_handle controller = self->hand_objects.controllers[hand];
+		scene_set_visible(controller, !tracked && controller_input->location_valid);
+		if (!tracked && controller_input->location_valid)
+			scene_set_pose(controller, controller_input->location.pose);
+
+		for (uint32_t i = 0; i < XR_HAND_JOINT_COUNT_EXT; i++) {
+			scene_handle joint = self->hand_objects.joints[hand][i];
+			XrHandJointLocationEXT* joint_location =
+				tracked && i < joint_locations[hand].jointCount ? &joint_locations[hand].jointLocations[i] : NULL;
+			bool valid = joint_location != NULL &&
+						 (joint_location->locationFlags & XR_SPACE_LOCATION_POSITION_VALID_BIT);
+			scene_set_visible(joint, valid);
+			if (!valid)
+				continue;
+
+			float size = joint_location->radius;
+			scene_set_pose(joint, joint_location->pose);
+			scene_set_scale(joint, XrVector3f{.x = size, .y = size, .z = size});
+		}
+	}
+}
 
-	XrPath trigger_value_path[HAND_COUNT];
-	xrStringToPath(self->instance, "/user/hand/left/input/trigger/value",
-				   &trigger_value_path[HAND_LEFT]);
-	xrStringToPath(self->instance, "/user/hand/right/input/trigger/value",
-				   &trigger_value_path[HAND_RIGHT]);
+// tracked hands touch objects with their joints, controllers point at them
+static void update_hand_interaction(XrExample* self,
+									const input_snapshot* input,
+									XrHandJointLocationsEXT* joint_locations)
+{
+	TRACE_SCOPE("update_hand_interaction");
+
+	for (scene_handle handle : self->hand_objects.highlighted)
+		scene_set_highlighted(handle, false);
+	self->hand_objects.highlighted.clear();
+
+	for (int hand = 0; hand < HAND_COUNT; hand++) {
+		if (joint_locations[hand].isActive) {
+			// all joints of a hand in one query
+			XrVector3f centers[XR_HAND_JOINT_COUNT_EXT];
+			float radii[XR_HAND_JOINT_COUNT_EXT];
+			uint32_t joint_count = 0;
+			for (uint32_t i = 0; i < joint_locations[hand].jointCount && i < XR_HAND_JOINT_COUNT_EXT; i++) {
+				XrHandJointLocationEXT* joint = &joint_locations[hand].jointLocations[i];
+				if (!(joint->locationFlags & XR_SPACE_LOCATION_POSITION_VALID_BIT))
+					continue;
+				centers[joint_count] = joint->pose.position;
+				radii[joint_count++] = joint->radius;
+			}
 
-	XrPath thumbstick_y_path[HAND_COUNT];
-	xrStringToPath(self->instance, "/user/hand/left/input/thumbstick/y",
-				   &thumbstick_y_path[HAND_LEFT]);
-	xrStringToPath(self->instance, "/user/hand/right/input/thumbstick/y",
-				   &thumbstick_y_path[HAND_RIGHT]);
+			scene_handle touched[16];
+			uint32_t count = scene_overlap_spheres(centers, radii, joint_count, touched, 16);
+			for (uint32_t j = 0; j < count && j < 16; j++)
+				self->hand_objects.highlighted.push_back(touched[j]);
+			continue;
+		}
 
-	XrPath grip_pose_path[HAND_COUNT];
-	xrStringToPath(self->instance, "/user/hand/left/input/grip/pose", &grip_pose_path[HAND_LEFT]);
-	xrStringToPath(self->instance, "/user/hand/right/input/grip/pose", &grip_pose_path[HAND_RIGHT]);
+		const XrPosef* pose = &input->hands[hand].location.pose;
+		if (!input->hands[hand].location_valid)
+			continue;
 
-	XrPath haptic_path[HAND_COUNT];
-	xrStringToPath(self->instance, "/user/hand/left/output/haptic", &haptic_path[HAND_LEFT]);
-	xrStringToPath(self->instance, "/user/hand/right/output/haptic", &haptic_path[HAND_RIGHT]);
+		// the controller points along its -z axis
+		XrMatrix4x4f rotation;
+		XrMatrix4x4f_CreateFromQuaternion(&rotation, &pose->orientation);
+		XrVector3f direction = {.x = -rotation.m[8], .y = -rotation.m[9], .z = -rotation.m[10]};
 
-	{
-		XrPath interaction_profile_path;
-		result = xrStringToPath(self->instance, "/interaction_profiles/khr/simple_controller",
-								&interaction_profile_path);
-		if (!xr_result(self->instance, result, "failed to get interaction profile"))
-			return;
+		float distance;
+		scene_handle hit = scene_raycast(pose->position, direction, 10.f, &distance);
+		if (hit != SCENE_HANDLE_INVALID)
+			self->hand_objects.highlighted.push_back(hit);
+	}
 
-		const XrActionSuggestedBinding bindings[] = {
-			{.action = pose_action, .binding = grip_pose_path[HAND_LEFT]},
-			{.action = pose_action, .binding = grip_pose_path[HAND_RIGHT]},
-			{.action = grab_action_float, .binding = select_click_path[HAND_LEFT]},
-			{.action = grab_action_float, .binding = select_click_path[HAND_RIGHT]},
-			{.action = haptic_action, .binding = haptic_path[HAND_LEFT]},
-			{.action = haptic_action, .binding = haptic_path[HAND_RIGHT]},
-		};
+	for (scene_handle handle : self->hand_objects.highlighted)
+		scene_set_highlighted(handle, true);
+}
 
-		const XrInteractionProfileSuggestedBinding suggested_bindings = {
-			.type = XR_TYPE_INTERACTION_PROFILE_SUGGESTED_BINDING,
-			.next = NULL,
-			.interactionProfile = interaction_profile_path,
-			.countSuggestedBindings = sizeof(bindings) / sizeof(bindings[0]),
-			.suggestedBindings = bindings};
+struct hand_joints_job
+{
+	XrExample* self;
+	XrTime time;
+	XrHandJointLocationsEXT* joint_locations;
+};
 
-		xrSuggestInteractionProfileBindings(self->instance, &suggested_bindings);
-		if (!xr_result(self->instance, result, "failed to suggest bindings"))
-			return;
-	}
+static void locate_hand_joints(void* data, uint32_t i)
+{
+	hand_joints_job* job = (hand_joints_job*)data;
+	XrExample* self = job->self;
 
-	{
-		XrPath interaction_profile_path;
-		result = xrStringToPath(self->instance, "/interaction_profiles/valve/index_controller",
-								&interaction_profile_path);
-		if (!xr_result(self->instance, result, "failed to get interaction profile"))
-			return;
+	if (self->hand_tracking.trackers[i] == NULL)
+		return;
 
-		const XrActionSuggestedBinding bindings[] = {
-			{.action = pose_action, .binding = grip_pose_path[HAND_LEFT]},
-			{.action = pose_action, .binding = grip_pose_path[HAND_RIGHT]},
-			{.action = grab_action_float, .binding = trigger_value_path[HAND_LEFT]},
-			{.action = grab_action_float, .binding = trigger_value_path[HAND_RIGHT]},
-			{.action = throttle_action_float, .binding = thumbstick_y_path[HAND_LEFT]},
-			{.action = throttle_action_float, .binding = thumbstick_y_path[HAND_RIGHT]},
-			{.action = haptic_action, .binding = haptic_path[HAND_LEFT]},
-			{.action = haptic_action, .binding = haptic_path[HAND_RIGHT]},
-		};
+	XrHandJointsLocateInfoEXT locateInfo = {.type = XR_TYPE_HAND_JOINTS_LOCATE_INFO_EXT,
+											.next = NULL,
+											.baseSpace = self->play_space,
+											.time = job->time};
 
-		const XrInteractionProfileSuggestedBinding suggested_bindings = {
-			.type = XR_TYPE_INTERACTION_PROFILE_SUGGESTED_BINDING,
-			.next = NULL,
-			.interactionProfile = interaction_profile_path,
-			.countSuggestedBindings = sizeof(bindings) / sizeof(bindings[0]),
-			.suggestedBindings = bindings};
+	XrResult result = self->hand_tracking.pfnLocateHandJointsEXT(self->hand_tracking.trackers[i],
+																 &locateInfo, &job->joint_locations[i]);
+	xr_result(self->instance, result, "failed to locate hand %u joints!", i);
+}
 
-		xrSuggestInteractionProfileBindings(self->instance, &suggested_bindings);
-		if (!xr_result(self->instance, result, "failed to suggest bindings"))
-			return;
+// the grab action vibrates the hand while it is held, the haptics thread keeps the
+// vibration going so it is only queued when the grab starts and released when it ends
+static void apply_grab_haptics(XrExample* self, const input_snapshot* input)
+{
+	for (int i = 0; i < HAND_COUNT; i++) {
+		const XrActionStateFloat* grab = &input->hands[i].grab;
+		bool held = grab->isActive && grab->currentState > 0.75;
+		if (held && self->grab_haptics[i] == 0) {
+			haptic_effect vibration = {.kind = HAPTIC_ENVELOPE,
+									   .amplitude = 0.5f,
+									   .frequency = XR_FREQUENCY_UNSPECIFIED,
+									   .duration_s = -1.f,
+									   .attack_s = 0.02f,
+									   .release_s = 0.05f};
+			self->grab_haptics[i] = haptics_play(i, &vibration);
+		} else if (!held && self->grab_haptics[i] != 0) {
+			// with the command ring full the release is tried again next frame
+			if (haptics_release(i, self->grab_haptics[i]))
+				self->grab_haptics[i] = 0;
+		}
 	}
+}
 
-	// poses can't be queried directly, we need to create a space for each
-	XrSpace pose_action_spaces[HAND_COUNT];
-	{
-		XrActionSpaceCreateInfo action_space_info;
-		action_space_info.type = XR_TYPE_ACTION_SPACE_CREATE_INFO;
-		action_space_info.next = NULL;
-		action_space_info.action = pose_action;
-		action_space_info.poseInActionSpace = identity_pose;
-		action_space_info.subactionPath = self->hand_paths[HAND_LEFT];
-
-		result = xrCreateActionSpace(self->session, &action_space_info, &pose_action_spaces[HAND_LEFT]);
-		if (!xr_result(self->instance, result, "failed to create left hand pose space"))
-			return;
+void main_loop(XrExample* self)
+{
+	XrResult result;
+
+	if (!input_init(self->instance, self->session, self->play_space))
+		return;
+
+	// set OXR_INPUT_RATE=Hz to sample the hands between frames, OXR_INPUT_OFFSET_MS
+	// moves the sampled time into the future or the past
+	const char* input_rate_env = getenv("OXR_INPUT_RATE");
+	if (input_rate_env != NULL && atoi(input_rate_env) > 0) {
+		const char* input_offset_env = getenv("OXR_INPUT_OFFSET_MS");
+		input_sampler_settings sampler_settings = {
+			.rate_hz = (uint32_t)atoi(input_rate_env),
+			.offset_ns = input_offset_env != NULL ? (int64_t)(atof(input_offset_env) * 1000000.) : 0,
+			.base_space = self->play_space,
+		};
+		for (int i = 0; i < HAND_COUNT; i++) {
+			sampler_settings.hand_spaces[i] = input_hand_space(i);
+			if (self->hand_tracking.system_supported)
+				sampler_settings.hand_trackers[i] = self->hand_tracking.trackers[i];
+		}
+		if (self->hand_tracking.system_supported)
+			sampler_settings.locate_hand_joints = self->hand_tracking.pfnLocateHandJointsEXT;
+		self->input_samples.resize(INPUT_SAMPLER_RING_SIZE);
+		input_sampler_start(&sampler_settings);
 	}
-	{
-		XrActionSpaceCreateInfo action_space_info;
-		action_space_info.type = XR_TYPE_ACTION_SPACE_CREATE_INFO;
-		action_space_info.next = NULL;
-		action_space_info.action = pose_action;
-		action_space_info.poseInActionSpace = identity_pose;
-		action_space_info.subactionPath = self->hand_paths[HAND_RIGHT];
-
-		result =
-			xrCreateActionSpace(self->session, &action_space_info, &pose_action_spaces[HAND_RIGHT]);
-		if (!xr_result(self->instance, result, "failed to create left hand pose space"))
-			return;
+	self->input_sample_count = 0;
+
+	// set OXR_HAND_RECORD=file to record the hand joints for OXR_BENCHMARK=gesture
+	if (self->hand_tracking.system_supported) {
+		gesture_add_defaults();
+		const char* hand_record_env = getenv("OXR_HAND_RECORD");
+		if (hand_record_env != NULL)
+			gesture_record_open(hand_record_env);
 	}
 
-	XrSessionActionSetsAttachInfo actionset_attach_info = {
-		.type = XR_TYPE_SESSION_ACTION_SETS_ATTACH_INFO,
-		.next = NULL,
-		.countActionSets = 1,
-		.actionSets = &main_actionset};
-	result = xrAttachSessionActionSets(self->session, &actionset_attach_info);
-	if (!xr_result(self->instance, result, "failed to attach action set"))
-		return;
+	// set OXR_HAPTICS_RATE=Hz to change how often the haptics thread updates the vibrations
+	haptics_settings haptic_settings;
+	haptics_default_settings(&haptic_settings);
+	const char* haptics_rate_env = getenv("OXR_HAPTICS_RATE");
+	if (haptics_rate_env != NULL && atoi(haptics_rate_env) > 0)
+		haptic_settings.tick_hz = (uint32_t)atoi(haptics_rate_env);
+	haptics_start(self->session, &haptic_settings);
+
+	// CPU frame timers, reported together with the GPU timers from gpu_timer.h
+	rolling_stats* cpu_frame_stats = stats_get("CPU frame");
+	rolling_stats* frame_interval_stats = stats_get("frame interval");
+	double last_wait_end_ms = -1.;
+	// the statistics with a unit are not milliseconds, they are reported apart
+	rolling_stats* render_scale_stats = stats_get_unit("render scale", "x");
+	rolling_stats* cull_visible_stats = stats_get_unit("cull visible", "count");
+	rolling_stats* cull_culled_stats = stats_get_unit("cull culled", "count");
+	rolling_stats* hand_query_stats = stats_get("hand queries");
+	rolling_stats* hand_filter_stats = stats_get_unit("hand filter", "us");
+	rolling_stats* gesture_stats = stats_get_unit("gesture", "us");
+	rolling_stats* input_stats = stats_get("input");
+	rolling_stats* input_samples_stats = stats_get_unit("input samples", "count");
+	rolling_stats* input_jitter_stats = stats_get("input jitter");
+	rolling_stats* input_latency_stats = stats_get("input latency");
+	rolling_stats* input_dropped_stats = stats_get_unit("input samples dropped", "count");
+	rolling_stats* haptic_calls_stats = stats_get_unit("haptic calls", "count");
+	rolling_stats* worker_utilization_stats = stats_get_unit("worker utilization", "%");
+	rolling_stats* raster_throughput_stats = stats_get_unit("layer raster", "MP/s");
+	rolling_stats* layer_update_stats = stats_get_unit("layer content updates", "count");
+	// percent of the frames that reproject the last eye images
+	rolling_stats* reprojected_stats = stats_get_unit("eyes reprojected", "%");
 
 	int loop_count = 0;
 	while (true) {
 		loop_count++;
 
+		double stage_start = trace_now_us();
+
 		// --- Poll SDL for events so we can exit with esc
 		SDL_Event sdl_event;
 		bool sdl_should_exit = false;
@@ -992,7 +1591,7 @@ void main_loop(XrExample* self)
 			sdl_handle_events(sdl_event, &sdl_should_exit);
 		}
 		if (sdl_should_exit) {
-			printf("Requesting exit...\n");
+			LOG_INFO("Requesting exit...\n");
 			xrRequestExitSession(self->session);
 		}
 
@@ -1010,31 +1609,32 @@ void main_loop(XrExample* self)
 			switch (runtime_event.type) {
 			case XR_TYPE_EVENT_DATA_EVENTS_LOST: {
 				XrEventDataEventsLost* event = (XrEventDataEventsLost*)&runtime_event;
-				printf("EVENT: %d events data lost!\n", event->lostEventCount);
+				LOG_WARN("EVENT: %d events data lost!\n", event->lostEventCount);
 				// do we care if the runtime loses events?
 				break;
 			}
 			case XR_TYPE_EVENT_DATA_INSTANCE_LOSS_PENDING: {
 				XrEventDataInstanceLossPending* event = (XrEventDataInstanceLossPending*)&runtime_event;
-				printf("EVENT: instance loss pending at %lu! Destroying instance.\n", event->lossTime);
+				LOG_WARN("EVENT: instance loss pending at %lu! Destroying instance.\n", event->lossTime);
 				session_stopping = true;
 				break;
 			}
 			case XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED: {
 				XrEventDataSessionStateChanged* event = (XrEventDataSessionStateChanged*)&runtime_event;
-				printf("EVENT: session state changed from %d to %d\n", self->state, event->state);
+				LOG_INFO("EVENT: session state changed from %d to %d\n", self->state, event->state);
 
 				self->state = event->state;
+				trace_counter("session state", self->state);
 
 				if (event->state >= XR_SESSION_STATE_STOPPING) {
-					printf("Session is stopping...\n");
+					LOG_INFO("Session is stopping...\n");
 					// still handle rest of the events instead of immediately quitting
 					session_stopping = true;
 				}
 				break;
 			}
 			case XR_TYPE_EVENT_DATA_REFERENCE_SPACE_CHANGE_PENDING: {
-				printf("EVENT: reference space change pending!\n");
+				LOG_INFO("EVENT: reference space change pending!\n");
 				XrEventDataReferenceSpaceChangePending* event =
 					(XrEventDataReferenceSpaceChangePending*)&runtime_event;
 				(void)event;
@@ -1042,7 +1642,7 @@ void main_loop(XrExample* self)
 				break;
 			}
 			case XR_TYPE_EVENT_DATA_INTERACTION_PROFILE_CHANGED: {
-				printf("EVENT: interaction profile changed!\n");
+				LOG_INFO("EVENT: interaction profile changed!\n");
 				XrEventDataInteractionProfileChanged* event =
 					(XrEventDataInteractionProfileChanged*)&runtime_event;
 				(void)event;
@@ -1050,7 +1650,7 @@ void main_loop(XrExample* self)
 				XrInteractionProfileState state = {.type = XR_TYPE_INTERACTION_PROFILE_STATE};
 
 				for (int i = 0; i < 2; i++) {
-					XrResult res = xrGetCurrentInteractionProfile(self->session, self->hand_paths[i], &state);
+					XrResult res = xrGetCurrentInteractionProfile(self->session, input_hand_path(i), &state);
 					if (!xr_result(self->instance, res, "Failed to get interaction profile for %d", i))
 						continue;
 
@@ -1060,31 +1660,34 @@ void main_loop(XrExample* self)
 					char profile_str[XR_MAX_PATH_LENGTH];
 					res = xrPathToString(self->instance, prof, XR_MAX_PATH_LENGTH, &strl, profile_str);
 					if (!xr_result(self->instance, res, "Failed to get interaction profile path str for %s",
-								   h_p_str(i)))
+								   h_p_str(i).c_str()))
 						continue;
 
-					printf("Event: Interaction profile changed for %s: %s\n", h_p_str(i), profile_str);
+					LOG_INFO("Event: Interaction profile changed for %s: %s\n", h_p_str(i).c_str(), profile_str);
 				}
 				// TODO: do something
 				break;
 			}
 
 			case XR_TYPE_EVENT_DATA_VISIBILITY_MASK_CHANGED_KHR: {
-				printf("EVENT: visibility mask changed!!\n");
+				LOG_INFO("EVENT: visibility mask changed!!\n");
 				XrEventDataVisibilityMaskChangedKHR* event =
 					(XrEventDataVisibilityMaskChangedKHR*)&runtime_event;
-				(void)event;
 				// this event is from an extension
+				if (self->visibility_mask.supported &&
+					event->viewIndex < self->visibility_mask.dirty.size()) {
+					self->visibility_mask.dirty[event->viewIndex] = true;
+				}
 				break;
 			}
 			case XR_TYPE_EVENT_DATA_PERF_SETTINGS_EXT: {
-				printf("EVENT: perf settings!\n");
+				LOG_INFO("EVENT: perf settings!\n");
 				XrEventDataPerfSettingsEXT* event = (XrEventDataPerfSettingsEXT*)&runtime_event;
 				(void)event;
 				// this event is from an extension
 				break;
 			}
-			default: printf("Unhandled event type %d\n", runtime_event.type);
+			default: LOG_WARN("Unhandled event type %d\n", runtime_event.type);
 			}
 
 			runtime_event.type = XR_TYPE_EVENT_DATA_BUFFER;
@@ -1093,15 +1696,17 @@ void main_loop(XrExample* self)
 		if (poll_result == XR_EVENT_UNAVAILABLE) {
 			// processed all events in the queue
 		} else {
-			printf("Failed to poll events!\n");
+			LOG_ERROR("Failed to poll events!\n");
 			break;
 		}
 
 		if (session_stopping) {
-			printf("Quitting main render loop\n");
+			LOG_INFO("Quitting main render loop\n");
 			return;
 		}
 
+		trace_stage("poll events", &stage_start);
+
 		// --- Wait for our turn to do head-pose dependent computation and render a frame
 		XrFrameState frameState = {.type = XR_TYPE_FRAME_STATE, .next = NULL};
 		XrFrameWaitInfo frameWaitInfo = {.type = XR_TYPE_FRAME_WAIT_INFO, .next = NULL};
@@ -1109,44 +1714,46 @@ void main_loop(XrExample* self)
 		if (!xr_result(self->instance, result, "xrWaitFrame() was not successful, exiting..."))
 			break;
 
+		trace_stage("xrWaitFrame", &stage_start);
 
-		XrHandJointLocationEXT joints[HAND_COUNT][XR_HAND_JOINT_COUNT_EXT];
-		XrHandJointLocationsEXT joint_locations[HAND_COUNT] = {{0}};
-		if (self->hand_tracking.system_supported) {
-
-			for (int i = 0; i < HAND_COUNT; i++) {
-
-				joint_locations[i] = XrHandJointLocationsEXT{
-					.type = XR_TYPE_HAND_JOINT_LOCATIONS_EXT,
-					.jointCount = XR_HAND_JOINT_COUNT_EXT,
-					.jointLocations = joints[i],
-				};
-
-				if (self->hand_tracking.trackers[i] == NULL)
-					continue;
+		double wait_end_ms = trace_now_us() / 1000.;
+		input_sampler_set_clock(frameState.predictedDisplayTime, wait_end_ms * 1000.);
+		if (last_wait_end_ms >= 0.)
+			stats_add(frame_interval_stats, (float)(wait_end_ms - last_wait_end_ms));
+		last_wait_end_ms = wait_end_ms;
 
-				XrHandJointsLocateInfoEXT locateInfo = {.type = XR_TYPE_HAND_JOINTS_LOCATE_INFO_EXT,
-														.next = NULL,
-														.baseSpace = self->play_space,
-														.time = frameState.predictedDisplayTime};
+		trace_counter("frame", loop_count);
+		trace_counter("predictedDisplayPeriod (ms)", frameState.predictedDisplayPeriod / 1000000.);
 
-				result = self->hand_tracking.pfnLocateHandJointsEXT(self->hand_tracking.trackers[i],
-																	&locateInfo, &joint_locations[i]);
-				if (!xr_result(self->instance, result, "failed to locate hand %d joints!", i))
-					break;
+		// velocities are only located when the filter predicts with them
+		bool predict_joints = self->hand_tracking.filter.settings.enabled &&
+							  self->hand_tracking.filter.settings.prediction_s > 0.f;
+		XrHandJointLocationEXT joints[HAND_COUNT][XR_HAND_JOINT_COUNT_EXT];
+		XrHandJointVelocityEXT velocities[HAND_COUNT][XR_HAND_JOINT_COUNT_EXT];
+		XrHandJointVelocitiesEXT joint_velocities[HAND_COUNT] = {};
+		XrHandJointLocationsEXT joint_locations[HAND_COUNT] = {};
+		for (int i = 0; i < HAND_COUNT; i++) {
+			joint_velocities[i] = XrHandJointVelocitiesEXT{
+				.type = XR_TYPE_HAND_JOINT_VELOCITIES_EXT,
+				.jointCount = XR_HAND_JOINT_COUNT_EXT,
+				.jointVelocities = velocities[i],
+			};
+			joint_locations[i] = XrHandJointLocationsEXT{
+				.type = XR_TYPE_HAND_JOINT_LOCATIONS_EXT,
+				.next = predict_joints ? &joint_velocities[i] : NULL,
+				.jointCount = XR_HAND_JOINT_COUNT_EXT,
+				.jointLocations = joints[i],
+			};
+		}
 
-				/*
-				if (joint_locations[i].isActive) {
-				  printf("located hand %d joints", i);
-				  for (uint32_t j = 0; j < joint_locations[i].jointCount; j++) {
-					printf("%f ", joint_locations[i].jointLocations[j].radius);
-				  }
-				  printf("\n");
-				} else {
-				  printf("hand %d joints inactive\n", i);
-				}
-				*/
-			}
+		// the hands are located by jobs while this thread locates the views
+		hand_joints_job joints_job = {.self = self,
+									  .time = frameState.predictedDisplayTime,
+									  .joint_locations = joint_locations};
+		job_counter joints_counter = {};
+		if (self->hand_tracking.system_supported) {
+			job_spawn(&joints_counter, "locate hand joints", HAND_COUNT, locate_hand_joints,
+					  &joints_job);
 		}
 
 		// --- Create projection matrices and view matrices for each eye
@@ -1167,110 +1774,104 @@ void main_loop(XrExample* self)
 		XrViewState view_state = {.type = XR_TYPE_VIEW_STATE, .next = NULL};
 		result = xrLocateViews(self->session, &view_locate_info, &view_state, view_count,
 							   &view_count, views.data());
+		// the joint locations point into this stack frame
+		job_wait(&joints_counter);
 		if (!xr_result(self->instance, result, "Could not locate views"))
 			break;
 
-		//! @todo Move this action processing to before xrWaitFrame, probably.
-		const XrActiveActionSet active_actionsets[] = {
-			{.actionSet = main_actionset, .subactionPath = XR_NULL_PATH}};
+		if (self->hand_tracking.system_supported && self->hand_tracking.filter.settings.enabled) {
+			double filter_start_us = trace_now_us();
+			pose_filter_apply(&self->hand_tracking.filter, frameState.predictedDisplayTime, joint_locations,
+							  predict_joints ? joint_velocities : NULL, HAND_COUNT);
+			stats_add(hand_filter_stats, (float)(trace_now_us() - filter_start_us));
+		}
 
-		XrActionsSyncInfo actions_sync_info = {
-			.type = XR_TYPE_ACTIONS_SYNC_INFO,
-			.countActiveActionSets = sizeof(active_actionsets) / sizeof(active_actionsets[0]),
-			.activeActionSets = active_actionsets,
-		};
-		result = xrSyncActions(self->session, &actions_sync_info);
-		xr_result(self->instance, result, "failed to sync actions!");
+		trace_stage("xrLocateViews and hand joints", &stage_start);
 
-		// query each value / location with a subaction path != XR_NULL_PATH
-		// resulting in individual values per hand/.
-		XrActionStateFloat grab_value[HAND_COUNT];
-		XrActionStateFloat throttle_value[HAND_COUNT];
-		XrSpaceLocation hand_locations[HAND_COUNT];
-		bool hand_locations_valid[HAND_COUNT];
+		const gesture_frame* gestures = NULL;
+		if (self->hand_tracking.system_supported) {
+			double gesture_start_us = trace_now_us();
+			gesture_record_frame(frameState.predictedDisplayTime, joint_locations, HAND_COUNT);
+			gestures = gesture_update(frameState.predictedDisplayTime, joint_locations, HAND_COUNT);
+			stats_add(gesture_stats, (float)(trace_now_us() - gesture_start_us));
+			for (uint32_t i = 0; i < gestures->event_count; i++) {
+				const gesture_event* event = &gestures->events[i];
+				LOG_INFO("Gesture %s %s on %s hand\n", gesture_get(event->gesture)->name,
+					   event->kind == GESTURE_EVENT_BEGAN ? "began" : "ended", h_str(event->hand).c_str());
+			}
+		}
 
-		for (int i = 0; i < HAND_COUNT; i++) {
-			XrActionStatePose pose_state = {.type = XR_TYPE_ACTION_STATE_POSE, .next = NULL};
-			{
-				XrActionStateGetInfo get_info = {.type = XR_TYPE_ACTION_STATE_GET_INFO,
-												 .next = NULL,
-												 .action = pose_action,
-												 .subactionPath = self->hand_paths[i]};
-				result = xrGetActionStatePose(self->session, &get_info, &pose_state);
-				xr_result(self->instance, result, "failed to get pose value!");
+		//! @todo Move this action processing to before xrWaitFrame, probably.
+		const input_snapshot* input = input_sync(frameState.predictedDisplayTime);
+		// gestures drive the actions no controller is bound to
+		if (gestures != NULL)
+			input_apply_gestures(gestures);
+		stats_add(input_stats, (float)input->cost_ms);
+		trace_counter("input ms", input->cost_ms);
+
+		// nothing but the poses changed, no button state to react to
+		if (input->changed != 0) {
+			for (int i = 0; i < HAND_COUNT; i++) {
+				const XrActionStateFloat* throttle = &input->hands[i].throttle;
+				if (input_changed(input, INPUT_ACTION_THROTTLE, i) && throttle->isActive &&
+					throttle->currentState != 0)
+					LOG_DEBUG("Throttle value %d: %f\n", i, throttle->currentState);
 			}
-			// printf("Hand pose %d active: %d\n", i, poseState.isActive);
-
-			hand_locations[i].type = XR_TYPE_SPACE_LOCATION;
-			hand_locations[i].next = NULL;
-
-			result = xrLocateSpace(pose_action_spaces[i], self->play_space,
-								   frameState.predictedDisplayTime, &hand_locations[i]);
-			xr_result(self->instance, result, "failed to locate space %d!", i);
-			hand_locations_valid[i] =
-				//(spaceLocation[i].locationFlags & XR_SPACE_LOCATION_POSITION_VALID_BIT) != 0 &&
-				(hand_locations[i].locationFlags & XR_SPACE_LOCATION_ORIENTATION_VALID_BIT) != 0;
-
-			/*
-			printf("Pose %d valid %d: %f %f %f %f, %f %f %f\n", i,
-			spaceLocationValid[i], spaceLocation[0].pose.orientation.x,
-			spaceLocation[0].pose.orientation.y, spaceLocation[0].pose.orientation.z,
-			spaceLocation[0].pose.orientation.w, spaceLocation[0].pose.position.x,
-			spaceLocation[0].pose.position.y, spaceLocation[0].pose.position.z
-			);
-			*/
-
-			grab_value[i].type = XR_TYPE_ACTION_STATE_FLOAT;
-			grab_value[i].next = NULL;
-			{
-				XrActionStateGetInfo get_info = {.type = XR_TYPE_ACTION_STATE_GET_INFO,
-												 .next = NULL,
-												 .action = grab_action_float,
-												 .subactionPath = self->hand_paths[i]};
-
-				result = xrGetActionStateFloat(self->session, &get_info, &grab_value[i]);
-				xr_result(self->instance, result, "failed to get grab value!");
+		}
+		apply_grab_haptics(self, input);
+		haptics_counts haptic_counts;
+		haptics_take_counts(&haptic_counts);
+		stats_add(haptic_calls_stats, (float)(haptic_counts.apply_calls + haptic_counts.stop_calls));
+		if (haptic_counts.dropped_commands > 0)
+			LOG_WARN("Dropped %u haptic effects\n", haptic_counts.dropped_commands);
+
+		if (input_sampler_running()) {
+			self->input_sample_count =
+				input_sampler_drain(self->input_samples.data(), (uint32_t)self->input_samples.size());
+			double drain_us = trace_now_us();
+			double target_interval_us = 1000000. / input_sampler_rate_hz();
+			for (uint32_t i = 0; i < self->input_sample_count; i++) {
+				const input_sample* sample = &self->input_samples[i];
+				// the first sample after a drop has no interval
+				if (sample->interval_us > 0.)
+					stats_add(input_jitter_stats, (float)(fabs(sample->interval_us - target_interval_us) / 1000.));
+				stats_add(input_latency_stats, (float)((drain_us - sample->sampled_us) / 1000.));
 			}
+			uint64_t dropped = input_sampler_take_dropped();
+			stats_add(input_samples_stats, (float)self->input_sample_count);
+			stats_add(input_dropped_stats, (float)dropped);
+			trace_counter("input samples", self->input_sample_count);
+			if (dropped > 0)
+				trace_counter("input samples dropped", dropped);
+		}
 
-			// printf("Grab %d active %d, current %f, changed %d\n", i,
-			// grabValue[i].isActive, grabValue[i].currentState,
-			// grabValue[i].changedSinceLastSync);
+		trace_stage("actions", &stage_start);
 
-			if (grab_value[i].isActive && grab_value[i].currentState > 0.75) {
-				XrHapticVibration vibration;
-				vibration.type = XR_TYPE_HAPTIC_VIBRATION;
-				vibration.next = NULL;
-				vibration.amplitude = 0.5;
-				vibration.duration = XR_MIN_HAPTIC_DURATION;
-				vibration.frequency = XR_FREQUENCY_UNSPECIFIED;
+		update_hand_objects(self, input, joint_locations);
+		scene_update(frameState.predictedDisplayTime);
 
-				XrHapticActionInfo haptic_action_info = {.type = XR_TYPE_HAPTIC_ACTION_INFO,
-														 .next = NULL,
-														 .action = haptic_action,
-														 .subactionPath = self->hand_paths[i]};
-				result = xrApplyHapticFeedback(self->session, &haptic_action_info,
-											   (const XrHapticBaseHeader*)&vibration);
-				xr_result(self->instance, result, "failed to apply haptic feedback!");
-				// printf("Sent haptic output to hand %d\n", i);
-			}
+		double query_start_us = trace_now_us();
+		update_hand_interaction(self, input, joint_locations);
+		stats_add(hand_query_stats, (float)((trace_now_us() - query_start_us) / 1000.));
 
+		const scene_draw_list* draw_list = scene_build_draw_list();
+		trace_counter("scene draws", draw_list->count);
 
-			throttle_value[i].type = XR_TYPE_ACTION_STATE_FLOAT;
-			throttle_value[i].next = NULL;
-			{
-				XrActionStateGetInfo get_info = {.type = XR_TYPE_ACTION_STATE_GET_INFO,
-												 .next = NULL,
-												 .action = throttle_action_float,
-												 .subactionPath = self->hand_paths[i]};
+		trace_stage("scene update", &stage_start);
 
-				result = xrGetActionStateFloat(self->session, &get_info, &throttle_value[i]);
-				xr_result(self->instance, result, "failed to get throttle value!");
-			}
-			if (throttle_value[i].isActive && throttle_value[i].currentState != 0) {
-				printf("Throttle value %d: changed %d: %f\n", i, throttle_value[i].changedSinceLastSync,
-					   throttle_value[i].currentState);
-			}
-		};
+		// one pass against a frustum enclosing all views, then per view
+		const cull_result* culled =
+			cull_views(draw_list, views.data(), view_count, self->near_z, self->far_z);
+		uint32_t view_draws = 0;
+		for (uint32_t i = 0; i < view_count && i < CULL_MAX_VIEWS; i++)
+			view_draws += culled->visible_count[i];
+		stats_add(cull_visible_stats, (float)culled->candidate_count);
+		stats_add(cull_culled_stats, (float)(draw_list->count - culled->candidate_count));
+		trace_counter("cull visible", culled->candidate_count);
+		trace_counter("cull culled", draw_list->count - culled->candidate_count);
+		trace_counter("cull view draws", view_draws);
+
+		trace_stage("cull", &stage_start);
 
 		// --- Begin frame
 		XrFrameBeginInfo frame_begin_info = {.type = XR_TYPE_FRAME_BEGIN_INFO, .next = NULL};
@@ -1279,201 +1880,215 @@ void main_loop(XrExample* self)
 		if (!xr_result(self->instance, result, "failed to begin frame!"))
 			break;
 
+		trace_stage("xrBeginFrame", &stage_start);
+
+		// frames that skip the eyes submit the images, poses and depth of the last rendered
+		// frame again, the runtime reprojects them
+		bool render_eyes = halfrate_update(&self->half_rate, last_gpu_frame_ms(self),
+										   frameState.predictedDisplayPeriod / 1000000.f);
+		if (self->half_rate.settings.mode != HALFRATE_OFF) {
+			stats_add(reprojected_stats, render_eyes ? 0.f : 100.f);
+			trace_counter("eyes reprojected", render_eyes ? 0 : 1);
+		}
+
+		// the extents have to match the images that are submitted
+		if (self->dynamic_resolution.enabled && render_eyes) {
+			float scale = dynres_update(&self->dynamic_resolution.controller, last_gpu_eyes_ms(self),
+										frameState.predictedDisplayPeriod / 1000000.f);
+			apply_render_scale(self, scale);
+			stats_add(render_scale_stats, scale);
+			trace_counter("render scale", scale);
+		}
+
+
+		mirror_begin_frame(trace_now_us() / 1000.);
+
+		// contents that are not due keep showing the image released last
+		environment_update();
+		layer_manager_begin_frame((uint64_t)loop_count);
+		uint32_t layer_updates = 0;
+		for (layer_content_id id = 0; id < LAYER_CONTENT_MAX; id++)
+			layer_updates += layer_manager_content_due(id) ? 1 : 0;
+		stats_add(layer_update_stats, (float)layer_updates);
+		trace_counter("layer content updates", layer_updates);
 
-		// render each eye and fill projection_views with the result
 		for (uint32_t i = 0; i < view_count; i++) {
-			XrMatrix4x4f projection_matrix;
-			XrMatrix4x4f_CreateProjectionFov(&projection_matrix, GRAPHICS_OPENGL, views[i].fov,
-											 self->near_z, self->far_z);
-
-			XrMatrix4x4f view_matrix;
-			XrMatrix4x4f_CreateViewMatrix(&view_matrix, &views[i].pose.position,
-										  &views[i].pose.orientation);
-
-			XrSwapchainImageAcquireInfo acquire_info = {.type = XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO,
-														.next = NULL};
-			uint32_t acquired_index;
-			result = xrAcquireSwapchainImage(self->swapchains[i], &acquire_info, &acquired_index);
-			if (!xr_result(self->instance, result, "failed to acquire swapchain image!"))
-				break;
+			if (self->visibility_mask.dirty[i]) {
+				update_visibility_mask(self, i);
+				self->visibility_mask.dirty[i] = false;
+			}
+		}
 
-			XrSwapchainImageWaitInfo wait_info = {
-				.type = XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO, .next = NULL, .timeout = 1000};
-			result = xrWaitSwapchainImage(self->swapchains[i], &wait_info);
-			if (!xr_result(self->instance, result, "failed to wait for swapchain image!"))
+		if (self->graphics_api == GRAPHICS_VULKAN) {
+#ifdef XR_EXAMPLE_VULKAN
+			if (!render_frame_vulkan(self, views.data(), render_eyes, draw_list, culled,
+									 frameState.predictedDisplayTime))
 				break;
-
-			uint32_t depth_acquired_index = UINT32_MAX;
-			if (self->depth_swapchain_format != -1) {
-				XrSwapchainImageAcquireInfo depth_acquire_info = {
-					.type = XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO, .next = NULL};
-				result = xrAcquireSwapchainImage(self->depth_swapchains[i], &depth_acquire_info,
-												 &depth_acquired_index);
+#endif
+			trace_stage("render eyes and layers", &stage_start);
+		} else {
+			// render each eye and fill projection_views with the result
+			uint32_t eye_count = render_eyes ? view_count : 0;
+			for (uint32_t i = 0; i < eye_count; i++) {
+				XrMatrix4x4f projection_matrix;
+				XrMatrix4x4f_CreateProjectionFov(&projection_matrix, GRAPHICS_OPENGL, views[i].fov,
+												 self->near_z, self->far_z);
+
+				XrMatrix4x4f view_matrix;
+				XrMatrix4x4f_CreateViewMatrix(&view_matrix, &views[i].pose.position,
+											  &views[i].pose.orientation);
+
+				XrSwapchainImageAcquireInfo acquire_info = {.type = XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO,
+															.next = NULL};
+				uint32_t acquired_index;
+				result = xrAcquireSwapchainImage(self->swapchains[i], &acquire_info, &acquired_index);
 				if (!xr_result(self->instance, result, "failed to acquire swapchain image!"))
 					break;
 
-				XrSwapchainImageWaitInfo depth_wait_info = {
+				XrSwapchainImageWaitInfo wait_info = {
 					.type = XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO, .next = NULL, .timeout = 1000};
-				result = xrWaitSwapchainImage(self->depth_swapchains[i], &depth_wait_info);
+				result = xrWaitSwapchainImage(self->swapchains[i], &wait_info);
 				if (!xr_result(self->instance, result, "failed to wait for swapchain image!"))
 					break;
-			}
 
-			self->projection_views[i].pose = views[i].pose;
-			self->projection_views[i].fov = views[i].fov;
-
-			GLuint depth_image = self->depth_swapchain_format != -1
-									 ? self->depth_images[i][depth_acquired_index].image
-									 : UINT32_MAX;
-
-			render_frame(self->viewconfig_views[i].recommendedImageRectWidth,
-						 self->viewconfig_views[i].recommendedImageRectHeight, projection_matrix,
-						 view_matrix, hand_locations, hand_locations_valid, joint_locations,
-						 self->framebuffers[i][acquired_index], depth_image,
-						 self->images[i][acquired_index], i, frameState.predictedDisplayTime);
-			glFinish();
-			XrSwapchainImageReleaseInfo release_info = {.type = XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO,
-														.next = NULL};
-			result = xrReleaseSwapchainImage(self->swapchains[i], &release_info);
-			if (!xr_result(self->instance, result, "failed to release swapchain image!"))
-				break;
+				uint32_t depth_acquired_index = UINT32_MAX;
+				if (self->depth_swapchain_format != -1) {
+					XrSwapchainImageAcquireInfo depth_acquire_info = {
+						.type = XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO, .next = NULL};
+					result = xrAcquireSwapchainImage(self->depth_swapchains[i], &depth_acquire_info,
+													 &depth_acquired_index);
+					if (!xr_result(self->instance, result, "failed to acquire swapchain image!"))
+						break;
+
+					XrSwapchainImageWaitInfo depth_wait_info = {
+						.type = XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO, .next = NULL, .timeout = 1000};
+					result = xrWaitSwapchainImage(self->depth_swapchains[i], &depth_wait_info);
+					if (!xr_result(self->instance, result, "failed to wait for swapchain image!"))
+						break;
+				}
 
-			if (self->depth_swapchain_format != -1) {
-				XrSwapchainImageReleaseInfo depth_release_info = {
-					.type = XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO, .next = NULL};
-				result = xrReleaseSwapchainImage(self->depth_swapchains[i], &depth_release_info);
+				self->projection_views[i].pose = views[i].pose;
+				self->projection_views[i].fov = views[i].fov;
+
+				GLuint depth_image = self->depth_swapchain_format != -1
+										 ? self->depth_images[i][depth_acquired_index].image
+										 : UINT32_MAX;
+
+				render_frame(self->projection_views[i].subImage.imageRect.extent.width,
+							 self->projection_views[i].subImage.imageRect.extent.height, projection_matrix,
+							 view_matrix, draw_list, culled->visible[i], culled->visible_count[i],
+							 self->framebuffers[i][acquired_index], depth_image,
+							 self->images[i][acquired_index], i);
+				// before the image is released back to the runtime
+				mirror_capture(i, self->framebuffers[i][acquired_index],
+							   self->projection_views[i].subImage.imageRect.extent.width,
+							   self->projection_views[i].subImage.imageRect.extent.height);
+				glFinish();
+				XrSwapchainImageReleaseInfo release_info = {.type = XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO,
+															.next = NULL};
+				result = xrReleaseSwapchainImage(self->swapchains[i], &release_info);
 				if (!xr_result(self->instance, result, "failed to release swapchain image!"))
 					break;
-			}
-		}
-
 
-		XrSwapchainImageAcquireInfo acquire_info = {.type = XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO,
-													.next = NULL};
-		uint32_t acquired_index;
-		result = xrAcquireSwapchainImage(self->quad_swapchain, &acquire_info, &acquired_index);
-		if (!xr_result(self->instance, result, "failed to acquire swapchain image!"))
-			break;
-
-		XrSwapchainImageWaitInfo wait_info = {
-			.type = XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO, .next = NULL, .timeout = 1000};
-		result = xrWaitSwapchainImage(self->quad_swapchain, &wait_info);
-		if (!xr_result(self->instance, result, "failed to wait for swapchain image!"))
-			break;
+				if (self->depth_swapchain_format != -1) {
+					XrSwapchainImageReleaseInfo depth_release_info = {
+						.type = XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO, .next = NULL};
+					result = xrReleaseSwapchainImage(self->depth_swapchains[i], &depth_release_info);
+					if (!xr_result(self->instance, result, "failed to release swapchain image!"))
+						break;
+				}
+			}
 
-		render_quad(self->quad_pixel_width, self->quad_pixel_height, self->swapchain_format,
-					self->quad_images[acquired_index], frameState.predictedDisplayTime);
+			trace_stage("render eyes", &stage_start);
 
-		XrSwapchainImageReleaseInfo release_info = {.type = XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO,
-													.next = NULL};
-		result = xrReleaseSwapchainImage(self->quad_swapchain, &release_info);
-		if (!xr_result(self->instance, result, "failed to release swapchain image!"))
-			break;
+			// each due content is generated once, the layers that share it show the same image
+			bool layers_ok = true;
+			for (layer_content_id id = 0; id < LAYER_CONTENT_MAX && layers_ok; id++) {
+				if (!layer_manager_content_due(id))
+					continue;
+				XrSwapchain swapchain = layer_content_swapchain(id);
+				const layer_content_desc* desc = layer_content_get_desc(id);
+
+				XrSwapchainImageAcquireInfo acquire_info = {.type = XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO,
+															.next = NULL};
+				uint32_t acquired_index;
+				result = xrAcquireSwapchainImage(swapchain, &acquire_info, &acquired_index);
+				if (!xr_result(self->instance, result, "failed to acquire swapchain image!")) {
+					layers_ok = false;
+					break;
+				}
 
+				XrSwapchainImageWaitInfo wait_info = {
+					.type = XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO, .next = NULL, .timeout = 1000};
+				result = xrWaitSwapchainImage(swapchain, &wait_info);
+				if (!xr_result(self->instance, result, "failed to wait for swapchain image!")) {
+					layers_ok = false;
+					break;
+				}
 
-		if (self->cylinder.supported) {
-			XrSwapchainImageAcquireInfo acquire_info = {.type = XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO,
-														.next = NULL};
-			uint32_t acquired_index;
-			result = xrAcquireSwapchainImage(self->cylinder.swapchain, &acquire_info, &acquired_index);
-			if (!xr_result(self->instance, result, "failed to acquire swapchain image!"))
-				break;
+				if (environment_is_content(id)) {
+					gpu_timer_begin("GPU environment");
+					environment_render(layer_content_gl_image(id, acquired_index));
+					gpu_timer_end();
+				} else {
+					gpu_timer_begin("GPU layer content");
+					render_quad(desc->width, desc->height, desc->format,
+								layer_content_gl_image(id, acquired_index), self->layer_content_producer,
+								frameState.predictedDisplayTime);
+					gpu_timer_end();
+				}
 
-			XrSwapchainImageWaitInfo wait_info = {
-				.type = XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO, .next = NULL, .timeout = 1000};
-			result = xrWaitSwapchainImage(self->cylinder.swapchain, &wait_info);
-			if (!xr_result(self->instance, result, "failed to wait for swapchain image!"))
+				XrSwapchainImageReleaseInfo release_info = {.type = XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO,
+															.next = NULL};
+				result = xrReleaseSwapchainImage(swapchain, &release_info);
+				if (!xr_result(self->instance, result, "failed to release swapchain image!"))
+					layers_ok = false;
+			}
+			if (!layers_ok)
 				break;
 
-			render_quad(self->cylinder.swapchain_width, self->cylinder.swapchain_height,
-						self->cylinder.format, self->cylinder.images[acquired_index],
-						frameState.predictedDisplayTime);
-
-			XrSwapchainImageReleaseInfo release_info = {.type = XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO,
-														.next = NULL};
-			result = xrReleaseSwapchainImage(self->cylinder.swapchain, &release_info);
-			if (!xr_result(self->instance, result, "failed to release swapchain image!"))
-				break;
+			trace_stage("render layers", &stage_start);
 		}
 
-
-
-		// projectionLayers struct reused for every frame
-		XrCompositionLayerProjection projection_layer = {
-			.type = XR_TYPE_COMPOSITION_LAYER_PROJECTION,
-			.next = NULL,
-			.layerFlags = 0,
-			.space = self->play_space,
-			.viewCount = view_count,
-			.views = self->projection_views.data(),
-		};
-
-		float aspect = (float)self->quad_pixel_width / (float)self->quad_pixel_height;
-		float quad_width = 1.f;
-		XrCompositionLayerQuad quad_layer;
-
-		quad_layer.type = XR_TYPE_COMPOSITION_LAYER_QUAD,
-		quad_layer.next = NULL,
-		quad_layer.layerFlags = XR_COMPOSITION_LAYER_BLEND_TEXTURE_SOURCE_ALPHA_BIT,
-		quad_layer.space = self->play_space,
-		quad_layer.eyeVisibility = XR_EYE_VISIBILITY_BOTH,
-		quad_layer.pose = {.orientation = {.x = 0.f, .y = 0.f, .z = 0.f, .w = 1.f},
-					 .position = {.x = 1.5f, .y = .7f, .z = -1.5f}},
-		quad_layer.size = {.width = quad_width, .height = quad_width / aspect},
-		quad_layer.subImage = {
-				.swapchain = self->quad_swapchain,
-				.imageRect = {
-					.offset = {.x = 0, .y = 0},
-		                           .extent = {.width = (int32_t)self->quad_pixel_width,
-		                                      .height = (int32_t)self->quad_pixel_height},
-				}};
-
-
-		float cylinder_aspect =
-			(float)self->cylinder.swapchain_width / (float)self->cylinder.swapchain_height;
-
-		float threesixty = M_PI * 2 - 0.0001; /* TODO: spec issue range [0, 2π)*/
-
-		float angleratio = 1 + (loop_count % 1000) / 50.;
-		XrCompositionLayerCylinderKHR cylinder_layer = {
-			.type = XR_TYPE_COMPOSITION_LAYER_CYLINDER_KHR,
-			.next = NULL,
-			.layerFlags = XR_COMPOSITION_LAYER_BLEND_TEXTURE_SOURCE_ALPHA_BIT,
-			.space = self->play_space,
-			.eyeVisibility = XR_EYE_VISIBILITY_BOTH,
-			.subImage = {.swapchain = self->cylinder.swapchain,
-						 .imageRect = {.offset = {.x = 0, .y = 0},
-		                               .extent = {.width = (int32_t)self->cylinder.swapchain_width,
-		                                          .height = (int32_t)self->cylinder.swapchain_height}}},
-			.pose = {.orientation = {.x = 0.f, .y = 0.f, .z = 0.f, .w = 1.f},
-					 .position = {.x = 1.5f, .y = 0.f, .z = -1.5f}},
-			.radius = 0.5,
-			.centralAngle = threesixty / 3,
-			.aspectRatio = cylinder_aspect};
-
-		int submitted_layer_count = 1;
-		const XrCompositionLayerBaseHeader* submittedLayers[3] = {
-			(const XrCompositionLayerBaseHeader* const) & projection_layer};
-
-		if (true) {
-			submittedLayers[submitted_layer_count++] =
-				(const XrCompositionLayerBaseHeader* const) & quad_layer;
-		}
-		if (self->cylinder.supported) {
-			submittedLayers[submitted_layer_count++] =
-				(const XrCompositionLayerBaseHeader* const) & cylinder_layer;
-		};
+		// the layer structs are filled once, only the views change every frame
+		uint32_t submitted_layer_count;
+		const XrCompositionLayerBaseHeader* const* submitted_layers =
+			layer_manager_build(&submitted_layer_count);
 
 		XrFrameEndInfo frameEndInfo;
 		frameEndInfo.type = XR_TYPE_FRAME_END_INFO;
 		frameEndInfo.displayTime = frameState.predictedDisplayTime;
 		frameEndInfo.layerCount = submitted_layer_count;
-		frameEndInfo.layers = submittedLayers;
+		frameEndInfo.layers = submitted_layers;
 		frameEndInfo.environmentBlendMode = XR_ENVIRONMENT_BLEND_MODE_OPAQUE;
 		frameEndInfo.next = NULL;
 		result = xrEndFrame(self->session, &frameEndInfo);
 		if (!xr_result(self->instance, result, "failed to end frame!"))
 			break;
+
+		trace_stage("xrEndFrame", &stage_start);
+
+		// off the critical path, after the frame is handed to the runtime
+		mirror_present();
+		trace_gpu_collect();
+
+		gpu_timer_frame_end();
+		gpu_timer_collect();
+
+		double frame_end_ms = trace_now_us() / 1000.;
+		stats_add(cpu_frame_stats, (float)(frame_end_ms - wait_end_ms));
+
+		// percent of the time all threads together spent in jobs
+		float worker_utilization = job_system_utilization() * 100.f;
+		stats_add(worker_utilization_stats, worker_utilization);
+		trace_counter("worker utilization", worker_utilization);
+
+		float raster_megapixels = raster_throughput();
+		if (raster_megapixels > 0.f) {
+			stats_add(raster_throughput_stats, raster_megapixels);
+			trace_counter("layer raster MP/s", raster_megapixels);
+		}
+		stats_report_every(frame_end_ms, 5000.);
 	}
 }
 
@@ -1489,6 +2104,11 @@ void cleanup(XrExample* self)
 {
 	XrResult result;
 
+	// the sampler locates the hand spaces and trackers, the haptics thread vibrates
+	// through the session
+	input_sampler_stop();
+	haptics_stop();
+
 	xrEndSession(self->session);
 
 	if (self->hand_tracking.system_supported) {
@@ -1512,23 +2132,78 @@ void cleanup(XrExample* self)
 		}
 	}
 
+	gesture_record_close();
+	environment_cleanup();
+	layer_content_cleanup();
+	input_cleanup();
+
 	xrDestroySession(self->session);
 
+#ifdef XR_EXAMPLE_VULKAN
+	// after the session, the runtime uses the device until then
+	vk_cleanup();
+#endif
+	gpu_timer_cleanup();
+	// the trace file is closed later, the queries need the GL context
+	trace_gpu_cleanup();
+
 	for(auto& frame_buffer: self->framebuffers)	{
 		glDeleteFramebuffers(frame_buffer.size(), frame_buffer.data());
 	}
 	xrDestroyInstance(self->instance);
 
-	cleanup_gl();
+	scene_cleanup();
+
+	if (self->graphics_api == GRAPHICS_OPENGL) {
+		cleanup_gl();
+		cleanup_platform_gl();
+	}
 }
 
 int main()
 {
+	// set OXR_TRACE=file.json to record a trace for chrome://tracing or ui.perfetto.dev
+	const char* trace_path = getenv("OXR_TRACE");
+	if (trace_path != NULL)
+		trace_init(trace_path);
+
+	// set OXR_LOG_RATE=n to print at most n messages per second from each log call,
+	// 0 prints all of them
+	log_settings logging;
+	log_default_settings(&logging);
+	const char* log_rate_env = getenv("OXR_LOG_RATE");
+	if (log_rate_env != NULL)
+		logging.site_rate = (uint32_t)atoi(log_rate_env);
+	log_start(&logging);
+
+	// the main thread runs jobs too while it waits for them
+	uint32_t worker_count = std::thread::hardware_concurrency();
+	job_system_init(worker_count > 1 ? worker_count - 1 : 0);
+
+	// set OXR_BENCHMARK=name to run a benchmark instead of the XR session
+	const char* benchmark_name = getenv("OXR_BENCHMARK");
+	if (benchmark_name != NULL) {
+		int ret = run_benchmark(benchmark_name);
+		job_system_shutdown();
+		trace_shutdown();
+		log_stop();
+		return ret;
+	}
+
 	XrExample self;
 	int ret = init_openxr(&self);
-	if (ret != 0)
+	if (ret != 0) {
+		job_system_shutdown();
+		// joins the writer thread and closes the trace file
+		trace_shutdown();
+		log_stop();
 		return ret;
+	}
+	init_scene(&self);
 	main_loop(&self);
 	cleanup(&self);
+	job_system_shutdown();
+	trace_shutdown();
+	log_stop();
 	return 0;
 }
@@ -0,0 +1,105 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Rate limited mirror of the eye images in the desktop window
+ */
+
+#include "mirror.h"
+
+#include <SDL2/SDL.h>
+
+#include "gpu_timer.h"
+#include "trace.h"
+
+static struct
+{
+	mirror_settings settings;
+	SDL_Window* window;
+	double last_update_ms;
+	bool due;
+	bool captured;
+} mirror;
+
+void
+mirror_init(const mirror_settings* settings)
+{
+	mirror.settings = *settings;
+	mirror.window = SDL_GL_GetCurrentWindow();
+	mirror.last_update_ms = -1.;
+	mirror.due = false;
+	mirror.captured = false;
+}
+
+void
+mirror_begin_frame(double now_ms)
+{
+	mirror.due = false;
+	mirror.captured = false;
+	if (mirror.settings.mode == MIRROR_NONE || mirror.window == NULL)
+		return;
+
+	double interval_ms = 1000. / mirror.settings.rate_hz;
+	if (mirror.last_update_ms >= 0. && now_ms - mirror.last_update_ms < interval_ms)
+		return;
+
+	// keep the phase, so e.g. 30 Hz on a 90 Hz display is every third frame
+	if (mirror.last_update_ms >= 0. && now_ms - mirror.last_update_ms < 2 * interval_ms)
+		mirror.last_update_ms += interval_ms;
+	else
+		mirror.last_update_ms = now_ms;
+	mirror.due = true;
+}
+
+void
+mirror_capture(uint32_t view_index, GLuint framebuffer, int w, int h)
+{
+	if (!mirror.due)
+		return;
+	if (mirror.settings.mode == MIRROR_LEFT && view_index != 0)
+		return;
+	if (mirror.settings.mode == MIRROR_BOTH && view_index > 1)
+		return;
+
+	TRACE_SCOPE("mirror_capture");
+	gpu_timer_scope gpu_timer("GPU mirror blit");
+
+	int window_w, window_h;
+	SDL_GL_GetDrawableSize(mirror.window, &window_w, &window_h);
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	if (!mirror.captured) {
+		glClearColor(0.f, 0.f, 0.f, 1.f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		mirror.captured = true;
+	}
+
+	// fit the eye into its part of the window, keeping the aspect ratio
+	int slot_count = mirror.settings.mode == MIRROR_BOTH ? 2 : 1;
+	int slot_w = window_w / slot_count;
+	int dst_w = slot_w;
+	int dst_h = (int)((int64_t)h * slot_w / w);
+	if (dst_h > window_h) {
+		dst_h = window_h;
+		dst_w = (int)((int64_t)w * window_h / h);
+	}
+	int dst_x = slot_w * (mirror.settings.mode == MIRROR_BOTH ? (int)view_index : 0) + (slot_w - dst_w) / 2;
+	int dst_y = (window_h - dst_h) / 2;
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glBlitFramebuffer(0, 0, w, h, dst_x, dst_y, dst_x + dst_w, dst_y + dst_h, GL_COLOR_BUFFER_BIT,
+	                  GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void
+mirror_present()
+{
+	if (!mirror.captured)
+		return;
+
+	TRACE_SCOPE("mirror_present");
+	gpu_timer_scope gpu_timer("GPU mirror swap");
+	// the swap interval is 0, this does not wait for the desktop's vsync
+	SDL_GL_SwapWindow(mirror.window);
+}
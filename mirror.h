@@ -0,0 +1,48 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Rate limited mirror of the eye images in the desktop window
+ *
+ * The eye images are blitted downscaled into the desktop window at a lower rate
+ * than the HMD runs at. The window is presented after xrEndFrame() without
+ * vsync, so the desktop can never hold up an XR frame.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "glimpl.h"
+
+enum mirror_mode
+{
+	MIRROR_NONE,
+	MIRROR_LEFT,
+	MIRROR_BOTH,
+};
+
+struct mirror_settings
+{
+	mirror_mode mode;
+	// how often the desktop window is updated
+	float rate_hz;
+};
+
+// mirrors into the window of the current GL context
+void
+mirror_init(const mirror_settings* settings);
+
+// decides whether this frame updates the mirror, call once per frame
+void
+mirror_begin_frame(double now_ms);
+
+// copies an eye image into the window if this frame updates the mirror.
+// framebuffer must still have the eye image attached.
+void
+mirror_capture(uint32_t view_index, GLuint framebuffer, int w, int h);
+
+// shows the captured images, call after xrEndFrame()
+void
+mirror_present();
@@ -0,0 +1,271 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Window system and OpenGL context creation for each platform
+ */
+
+#include "platform.h"
+
+#include <stdio.h>
+
+#include <SDL2/SDL.h>
+
+static SDL_Window* desktop_window = NULL;
+static SDL_GLContext gl_context = NULL;
+
+#if defined(XR_EXAMPLE_PLATFORM_EGL)
+const char* platform_binding_extension = XR_MNDX_EGL_ENABLE_EXTENSION_NAME;
+#else
+const char* platform_binding_extension = NULL;
+#endif
+
+static bool
+init_sdl_window(int w, int h)
+{
+	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+		printf("Unable to initialize SDL");
+		return false;
+	}
+
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_COMPATIBILITY);
+
+	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 0);
+
+	/* Create our window centered at half the VR resolution */
+	desktop_window = SDL_CreateWindow("OpenXR Example", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+		w / 2, h / 2, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
+	if (!desktop_window) {
+		printf("Unable to create window");
+		return false;
+	}
+
+	gl_context = SDL_GL_CreateContext(desktop_window);
+	if (!gl_context) {
+		printf("Unable to create OpenGL context");
+		return false;
+	}
+
+	SDL_GL_SetSwapInterval(0);
+	return true;
+}
+
+static bool
+init_glew()
+{
+	GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	// a GLEW built for GLX complains about EGL contexts, but loads GL functions just fine
+	if (err == GLEW_ERROR_NO_GLX_DISPLAY)
+		err = GLEW_OK;
+#endif
+	if (err != GLEW_OK) {
+		printf("Failed to initialize GLEW: %s\n", glewGetErrorString(err));
+		return false;
+	}
+	return true;
+}
+
+#if defined(XR_EXAMPLE_PLATFORM_WIN32)
+
+bool
+init_platform_gl(platform_graphics_binding* binding, platform_context_mode mode, int w, int h)
+{
+	if (mode != PLATFORM_CONTEXT_WINDOW) {
+		printf("Headless contexts need the EGL platform\n");
+		return false;
+	}
+	if (!init_sdl_window(w, h) || !init_glew())
+		return false;
+
+	// HACK? OpenXR wants us to report these values, so "work around" SDL a
+	// bit and get the underlying wgl stuff.
+	*binding = {.type = XR_TYPE_GRAPHICS_BINDING_OPENGL_WIN32_KHR, .next = NULL};
+	binding->hDC = wglGetCurrentDC();
+	binding->hGLRC = wglGetCurrentContext();
+	return true;
+}
+
+#elif defined(XR_EXAMPLE_PLATFORM_XLIB)
+
+bool
+init_platform_gl(platform_graphics_binding* binding, platform_context_mode mode, int w, int h)
+{
+	if (mode != PLATFORM_CONTEXT_WINDOW) {
+		printf("Headless contexts need the EGL platform\n");
+		return false;
+	}
+	if (!init_sdl_window(w, h) || !init_glew())
+		return false;
+
+	// HACK? OpenXR wants us to report these values, so "work around" SDL a
+	// bit and get the underlying glx stuff. Does this still work when e.g.
+	// SDL switches to xcb?
+	*binding = {.type = XR_TYPE_GRAPHICS_BINDING_OPENGL_XLIB_KHR, .next = NULL};
+	binding->xDisplay = glXGetCurrentDisplay();
+	binding->glxContext = glXGetCurrentContext();
+	binding->glxDrawable = glXGetCurrentDrawable();
+
+	int fbconfig_id = 0;
+	glXQueryContext(binding->xDisplay, binding->glxContext, GLX_FBCONFIG_ID, &fbconfig_id);
+	int fbconfig_attribs[] = {GLX_FBCONFIG_ID, fbconfig_id, None};
+	int fbconfig_count = 0;
+	GLXFBConfig* fbconfigs = glXChooseFBConfig(binding->xDisplay, DefaultScreen(binding->xDisplay),
+	                                           fbconfig_attribs, &fbconfig_count);
+	if (fbconfigs == NULL || fbconfig_count == 0) {
+		printf("Failed to find the GLXFBConfig of the context\n");
+		return false;
+	}
+	binding->glxFBConfig = fbconfigs[0];
+	XFree(fbconfigs);
+
+	XVisualInfo* visual = glXGetVisualFromFBConfig(binding->xDisplay, binding->glxFBConfig);
+	if (visual != NULL) {
+		binding->visualid = (uint32_t)visual->visualid;
+		XFree(visual);
+	}
+	return true;
+}
+
+#elif defined(XR_EXAMPLE_PLATFORM_EGL)
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+static EGLContext egl_context = EGL_NO_CONTEXT;
+static EGLSurface egl_surface = EGL_NO_SURFACE;
+
+// creates a context without any window, e.g. for llvmpipe on a render server
+static bool
+init_headless_egl(platform_context_mode mode, int w, int h)
+{
+	if (mode == PLATFORM_CONTEXT_SURFACELESS) {
+		PFNEGLGETPLATFORMDISPLAYEXTPROC pfnGetPlatformDisplayEXT =
+		    (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (pfnGetPlatformDisplayEXT == NULL) {
+			printf("eglGetPlatformDisplayEXT not available\n");
+			return false;
+		}
+		egl_display = pfnGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	} else {
+		egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+
+	EGLint major, minor;
+	if (egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, &major, &minor)) {
+		printf("Failed to initialize EGL display\n");
+		return false;
+	}
+	printf("Initialized EGL %d.%d\n", major, minor);
+
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		printf("EGL does not support desktop OpenGL\n");
+		return false;
+	}
+
+	const EGLint config_attribs[] = {
+	    EGL_SURFACE_TYPE, mode == PLATFORM_CONTEXT_PBUFFER ? EGL_PBUFFER_BIT : 0,
+	    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+	    EGL_RED_SIZE, 8,
+	    EGL_GREEN_SIZE, 8,
+	    EGL_BLUE_SIZE, 8,
+	    EGL_ALPHA_SIZE, 8,
+	    EGL_NONE};
+	EGLConfig config;
+	EGLint config_count = 0;
+	if (!eglChooseConfig(egl_display, config_attribs, &config, 1, &config_count) || config_count == 0) {
+		printf("No matching EGL config\n");
+		return false;
+	}
+
+	const EGLint context_attribs[] = {
+	    EGL_CONTEXT_MAJOR_VERSION, 4,
+	    EGL_CONTEXT_MINOR_VERSION, 0,
+	    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+	    EGL_NONE};
+	egl_context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, context_attribs);
+	if (egl_context == EGL_NO_CONTEXT) {
+		printf("Failed to create EGL context\n");
+		return false;
+	}
+
+	if (mode == PLATFORM_CONTEXT_PBUFFER) {
+		// nothing is ever drawn to it, rendering goes to the swapchain images
+		const EGLint pbuffer_attribs[] = {EGL_WIDTH, w / 2, EGL_HEIGHT, h / 2, EGL_NONE};
+		egl_surface = eglCreatePbufferSurface(egl_display, config, pbuffer_attribs);
+		if (egl_surface == EGL_NO_SURFACE) {
+			printf("Failed to create EGL pbuffer\n");
+			return false;
+		}
+	}
+
+	if (!eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context)) {
+		printf("Failed to make EGL context current\n");
+		return false;
+	}
+	return true;
+}
+
+bool
+init_platform_gl(platform_graphics_binding* binding, platform_context_mode mode, int w, int h)
+{
+	if (mode == PLATFORM_CONTEXT_WINDOW) {
+		// SDL on X11 uses GLX unless told otherwise
+		SDL_SetHint(SDL_HINT_VIDEO_X11_FORCE_EGL, "1");
+		if (!init_sdl_window(w, h))
+			return false;
+	} else if (!init_headless_egl(mode, w, h)) {
+		return false;
+	}
+
+	if (!init_glew())
+		return false;
+
+	*binding = {.type = XR_TYPE_GRAPHICS_BINDING_EGL_MNDX, .next = NULL};
+	binding->getProcAddress = eglGetProcAddress;
+	binding->display = eglGetCurrentDisplay();
+	binding->context = eglGetCurrentContext();
+
+	EGLint config_id = 0;
+	eglQueryContext(binding->display, binding->context, EGL_CONFIG_ID, &config_id);
+	const EGLint config_attribs[] = {EGL_CONFIG_ID, config_id, EGL_NONE};
+	EGLint config_count = 0;
+	if (!eglChooseConfig(binding->display, config_attribs, &binding->config, 1, &config_count) ||
+	    config_count == 0) {
+		printf("Failed to find the EGLConfig of the context\n");
+		return false;
+	}
+	return true;
+}
+
+#endif
+
+void
+cleanup_platform_gl()
+{
+#if defined(XR_EXAMPLE_PLATFORM_EGL)
+	if (egl_display != EGL_NO_DISPLAY) {
+		eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (egl_surface != EGL_NO_SURFACE)
+			eglDestroySurface(egl_display, egl_surface);
+		if (egl_context != EGL_NO_CONTEXT)
+			eglDestroyContext(egl_display, egl_context);
+		eglTerminate(egl_display);
+		egl_display = EGL_NO_DISPLAY;
+	}
+#endif
+
+	if (gl_context != NULL) {
+		SDL_GL_DeleteContext(gl_context);
+		gl_context = NULL;
+	}
+	if (desktop_window != NULL) {
+		SDL_DestroyWindow(desktop_window);
+		desktop_window = NULL;
+		SDL_Quit();
+	}
+}
@@ -0,0 +1,75 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Window system and OpenGL context creation for each platform
+ *
+ * The platform is selected at build time by defining one of
+ * XR_EXAMPLE_PLATFORM_WIN32, XR_EXAMPLE_PLATFORM_XLIB or XR_EXAMPLE_PLATFORM_EGL.
+ * Without a definition Windows uses WIN32 and everything else XLIB.
+ */
+
+#pragma once
+
+#if !defined(XR_EXAMPLE_PLATFORM_WIN32) && !defined(XR_EXAMPLE_PLATFORM_XLIB) &&                  \
+    !defined(XR_EXAMPLE_PLATFORM_EGL)
+#ifdef _WIN32
+#define XR_EXAMPLE_PLATFORM_WIN32
+#else
+#define XR_EXAMPLE_PLATFORM_XLIB
+#endif
+#endif
+
+// GLEW has to come before any other GL header
+#include <GL/glew.h>
+
+#if defined(XR_EXAMPLE_PLATFORM_WIN32)
+#include <Windows.h>
+#define XR_USE_PLATFORM_WIN32
+#elif defined(XR_EXAMPLE_PLATFORM_XLIB)
+#include <X11/Xlib.h>
+#include <GL/glx.h>
+#define XR_USE_PLATFORM_XLIB
+#elif defined(XR_EXAMPLE_PLATFORM_EGL)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define XR_USE_PLATFORM_EGL
+#endif
+
+#define XR_USE_GRAPHICS_API_OPENGL
+// the Vulkan backend (vkimpl.h) is optional, selected at runtime
+#ifdef XR_EXAMPLE_VULKAN
+#include <vulkan/vulkan.h>
+#define XR_USE_GRAPHICS_API_VULKAN
+#endif
+#include "openxr/openxr.h"
+#include "openxr/openxr_platform.h"
+
+#if defined(XR_EXAMPLE_PLATFORM_WIN32)
+typedef XrGraphicsBindingOpenGLWin32KHR platform_graphics_binding;
+#elif defined(XR_EXAMPLE_PLATFORM_XLIB)
+typedef XrGraphicsBindingOpenGLXlibKHR platform_graphics_binding;
+#elif defined(XR_EXAMPLE_PLATFORM_EGL)
+typedef XrGraphicsBindingEGLMNDX platform_graphics_binding;
+#endif
+
+enum platform_context_mode
+{
+	// OpenGL context of an SDL desktop window
+	PLATFORM_CONTEXT_WINDOW,
+	// no window and no surface, needs EGL_KHR_surfaceless_context (EGL only)
+	PLATFORM_CONTEXT_SURFACELESS,
+	// no window, the context is bound to a small pbuffer (EGL only)
+	PLATFORM_CONTEXT_PBUFFER,
+};
+
+// instance extension the graphics binding needs in addition to XR_KHR_opengl_enable, or NULL
+extern const char* platform_binding_extension;
+
+// creates the OpenGL context, makes it current and fills the graphics binding for
+// xrCreateSession. w and h are the size of the desktop window.
+bool
+init_platform_gl(platform_graphics_binding* binding, platform_context_mode mode, int w, int h);
+
+void
+cleanup_platform_gl();
@@ -0,0 +1,347 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief One Euro filtering and short horizon prediction of hand joints
+ */
+
+#include "pose_filter.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define POSE_FILTER_SSE
+#endif
+
+#include "trace.h"
+
+// longer gaps, e.g. while the session was not focused, restart the filter
+#define POSE_FILTER_MAX_DT 0.25f
+
+static const float two_pi = 6.28318531f;
+
+static const XrSpaceLocationFlags pose_valid_bits =
+	XR_SPACE_LOCATION_POSITION_VALID_BIT | XR_SPACE_LOCATION_ORIENTATION_VALID_BIT;
+
+// the joints of one frame, gathered into lanes
+struct joint_input
+{
+	alignas(16) float x[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float y[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float z[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float qx[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float qy[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float qz[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float qw[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float valid[POSE_FILTER_MAX_JOINTS];
+	// linear and angular velocity times the prediction horizon
+	alignas(16) float vx[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float vy[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float vz[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float wx[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float wy[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float wz[POSE_FILTER_MAX_JOINTS];
+};
+
+// filter coefficients of one frame
+struct frame_constants
+{
+	// 2 pi dt, the cutoff alpha is r / (r + 1) with r = 2 pi dt cutoff
+	float two_pi_dt;
+	float inv_dt;
+	float derivative_alpha;
+};
+
+void
+pose_filter_default_settings(pose_filter_settings* settings)
+{
+	*settings = {
+		.enabled = true,
+		.min_cutoff = 1.f,
+		.beta = 50.f,
+		.rotation_min_cutoff = 1.f,
+		.rotation_beta = 5.f,
+		.derivative_cutoff = 1.f,
+		.prediction_s = 0.f,
+	};
+}
+
+void
+pose_filter_init(pose_filter* self, const pose_filter_settings* settings)
+{
+	self->settings = *settings;
+	pose_filter_reset(self);
+}
+
+void
+pose_filter_reset(pose_filter* self)
+{
+	self->last_time = 0;
+	memset(self->initialized, 0, sizeof(self->initialized));
+}
+
+static void
+filter_joint(pose_filter* self, const frame_constants* c, joint_input* in, uint32_t i)
+{
+	const pose_filter_settings* s = &self->settings;
+
+	if (in->valid[i] == 0.f) {
+		self->initialized[i] = 0.f;
+		return;
+	}
+	if (self->initialized[i] == 0.f) {
+		self->x[i] = in->x[i];
+		self->y[i] = in->y[i];
+		self->z[i] = in->z[i];
+		self->dx[i] = self->dy[i] = self->dz[i] = 0.f;
+		self->qx[i] = in->qx[i];
+		self->qy[i] = in->qy[i];
+		self->qz[i] = in->qz[i];
+		self->qw[i] = in->qw[i];
+		self->rotation_speed[i] = 0.f;
+		self->initialized[i] = 1.f;
+	} else {
+		float dx = (in->x[i] - self->x[i]) * c->inv_dt;
+		float dy = (in->y[i] - self->y[i]) * c->inv_dt;
+		float dz = (in->z[i] - self->z[i]) * c->inv_dt;
+		self->dx[i] += c->derivative_alpha * (dx - self->dx[i]);
+		self->dy[i] += c->derivative_alpha * (dy - self->dy[i]);
+		self->dz[i] += c->derivative_alpha * (dz - self->dz[i]);
+		float speed = sqrtf(self->dx[i] * self->dx[i] + self->dy[i] * self->dy[i] + self->dz[i] * self->dz[i]);
+		float r = c->two_pi_dt * (s->min_cutoff + s->beta * speed);
+		float alpha = r / (r + 1.f);
+		self->x[i] += alpha * (in->x[i] - self->x[i]);
+		self->y[i] += alpha * (in->y[i] - self->y[i]);
+		self->z[i] += alpha * (in->z[i] - self->z[i]);
+
+		// q and -q are the same rotation, blend towards the closer one
+		float d = in->qx[i] * self->qx[i] + in->qy[i] * self->qy[i] + in->qz[i] * self->qz[i] +
+		          in->qw[i] * self->qw[i];
+		float sign = d < 0.f ? -1.f : 1.f;
+		d *= sign;
+		// the rotation angle is 2 asin(sin_half), about 2 sin_half for small angles
+		float sin_half = sqrtf(fmaxf(0.f, 1.f - d * d));
+		self->rotation_speed[i] += c->derivative_alpha * (2.f * sin_half * c->inv_dt - self->rotation_speed[i]);
+		r = c->two_pi_dt * (s->rotation_min_cutoff + s->rotation_beta * self->rotation_speed[i]);
+		alpha = r / (r + 1.f);
+		float qx = self->qx[i] + alpha * (sign * in->qx[i] - self->qx[i]);
+		float qy = self->qy[i] + alpha * (sign * in->qy[i] - self->qy[i]);
+		float qz = self->qz[i] + alpha * (sign * in->qz[i] - self->qz[i]);
+		float qw = self->qw[i] + alpha * (sign * in->qw[i] - self->qw[i]);
+		float inv_length = 1.f / sqrtf(qx * qx + qy * qy + qz * qz + qw * qw);
+		self->qx[i] = qx * inv_length;
+		self->qy[i] = qy * inv_length;
+		self->qz[i] = qz * inv_length;
+		self->qw[i] = qw * inv_length;
+	}
+
+	in->x[i] = self->x[i] + in->vx[i];
+	in->y[i] = self->y[i] + in->vy[i];
+	in->z[i] = self->z[i] + in->vz[i];
+
+	// rotated by the small angle quaternion (w / 2, 1), normalized
+	float hx = 0.5f * in->wx[i], hy = 0.5f * in->wy[i], hz = 0.5f * in->wz[i];
+	float qx = self->qx[i], qy = self->qy[i], qz = self->qz[i], qw = self->qw[i];
+	float px = qx + hx * qw + hy * qz - hz * qy;
+	float py = qy - hx * qz + hy * qw + hz * qx;
+	float pz = qz + hx * qy - hy * qx + hz * qw;
+	float pw = qw - hx * qx - hy * qy - hz * qz;
+	float inv_length = 1.f / sqrtf(px * px + py * py + pz * pz + pw * pw);
+	in->qx[i] = px * inv_length;
+	in->qy[i] = py * inv_length;
+	in->qz[i] = pz * inv_length;
+	in->qw[i] = pw * inv_length;
+}
+
+#ifdef POSE_FILTER_SSE
+static inline __m128
+blend(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128
+normalize_factor(__m128 x, __m128 y, __m128 z, __m128 w)
+{
+	__m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+	                            _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+	return _mm_div_ps(_mm_set1_ps(1.f), _mm_sqrt_ps(length2));
+}
+
+// the same as filter_joint() for joints i to i + 3
+static void
+filter_joints4(pose_filter* self, const frame_constants* c, joint_input* in, uint32_t i)
+{
+	const pose_filter_settings* s = &self->settings;
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 inv_dt = _mm_set1_ps(c->inv_dt);
+	const __m128 two_pi_dt = _mm_set1_ps(c->two_pi_dt);
+	const __m128 derivative_alpha = _mm_set1_ps(c->derivative_alpha);
+
+	__m128 valid = _mm_cmpgt_ps(_mm_load_ps(in->valid + i), zero);
+	__m128 filtered = _mm_and_ps(valid, _mm_cmpgt_ps(_mm_load_ps(self->initialized + i), zero));
+
+	// positions
+	__m128 x = _mm_load_ps(in->x + i), y = _mm_load_ps(in->y + i), z = _mm_load_ps(in->z + i);
+	__m128 fx = _mm_load_ps(self->x + i), fy = _mm_load_ps(self->y + i), fz = _mm_load_ps(self->z + i);
+	__m128 dx = _mm_load_ps(self->dx + i), dy = _mm_load_ps(self->dy + i), dz = _mm_load_ps(self->dz + i);
+	dx = _mm_add_ps(dx, _mm_mul_ps(derivative_alpha, _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(x, fx), inv_dt), dx)));
+	dy = _mm_add_ps(dy, _mm_mul_ps(derivative_alpha, _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(y, fy), inv_dt), dy)));
+	dz = _mm_add_ps(dz, _mm_mul_ps(derivative_alpha, _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(z, fz), inv_dt), dz)));
+	__m128 speed = _mm_sqrt_ps(
+	    _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+	__m128 r = _mm_mul_ps(two_pi_dt, _mm_add_ps(_mm_set1_ps(s->min_cutoff), _mm_mul_ps(_mm_set1_ps(s->beta), speed)));
+	__m128 alpha = _mm_div_ps(r, _mm_add_ps(r, one));
+	fx = blend(filtered, _mm_add_ps(fx, _mm_mul_ps(alpha, _mm_sub_ps(x, fx))), x);
+	fy = blend(filtered, _mm_add_ps(fy, _mm_mul_ps(alpha, _mm_sub_ps(y, fy))), y);
+	fz = blend(filtered, _mm_add_ps(fz, _mm_mul_ps(alpha, _mm_sub_ps(z, fz))), z);
+	_mm_store_ps(self->x + i, fx);
+	_mm_store_ps(self->y + i, fy);
+	_mm_store_ps(self->z + i, fz);
+	_mm_store_ps(self->dx + i, _mm_and_ps(filtered, dx));
+	_mm_store_ps(self->dy + i, _mm_and_ps(filtered, dy));
+	_mm_store_ps(self->dz + i, _mm_and_ps(filtered, dz));
+
+	// orientations, flipped to the closer sign by xor with the sign bit of the dot product
+	__m128 qx = _mm_load_ps(in->qx + i), qy = _mm_load_ps(in->qy + i);
+	__m128 qz = _mm_load_ps(in->qz + i), qw = _mm_load_ps(in->qw + i);
+	__m128 fqx = _mm_load_ps(self->qx + i), fqy = _mm_load_ps(self->qy + i);
+	__m128 fqz = _mm_load_ps(self->qz + i), fqw = _mm_load_ps(self->qw + i);
+	__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, fqx), _mm_mul_ps(qy, fqy)),
+	                      _mm_add_ps(_mm_mul_ps(qz, fqz), _mm_mul_ps(qw, fqw)));
+	__m128 sign = _mm_and_ps(d, _mm_set1_ps(-0.f));
+	qx = _mm_xor_ps(qx, sign);
+	qy = _mm_xor_ps(qy, sign);
+	qz = _mm_xor_ps(qz, sign);
+	qw = _mm_xor_ps(qw, sign);
+	d = _mm_xor_ps(d, sign);
+	__m128 sin_half = _mm_sqrt_ps(_mm_max_ps(zero, _mm_sub_ps(one, _mm_mul_ps(d, d))));
+	__m128 rotation_speed = _mm_load_ps(self->rotation_speed + i);
+	__m128 angular = _mm_mul_ps(_mm_add_ps(sin_half, sin_half), inv_dt);
+	rotation_speed = _mm_add_ps(rotation_speed, _mm_mul_ps(derivative_alpha, _mm_sub_ps(angular, rotation_speed)));
+	r = _mm_mul_ps(two_pi_dt, _mm_add_ps(_mm_set1_ps(s->rotation_min_cutoff),
+	                                     _mm_mul_ps(_mm_set1_ps(s->rotation_beta), rotation_speed)));
+	alpha = _mm_div_ps(r, _mm_add_ps(r, one));
+	fqx = _mm_add_ps(fqx, _mm_mul_ps(alpha, _mm_sub_ps(qx, fqx)));
+	fqy = _mm_add_ps(fqy, _mm_mul_ps(alpha, _mm_sub_ps(qy, fqy)));
+	fqz = _mm_add_ps(fqz, _mm_mul_ps(alpha, _mm_sub_ps(qz, fqz)));
+	fqw = _mm_add_ps(fqw, _mm_mul_ps(alpha, _mm_sub_ps(qw, fqw)));
+	__m128 inv_length = normalize_factor(fqx, fqy, fqz, fqw);
+	fqx = blend(filtered, _mm_mul_ps(fqx, inv_length), qx);
+	fqy = blend(filtered, _mm_mul_ps(fqy, inv_length), qy);
+	fqz = blend(filtered, _mm_mul_ps(fqz, inv_length), qz);
+	fqw = blend(filtered, _mm_mul_ps(fqw, inv_length), qw);
+	_mm_store_ps(self->qx + i, fqx);
+	_mm_store_ps(self->qy + i, fqy);
+	_mm_store_ps(self->qz + i, fqz);
+	_mm_store_ps(self->qw + i, fqw);
+	_mm_store_ps(self->rotation_speed + i, _mm_and_ps(filtered, rotation_speed));
+	_mm_store_ps(self->initialized + i, _mm_and_ps(valid, one));
+
+	// prediction, the velocities are 0 for lanes that are not predicted. Invalid
+	// lanes are not written back.
+	_mm_store_ps(in->x + i, _mm_add_ps(fx, _mm_load_ps(in->vx + i)));
+	_mm_store_ps(in->y + i, _mm_add_ps(fy, _mm_load_ps(in->vy + i)));
+	_mm_store_ps(in->z + i, _mm_add_ps(fz, _mm_load_ps(in->vz + i)));
+
+	const __m128 half = _mm_set1_ps(0.5f);
+	__m128 hx = _mm_mul_ps(half, _mm_load_ps(in->wx + i));
+	__m128 hy = _mm_mul_ps(half, _mm_load_ps(in->wy + i));
+	__m128 hz = _mm_mul_ps(half, _mm_load_ps(in->wz + i));
+	__m128 px = _mm_add_ps(_mm_add_ps(fqx, _mm_mul_ps(hx, fqw)), _mm_sub_ps(_mm_mul_ps(hy, fqz), _mm_mul_ps(hz, fqy)));
+	__m128 py = _mm_add_ps(_mm_sub_ps(fqy, _mm_mul_ps(hx, fqz)), _mm_add_ps(_mm_mul_ps(hy, fqw), _mm_mul_ps(hz, fqx)));
+	__m128 pz = _mm_add_ps(_mm_add_ps(fqz, _mm_mul_ps(hx, fqy)), _mm_sub_ps(_mm_mul_ps(hz, fqw), _mm_mul_ps(hy, fqx)));
+	__m128 pw = _mm_sub_ps(_mm_sub_ps(fqw, _mm_mul_ps(hx, fqx)), _mm_add_ps(_mm_mul_ps(hy, fqy), _mm_mul_ps(hz, fqz)));
+	inv_length = normalize_factor(px, py, pz, pw);
+	_mm_store_ps(in->qx + i, _mm_mul_ps(px, inv_length));
+	_mm_store_ps(in->qy + i, _mm_mul_ps(py, inv_length));
+	_mm_store_ps(in->qz + i, _mm_mul_ps(pz, inv_length));
+	_mm_store_ps(in->qw + i, _mm_mul_ps(pw, inv_length));
+}
+#endif
+
+void
+pose_filter_apply(pose_filter* self,
+                  XrTime time,
+                  XrHandJointLocationsEXT* hands,
+                  const XrHandJointVelocitiesEXT* velocities,
+                  uint32_t hand_count)
+{
+	if (!self->settings.enabled)
+		return;
+	TRACE_SCOPE("pose_filter_apply");
+
+	float dt = (time - self->last_time) / 1e9f;
+	if (self->last_time == 0 || dt <= 0.f || dt > POSE_FILTER_MAX_DT) {
+		memset(self->initialized, 0, sizeof(self->initialized));
+		// the first frame is only recorded, any positive dt will do
+		dt = 1.f / 90.f;
+	}
+	self->last_time = time;
+
+	frame_constants c;
+	c.two_pi_dt = two_pi * dt;
+	c.inv_dt = 1.f / dt;
+	float r = c.two_pi_dt * self->settings.derivative_cutoff;
+	c.derivative_alpha = r / (r + 1.f);
+
+	if (hand_count > POSE_FILTER_MAX_HANDS)
+		hand_count = POSE_FILTER_MAX_HANDS;
+	uint32_t count = hand_count * XR_HAND_JOINT_COUNT_EXT;
+	float horizon = self->settings.prediction_s;
+
+	joint_input in;
+	for (uint32_t hand = 0; hand < hand_count; hand++) {
+		const XrHandJointLocationsEXT* locations = &hands[hand];
+		const XrHandJointVelocitiesEXT* hand_velocities =
+			velocities != NULL && horizon > 0.f ? &velocities[hand] : NULL;
+
+		for (uint32_t j = 0; j < XR_HAND_JOINT_COUNT_EXT; j++) {
+			uint32_t i = hand * XR_HAND_JOINT_COUNT_EXT + j;
+			bool valid = locations->isActive && j < locations->jointCount &&
+			             (locations->jointLocations[j].locationFlags & pose_valid_bits) == pose_valid_bits;
+			in.valid[i] = valid ? 1.f : 0.f;
+			const XrPosef* pose = valid ? &locations->jointLocations[j].pose : NULL;
+			in.x[i] = pose ? pose->position.x : 0.f;
+			in.y[i] = pose ? pose->position.y : 0.f;
+			in.z[i] = pose ? pose->position.z : 0.f;
+			in.qx[i] = pose ? pose->orientation.x : 0.f;
+			in.qy[i] = pose ? pose->orientation.y : 0.f;
+			in.qz[i] = pose ? pose->orientation.z : 0.f;
+			in.qw[i] = pose ? pose->orientation.w : 1.f;
+
+			const XrHandJointVelocityEXT* velocity =
+				hand_velocities != NULL && j < hand_velocities->jointCount ? &hand_velocities->jointVelocities[j] : NULL;
+			bool linear = velocity != NULL && (velocity->velocityFlags & XR_SPACE_VELOCITY_LINEAR_VALID_BIT);
+			bool angular = velocity != NULL && (velocity->velocityFlags & XR_SPACE_VELOCITY_ANGULAR_VALID_BIT);
+			in.vx[i] = linear ? velocity->linearVelocity.x * horizon : 0.f;
+			in.vy[i] = linear ? velocity->linearVelocity.y * horizon : 0.f;
+			in.vz[i] = linear ? velocity->linearVelocity.z * horizon : 0.f;
+			in.wx[i] = angular ? velocity->angularVelocity.x * horizon : 0.f;
+			in.wy[i] = angular ? velocity->angularVelocity.y * horizon : 0.f;
+			in.wz[i] = angular ? velocity->angularVelocity.z * horizon : 0.f;
+		}
+	}
+
+	uint32_t i = 0;
+#ifdef POSE_FILTER_SSE
+	for (; i + 4 <= count; i += 4)
+		filter_joints4(self, &c, &in, i);
+#endif
+	for (; i < count; i++)
+		filter_joint(self, &c, &in, i);
+
+	for (uint32_t hand = 0; hand < hand_count; hand++) {
+		for (uint32_t j = 0; j < XR_HAND_JOINT_COUNT_EXT && j < hands[hand].jointCount; j++) {
+			uint32_t k = hand * XR_HAND_JOINT_COUNT_EXT + j;
+			if (in.valid[k] == 0.f)
+				continue;
+			XrPosef* pose = &hands[hand].jointLocations[j].pose;
+			pose->position = {.x = in.x[k], .y = in.y[k], .z = in.z[k]};
+			pose->orientation = {.x = in.qx[k], .y = in.qy[k], .z = in.qz[k], .w = in.qw[k]};
+		}
+	}
+}
@@ -0,0 +1,82 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief One Euro filtering and short horizon prediction of hand joints
+ *
+ * Every joint position and orientation is smoothed with a One Euro filter: a low
+ * pass whose cutoff frequency rises with the filtered speed of the joint, so slow
+ * movements lose their jitter while fast ones keep little lag. Orientations are
+ * blended with a normalized lerp along the shorter arc.
+ *
+ * The joints of all hands are kept in structure of arrays form and filtered four at
+ * a time with SSE. With joint velocities the filtered poses are extrapolated by the
+ * prediction horizon, the filter state itself stays unpredicted.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "openxr/openxr.h"
+
+#define POSE_FILTER_MAX_HANDS 2
+#define POSE_FILTER_MAX_JOINTS (POSE_FILTER_MAX_HANDS * XR_HAND_JOINT_COUNT_EXT)
+
+struct pose_filter_settings
+{
+	bool enabled;
+	// cutoff in Hz while a joint rests
+	float min_cutoff;
+	// cutoff increase in Hz per m/s of joint speed
+	float beta;
+	float rotation_min_cutoff;
+	// cutoff increase in Hz per rad/s of joint rotation
+	float rotation_beta;
+	// cutoff of the low pass on the speeds
+	float derivative_cutoff;
+	// seconds the poses are extrapolated with the joint velocities, 0 disables it
+	float prediction_s;
+};
+
+// filter state, one lane per joint
+struct pose_filter
+{
+	pose_filter_settings settings;
+	XrTime last_time;
+
+	alignas(16) float x[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float y[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float z[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float dx[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float dy[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float dz[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float qx[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float qy[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float qz[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float qw[POSE_FILTER_MAX_JOINTS];
+	alignas(16) float rotation_speed[POSE_FILTER_MAX_JOINTS];
+	// 1 once the lane holds a filtered pose
+	alignas(16) float initialized[POSE_FILTER_MAX_JOINTS];
+};
+
+void
+pose_filter_default_settings(pose_filter_settings* settings);
+
+void
+pose_filter_init(pose_filter* self, const pose_filter_settings* settings);
+
+// forgets the filtered poses, e.g. after tracking was lost
+void
+pose_filter_reset(pose_filter* self);
+
+// filters the joints of hand_count hands located for time in place. velocities is
+// NULL or has one entry per hand, joints without valid velocities are not predicted.
+// Joints whose position or orientation is invalid are left as they are and
+// restart the filter once they are valid again.
+void
+pose_filter_apply(pose_filter* self,
+                  XrTime time,
+                  XrHandJointLocationsEXT* hands,
+                  const XrHandJointVelocitiesEXT* velocities,
+                  uint32_t hand_count);
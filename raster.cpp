@@ -0,0 +1,249 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief CPU generated content for the quad and cylinder layers
+ */
+
+#include "raster.h"
+
+#include <atomic>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define RASTER_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RASTER_SSE2
+#endif
+
+#include "job.h"
+#include "trace.h"
+
+// rows per job, so a band is worth more than the cost of a job
+#define RASTER_BAND_PIXELS 65536
+
+static std::atomic<uint64_t> raster_pixels;
+static std::atomic<uint64_t> raster_ns;
+
+void
+raster_fill_row(uint32_t* row, int count, uint32_t color)
+{
+	int i = 0;
+#ifdef RASTER_AVX2
+	__m256i color8 = _mm256_set1_epi32((int)color);
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_si256((__m256i*)&row[i], color8);
+#endif
+#ifdef RASTER_SSE2
+	__m128i color4 = _mm_set1_epi32((int)color);
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_si128((__m128i*)&row[i], color4);
+#endif
+	for (; i < count; i++)
+		row[i] = color;
+}
+
+// (s * a + d * (255 - a)) / 255, rounded
+static inline uint32_t
+blend_channel(uint32_t s, uint32_t d, uint32_t a)
+{
+	uint32_t t = s * a + d * (255 - a) + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+#ifdef RASTER_SSE2
+// 2 pixels widened to 16 bit channels
+static inline __m128i
+blend_pixels_16(__m128i s, __m128i d, __m128i a)
+{
+	__m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), a);
+	__m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, inverse)),
+	                          _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static inline __m128i
+compose_over_4(__m128i s, __m128i d)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i s_lo = _mm_unpacklo_epi8(s, zero);
+	__m128i s_hi = _mm_unpackhi_epi8(s, zero);
+	// the alpha of each pixel in all four of its channels
+	__m128i a_lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	__m128i a_hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+	// blending 255 into the alpha channel gives a + d * (1 - a)
+	__m128i s_opaque = _mm_or_si128(s, _mm_set1_epi32((int)0xff000000));
+	__m128i lo = blend_pixels_16(_mm_unpacklo_epi8(s_opaque, zero), _mm_unpacklo_epi8(d, zero), a_lo);
+	__m128i hi = blend_pixels_16(_mm_unpackhi_epi8(s_opaque, zero), _mm_unpackhi_epi8(d, zero), a_hi);
+	return _mm_packus_epi16(lo, hi);
+}
+#endif
+
+#ifdef RASTER_AVX2
+// same as the SSE2 version, unpacking and packing stay within the 128 bit lanes
+static inline __m256i
+compose_over_8(__m256i s, __m256i d)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i s_lo = _mm256_unpacklo_epi8(s, zero);
+	__m256i s_hi = _mm256_unpackhi_epi8(s, zero);
+	__m256i a_lo =
+	    _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s_lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	__m256i a_hi =
+	    _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s_hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+	__m256i s_opaque = _mm256_or_si256(s, _mm256_set1_epi32((int)0xff000000));
+	__m256i result[2];
+	__m256i a[2] = {a_lo, a_hi};
+	__m256i s16[2] = {_mm256_unpacklo_epi8(s_opaque, zero), _mm256_unpackhi_epi8(s_opaque, zero)};
+	__m256i d16[2] = {_mm256_unpacklo_epi8(d, zero), _mm256_unpackhi_epi8(d, zero)};
+	for (int i = 0; i < 2; i++) {
+		__m256i inverse = _mm256_sub_epi16(_mm256_set1_epi16(255), a[i]);
+		__m256i t = _mm256_add_epi16(
+		    _mm256_add_epi16(_mm256_mullo_epi16(s16[i], a[i]), _mm256_mullo_epi16(d16[i], inverse)),
+		    _mm256_set1_epi16(128));
+		result[i] = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+	}
+	return _mm256_packus_epi16(result[0], result[1]);
+}
+#endif
+
+void
+raster_compose_over_row(uint32_t* dst, const uint32_t* src, int count)
+{
+	int i = 0;
+#ifdef RASTER_AVX2
+	for (; i + 8 <= count; i += 8) {
+		__m256i s = _mm256_loadu_si256((const __m256i*)&src[i]);
+		__m256i d = _mm256_loadu_si256((const __m256i*)&dst[i]);
+		_mm256_storeu_si256((__m256i*)&dst[i], compose_over_8(s, d));
+	}
+#endif
+#ifdef RASTER_SSE2
+	for (; i + 4 <= count; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i*)&src[i]);
+		__m128i d = _mm_loadu_si128((const __m128i*)&dst[i]);
+		_mm_storeu_si128((__m128i*)&dst[i], compose_over_4(s, d));
+	}
+#endif
+	for (; i < count; i++) {
+		uint32_t s = src[i];
+		uint32_t d = dst[i];
+		uint32_t a = s >> 24;
+		uint32_t result = 0;
+		for (int shift = 0; shift < 24; shift += 8)
+			result |= blend_channel((s >> shift) & 0xff, (d >> shift) & 0xff, a) << shift;
+		result |= blend_channel(255, d >> 24, a) << 24;
+		dst[i] = result;
+	}
+}
+
+// clipped to the row
+static void
+fill_span(uint32_t* row, int w, int begin, int end, uint32_t color)
+{
+	if (begin < 0)
+		begin = 0;
+	if (end > w)
+		end = w;
+	if (begin < end)
+		raster_fill_row(row + begin, end - begin, color);
+}
+
+void
+raster_quad_pattern_rows(uint32_t* rgba, int w, int h, int row_begin, int row_end)
+{
+	for (int row = row_begin; row < row_end; row++) {
+		uint32_t* pixels = rgba + (size_t)row * w;
+		uint8_t red = (uint8_t)(((float)row / (float)h) * 255.);
+		raster_fill_row(pixels, w, raster_rgba(red, 0, 0, 255));
+
+		// |row - col| < 3, then |(w - col) - row| < 3 drawn over it
+		fill_span(pixels, w, row - 2, row + 3, raster_rgba(255, 255, 255, 255));
+		fill_span(pixels, w, w - row - 2, w - row + 3, raster_rgba(0, 0, 0, 255));
+	}
+}
+
+static void
+record_throughput(uint64_t pixels, double start_us)
+{
+	double ns = (trace_now_us() - start_us) * 1000.;
+	raster_pixels.fetch_add(pixels, std::memory_order_relaxed);
+	raster_ns.fetch_add((uint64_t)ns, std::memory_order_relaxed);
+}
+
+static int
+band_rows(int w)
+{
+	int rows = w > 0 ? RASTER_BAND_PIXELS / w : 1;
+	return rows > 0 ? rows : 1;
+}
+
+struct quad_pattern_job
+{
+	uint32_t* rgba;
+	int w;
+	int h;
+};
+
+static void
+quad_pattern_band(void* data, uint32_t begin, uint32_t end)
+{
+	quad_pattern_job* job = (quad_pattern_job*)data;
+	raster_quad_pattern_rows(job->rgba, job->w, job->h, (int)begin, (int)end);
+}
+
+void
+raster_quad_pattern(uint8_t* rgba, int w, int h)
+{
+	TRACE_SCOPE("raster_quad_pattern");
+	double start_us = trace_now_us();
+
+	quad_pattern_job job = {.rgba = (uint32_t*)rgba, .w = w, .h = h};
+	job_parallel_for("raster quad band", (uint32_t)h, (uint32_t)band_rows(w), quad_pattern_band, &job);
+
+	record_throughput((uint64_t)w * h, start_us);
+}
+
+struct compose_job
+{
+	uint32_t* dst;
+	const uint32_t* src;
+	int w;
+};
+
+static void
+compose_band(void* data, uint32_t begin, uint32_t end)
+{
+	compose_job* job = (compose_job*)data;
+	for (uint32_t row = begin; row < end; row++) {
+		size_t offset = (size_t)row * job->w;
+		raster_compose_over_row(job->dst + offset, job->src + offset, job->w);
+	}
+}
+
+void
+raster_compose_over(uint8_t* dst, const uint8_t* src, int w, int h)
+{
+	TRACE_SCOPE("raster_compose_over");
+	double start_us = trace_now_us();
+
+	compose_job job = {.dst = (uint32_t*)dst, .src = (const uint32_t*)src, .w = w};
+	job_parallel_for("raster compose band", (uint32_t)h, (uint32_t)band_rows(w), compose_band, &job);
+
+	record_throughput((uint64_t)w * h, start_us);
+}
+
+float
+raster_throughput()
+{
+	uint64_t pixels = raster_pixels.exchange(0, std::memory_order_relaxed);
+	uint64_t ns = raster_ns.exchange(0, std::memory_order_relaxed);
+	if (pixels == 0 || ns == 0)
+		return 0.f;
+	// pixels per nanosecond are thousands of megapixels per second
+	return (float)((double)pixels / (double)ns * 1000.);
+}
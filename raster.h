@@ -0,0 +1,47 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief CPU generated content for the quad and cylinder layers
+ *
+ * Row kernels fill and compose RGBA8 pixels with SSE2, or AVX2 when the compiler
+ * targets it. The image functions split the rows into bands that run as jobs, so
+ * they can write straight into a mapped upload buffer.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// an RGBA8 pixel as stored in memory, read as a little endian uint32_t
+static inline uint32_t
+raster_rgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+	return (uint32_t)r | ((uint32_t)g << 8) | ((uint32_t)b << 16) | ((uint32_t)a << 24);
+}
+
+void
+raster_fill_row(uint32_t* row, int count, uint32_t color);
+
+// src over dst with the alpha of src, not premultiplied. The result alpha is
+// src_alpha + dst_alpha * (1 - src_alpha).
+void
+raster_compose_over_row(uint32_t* dst, const uint32_t* src, int count);
+
+// rows [row_begin, row_end) of the quad pattern, see raster_quad_pattern()
+void
+raster_quad_pattern_rows(uint32_t* rgba, int w, int h, int row_begin, int row_end);
+
+// red gradient from top to bottom with a white and a black diagonal line,
+// w * h RGBA8 pixels
+void
+raster_quad_pattern(uint8_t* rgba, int w, int h);
+
+// composes a w * h src image over dst
+void
+raster_compose_over(uint8_t* dst, const uint8_t* src, int w, int h);
+
+// megapixels per second written by raster_quad_pattern() and raster_compose_over()
+// since the last call, 0 if there were no calls. May be called from any thread.
+float
+raster_throughput();
@@ -0,0 +1,599 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Scene objects stored in structure of arrays tables
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include "scene.h"
+#include "bvh.h"
+#include "job.h"
+#include "trace.h"
+
+#define SCENE_SLOT_BITS 20
+#define SCENE_SLOT_MASK ((1u << SCENE_SLOT_BITS) - 1)
+#define SCENE_GENERATION_MASK ((1u << (32 - SCENE_SLOT_BITS)) - 1)
+#define SCENE_NO_OBJECT UINT32_MAX
+// objects per scene_update() job
+#define SCENE_UPDATE_BATCH 1024
+
+#define SCENE_FLAG_DIRTY 1
+#define SCENE_FLAG_VISIBLE 2
+#define SCENE_FLAG_PICKABLE 4
+#define SCENE_FLAG_HIGHLIGHTED 8
+#define SCENE_FLAG_ENVIRONMENT 16
+
+// rendered into the environment layer when the environment is split from the eyes
+#define SCENE_ENVIRONMENT_FLAGS (SCENE_FLAG_VISIBLE | SCENE_FLAG_ENVIRONMENT)
+
+const float scene_material_colors[SCENE_MATERIAL_COUNT][3] = {
+    {0.f, 0.f, 0.f},
+    {1.f, .5f, .5f},
+    {.5f, 1.f, .5f},
+    {1.f, 1.f, .2f},
+};
+
+// bounding sphere radius of each mesh at scale 1
+static const float mesh_radius[SCENE_MESH_COUNT] = {
+    // half the diagonal of the unit cube
+    0.8660254f,
+};
+
+struct draw_storage
+{
+	std::vector<XrMatrix4x4f> models;
+	std::vector<uint32_t> meshes, materials;
+	std::vector<float> x, y, z, radius;
+	scene_draw_list list;
+};
+
+static struct
+{
+	// objects, densely packed. Removing an object moves the last one into its place.
+	std::vector<XrVector3f> position;
+	std::vector<XrQuaternionf> orientation;
+	std::vector<XrVector3f> scale;
+	std::vector<float> spin;
+	std::vector<uint32_t> mesh;
+	std::vector<uint32_t> material;
+	std::vector<uint8_t> flags;
+	std::vector<XrMatrix4x4f> world;
+	std::vector<float> bound_x, bound_y, bound_z, bound_radius;
+	std::vector<uint32_t> object_slot;
+
+	// handle slots, pointing to the object index
+	std::vector<uint32_t> slot_object;
+	std::vector<uint32_t> slot_generation;
+	std::vector<uint32_t> free_slots;
+
+	// hierarchy over the pickable objects, item i is object pick_objects[i]
+	bvh pick_bvh;
+	std::vector<uint32_t> pick_objects;
+	std::vector<float> pick_x, pick_y, pick_z, pick_radius;
+	bool pick_rebuild;
+	bool pick_refit;
+
+	// packed draw lists, the eye list is rebuilt every frame, the environment list
+	// only when the environment changed
+	draw_storage draws;
+	draw_storage environment_draws;
+
+	bool environment_split;
+	uint32_t environment_version;
+} scene;
+
+// object index of a handle, SCENE_NO_OBJECT for stale handles
+static uint32_t
+object_index(scene_handle handle)
+{
+	uint32_t slot = (handle & SCENE_SLOT_MASK) - 1;
+	if (handle == SCENE_HANDLE_INVALID || slot >= scene.slot_object.size())
+		return SCENE_NO_OBJECT;
+	if (scene.slot_generation[slot] != handle >> SCENE_SLOT_BITS)
+		return SCENE_NO_OBJECT;
+	return scene.slot_object[slot];
+}
+
+scene_handle
+scene_add(scene_mesh mesh, scene_material material, XrPosef pose, XrVector3f scale)
+{
+	uint32_t slot;
+	if (!scene.free_slots.empty()) {
+		slot = scene.free_slots.back();
+		scene.free_slots.pop_back();
+	} else {
+		slot = scene.slot_object.size();
+		if (slot + 1 > SCENE_SLOT_MASK) {
+			printf("Scene is full, can not add more than %u objects\n", SCENE_SLOT_MASK);
+			return SCENE_HANDLE_INVALID;
+		}
+		scene.slot_object.push_back(SCENE_NO_OBJECT);
+		scene.slot_generation.push_back(1);
+	}
+
+	uint32_t index = scene.position.size();
+	scene.slot_object[slot] = index;
+
+	scene.position.push_back(pose.position);
+	scene.orientation.push_back(pose.orientation);
+	scene.scale.push_back(scale);
+	scene.spin.push_back(0.f);
+	scene.mesh.push_back(mesh);
+	scene.material.push_back(material);
+	scene.flags.push_back(SCENE_FLAG_DIRTY | SCENE_FLAG_VISIBLE | SCENE_FLAG_PICKABLE);
+	scene.world.push_back(XrMatrix4x4f{});
+	scene.bound_x.push_back(0.f);
+	scene.bound_y.push_back(0.f);
+	scene.bound_z.push_back(0.f);
+	scene.bound_radius.push_back(0.f);
+	scene.object_slot.push_back(slot);
+	scene.pick_rebuild = true;
+
+	return (scene.slot_generation[slot] << SCENE_SLOT_BITS) | (slot + 1);
+}
+
+static scene_handle
+object_handle(uint32_t index)
+{
+	uint32_t slot = scene.object_slot[index];
+	return (scene.slot_generation[slot] << SCENE_SLOT_BITS) | (slot + 1);
+}
+
+template <typename T>
+static void
+move_last(std::vector<T>& table, uint32_t index)
+{
+	table[index] = table.back();
+	table.pop_back();
+}
+
+void
+scene_remove(scene_handle handle)
+{
+	uint32_t index = object_index(handle);
+	if (index == SCENE_NO_OBJECT)
+		return;
+
+	if (scene.flags[index] & SCENE_FLAG_ENVIRONMENT)
+		scene.environment_version++;
+
+	uint32_t slot = (handle & SCENE_SLOT_MASK) - 1;
+	uint32_t last_slot = scene.object_slot.back();
+	scene.slot_object[last_slot] = index;
+
+	move_last(scene.position, index);
+	move_last(scene.orientation, index);
+	move_last(scene.scale, index);
+	move_last(scene.spin, index);
+	move_last(scene.mesh, index);
+	move_last(scene.material, index);
+	move_last(scene.flags, index);
+	move_last(scene.world, index);
+	move_last(scene.bound_x, index);
+	move_last(scene.bound_y, index);
+	move_last(scene.bound_z, index);
+	move_last(scene.bound_radius, index);
+	move_last(scene.object_slot, index);
+
+	// old handles of the slot become stale
+	scene.slot_object[slot] = SCENE_NO_OBJECT;
+	scene.slot_generation[slot] = (scene.slot_generation[slot] + 1) & SCENE_GENERATION_MASK;
+	if (scene.slot_generation[slot] == 0)
+		scene.slot_generation[slot] = 1;
+	scene.free_slots.push_back(slot);
+	scene.pick_rebuild = true;
+}
+
+bool
+scene_valid(scene_handle handle)
+{
+	return object_index(handle) != SCENE_NO_OBJECT;
+}
+
+void
+scene_set_pose(scene_handle handle, XrPosef pose)
+{
+	uint32_t index = object_index(handle);
+	if (index == SCENE_NO_OBJECT)
+		return;
+	scene.position[index] = pose.position;
+	scene.orientation[index] = pose.orientation;
+	scene.flags[index] |= SCENE_FLAG_DIRTY;
+}
+
+void
+scene_set_scale(scene_handle handle, XrVector3f scale)
+{
+	uint32_t index = object_index(handle);
+	if (index == SCENE_NO_OBJECT)
+		return;
+	scene.scale[index] = scale;
+	scene.flags[index] |= SCENE_FLAG_DIRTY;
+}
+
+void
+scene_set_visible(scene_handle handle, bool visible)
+{
+	uint32_t index = object_index(handle);
+	if (index == SCENE_NO_OBJECT)
+		return;
+	if (visible == ((scene.flags[index] & SCENE_FLAG_VISIBLE) != 0))
+		return;
+	scene.flags[index] ^= SCENE_FLAG_VISIBLE;
+	if (scene.flags[index] & SCENE_FLAG_ENVIRONMENT)
+		scene.environment_version++;
+}
+
+void
+scene_set_spin(scene_handle handle, float rotations_per_sec)
+{
+	uint32_t index = object_index(handle);
+	if (index == SCENE_NO_OBJECT)
+		return;
+	scene.spin[index] = rotations_per_sec;
+	scene.flags[index] |= SCENE_FLAG_DIRTY;
+}
+
+void
+scene_set_pickable(scene_handle handle, bool pickable)
+{
+	uint32_t index = object_index(handle);
+	if (index == SCENE_NO_OBJECT || pickable == ((scene.flags[index] & SCENE_FLAG_PICKABLE) != 0))
+		return;
+	scene.flags[index] ^= SCENE_FLAG_PICKABLE;
+	scene.pick_rebuild = true;
+}
+
+void
+scene_set_highlighted(scene_handle handle, bool highlighted)
+{
+	uint32_t index = object_index(handle);
+	if (index == SCENE_NO_OBJECT)
+		return;
+	if (highlighted == ((scene.flags[index] & SCENE_FLAG_HIGHLIGHTED) != 0))
+		return;
+	scene.flags[index] ^= SCENE_FLAG_HIGHLIGHTED;
+	if (scene.flags[index] & SCENE_FLAG_ENVIRONMENT)
+		scene.environment_version++;
+}
+
+void
+scene_set_environment(scene_handle handle, bool environment)
+{
+	uint32_t index = object_index(handle);
+	if (index == SCENE_NO_OBJECT || environment == ((scene.flags[index] & SCENE_FLAG_ENVIRONMENT) != 0))
+		return;
+	scene.flags[index] ^= SCENE_FLAG_ENVIRONMENT;
+	scene.environment_version++;
+}
+
+void
+scene_split_environment(bool split)
+{
+	if (scene.environment_split == split)
+		return;
+	scene.environment_split = split;
+	scene.environment_version++;
+}
+
+uint32_t
+scene_environment_version()
+{
+	return scene.environment_version;
+}
+
+uint32_t
+scene_object_count()
+{
+	return scene.position.size();
+}
+
+struct update_objects_job
+{
+	double display_time_seconds;
+	// set by any batch that moved a pickable object
+	std::atomic<bool> pick_refit;
+	// set by any batch that moved an environment object
+	std::atomic<bool> environment_changed;
+};
+
+// batches only write the objects in their range
+static void
+update_objects(void* data, uint32_t begin, uint32_t end)
+{
+	update_objects_job* job = (update_objects_job*)data;
+	bool pick_refit = false;
+	bool environment_changed = false;
+
+	for (uint32_t i = begin; i < end; i++) {
+		if (scene.spin[i] == 0.f)
+			continue;
+		// whole degrees, like the cubes always turned
+		float rotation = ((long)(job->display_time_seconds * 360. * scene.spin[i])) % 360;
+		float half_angle = rotation * (float)M_PI / 360.f;
+		scene.orientation[i] = {.x = 0.f, .y = sinf(half_angle), .z = 0.f, .w = cosf(half_angle)};
+		scene.flags[i] |= SCENE_FLAG_DIRTY;
+	}
+
+	for (uint32_t i = begin; i < end; i++) {
+		if (!(scene.flags[i] & SCENE_FLAG_DIRTY))
+			continue;
+
+		XrMatrix4x4f_CreateModelMatrix(&scene.world[i], &scene.position[i], &scene.orientation[i],
+		                               &scene.scale[i]);
+
+		// meshes are centered on the origin
+		XrVector3f s = scene.scale[i];
+		float max_scale = fmaxf(fabsf(s.x), fmaxf(fabsf(s.y), fabsf(s.z)));
+		float radius = mesh_radius[scene.mesh[i]] * max_scale;
+
+		// spinning only changes the orientation, the hierarchy stays valid
+		bool moved = scene.bound_x[i] != scene.position[i].x || scene.bound_y[i] != scene.position[i].y ||
+		             scene.bound_z[i] != scene.position[i].z || scene.bound_radius[i] != radius;
+		if (moved && (scene.flags[i] & SCENE_FLAG_PICKABLE))
+			pick_refit = true;
+		if (scene.flags[i] & SCENE_FLAG_ENVIRONMENT)
+			environment_changed = true;
+
+		scene.bound_x[i] = scene.position[i].x;
+		scene.bound_y[i] = scene.position[i].y;
+		scene.bound_z[i] = scene.position[i].z;
+		scene.bound_radius[i] = radius;
+
+		scene.flags[i] &= ~SCENE_FLAG_DIRTY;
+	}
+
+	if (pick_refit)
+		job->pick_refit.store(true, std::memory_order_relaxed);
+	if (environment_changed)
+		job->environment_changed.store(true, std::memory_order_relaxed);
+}
+
+void
+scene_update(XrTime predicted_display_time)
+{
+	TRACE_SCOPE("scene_update");
+
+	uint32_t count = scene.position.size();
+
+	update_objects_job job;
+	job.display_time_seconds = ((double)predicted_display_time) / (1000. * 1000. * 1000.);
+	job.pick_refit = false;
+	job.environment_changed = false;
+	job_parallel_for("scene update objects", count, SCENE_UPDATE_BATCH, update_objects, &job);
+	if (job.pick_refit.load(std::memory_order_relaxed))
+		scene.pick_refit = true;
+	if (job.environment_changed.load(std::memory_order_relaxed))
+		scene.environment_version++;
+
+	if (scene.pick_rebuild) {
+		TRACE_SCOPE("scene pick rebuild");
+		scene.pick_objects.clear();
+		for (uint32_t i = 0; i < count; i++) {
+			if (scene.flags[i] & SCENE_FLAG_PICKABLE)
+				scene.pick_objects.push_back(i);
+		}
+	}
+
+	if (scene.pick_rebuild || scene.pick_refit) {
+		uint32_t pick_count = scene.pick_objects.size();
+		scene.pick_x.resize(pick_count);
+		scene.pick_y.resize(pick_count);
+		scene.pick_z.resize(pick_count);
+		scene.pick_radius.resize(pick_count);
+		for (uint32_t i = 0; i < pick_count; i++) {
+			uint32_t object = scene.pick_objects[i];
+			scene.pick_x[i] = scene.bound_x[object];
+			scene.pick_y[i] = scene.bound_y[object];
+			scene.pick_z[i] = scene.bound_z[object];
+			scene.pick_radius[i] = scene.bound_radius[object];
+		}
+
+		if (scene.pick_rebuild) {
+			bvh_build(&scene.pick_bvh, pick_count, scene.pick_x.data(), scene.pick_y.data(),
+			          scene.pick_z.data(), scene.pick_radius.data());
+		} else {
+			TRACE_SCOPE("scene pick refit");
+			bvh_refit(&scene.pick_bvh, scene.pick_x.data(), scene.pick_y.data(), scene.pick_z.data(),
+			          scene.pick_radius.data());
+		}
+		scene.pick_rebuild = false;
+		scene.pick_refit = false;
+	}
+}
+
+uint32_t
+scene_overlap_sphere(XrVector3f center, float radius, scene_handle* handles, uint32_t max_handles)
+{
+	// the item indices are written to handles and translated in place
+	uint32_t found = bvh_overlap_sphere(&scene.pick_bvh, center, radius, handles, max_handles);
+	uint32_t written = found < max_handles ? found : max_handles;
+	for (uint32_t i = 0; i < written; i++)
+		handles[i] = object_handle(scene.pick_objects[handles[i]]);
+	return found;
+}
+
+uint32_t
+scene_overlap_spheres(const XrVector3f* centers,
+                      const float* radii,
+                      uint32_t count,
+                      scene_handle* handles,
+                      uint32_t max_handles)
+{
+	uint32_t found = bvh_overlap_spheres(&scene.pick_bvh, centers, radii, count, handles, max_handles);
+	uint32_t written = found < max_handles ? found : max_handles;
+	for (uint32_t i = 0; i < written; i++)
+		handles[i] = object_handle(scene.pick_objects[handles[i]]);
+	return found;
+}
+
+scene_handle
+scene_raycast(XrVector3f origin, XrVector3f direction, float max_distance, float* distance)
+{
+	uint32_t item;
+	if (!bvh_raycast(&scene.pick_bvh, origin, direction, max_distance, &item, distance))
+		return SCENE_HANDLE_INVALID;
+	return object_handle(scene.pick_objects[item]);
+}
+
+static uint32_t
+draw_material(uint32_t index)
+{
+	return (scene.flags[index] & SCENE_FLAG_HIGHLIGHTED) ? (uint32_t)SCENE_MATERIAL_HIGHLIGHT : scene.material[index];
+}
+
+// objects whose flags masked with SCENE_ENVIRONMENT_FLAGS equal match
+static const scene_draw_list*
+build_draw_list(draw_storage* draws, uint8_t match)
+{
+	uint32_t count = scene.position.size();
+	uint8_t mask = scene.environment_split ? SCENE_ENVIRONMENT_FLAGS : SCENE_FLAG_VISIBLE;
+
+	// counting sort by material, so renderers change the color as rarely as possible
+	uint32_t material_start[SCENE_MATERIAL_COUNT + 1] = {};
+	for (uint32_t i = 0; i < count; i++) {
+		if ((scene.flags[i] & mask) == match)
+			material_start[draw_material(i) + 1]++;
+	}
+	for (int m = 0; m < SCENE_MATERIAL_COUNT; m++)
+		material_start[m + 1] += material_start[m];
+
+	uint32_t draw_count = material_start[SCENE_MATERIAL_COUNT];
+	draws->models.resize(draw_count);
+	draws->meshes.resize(draw_count);
+	draws->materials.resize(draw_count);
+	draws->x.resize(draw_count);
+	draws->y.resize(draw_count);
+	draws->z.resize(draw_count);
+	draws->radius.resize(draw_count);
+
+	for (uint32_t i = 0; i < count; i++) {
+		if ((scene.flags[i] & mask) != match)
+			continue;
+		uint32_t material = draw_material(i);
+		uint32_t d = material_start[material]++;
+		draws->models[d] = scene.world[i];
+		draws->meshes[d] = scene.mesh[i];
+		draws->materials[d] = material;
+		draws->x[d] = scene.bound_x[i];
+		draws->y[d] = scene.bound_y[i];
+		draws->z[d] = scene.bound_z[i];
+		draws->radius[d] = scene.bound_radius[i];
+	}
+
+	draws->list = {.count = draw_count,
+	               .models = draws->models.data(),
+	               .meshes = draws->meshes.data(),
+	               .materials = draws->materials.data(),
+	               .bound_x = draws->x.data(),
+	               .bound_y = draws->y.data(),
+	               .bound_z = draws->z.data(),
+	               .bound_radius = draws->radius.data()};
+	return &draws->list;
+}
+
+const scene_draw_list*
+scene_build_draw_list()
+{
+	TRACE_SCOPE("scene_build_draw_list");
+	return build_draw_list(&scene.draws, SCENE_FLAG_VISIBLE);
+}
+
+const scene_draw_list*
+scene_build_environment_draw_list()
+{
+	TRACE_SCOPE("scene_build_environment_draw_list");
+	// without the split the environment objects are in the eye list
+	if (!scene.environment_split) {
+		scene.environment_draws.list = {};
+		return &scene.environment_draws.list;
+	}
+	return build_draw_list(&scene.environment_draws, SCENE_ENVIRONMENT_FLAGS);
+}
+
+void
+scene_add_default_objects()
+{
+	float dist = 1.5f;
+	float height = 0.5f;
+	XrVector3f positions[4] = {{0, height, -dist}, {0, height, dist}, {dist, height, 0}, {-dist, height, 0}};
+	XrVector3f scale = {.x = .33f, .y = .33f, .z = .33f};
+
+	for (XrVector3f& position : positions) {
+		XrPosef pose = {.orientation = {.x = 0.f, .y = 0.f, .z = 0.f, .w = 1.f}, .position = position};
+		scene_handle cube = scene_add(SCENE_MESH_CUBE, SCENE_MATERIAL_UV, pose, scale);
+		scene_set_spin(cube, .25f);
+	}
+}
+
+void
+scene_add_stress_cubes(uint32_t count)
+{
+	// a cube shaped grid centered on the origin, starting with the lowest layer
+	uint32_t side = (uint32_t)ceil(cbrt((double)count));
+	float spacing = .25f;
+	float half_extent = (side - 1) * spacing / 2.f;
+	XrVector3f scale = {.x = .05f, .y = .05f, .z = .05f};
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t x = i % side;
+		uint32_t z = (i / side) % side;
+		uint32_t y = i / (side * side);
+		XrPosef pose = {.orientation = {.x = 0.f, .y = 0.f, .z = 0.f, .w = 1.f},
+		                .position = {.x = x * spacing - half_extent,
+		                             .y = y * spacing,
+		                             .z = z * spacing - half_extent}};
+		if (scene_add(SCENE_MESH_CUBE, SCENE_MATERIAL_UV, pose, scale) == SCENE_HANDLE_INVALID)
+			return;
+	}
+	printf("Added %u stress test cubes\n", count);
+}
+
+void
+scene_add_environment_objects()
+{
+	// towers of different heights on a ring far around the origin
+	int count = 48;
+	float ring_radius = 30.f;
+	for (int i = 0; i < count; i++) {
+		float angle = i * 2.f * (float)M_PI / count;
+		float height = 4.f + 12.f * (float)((i * 7) % 11) / 10.f;
+		XrPosef pose = {.orientation = {.x = 0.f, .y = sinf(-angle / 2.f), .z = 0.f, .w = cosf(-angle / 2.f)},
+		                .position = {.x = sinf(angle) * ring_radius, .y = height / 2.f, .z = -cosf(angle) * ring_radius}};
+		XrVector3f scale = {.x = 3.f, .y = height, .z = 3.f};
+		scene_handle tower = scene_add(SCENE_MESH_CUBE, SCENE_MATERIAL_UV, pose, scale);
+		if (tower == SCENE_HANDLE_INVALID)
+			return;
+		scene_set_pickable(tower, false);
+		scene_set_environment(tower, true);
+	}
+}
+
+void
+scene_cleanup()
+{
+	scene.position.clear();
+	scene.orientation.clear();
+	scene.scale.clear();
+	scene.spin.clear();
+	scene.mesh.clear();
+	scene.material.clear();
+	scene.flags.clear();
+	scene.world.clear();
+	scene.bound_x.clear();
+	scene.bound_y.clear();
+	scene.bound_z.clear();
+	scene.bound_radius.clear();
+	scene.object_slot.clear();
+	scene.slot_object.clear();
+	scene.slot_generation.clear();
+	scene.free_slots.clear();
+	scene.pick_objects.clear();
+	scene.pick_bvh = bvh{};
+	scene.pick_rebuild = true;
+}
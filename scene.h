@@ -0,0 +1,156 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Scene objects stored in structure of arrays tables
+ *
+ * Objects are referenced by handles that stay valid until the object is removed,
+ * internally they are packed densely so updates walk contiguous arrays. Setting a
+ * transform only marks the object dirty, scene_update() recomputes the world matrices
+ * and bounds of dirty objects. The renderers only consume the packed draw list.
+ * Pickable objects are kept in a bounding volume hierarchy for hand interaction
+ * queries, it is refit when they move and rebuilt when objects are added or removed.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "xrmath.h"
+
+// slot index in the low bits, generation in the high bits. 0 is never a valid handle.
+typedef uint32_t scene_handle;
+#define SCENE_HANDLE_INVALID 0
+
+// all meshes are drawn with the vertices of cube_mesh.h for now
+enum scene_mesh
+{
+	SCENE_MESH_CUBE,
+	SCENE_MESH_COUNT,
+};
+
+enum scene_material
+{
+	// colored by the UV coordinates
+	SCENE_MATERIAL_UV,
+	SCENE_MATERIAL_LEFT_HAND,
+	SCENE_MATERIAL_RIGHT_HAND,
+	// drawn instead of the material of highlighted objects
+	SCENE_MATERIAL_HIGHLIGHT,
+	SCENE_MATERIAL_COUNT,
+};
+
+// flat color per material, (0, 0, 0) means the shader uses the UV color
+extern const float scene_material_colors[SCENE_MATERIAL_COUNT][3];
+
+// packed visible objects of one frame, sorted by material. Bounding spheres are in
+// world space, one array per component.
+struct scene_draw_list
+{
+	uint32_t count;
+	const XrMatrix4x4f* models;
+	const uint32_t* meshes;
+	const uint32_t* materials;
+	const float* bound_x;
+	const float* bound_y;
+	const float* bound_z;
+	const float* bound_radius;
+};
+
+// Not thread safe, all functions have to be called from the same thread. The draw
+// list can be read from any thread until the next scene_build_draw_list().
+
+scene_handle
+scene_add(scene_mesh mesh, scene_material material, XrPosef pose, XrVector3f scale);
+
+void
+scene_remove(scene_handle handle);
+
+bool
+scene_valid(scene_handle handle);
+
+void
+scene_set_pose(scene_handle handle, XrPosef pose);
+
+void
+scene_set_scale(scene_handle handle, XrVector3f scale);
+
+// hidden objects stay in the scene but are not put into the draw list
+void
+scene_set_visible(scene_handle handle, bool visible);
+
+// rotates the object around the y axis, replacing the orientation of its pose
+void
+scene_set_spin(scene_handle handle, float rotations_per_sec);
+
+// objects are pickable by default, only pickable objects are found by the queries
+void
+scene_set_pickable(scene_handle handle, bool pickable);
+
+void
+scene_set_highlighted(scene_handle handle, bool highlighted);
+
+// distant, mostly static objects, rendered into the environment layer instead of the
+// eyes while the environment is split, see scene_split_environment()
+void
+scene_set_environment(scene_handle handle, bool environment);
+
+// with split, environment objects are only in the environment draw list, without
+// they are drawn into the eyes like all other objects
+void
+scene_split_environment(bool split);
+
+// changes whenever the environment draw list would change
+uint32_t
+scene_environment_version();
+
+uint32_t
+scene_object_count();
+
+// applies spin and recomputes world matrices and bounds of dirty objects
+void
+scene_update(XrTime predicted_display_time);
+
+const scene_draw_list*
+scene_build_draw_list();
+
+// the visible environment objects, empty unless the environment is split. Stays valid
+// until the next call.
+const scene_draw_list*
+scene_build_environment_draw_list();
+
+// Queries use the bounding spheres as of the last scene_update().
+
+// writes up to max_handles pickable objects overlapping the sphere, returns how many
+// overlap in total
+uint32_t
+scene_overlap_sphere(XrVector3f center, float radius, scene_handle* handles, uint32_t max_handles);
+
+// pickable objects overlapping any of the spheres, each reported once
+uint32_t
+scene_overlap_spheres(const XrVector3f* centers,
+                      const float* radii,
+                      uint32_t count,
+                      scene_handle* handles,
+                      uint32_t max_handles);
+
+// nearest pickable object hit by the ray, SCENE_HANDLE_INVALID if none.
+// direction has to be normalized.
+scene_handle
+scene_raycast(XrVector3f origin, XrVector3f direction, float max_distance, float* distance);
+
+// the four spinning cubes around the origin
+void
+scene_add_default_objects();
+
+// a grid of count small static cubes around the origin, for measuring how the
+// frame time scales with the object count
+void
+scene_add_stress_cubes(uint32_t count);
+
+// a ring of towers far away from the origin, marked as environment objects
+void
+scene_add_environment_objects();
+
+void
+scene_cleanup();
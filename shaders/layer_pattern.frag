@@ -0,0 +1,33 @@
+#version 450
+
+// Vulkan version of layer_fragmentshader in glimpl.cpp, the same pattern as
+// raster_quad_pattern()
+
+layout(push_constant) uniform Layer
+{
+	ivec2 size;
+	// the attachment encodes to sRGB, decode so the stored bytes match the CPU producer
+	int srgb;
+} layer;
+
+layout(location = 0) out vec4 FragColor;
+
+vec3 srgb_to_linear(vec3 c)
+{
+	return mix(c / 12.92, pow((c + 0.055) / 1.055, vec3(2.4)), greaterThan(c, vec3(0.04045)));
+}
+
+void main()
+{
+	int col = int(gl_FragCoord.x);
+	int row = int(gl_FragCoord.y);
+
+	// whole steps like the bytes written by the CPU
+	vec3 color = vec3(floor(float(row) / float(layer.size.y) * 255.0) / 255.0, 0.0, 0.0);
+	if (abs(row - col) < 3)
+		color = vec3(1.0);
+	if (abs((layer.size.x - col) - row) < 3)
+		color = vec3(0.0);
+
+	FragColor = vec4(layer.srgb != 0 ? srgb_to_linear(color) : color, 1.0);
+}
@@ -0,0 +1,21 @@
+#version 450
+
+// Vulkan version of the scene shader in glimpl.cpp
+
+layout(push_constant) uniform Draw
+{
+	mat4 mvp;
+	vec4 color;
+} draw;
+
+layout(location = 0) in vec2 vertexColor;
+
+layout(location = 0) out vec4 FragColor;
+
+void main()
+{
+	// the color (0, 0, 0) gets replaced by the UV color
+	FragColor = (draw.color.x < 0.01 && draw.color.y < 0.01 && draw.color.z < 0.01)
+	    ? vec4(vertexColor, 1.0, 1.0)
+	    : vec4(draw.color.xyz, 1.0);
+}
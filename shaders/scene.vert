@@ -0,0 +1,20 @@
+#version 450
+
+// Vulkan version of the scene shader in glimpl.cpp
+
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec2 aColor;
+
+layout(push_constant) uniform Draw
+{
+	mat4 mvp;
+	vec4 color;
+} draw;
+
+layout(location = 0) out vec2 vertexColor;
+
+void main()
+{
+	gl_Position = draw.mvp * vec4(aPos, 1.0);
+	vertexColor = aColor;
+}
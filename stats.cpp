@@ -0,0 +1,139 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Rolling frame timing statistics with a periodic console report
+ */
+
+#include "stats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "log.h"
+
+#define STATS_MAX_COUNT 64
+
+static rolling_stats all_stats[STATS_MAX_COUNT];
+static uint32_t all_stats_count = 0;
+static double last_report_ms = -1.;
+
+rolling_stats*
+stats_get(const char* name)
+{
+	for (uint32_t i = 0; i < all_stats_count; i++) {
+		if (all_stats[i].name == name || strcmp(all_stats[i].name, name) == 0)
+			return &all_stats[i];
+	}
+
+	if (all_stats_count == STATS_MAX_COUNT) {
+		printf("Too many statistics, not recording %s\n", name);
+		return NULL;
+	}
+
+	rolling_stats* stats = &all_stats[all_stats_count++];
+	stats->name = name;
+	stats->unit = NULL;
+	stats->count = 0;
+	stats->next = 0;
+	stats->last = 0.f;
+	return stats;
+}
+
+rolling_stats*
+stats_get_unit(const char* name, const char* unit)
+{
+	rolling_stats* stats = stats_get(name);
+	if (stats != NULL)
+		stats->unit = unit;
+	return stats;
+}
+
+void
+stats_add(rolling_stats* stats, float value)
+{
+	if (stats == NULL)
+		return;
+
+	stats->samples[stats->next] = value;
+	stats->next = (stats->next + 1) % STATS_WINDOW;
+	if (stats->count < STATS_WINDOW)
+		stats->count++;
+	stats->last = value;
+}
+
+void
+stats_summarize(const rolling_stats* stats, stats_summary* summary)
+{
+	*summary = {};
+	summary->count = stats->count;
+	summary->last = stats->last;
+	if (stats->count == 0)
+		return;
+
+	float sorted[STATS_WINDOW];
+	memcpy(sorted, stats->samples, stats->count * sizeof(float));
+	std::sort(sorted, sorted + stats->count);
+
+	double sum = 0;
+	for (uint32_t i = 0; i < stats->count; i++)
+		sum += sorted[i];
+
+	summary->mean = (float)(sum / stats->count);
+	summary->min = sorted[0];
+	summary->max = sorted[stats->count - 1];
+	summary->p50 = sorted[(stats->count - 1) * 50 / 100];
+	summary->p90 = sorted[(stats->count - 1) * 90 / 100];
+	summary->p99 = sorted[(stats->count - 1) * 99 / 100];
+}
+
+// the report runs in the frame loop, it goes through the log unlimited
+static void
+report_table(bool milliseconds)
+{
+	bool header = false;
+	for (uint32_t i = 0; i < all_stats_count; i++) {
+		if ((all_stats[i].unit == NULL) != milliseconds)
+			continue;
+		stats_summary s;
+		stats_summarize(&all_stats[i], &s);
+		if (s.count == 0)
+			continue;
+
+		if (!header) {
+			LOG_AT_RATE(LOG_LEVEL_INFO, 0, "%-28s %8s %8s %8s %8s %8s %8s\n", milliseconds ? "ms" : "", "mean",
+			            "min", "p50", "p90", "p99", "max");
+			header = true;
+		}
+		char name[64];
+		if (milliseconds)
+			snprintf(name, sizeof(name), "%s", all_stats[i].name);
+		else
+			snprintf(name, sizeof(name), "%s (%s)", all_stats[i].name, all_stats[i].unit);
+		LOG_AT_RATE(LOG_LEVEL_INFO, 0, "%-28s %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n", name, s.mean, s.min,
+		            s.p50, s.p90, s.p99, s.max);
+	}
+}
+
+void
+stats_report()
+{
+	report_table(true);
+	report_table(false);
+}
+
+void
+stats_report_every(double now_ms, double interval_ms)
+{
+	if (last_report_ms < 0.) {
+		last_report_ms = now_ms;
+		return;
+	}
+	if (now_ms - last_report_ms < interval_ms)
+		return;
+
+	last_report_ms = now_ms;
+	stats_report();
+}
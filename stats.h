@@ -0,0 +1,62 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Rolling frame timing statistics with a periodic console report
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// number of samples the statistics are computed over
+#define STATS_WINDOW 512
+
+struct rolling_stats
+{
+	const char* name;
+	// NULL for milliseconds
+	const char* unit;
+	float samples[STATS_WINDOW];
+	uint32_t count;
+	uint32_t next;
+	float last;
+};
+
+struct stats_summary
+{
+	uint32_t count;
+	float last;
+	float mean;
+	float min;
+	float max;
+	float p50;
+	float p90;
+	float p99;
+};
+
+// Not thread safe: create all statistics on one thread, and feed each one from a
+// single thread.
+
+// finds or creates the statistics for name, which must be a string literal.
+// Lookup is a linear search, keep the pointer around in hot paths.
+rolling_stats*
+stats_get(const char* name);
+
+// statistics that are not milliseconds, reported in a table of their own with the
+// unit, a string literal too
+rolling_stats*
+stats_get_unit(const char* name, const char* unit);
+
+void
+stats_add(rolling_stats* stats, float value);
+
+void
+stats_summarize(const rolling_stats* stats, stats_summary* summary);
+
+// prints all statistics once interval_ms has passed since the last report
+void
+stats_report_every(double now_ms, double interval_ms);
+
+void
+stats_report();
@@ -0,0 +1,371 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Chrome/Perfetto trace-event export of CPU and GPU work
+ */
+
+#include "trace.h"
+
+#include <stdio.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "glimpl.h" // GL headers for the timestamp queries
+
+// per thread, must be a power of two. 16k events are ~5 seconds of a busy
+// render thread, the writer drains far more often than that.
+#define TRACE_RING_SIZE (1 << 14)
+
+// pending GPU spans, must be a power of two. Results are read back a few frames
+// late, this only has to cover the GPU latency.
+#define TRACE_GPU_QUERY_COUNT 256
+
+// tid the GPU spans are shown under
+#define TRACE_GPU_TID 0xffff
+
+enum trace_phase
+{
+	TRACE_PHASE_COMPLETE,
+	TRACE_PHASE_COUNTER,
+	TRACE_PHASE_GPU,
+};
+
+struct trace_event
+{
+	const char* name;
+	double ts;
+	// duration for spans, value for counters
+	double value;
+	trace_phase phase;
+};
+
+// single producer (the owning thread), single consumer (the writer thread)
+struct trace_ring
+{
+	uint32_t tid;
+	const char* thread_name;
+	bool thread_name_written;
+	std::atomic<uint32_t> head;
+	std::atomic<uint32_t> tail;
+	std::atomic<uint64_t> dropped;
+	trace_event events[TRACE_RING_SIZE];
+};
+
+std::atomic<bool> trace_enabled(false);
+
+static std::chrono::steady_clock::time_point trace_start;
+
+static std::mutex rings_mutex;
+static std::vector<trace_ring*> rings;
+static thread_local trace_ring* local_ring = NULL;
+
+static FILE* trace_file = NULL;
+static bool first_event_written;
+static std::thread writer_thread;
+static std::mutex writer_mutex;
+static std::condition_variable writer_cv;
+static bool writer_stop;
+
+// only touched from the GL thread
+static struct
+{
+	bool initialized;
+	GLuint queries[TRACE_GPU_QUERY_COUNT][2];
+	const char* names[TRACE_GPU_QUERY_COUNT];
+	uint32_t head;
+	uint32_t tail;
+	bool active;
+	uint32_t collect_count;
+	// GL_TIMESTAMP and trace clock sampled at the same time
+	int64_t gpu_base_ns;
+	double cpu_base_us;
+	uint64_t dropped;
+} gpu;
+
+double
+trace_now_us()
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - trace_start)
+	    .count();
+}
+
+static trace_ring*
+get_local_ring()
+{
+	if (local_ring != NULL)
+		return local_ring;
+
+	local_ring = new trace_ring();
+	local_ring->head = 0;
+	local_ring->tail = 0;
+	local_ring->dropped = 0;
+	local_ring->thread_name = NULL;
+	local_ring->thread_name_written = false;
+
+	std::lock_guard<std::mutex> lock(rings_mutex);
+	local_ring->tid = (uint32_t)rings.size() + 1;
+	rings.push_back(local_ring);
+	return local_ring;
+}
+
+static void
+push_event(const char* name, double ts, double value, trace_phase phase)
+{
+	if (!trace_enabled.load(std::memory_order_relaxed))
+		return;
+
+	trace_ring* ring = get_local_ring();
+	uint32_t head = ring->head.load(std::memory_order_relaxed);
+	if (head - ring->tail.load(std::memory_order_acquire) == TRACE_RING_SIZE) {
+		// never block the recording thread, the writer fell behind
+		ring->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	trace_event* event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+	event->name = name;
+	event->ts = ts;
+	event->value = value;
+	event->phase = phase;
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+void
+trace_thread_name(const char* name)
+{
+	if (!trace_enabled.load(std::memory_order_relaxed))
+		return;
+	trace_ring* ring = get_local_ring();
+	std::lock_guard<std::mutex> lock(rings_mutex);
+	ring->thread_name = name;
+	ring->thread_name_written = false;
+}
+
+void
+trace_complete(const char* name, double start_us, double duration_us)
+{
+	push_event(name, start_us, duration_us, TRACE_PHASE_COMPLETE);
+}
+
+void
+trace_stage(const char* name, double* stage_start_us)
+{
+	if (!trace_enabled.load(std::memory_order_relaxed))
+		return;
+	double now = trace_now_us();
+	push_event(name, *stage_start_us, now - *stage_start_us, TRACE_PHASE_COMPLETE);
+	*stage_start_us = now;
+}
+
+void
+trace_counter(const char* name, double value)
+{
+	push_event(name, trace_now_us(), value, TRACE_PHASE_COUNTER);
+}
+
+static void
+write_separator()
+{
+	if (first_event_written)
+		fputs(",\n", trace_file);
+	first_event_written = true;
+}
+
+static void
+write_thread_name(uint32_t tid, const char* name)
+{
+	write_separator();
+	fprintf(trace_file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+	        tid, name);
+}
+
+static void
+drain_rings()
+{
+	std::lock_guard<std::mutex> lock(rings_mutex);
+	for (trace_ring* ring : rings) {
+		if (ring->thread_name != NULL && !ring->thread_name_written) {
+			write_thread_name(ring->tid, ring->thread_name);
+			ring->thread_name_written = true;
+		}
+
+		uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+		uint32_t head = ring->head.load(std::memory_order_acquire);
+		for (; tail != head; tail++) {
+			const trace_event* event = &ring->events[tail & (TRACE_RING_SIZE - 1)];
+			write_separator();
+			switch (event->phase) {
+			case TRACE_PHASE_COMPLETE:
+				fprintf(trace_file,
+				        "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				        event->name, ring->tid, event->ts, event->value);
+				break;
+			case TRACE_PHASE_GPU:
+				fprintf(trace_file,
+				        "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				        event->name, TRACE_GPU_TID, event->ts, event->value);
+				break;
+			case TRACE_PHASE_COUNTER:
+				fprintf(trace_file,
+				        "{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"value\":%.6g}}",
+				        event->name, ring->tid, event->ts, event->value);
+				break;
+			}
+		}
+		ring->tail.store(tail, std::memory_order_release);
+	}
+}
+
+static void
+writer_main()
+{
+	std::unique_lock<std::mutex> lock(writer_mutex);
+	while (!writer_stop) {
+		writer_cv.wait_for(lock, std::chrono::milliseconds(50));
+		drain_rings();
+	}
+}
+
+bool
+trace_init(const char* path)
+{
+	trace_file = fopen(path, "w");
+	if (trace_file == NULL) {
+		printf("Failed to open trace file %s\n", path);
+		return false;
+	}
+	setvbuf(trace_file, NULL, _IOFBF, 1 << 20);
+
+	trace_start = std::chrono::steady_clock::now();
+	first_event_written = false;
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", trace_file);
+	write_thread_name(TRACE_GPU_TID, "GPU");
+
+	writer_stop = false;
+	writer_thread = std::thread(writer_main);
+
+	trace_enabled = true;
+	trace_thread_name("main");
+
+	printf("Writing trace to %s\n", path);
+	return true;
+}
+
+void
+trace_shutdown()
+{
+	if (!trace_enabled)
+		return;
+	trace_enabled = false;
+
+	{
+		std::lock_guard<std::mutex> lock(writer_mutex);
+		writer_stop = true;
+	}
+	writer_cv.notify_one();
+	writer_thread.join();
+
+	drain_rings();
+	fputs("\n]}\n", trace_file);
+	fclose(trace_file);
+	trace_file = NULL;
+
+	// the rings stay allocated until the process exits: threads like the log
+	// writer and the job workers still run and may have passed the trace_enabled
+	// check, their thread_local ring pointers must stay valid
+	uint64_t dropped = gpu.dropped;
+	std::lock_guard<std::mutex> lock(rings_mutex);
+	for (trace_ring* ring : rings)
+		dropped += ring->dropped;
+
+	printf("Trace finished, %lu events dropped\n", (unsigned long)dropped);
+}
+
+static void
+gpu_calibrate()
+{
+	// does not wait for the GPU, only asks for its current clock
+	GLint64 gpu_now;
+	glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+	gpu.gpu_base_ns = gpu_now;
+	gpu.cpu_base_us = trace_now_us();
+}
+
+void
+trace_gpu_begin(const char* name)
+{
+	if (!trace_enabled.load(std::memory_order_relaxed))
+		return;
+
+	if (!gpu.initialized) {
+		glGenQueries(TRACE_GPU_QUERY_COUNT * 2, &gpu.queries[0][0]);
+		gpu_calibrate();
+		gpu.initialized = true;
+	}
+
+	if (gpu.head - gpu.tail == TRACE_GPU_QUERY_COUNT) {
+		gpu.dropped++;
+		return;
+	}
+
+	uint32_t slot = gpu.head & (TRACE_GPU_QUERY_COUNT - 1);
+	gpu.names[slot] = name;
+	glQueryCounter(gpu.queries[slot][0], GL_TIMESTAMP);
+	gpu.active = true;
+}
+
+void
+trace_gpu_end()
+{
+	if (!gpu.active)
+		return;
+
+	uint32_t slot = gpu.head & (TRACE_GPU_QUERY_COUNT - 1);
+	glQueryCounter(gpu.queries[slot][1], GL_TIMESTAMP);
+	gpu.head++;
+	gpu.active = false;
+}
+
+void
+trace_gpu_cleanup()
+{
+	if (!gpu.initialized)
+		return;
+	glDeleteQueries(TRACE_GPU_QUERY_COUNT * 2, &gpu.queries[0][0]);
+	gpu.head = gpu.tail = 0;
+	gpu.active = false;
+	gpu.initialized = false;
+}
+
+void
+trace_gpu_collect()
+{
+	if (!gpu.initialized)
+		return;
+
+	// the two clocks drift apart over a long session
+	if (++gpu.collect_count % 512 == 0)
+		gpu_calibrate();
+
+	while (gpu.tail != gpu.head) {
+		uint32_t slot = gpu.tail & (TRACE_GPU_QUERY_COUNT - 1);
+
+		GLint available = 0;
+		glGetQueryObjectiv(gpu.queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			break;
+
+		GLuint64 begin_ns, end_ns;
+		glGetQueryObjectui64v(gpu.queries[slot][0], GL_QUERY_RESULT, &begin_ns);
+		glGetQueryObjectui64v(gpu.queries[slot][1], GL_QUERY_RESULT, &end_ns);
+
+		double ts = gpu.cpu_base_us + ((int64_t)begin_ns - gpu.gpu_base_ns) / 1000.;
+		push_event(gpu.names[slot], ts, (end_ns - begin_ns) / 1000., TRACE_PHASE_GPU);
+		gpu.tail++;
+	}
+}
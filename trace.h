@@ -0,0 +1,93 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Chrome/Perfetto trace-event export of CPU and GPU work
+ *
+ * Events are recorded into a ring buffer owned by the recording thread and
+ * drained by a background writer thread, so recording never touches the file
+ * system. Load the resulting JSON file in chrome://tracing or ui.perfetto.dev.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+// all event names must be string literals (or otherwise outlive the trace),
+// only the pointer is stored in the ring buffer
+extern std::atomic<bool> trace_enabled;
+
+// starts the writer thread, returns false if the file can not be opened
+bool
+trace_init(const char* path);
+
+// flushes all pending events and closes the file, the per thread rings are kept
+// for threads that are still running
+void
+trace_shutdown();
+
+// current time on the trace clock, in microseconds
+double
+trace_now_us();
+
+// names the calling thread in the trace viewer
+void
+trace_thread_name(const char* name);
+
+// a complete span ("X" event) on the calling thread
+void
+trace_complete(const char* name, double start_us, double duration_us);
+
+// ends a span at the current time and starts the next one there, for
+// instrumenting consecutive stages of a function without extra scopes
+void
+trace_stage(const char* name, double* stage_start_us);
+
+// a counter track ("C" event)
+void
+trace_counter(const char* name, double value);
+
+// GPU spans measured with GL_TIMESTAMP queries, shown on a separate "GPU" track.
+// Must be called on the thread that owns the GL context. Spans must not nest.
+void
+trace_gpu_begin(const char* name);
+
+void
+trace_gpu_end();
+
+// reads back finished GPU queries without stalling, call once per frame
+void
+trace_gpu_collect();
+
+// deletes the GPU queries, call while the GL context is still current. Spans that
+// were not read back yet are lost.
+void
+trace_gpu_cleanup();
+
+// records the enclosing scope as a span on the calling thread
+struct trace_scope
+{
+	const char* name;
+	double start;
+
+	trace_scope(const char* n) : name(n), start(trace_enabled.load(std::memory_order_relaxed) ? trace_now_us() : -1.) {}
+	~trace_scope()
+	{
+		if (start >= 0.)
+			trace_complete(name, start, trace_now_us() - start);
+	}
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+// GPU span for the enclosing scope
+struct trace_gpu_scope
+{
+	trace_gpu_scope(const char* name) { trace_gpu_begin(name); }
+	~trace_gpu_scope() { trace_gpu_end(); }
+};
+
+#define TRACE_GPU_SCOPE(name) trace_gpu_scope TRACE_CONCAT(trace_gpu_scope_, __LINE__)(name)
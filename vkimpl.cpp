@@ -0,0 +1,1173 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Vulkan rendering of the same scene and layer content as glimpl.h
+ */
+
+#include "vkimpl.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "cube_mesh.h"
+#include "raster.h"
+#include "stats.h"
+#include "trace.h"
+
+// SPIR-V generated from shaders/ at build time
+#include "scene.vert.h"
+#include "scene.frag.h"
+#include "layer_pattern.vert.h"
+#include "layer_pattern.frag.h"
+
+// command buffers that may be executing while the next frame is recorded
+#define VK_FRAMES_IN_FLIGHT 2
+// timestamps at the start of a frame, after the eyes and at the end
+#define VK_FRAME_QUERIES 3
+
+// the runtime does not provide depth images, every eye has its own
+#define VK_DEPTH_FORMAT VK_FORMAT_D32_SFLOAT
+
+struct vk_draw_constants
+{
+	XrMatrix4x4f mvp;
+	float color[4];
+};
+
+struct vk_layer_constants
+{
+	int32_t size[2];
+	int32_t srgb;
+};
+
+struct vk_swapchain_target
+{
+	bool used;
+	VkFormat format;
+	uint32_t width;
+	uint32_t height;
+	std::vector<VkImage> images;
+
+	// eye targets and the GPU layer producer
+	std::vector<VkImageView> image_views;
+	std::vector<VkFramebuffer> framebuffers;
+	// frames in flight are ordered by the subpass dependency of the render pass
+	VkImage depth_image;
+	VkDeviceMemory depth_memory;
+	VkImageView depth_view;
+
+	// layer targets, persistently mapped for the CPU producer
+	VkBuffer staging[VK_FRAMES_IN_FLIGHT];
+	VkDeviceMemory staging_memory[VK_FRAMES_IN_FLIGHT];
+	void* staging_data[VK_FRAMES_IN_FLIGHT];
+	// the GPU producer renders with a pipeline for the format of the layer
+	VkRenderPass layer_render_pass;
+	VkPipeline layer_pipeline;
+};
+
+// secondary command buffer of one target, with its own pool so the targets can be
+// recorded on different threads
+struct vk_target_commands
+{
+	VkCommandPool command_pool;
+	VkCommandBuffer command_buffer;
+	bool recorded;
+	uint32_t image_index;
+	int width;
+	int height;
+	// the render pass vk_end_frame() begins around the commands, if any
+	VkRenderPass render_pass;
+	VkFramebuffer framebuffer;
+};
+
+struct vk_frame
+{
+	// primary command buffer, executes the secondary ones in target order
+	VkCommandPool command_pool;
+	VkCommandBuffer command_buffer;
+	vk_target_commands targets[VK_TARGET_COUNT];
+	// timeline value that is signaled when the commands of this frame have finished
+	uint64_t timeline_value;
+	bool timestamps_written;
+	bool eyes_recorded;
+};
+
+static struct
+{
+	VkInstance instance;
+	VkPhysicalDevice physical_device;
+	VkDevice device;
+	uint32_t queue_family_index;
+	VkQueue queue;
+	VkPhysicalDeviceMemoryProperties memory_properties;
+
+	bool timestamps_supported;
+	float timestamp_period;
+	VkQueryPool query_pool;
+	float last_frame_ms;
+	float last_eyes_ms;
+	rolling_stats* frame_stats;
+
+	VkRenderPass render_pass;
+	VkPipelineLayout pipeline_layout;
+	VkPipeline pipeline;
+	VkBuffer vertex_buffer;
+	VkDeviceMemory vertex_memory;
+	VkPipelineLayout layer_pipeline_layout;
+
+	VkSemaphore timeline;
+	uint64_t frame_count;
+	vk_frame frames[VK_FRAMES_IN_FLIGHT];
+	vk_frame* current;
+
+	vk_swapchain_target targets[VK_TARGET_COUNT];
+} vk;
+
+static bool
+vk_check(VkResult result, const char* what)
+{
+	if (result == VK_SUCCESS)
+		return true;
+	printf("%s failed: VkResult %d\n", what, result);
+	return false;
+}
+
+// the XR_KHR_vulkan_enable extension lists are a single space separated string
+static std::vector<const char*>
+split_extension_list(std::vector<char>& list)
+{
+	std::vector<const char*> names;
+	char* name = list.data();
+	for (char& c : list) {
+		if (c == ' ' || c == '\0') {
+			c = '\0';
+			if (*name != '\0')
+				names.push_back(name);
+			name = &c + 1;
+		}
+	}
+	return names;
+}
+
+static bool
+find_memory_type(uint32_t type_bits, VkMemoryPropertyFlags properties, uint32_t* type_index)
+{
+	for (uint32_t i = 0; i < vk.memory_properties.memoryTypeCount; i++) {
+		if ((type_bits & (1u << i)) &&
+		    (vk.memory_properties.memoryTypes[i].propertyFlags & properties) == properties) {
+			*type_index = i;
+			return true;
+		}
+	}
+	printf("No Vulkan memory type with properties %#x\n", properties);
+	return false;
+}
+
+static bool
+create_command_buffer(VkCommandBufferLevel level, VkCommandPool* pool, VkCommandBuffer* command_buffer)
+{
+	VkCommandPoolCreateInfo pool_info = {.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+	                                     .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+	                                     .queueFamilyIndex = vk.queue_family_index};
+	if (!vk_check(vkCreateCommandPool(vk.device, &pool_info, NULL, pool), "vkCreateCommandPool"))
+		return false;
+
+	VkCommandBufferAllocateInfo allocate_info = {.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+	                                             .commandPool = *pool,
+	                                             .level = level,
+	                                             .commandBufferCount = 1};
+	return vk_check(vkAllocateCommandBuffers(vk.device, &allocate_info, command_buffer),
+	                "vkAllocateCommandBuffers");
+}
+
+static bool
+create_buffer(VkDeviceSize size,
+              VkBufferUsageFlags usage,
+              VkBuffer* buffer,
+              VkDeviceMemory* memory,
+              void** mapped)
+{
+	VkBufferCreateInfo buffer_info = {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+	                                  .size = size,
+	                                  .usage = usage,
+	                                  .sharingMode = VK_SHARING_MODE_EXCLUSIVE};
+	if (!vk_check(vkCreateBuffer(vk.device, &buffer_info, NULL, buffer), "vkCreateBuffer"))
+		return false;
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(vk.device, *buffer, &requirements);
+
+	VkMemoryAllocateInfo allocate_info = {.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+	                                      .allocationSize = requirements.size};
+	if (!find_memory_type(requirements.memoryTypeBits,
+	                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+	                      &allocate_info.memoryTypeIndex))
+		return false;
+	if (!vk_check(vkAllocateMemory(vk.device, &allocate_info, NULL, memory), "vkAllocateMemory"))
+		return false;
+	vkBindBufferMemory(vk.device, *buffer, *memory, 0);
+
+	return vk_check(vkMapMemory(vk.device, *memory, 0, VK_WHOLE_SIZE, 0, mapped), "vkMapMemory");
+}
+
+static bool
+create_image_view(VkImage image, VkFormat format, VkImageAspectFlags aspect, VkImageView* view)
+{
+	VkImageViewCreateInfo view_info = {
+	    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+	    .image = image,
+	    .viewType = VK_IMAGE_VIEW_TYPE_2D,
+	    .format = format,
+	    .subresourceRange = {.aspectMask = aspect, .levelCount = 1, .layerCount = 1},
+	};
+	return vk_check(vkCreateImageView(vk.device, &view_info, NULL, view), "vkCreateImageView");
+}
+
+bool
+vk_init(XrInstance xr_instance, XrSystemId system_id, XrGraphicsBindingVulkanKHR* binding)
+{
+	XrResult result;
+
+	PFN_xrGetVulkanGraphicsRequirementsKHR pfnGetVulkanGraphicsRequirementsKHR = NULL;
+	PFN_xrGetVulkanInstanceExtensionsKHR pfnGetVulkanInstanceExtensionsKHR = NULL;
+	PFN_xrGetVulkanGraphicsDeviceKHR pfnGetVulkanGraphicsDeviceKHR = NULL;
+	PFN_xrGetVulkanDeviceExtensionsKHR pfnGetVulkanDeviceExtensionsKHR = NULL;
+	xrGetInstanceProcAddr(xr_instance, "xrGetVulkanGraphicsRequirementsKHR",
+	                      (PFN_xrVoidFunction*)&pfnGetVulkanGraphicsRequirementsKHR);
+	xrGetInstanceProcAddr(xr_instance, "xrGetVulkanInstanceExtensionsKHR",
+	                      (PFN_xrVoidFunction*)&pfnGetVulkanInstanceExtensionsKHR);
+	xrGetInstanceProcAddr(xr_instance, "xrGetVulkanGraphicsDeviceKHR",
+	                      (PFN_xrVoidFunction*)&pfnGetVulkanGraphicsDeviceKHR);
+	xrGetInstanceProcAddr(xr_instance, "xrGetVulkanDeviceExtensionsKHR",
+	                      (PFN_xrVoidFunction*)&pfnGetVulkanDeviceExtensionsKHR);
+	if (pfnGetVulkanGraphicsRequirementsKHR == NULL || pfnGetVulkanInstanceExtensionsKHR == NULL ||
+	    pfnGetVulkanGraphicsDeviceKHR == NULL || pfnGetVulkanDeviceExtensionsKHR == NULL) {
+		printf("Failed to get XR_KHR_vulkan_enable functions!\n");
+		return false;
+	}
+
+	// OpenXR requires checking graphics requirements before creating a session.
+	XrGraphicsRequirementsVulkanKHR vulkan_reqs = {.type = XR_TYPE_GRAPHICS_REQUIREMENTS_VULKAN_KHR,
+	                                               .next = NULL};
+	result = pfnGetVulkanGraphicsRequirementsKHR(xr_instance, system_id, &vulkan_reqs);
+	if (XR_FAILED(result)) {
+		printf("Failed to get Vulkan graphics requirements: %d\n", result);
+		return false;
+	}
+
+	// timeline semaphores are core in Vulkan 1.2. The maximum the runtime reports is only
+	// the newest version it was tested with, so it is not enforced.
+	if (XR_MAKE_VERSION(1, 2, 0) > vulkan_reqs.maxApiVersionSupported) {
+		printf("Runtime was tested with Vulkan %d.%d only, using Vulkan 1.2 anyway\n",
+		       (int)XR_VERSION_MAJOR(vulkan_reqs.maxApiVersionSupported),
+		       (int)XR_VERSION_MINOR(vulkan_reqs.maxApiVersionSupported));
+	}
+
+	uint32_t size = 0;
+	pfnGetVulkanInstanceExtensionsKHR(xr_instance, system_id, 0, &size, NULL);
+	std::vector<char> instance_extension_list(size + 1, '\0');
+	result = pfnGetVulkanInstanceExtensionsKHR(xr_instance, system_id, size, &size,
+	                                           instance_extension_list.data());
+	if (XR_FAILED(result)) {
+		printf("Failed to get Vulkan instance extensions: %d\n", result);
+		return false;
+	}
+	std::vector<const char*> instance_extensions = split_extension_list(instance_extension_list);
+
+	VkApplicationInfo app_info = {.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+	                              .pApplicationName = "OpenXR Vulkan Example",
+	                              .applicationVersion = 1,
+	                              .pEngineName = "Custom",
+	                              .engineVersion = 0,
+	                              .apiVersion = VK_API_VERSION_1_2};
+	VkInstanceCreateInfo instance_info = {
+	    .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+	    .pApplicationInfo = &app_info,
+	    .enabledExtensionCount = (uint32_t)instance_extensions.size(),
+	    .ppEnabledExtensionNames = instance_extensions.data(),
+	};
+	if (!vk_check(vkCreateInstance(&instance_info, NULL, &vk.instance), "vkCreateInstance"))
+		return false;
+
+	result = pfnGetVulkanGraphicsDeviceKHR(xr_instance, system_id, vk.instance, &vk.physical_device);
+	if (XR_FAILED(result)) {
+		printf("Failed to get Vulkan graphics device: %d\n", result);
+		return false;
+	}
+
+	VkPhysicalDeviceProperties device_props;
+	vkGetPhysicalDeviceProperties(vk.physical_device, &device_props);
+	printf("Using Vulkan device: %s, Vulkan %d.%d.%d\n", device_props.deviceName,
+	       VK_VERSION_MAJOR(device_props.apiVersion), VK_VERSION_MINOR(device_props.apiVersion),
+	       VK_VERSION_PATCH(device_props.apiVersion));
+	if (device_props.apiVersion < VK_API_VERSION_1_2) {
+		printf("Vulkan device does not support Vulkan 1.2!\n");
+		return false;
+	}
+	vk.timestamp_period = device_props.limits.timestampPeriod;
+	vkGetPhysicalDeviceMemoryProperties(vk.physical_device, &vk.memory_properties);
+
+	uint32_t queue_family_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(vk.physical_device, &queue_family_count, NULL);
+	std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(vk.physical_device, &queue_family_count,
+	                                         queue_families.data());
+	vk.queue_family_index = UINT32_MAX;
+	for (uint32_t i = 0; i < queue_family_count; i++) {
+		if (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+			vk.queue_family_index = i;
+			vk.timestamps_supported = queue_families[i].timestampValidBits != 0;
+			break;
+		}
+	}
+	if (vk.queue_family_index == UINT32_MAX) {
+		printf("Vulkan device has no graphics queue!\n");
+		return false;
+	}
+
+	size = 0;
+	pfnGetVulkanDeviceExtensionsKHR(xr_instance, system_id, 0, &size, NULL);
+	std::vector<char> device_extension_list(size + 1, '\0');
+	result = pfnGetVulkanDeviceExtensionsKHR(xr_instance, system_id, size, &size,
+	                                         device_extension_list.data());
+	if (XR_FAILED(result)) {
+		printf("Failed to get Vulkan device extensions: %d\n", result);
+		return false;
+	}
+	std::vector<const char*> device_extensions = split_extension_list(device_extension_list);
+
+	float queue_priority = 1.f;
+	VkDeviceQueueCreateInfo queue_info = {.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+	                                      .queueFamilyIndex = vk.queue_family_index,
+	                                      .queueCount = 1,
+	                                      .pQueuePriorities = &queue_priority};
+
+	VkPhysicalDeviceVulkan12Features features12 = {
+	    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+	    .timelineSemaphore = VK_TRUE,
+	};
+	VkDeviceCreateInfo device_info = {
+	    .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+	    .pNext = &features12,
+	    .queueCreateInfoCount = 1,
+	    .pQueueCreateInfos = &queue_info,
+	    .enabledExtensionCount = (uint32_t)device_extensions.size(),
+	    .ppEnabledExtensionNames = device_extensions.data(),
+	};
+	if (!vk_check(vkCreateDevice(vk.physical_device, &device_info, NULL, &vk.device),
+	              "vkCreateDevice"))
+		return false;
+	vkGetDeviceQueue(vk.device, vk.queue_family_index, 0, &vk.queue);
+
+	VkSemaphoreTypeCreateInfo timeline_info = {.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+	                                           .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+	                                           .initialValue = 0};
+	VkSemaphoreCreateInfo semaphore_info = {.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+	                                        .pNext = &timeline_info};
+	if (!vk_check(vkCreateSemaphore(vk.device, &semaphore_info, NULL, &vk.timeline),
+	              "vkCreateSemaphore"))
+		return false;
+
+	// command pools per frame, so resetting them never touches a pending command buffer
+	for (vk_frame& frame : vk.frames) {
+		if (!create_command_buffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, &frame.command_pool,
+		                           &frame.command_buffer))
+			return false;
+		for (vk_target_commands& target : frame.targets) {
+			if (!create_command_buffer(VK_COMMAND_BUFFER_LEVEL_SECONDARY, &target.command_pool,
+			                           &target.command_buffer))
+				return false;
+		}
+	}
+
+	if (vk.timestamps_supported) {
+		VkQueryPoolCreateInfo query_info = {.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		                                    .queryType = VK_QUERY_TYPE_TIMESTAMP,
+		                                    .queryCount = VK_FRAME_QUERIES * VK_FRAMES_IN_FLIGHT};
+		if (!vk_check(vkCreateQueryPool(vk.device, &query_info, NULL, &vk.query_pool),
+		              "vkCreateQueryPool"))
+			return false;
+	}
+	vk.last_frame_ms = -1.f;
+	vk.last_eyes_ms = -1.f;
+	vk.frame_stats = stats_get("GPU frame");
+
+	*binding = XrGraphicsBindingVulkanKHR{.type = XR_TYPE_GRAPHICS_BINDING_VULKAN_KHR,
+	                                      .next = NULL,
+	                                      .instance = vk.instance,
+	                                      .physicalDevice = vk.physical_device,
+	                                      .device = vk.device,
+	                                      .queueFamilyIndex = vk.queue_family_index,
+	                                      .queueIndex = 0};
+	return true;
+}
+
+static VkShaderModule
+create_shader_module(const uint32_t* code, size_t size)
+{
+	VkShaderModuleCreateInfo module_info = {.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+	                                        .codeSize = size,
+	                                        .pCode = code};
+	VkShaderModule module = VK_NULL_HANDLE;
+	vk_check(vkCreateShaderModule(vk.device, &module_info, NULL, &module), "vkCreateShaderModule");
+	return module;
+}
+
+bool
+vk_init_pipeline(int64_t color_format)
+{
+	// the swapchain images are transitioned with explicit barriers, the render pass
+	// keeps them in the layout the runtime expects on release
+	VkAttachmentDescription attachments[2] = {
+	    {
+	        .format = (VkFormat)color_format,
+	        .samples = VK_SAMPLE_COUNT_1_BIT,
+	        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+	        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+	        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	        .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	        .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	    },
+	    {
+	        .format = VK_DEPTH_FORMAT,
+	        .samples = VK_SAMPLE_COUNT_1_BIT,
+	        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+	        .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	        .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+	    },
+	};
+	VkAttachmentReference color_reference = {.attachment = 0,
+	                                         .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+	VkAttachmentReference depth_reference = {
+	    .attachment = 1, .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+	VkSubpassDescription subpass = {.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+	                                .colorAttachmentCount = 1,
+	                                .pColorAttachments = &color_reference,
+	                                .pDepthStencilAttachment = &depth_reference};
+	// the depth image is shared by the frames in flight
+	VkSubpassDependency dependency = {
+	    .srcSubpass = VK_SUBPASS_EXTERNAL,
+	    .dstSubpass = 0,
+	    .srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+	    .dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+	    .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+	    .dstAccessMask =
+	        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+	};
+	VkRenderPassCreateInfo render_pass_info = {.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+	                                           .attachmentCount = 2,
+	                                           .pAttachments = attachments,
+	                                           .subpassCount = 1,
+	                                           .pSubpasses = &subpass,
+	                                           .dependencyCount = 1,
+	                                           .pDependencies = &dependency};
+	if (!vk_check(vkCreateRenderPass(vk.device, &render_pass_info, NULL, &vk.render_pass),
+	              "vkCreateRenderPass"))
+		return false;
+
+	VkPushConstantRange push_constant_range = {
+	    .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+	    .offset = 0,
+	    .size = sizeof(vk_draw_constants)};
+	VkPipelineLayoutCreateInfo layout_info = {.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+	                                          .pushConstantRangeCount = 1,
+	                                          .pPushConstantRanges = &push_constant_range};
+	if (!vk_check(vkCreatePipelineLayout(vk.device, &layout_info, NULL, &vk.pipeline_layout),
+	              "vkCreatePipelineLayout"))
+		return false;
+
+	VkShaderModule vertex_module = create_shader_module(scene_vert_spv, sizeof(scene_vert_spv));
+	VkShaderModule fragment_module = create_shader_module(scene_frag_spv, sizeof(scene_frag_spv));
+	if (vertex_module == VK_NULL_HANDLE || fragment_module == VK_NULL_HANDLE)
+		return false;
+
+	VkPipelineShaderStageCreateInfo stages[2] = {
+	    {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+	     .stage = VK_SHADER_STAGE_VERTEX_BIT,
+	     .module = vertex_module,
+	     .pName = "main"},
+	    {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+	     .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+	     .module = fragment_module,
+	     .pName = "main"},
+	};
+
+	VkVertexInputBindingDescription vertex_binding = {
+	    .binding = 0, .stride = CUBE_VERTEX_STRIDE, .inputRate = VK_VERTEX_INPUT_RATE_VERTEX};
+	VkVertexInputAttributeDescription vertex_attributes[2] = {
+	    {.location = 0, .binding = 0, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = 0},
+	    {.location = 1, .binding = 0, .format = VK_FORMAT_R32G32_SFLOAT, .offset = 3 * sizeof(float)},
+	};
+	VkPipelineVertexInputStateCreateInfo vertex_input = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+	    .vertexBindingDescriptionCount = 1,
+	    .pVertexBindingDescriptions = &vertex_binding,
+	    .vertexAttributeDescriptionCount = 2,
+	    .pVertexAttributeDescriptions = vertex_attributes};
+	VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+	    .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST};
+	VkPipelineViewportStateCreateInfo viewport_state = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+	    .viewportCount = 1,
+	    .scissorCount = 1};
+	// like the GL backend, no face culling
+	VkPipelineRasterizationStateCreateInfo rasterization = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+	    .polygonMode = VK_POLYGON_MODE_FILL,
+	    .cullMode = VK_CULL_MODE_NONE,
+	    .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+	    .lineWidth = 1.f};
+	VkPipelineMultisampleStateCreateInfo multisample = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+	    .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT};
+	VkPipelineDepthStencilStateCreateInfo depth_stencil = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+	    .depthTestEnable = VK_TRUE,
+	    .depthWriteEnable = VK_TRUE,
+	    .depthCompareOp = VK_COMPARE_OP_LESS};
+	VkPipelineColorBlendAttachmentState blend_attachment = {
+	    .blendEnable = VK_FALSE,
+	    .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+	                      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT};
+	VkPipelineColorBlendStateCreateInfo color_blend = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+	    .attachmentCount = 1,
+	    .pAttachments = &blend_attachment};
+	// the rendered size changes with dynamic resolution
+	VkDynamicState dynamic_states[2] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+	VkPipelineDynamicStateCreateInfo dynamic_state = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+	    .dynamicStateCount = 2,
+	    .pDynamicStates = dynamic_states};
+
+	VkGraphicsPipelineCreateInfo pipeline_info = {
+	    .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+	    .stageCount = 2,
+	    .pStages = stages,
+	    .pVertexInputState = &vertex_input,
+	    .pInputAssemblyState = &input_assembly,
+	    .pViewportState = &viewport_state,
+	    .pRasterizationState = &rasterization,
+	    .pMultisampleState = &multisample,
+	    .pDepthStencilState = &depth_stencil,
+	    .pColorBlendState = &color_blend,
+	    .pDynamicState = &dynamic_state,
+	    .layout = vk.pipeline_layout,
+	    .renderPass = vk.render_pass,
+	    .subpass = 0};
+	VkResult result =
+	    vkCreateGraphicsPipelines(vk.device, VK_NULL_HANDLE, 1, &pipeline_info, NULL, &vk.pipeline);
+	vkDestroyShaderModule(vk.device, vertex_module, NULL);
+	vkDestroyShaderModule(vk.device, fragment_module, NULL);
+	if (!vk_check(result, "vkCreateGraphicsPipelines"))
+		return false;
+
+	void* vertex_data;
+	if (!create_buffer(sizeof(cube_vertices), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, &vk.vertex_buffer,
+	                   &vk.vertex_memory, &vertex_data))
+		return false;
+	memcpy(vertex_data, cube_vertices, sizeof(cube_vertices));
+	vkUnmapMemory(vk.device, vk.vertex_memory);
+
+	VkPushConstantRange layer_push_constant_range = {
+	    .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT, .offset = 0, .size = sizeof(vk_layer_constants)};
+	VkPipelineLayoutCreateInfo layer_layout_info = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+	    .pushConstantRangeCount = 1,
+	    .pPushConstantRanges = &layer_push_constant_range};
+	return vk_check(
+	    vkCreatePipelineLayout(vk.device, &layer_layout_info, NULL, &vk.layer_pipeline_layout),
+	    "vkCreatePipelineLayout");
+}
+
+static bool
+is_srgb_format(VkFormat format)
+{
+	return format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_B8G8R8A8_SRGB ||
+	       format == VK_FORMAT_A8B8G8R8_SRGB_PACK32;
+}
+
+// Render pass and pipeline of the GPU layer producer. The fullscreen triangle covers
+// every pixel, so the old content is not loaded.
+static bool
+create_layer_pipeline(vk_swapchain_target* t)
+{
+	VkAttachmentDescription attachment = {
+	    .format = t->format,
+	    .samples = VK_SAMPLE_COUNT_1_BIT,
+	    .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	    .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+	    .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	    .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	    .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	};
+	VkAttachmentReference color_reference = {.attachment = 0,
+	                                         .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+	VkSubpassDescription subpass = {.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+	                                .colorAttachmentCount = 1,
+	                                .pColorAttachments = &color_reference};
+	VkRenderPassCreateInfo render_pass_info = {.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+	                                           .attachmentCount = 1,
+	                                           .pAttachments = &attachment,
+	                                           .subpassCount = 1,
+	                                           .pSubpasses = &subpass};
+	if (!vk_check(vkCreateRenderPass(vk.device, &render_pass_info, NULL, &t->layer_render_pass),
+	              "vkCreateRenderPass"))
+		return false;
+
+	VkShaderModule vertex_module = create_shader_module(layer_pattern_vert_spv, sizeof(layer_pattern_vert_spv));
+	VkShaderModule fragment_module = create_shader_module(layer_pattern_frag_spv, sizeof(layer_pattern_frag_spv));
+	if (vertex_module == VK_NULL_HANDLE || fragment_module == VK_NULL_HANDLE)
+		return false;
+
+	VkPipelineShaderStageCreateInfo stages[2] = {
+	    {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+	     .stage = VK_SHADER_STAGE_VERTEX_BIT,
+	     .module = vertex_module,
+	     .pName = "main"},
+	    {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+	     .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+	     .module = fragment_module,
+	     .pName = "main"},
+	};
+	VkPipelineVertexInputStateCreateInfo vertex_input = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
+	VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+	    .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST};
+	VkViewport viewport = {.width = (float)t->width, .height = (float)t->height, .maxDepth = 1.f};
+	VkRect2D scissor = {.extent = {t->width, t->height}};
+	VkPipelineViewportStateCreateInfo viewport_state = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+	    .viewportCount = 1,
+	    .pViewports = &viewport,
+	    .scissorCount = 1,
+	    .pScissors = &scissor};
+	VkPipelineRasterizationStateCreateInfo rasterization = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+	    .polygonMode = VK_POLYGON_MODE_FILL,
+	    .cullMode = VK_CULL_MODE_NONE,
+	    .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+	    .lineWidth = 1.f};
+	VkPipelineMultisampleStateCreateInfo multisample = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+	    .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT};
+	VkPipelineColorBlendAttachmentState blend_attachment = {
+	    .blendEnable = VK_FALSE,
+	    .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+	                      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT};
+	VkPipelineColorBlendStateCreateInfo color_blend = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+	    .attachmentCount = 1,
+	    .pAttachments = &blend_attachment};
+
+	VkGraphicsPipelineCreateInfo pipeline_info = {
+	    .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+	    .stageCount = 2,
+	    .pStages = stages,
+	    .pVertexInputState = &vertex_input,
+	    .pInputAssemblyState = &input_assembly,
+	    .pViewportState = &viewport_state,
+	    .pRasterizationState = &rasterization,
+	    .pMultisampleState = &multisample,
+	    .pColorBlendState = &color_blend,
+	    .layout = vk.layer_pipeline_layout,
+	    .renderPass = t->layer_render_pass,
+	    .subpass = 0};
+	VkResult result =
+	    vkCreateGraphicsPipelines(vk.device, VK_NULL_HANDLE, 1, &pipeline_info, NULL, &t->layer_pipeline);
+	vkDestroyShaderModule(vk.device, vertex_module, NULL);
+	vkDestroyShaderModule(vk.device, fragment_module, NULL);
+	return vk_check(result, "vkCreateGraphicsPipelines");
+}
+
+static bool
+create_depth_image(vk_swapchain_target* t)
+{
+	VkImageCreateInfo image_info = {.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+	                                .imageType = VK_IMAGE_TYPE_2D,
+	                                .format = VK_DEPTH_FORMAT,
+	                                .extent = {t->width, t->height, 1},
+	                                .mipLevels = 1,
+	                                .arrayLayers = 1,
+	                                .samples = VK_SAMPLE_COUNT_1_BIT,
+	                                .tiling = VK_IMAGE_TILING_OPTIMAL,
+	                                .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+	                                .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	                                .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED};
+	if (!vk_check(vkCreateImage(vk.device, &image_info, NULL, &t->depth_image), "vkCreateImage"))
+		return false;
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(vk.device, t->depth_image, &requirements);
+	VkMemoryAllocateInfo allocate_info = {.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+	                                      .allocationSize = requirements.size};
+	if (!find_memory_type(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	                      &allocate_info.memoryTypeIndex))
+		return false;
+	if (!vk_check(vkAllocateMemory(vk.device, &allocate_info, NULL, &t->depth_memory),
+	              "vkAllocateMemory"))
+		return false;
+	vkBindImageMemory(vk.device, t->depth_image, t->depth_memory, 0);
+
+	return create_image_view(t->depth_image, VK_DEPTH_FORMAT, VK_IMAGE_ASPECT_DEPTH_BIT,
+	                         &t->depth_view);
+}
+
+// the GPU must be done with the target
+static void
+destroy_target(vk_swapchain_target* t)
+{
+	for (VkFramebuffer framebuffer : t->framebuffers)
+		vkDestroyFramebuffer(vk.device, framebuffer, NULL);
+	for (VkImageView view : t->image_views)
+		vkDestroyImageView(vk.device, view, NULL);
+	if (t->depth_image != VK_NULL_HANDLE) {
+		vkDestroyImageView(vk.device, t->depth_view, NULL);
+		vkDestroyImage(vk.device, t->depth_image, NULL);
+		vkFreeMemory(vk.device, t->depth_memory, NULL);
+	}
+	for (int i = 0; i < VK_FRAMES_IN_FLIGHT; i++) {
+		if (t->staging[i] == VK_NULL_HANDLE)
+			continue;
+		vkDestroyBuffer(vk.device, t->staging[i], NULL);
+		vkFreeMemory(vk.device, t->staging_memory[i], NULL);
+	}
+	if (t->layer_pipeline != VK_NULL_HANDLE)
+		vkDestroyPipeline(vk.device, t->layer_pipeline, NULL);
+	if (t->layer_render_pass != VK_NULL_HANDLE)
+		vkDestroyRenderPass(vk.device, t->layer_render_pass, NULL);
+	*t = vk_swapchain_target();
+}
+
+bool
+vk_add_swapchain(vk_target target, XrSwapchain swapchain, int64_t format, uint32_t w, uint32_t h)
+{
+	// a target of a released layer content is reused for a new swapchain
+	vk_remove_swapchain(target);
+
+	vk_swapchain_target* t = &vk.targets[target];
+	t->used = true;
+	t->format = (VkFormat)format;
+	t->width = w;
+	t->height = h;
+
+	uint32_t swapchain_length;
+	XrResult result = xrEnumerateSwapchainImages(swapchain, 0, &swapchain_length, NULL);
+	if (XR_FAILED(result)) {
+		printf("Failed to enumerate swapchains: %d\n", result);
+		return false;
+	}
+
+	// these are wrappers for the actual VkImage
+	std::vector<XrSwapchainImageVulkanKHR> images(swapchain_length,
+	                                              {XR_TYPE_SWAPCHAIN_IMAGE_VULKAN_KHR, NULL});
+	result = xrEnumerateSwapchainImages(swapchain, swapchain_length, &swapchain_length,
+	                                    (XrSwapchainImageBaseHeader*)images.data());
+	if (XR_FAILED(result)) {
+		printf("Failed to enumerate swapchain images: %d\n", result);
+		return false;
+	}
+	for (const XrSwapchainImageVulkanKHR& image : images)
+		t->images.push_back(image.image);
+
+	// layer targets are set up for both producers, so they are interchangeable
+	bool layer = target >= VK_TARGET_LAYER;
+	if (layer) {
+		for (int i = 0; i < VK_FRAMES_IN_FLIGHT; i++) {
+			if (!create_buffer((VkDeviceSize)w * h * 4, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			                   &t->staging[i], &t->staging_memory[i], &t->staging_data[i]))
+				return false;
+		}
+		if (!create_layer_pipeline(t))
+			return false;
+	} else if (!create_depth_image(t)) {
+		return false;
+	}
+
+	t->image_views.resize(swapchain_length);
+	t->framebuffers.resize(swapchain_length);
+	for (uint32_t i = 0; i < swapchain_length; i++) {
+		if (!create_image_view(t->images[i], t->format, VK_IMAGE_ASPECT_COLOR_BIT,
+		                       &t->image_views[i]))
+			return false;
+
+		VkImageView framebuffer_attachments[2] = {t->image_views[i], t->depth_view};
+		VkFramebufferCreateInfo framebuffer_info = {
+		    .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+		    .renderPass = layer ? t->layer_render_pass : vk.render_pass,
+		    .attachmentCount = layer ? 1u : 2u,
+		    .pAttachments = framebuffer_attachments,
+		    .width = w,
+		    .height = h,
+		    .layers = 1};
+		if (!vk_check(vkCreateFramebuffer(vk.device, &framebuffer_info, NULL, &t->framebuffers[i]),
+		              "vkCreateFramebuffer"))
+			return false;
+	}
+	return true;
+}
+
+void
+vk_remove_swapchain(vk_target target)
+{
+	vk_swapchain_target* t = &vk.targets[target];
+	if (vk.device == VK_NULL_HANDLE || !t->used)
+		return;
+
+	// layer contents are rarely released, waiting for the frames in flight is simpler
+	// than deferring the destruction
+	vkDeviceWaitIdle(vk.device);
+	destroy_target(t);
+}
+
+bool
+vk_begin_frame()
+{
+	TRACE_SCOPE("vk_begin_frame");
+
+	vk_frame* frame = &vk.frames[vk.frame_count % VK_FRAMES_IN_FLIGHT];
+	VkSemaphoreWaitInfo wait_info = {.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+	                                 .semaphoreCount = 1,
+	                                 .pSemaphores = &vk.timeline,
+	                                 .pValues = &frame->timeline_value};
+	if (!vk_check(vkWaitSemaphores(vk.device, &wait_info, UINT64_MAX), "vkWaitSemaphores"))
+		return false;
+
+	uint32_t first_query = (uint32_t)(frame - vk.frames) * VK_FRAME_QUERIES;
+	if (frame->timestamps_written) {
+		// the frame has finished, this does not wait
+		uint64_t timestamps[VK_FRAME_QUERIES];
+		if (vkGetQueryPoolResults(vk.device, vk.query_pool, first_query, VK_FRAME_QUERIES, sizeof(timestamps),
+		                          timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+			vk.last_frame_ms = (float)((timestamps[2] - timestamps[0]) * vk.timestamp_period / 1e6);
+			stats_add(vk.frame_stats, vk.last_frame_ms);
+			// frames that only reproject render no eyes
+			if (frame->eyes_recorded)
+				vk.last_eyes_ms = (float)((timestamps[1] - timestamps[0]) * vk.timestamp_period / 1e6);
+		}
+	}
+
+	vkResetCommandPool(vk.device, frame->command_pool, 0);
+	for (vk_target_commands& target : frame->targets) {
+		vkResetCommandPool(vk.device, target.command_pool, 0);
+		target.recorded = false;
+	}
+
+	vk.current = frame;
+	return true;
+}
+
+// Secondary command buffers cannot begin render passes, with a render pass the
+// commands continue the one vk_end_frame() begins for them
+static VkCommandBuffer
+begin_target_commands(vk_target target,
+                      uint32_t image_index,
+                      int w,
+                      int h,
+                      VkRenderPass render_pass,
+                      VkFramebuffer framebuffer)
+{
+	vk_target_commands* commands = &vk.current->targets[target];
+	commands->image_index = image_index;
+	commands->width = w;
+	commands->height = h;
+	commands->render_pass = render_pass;
+	commands->framebuffer = framebuffer;
+
+	VkCommandBufferInheritanceInfo inheritance = {
+	    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+	    .renderPass = render_pass,
+	    .subpass = 0,
+	    .framebuffer = framebuffer};
+	VkCommandBufferUsageFlags flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (render_pass != VK_NULL_HANDLE)
+		flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	VkCommandBufferBeginInfo begin_info = {.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+	                                       .flags = flags,
+	                                       .pInheritanceInfo = &inheritance};
+	vk_check(vkBeginCommandBuffer(commands->command_buffer, &begin_info), "vkBeginCommandBuffer");
+	return commands->command_buffer;
+}
+
+static void
+end_target_commands(vk_target target)
+{
+	vk_target_commands* commands = &vk.current->targets[target];
+	commands->recorded =
+	    vk_check(vkEndCommandBuffer(commands->command_buffer), "vkEndCommandBuffer");
+}
+
+static void
+image_barrier(VkCommandBuffer cmd,
+              VkImage image,
+              VkImageLayout old_layout,
+              VkImageLayout new_layout,
+              VkPipelineStageFlags src_stage,
+              VkAccessFlags src_access,
+              VkPipelineStageFlags dst_stage,
+              VkAccessFlags dst_access)
+{
+	VkImageMemoryBarrier barrier = {
+	    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+	    .srcAccessMask = src_access,
+	    .dstAccessMask = dst_access,
+	    .oldLayout = old_layout,
+	    .newLayout = new_layout,
+	    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+	    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+	    .image = image,
+	    .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .levelCount = 1, .layerCount = 1},
+	};
+	vkCmdPipelineBarrier(cmd, src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+static void
+draw_cube(VkCommandBuffer cmd,
+          const XrMatrix4x4f* view_projection,
+          const XrMatrix4x4f* model,
+          const float* color)
+{
+	vk_draw_constants constants = {.color = {color[0], color[1], color[2], 1.f}};
+	XrMatrix4x4f_Multiply(&constants.mvp, view_projection, model);
+	vkCmdPushConstants(cmd, vk.pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+	                   0, sizeof(constants), &constants);
+	vkCmdDraw(cmd, CUBE_VERTEX_COUNT, 1, 0, 0);
+}
+
+void
+vk_render_frame(vk_target target,
+                uint32_t image_index,
+                int w,
+                int h,
+                XrMatrix4x4f projectionmatrix,
+                XrMatrix4x4f viewmatrix,
+                const scene_draw_list* draw_list,
+                const uint32_t* visible,
+                uint32_t visible_count)
+{
+	TRACE_SCOPE("vk_render_frame");
+
+	vk_swapchain_target* t = &vk.targets[target];
+	VkCommandBuffer cmd =
+	    begin_target_commands(target, image_index, w, h, vk.render_pass, t->framebuffers[image_index]);
+
+	VkViewport viewport = {0.f, 0.f, (float)w, (float)h, 0.f, 1.f};
+	VkRect2D scissor = {{0, 0}, {(uint32_t)w, (uint32_t)h}};
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, vk.pipeline);
+	VkDeviceSize vertex_offset = 0;
+	vkCmdBindVertexBuffers(cmd, 0, 1, &vk.vertex_buffer, &vertex_offset);
+
+	XrMatrix4x4f view_projection;
+	XrMatrix4x4f_Multiply(&view_projection, &projectionmatrix, &viewmatrix);
+
+	for (uint32_t i = 0; i < visible_count; i++) {
+		uint32_t draw = visible[i];
+		draw_cube(cmd, &view_projection, &draw_list->models[draw],
+		          scene_material_colors[draw_list->materials[draw]]);
+	}
+
+	end_target_commands(target);
+}
+
+static void
+upload_layer_cpu(vk_target target, uint32_t image_index)
+{
+	vk_swapchain_target* t = &vk.targets[target];
+	int frame_index = (int)(vk.current - vk.frames);
+	VkCommandBuffer cmd =
+	    begin_target_commands(target, image_index, t->width, t->height, VK_NULL_HANDLE, VK_NULL_HANDLE);
+
+	// the staging buffer of this frame is not used by the GPU anymore
+	raster_quad_pattern((uint8_t*)t->staging_data[frame_index], t->width, t->height);
+
+	image_barrier(cmd, t->images[image_index], VK_IMAGE_LAYOUT_UNDEFINED,
+	              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+	              VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	VkBufferImageCopy region = {
+	    .bufferOffset = 0,
+	    .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .layerCount = 1},
+	    .imageOffset = {0, 0, 0},
+	    .imageExtent = {t->width, t->height, 1},
+	};
+	vkCmdCopyBufferToImage(cmd, t->staging[frame_index], t->images[image_index],
+	                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+	// the runtime expects color attachment swapchains in this layout on release
+	image_barrier(cmd, t->images[image_index], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	              VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT,
+	              VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+
+	end_target_commands(target);
+}
+
+static void
+render_layer_gpu(vk_target target, uint32_t image_index)
+{
+	vk_swapchain_target* t = &vk.targets[target];
+	VkCommandBuffer cmd = begin_target_commands(target, image_index, t->width, t->height,
+	                                            t->layer_render_pass, t->framebuffers[image_index]);
+
+	vk_layer_constants constants = {.size = {(int32_t)t->width, (int32_t)t->height},
+	                                .srgb = is_srgb_format(t->format) ? 1 : 0};
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, t->layer_pipeline);
+	vkCmdPushConstants(cmd, vk.layer_pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+	                   sizeof(constants), &constants);
+	vkCmdDraw(cmd, 3, 1, 0, 0);
+
+	end_target_commands(target);
+}
+
+void
+vk_render_quad(vk_target target, uint32_t image_index, layer_producer producer, XrTime predictedDisplayTime)
+{
+	TRACE_SCOPE("vk_render_quad");
+
+	if (producer == LAYER_PRODUCER_GPU)
+		render_layer_gpu(target, image_index);
+	else
+		upload_layer_cpu(target, image_index);
+}
+
+bool
+vk_end_frame()
+{
+	TRACE_SCOPE("vk_end_frame");
+
+	vk_frame* frame = vk.current;
+	VkCommandBuffer cmd = frame->command_buffer;
+	uint32_t first_query = (uint32_t)(frame - vk.frames) * VK_FRAME_QUERIES;
+
+	VkCommandBufferBeginInfo begin_info = {.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+	                                       .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+	if (!vk_check(vkBeginCommandBuffer(cmd, &begin_info), "vkBeginCommandBuffer"))
+		return false;
+
+	if (vk.timestamps_supported) {
+		vkCmdResetQueryPool(cmd, vk.query_pool, first_query, VK_FRAME_QUERIES);
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vk.query_pool, first_query);
+	}
+	frame->timestamps_written = vk.timestamps_supported;
+	frame->eyes_recorded = false;
+
+	for (int i = 0; i < VK_TARGET_COUNT; i++) {
+		// the eyes come first, the layers after this timestamp
+		if (i == VK_TARGET_LAYER && vk.timestamps_supported)
+			vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.query_pool, first_query + 1);
+
+		vk_target_commands* commands = &frame->targets[i];
+		if (!commands->recorded)
+			continue;
+		if (i < VK_TARGET_LAYER)
+			frame->eyes_recorded = true;
+
+		if (commands->render_pass == VK_NULL_HANDLE) {
+			vkCmdExecuteCommands(cmd, 1, &commands->command_buffer);
+			continue;
+		}
+
+		// the previous content is cleared anyway, the layer render pass does this itself
+		if (i < VK_TARGET_LAYER) {
+			VkImage image = vk.targets[i].images[commands->image_index];
+			image_barrier(cmd, image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+			              VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+			              VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			              VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+		}
+
+		VkClearValue clear_values[2];
+		clear_values[0].color = {{0.f, 0.f, 0.2f, 1.f}};
+		clear_values[1].depthStencil = {1.f, 0};
+		VkRenderPassBeginInfo render_pass_begin = {
+		    .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+		    .renderPass = commands->render_pass,
+		    .framebuffer = commands->framebuffer,
+		    .renderArea = {.offset = {0, 0},
+		                   .extent = {(uint32_t)commands->width, (uint32_t)commands->height}},
+		    .clearValueCount = 2,
+		    .pClearValues = clear_values};
+		vkCmdBeginRenderPass(cmd, &render_pass_begin, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		vkCmdExecuteCommands(cmd, 1, &commands->command_buffer);
+		vkCmdEndRenderPass(cmd);
+	}
+
+	if (vk.timestamps_supported) {
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.query_pool, first_query + 2);
+	}
+	if (!vk_check(vkEndCommandBuffer(cmd), "vkEndCommandBuffer"))
+		return false;
+
+	frame->timeline_value = ++vk.frame_count;
+	VkTimelineSemaphoreSubmitInfo timeline_submit = {
+	    .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+	    .signalSemaphoreValueCount = 1,
+	    .pSignalSemaphoreValues = &frame->timeline_value};
+	VkSubmitInfo submit_info = {.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+	                            .pNext = &timeline_submit,
+	                            .commandBufferCount = 1,
+	                            .pCommandBuffers = &cmd,
+	                            .signalSemaphoreCount = 1,
+	                            .pSignalSemaphores = &vk.timeline};
+	vk.current = NULL;
+	return vk_check(vkQueueSubmit(vk.queue, 1, &submit_info, VK_NULL_HANDLE), "vkQueueSubmit");
+}
+
+float
+vk_last_frame_ms()
+{
+	return vk.last_frame_ms;
+}
+
+float
+vk_last_eyes_ms()
+{
+	return vk.last_eyes_ms;
+}
+
+void
+vk_cleanup()
+{
+	if (vk.device == VK_NULL_HANDLE)
+		return;
+
+	vkDeviceWaitIdle(vk.device);
+
+	for (vk_swapchain_target& t : vk.targets) {
+		if (t.used)
+			destroy_target(&t);
+	}
+
+	vkDestroyBuffer(vk.device, vk.vertex_buffer, NULL);
+	vkFreeMemory(vk.device, vk.vertex_memory, NULL);
+	vkDestroyPipeline(vk.device, vk.pipeline, NULL);
+	vkDestroyPipelineLayout(vk.device, vk.pipeline_layout, NULL);
+	vkDestroyPipelineLayout(vk.device, vk.layer_pipeline_layout, NULL);
+	vkDestroyRenderPass(vk.device, vk.render_pass, NULL);
+	if (vk.query_pool != VK_NULL_HANDLE)
+		vkDestroyQueryPool(vk.device, vk.query_pool, NULL);
+	for (vk_frame& frame : vk.frames) {
+		vkDestroyCommandPool(vk.device, frame.command_pool, NULL);
+		for (vk_target_commands& target : frame.targets)
+			vkDestroyCommandPool(vk.device, target.command_pool, NULL);
+	}
+	vkDestroySemaphore(vk.device, vk.timeline, NULL);
+
+	vkDestroyDevice(vk.device, NULL);
+	vkDestroyInstance(vk.instance, NULL);
+	vk.device = VK_NULL_HANDLE;
+	vk.instance = VK_NULL_HANDLE;
+}
@@ -0,0 +1,91 @@
+// Copyright 2019, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Vulkan rendering of the same scene and layer content as glimpl.h
+ *
+ * Built when XR_EXAMPLE_VULKAN is defined, selected at runtime with OXR_GRAPHICS=vulkan.
+ * Every target records into its own secondary command buffer between vk_begin_frame()
+ * and vk_end_frame(), so different targets can be recorded on different threads.
+ * vk_end_frame() executes them from one primary command buffer and submits once.
+ * Frames in flight are tracked with a timeline semaphore, there is no equivalent of
+ * glFinish().
+ */
+
+#pragma once
+
+// vulkan.h and the XR_KHR_vulkan_enable types
+#include "platform.h"
+
+#include "xrmath.h"
+#include "scene.h"
+#include "layer_producer.h"
+
+// each swapchain the backend renders into is registered as one target
+#define VK_TARGET_MAX_EYES 4
+#define VK_TARGET_MAX_LAYERS 4
+
+enum vk_target
+{
+	// eye i is VK_TARGET_EYE + i
+	VK_TARGET_EYE = 0,
+	// layer content i is VK_TARGET_LAYER + i, see layer_content.h
+	VK_TARGET_LAYER = VK_TARGET_MAX_EYES,
+	VK_TARGET_COUNT = VK_TARGET_LAYER + VK_TARGET_MAX_LAYERS,
+};
+
+// creates the Vulkan instance and device the runtime asks for and fills the
+// graphics binding for xrCreateSession
+bool
+vk_init(XrInstance xr_instance, XrSystemId system_id, XrGraphicsBindingVulkanKHR* binding);
+
+// creates the render pass and pipeline for the eye swapchain format
+bool
+vk_init_pipeline(int64_t color_format);
+
+// enumerates the images of a swapchain and creates what is needed to render into them.
+// Every target gets a framebuffer per image, layer targets also a staging buffer per
+// frame in flight for the CPU producer. Layer swapchains need
+// XR_SWAPCHAIN_USAGE_TRANSFER_DST_BIT and XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT.
+bool
+vk_add_swapchain(vk_target target, XrSwapchain swapchain, int64_t format, uint32_t w, uint32_t h);
+
+// destroys what vk_add_swapchain() created for the target, before its swapchain is
+// destroyed. Waits for the frames in flight.
+void
+vk_remove_swapchain(vk_target target);
+
+// waits until the command buffer of the oldest frame in flight can be reused
+bool
+vk_begin_frame();
+
+// vk_render_frame() and vk_render_quad() may run concurrently for different targets,
+// each target at most once per frame
+void
+vk_render_frame(vk_target target,
+                uint32_t image_index,
+                int w,
+                int h,
+                XrMatrix4x4f projectionmatrix,
+                XrMatrix4x4f viewmatrix,
+                const scene_draw_list* draw_list,
+                const uint32_t* visible,
+                uint32_t visible_count);
+
+void
+vk_render_quad(vk_target target, uint32_t image_index, layer_producer producer, XrTime predictedDisplayTime);
+
+// submits the frame, the swapchain images can be released afterwards
+bool
+vk_end_frame();
+
+// GPU time of the last finished frame in milliseconds, negative if none is available yet
+float
+vk_last_frame_ms();
+
+// like vk_last_frame_ms(), but only the eye render passes
+float
+vk_last_eyes_ms();
+
+void
+vk_cleanup();